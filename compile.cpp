@@ -11,6 +11,43 @@
 #include <queue> 
 #include <map>
 #include <stack>
+#include <stdexcept>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <cstdlib>
+#include <new>
+#include <cstddef>
+#include <random>
+#include <climits>
+#include <iomanip>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <list>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+#if defined(__unix__)
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <csignal>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 #define MAX_PROD 100
 #define MAX 50
@@ -18,6 +55,273 @@
 #define MAX_INPUT_SIZE 256
 #define MAX_TOKEN_LEN 64 
 
+// 内存分配计数：替换全局 operator new/delete，按线程统计分配次数和字节数
+thread_local size_t tl_allocationCount = 0;
+thread_local size_t tl_allocatedBytes = 0;
+
+// 所有形式的 new（普通、数组、nothrow、对齐）都经过这里计数，按对齐要求选择 malloc 或 aligned_alloc
+static void* countedAllocate(std::size_t size, std::size_t alignment) {
+    ++tl_allocationCount;
+    tl_allocatedBytes += size;
+    if (size == 0) size = 1;
+    if (alignment <= alignof(std::max_align_t)) return std::malloc(size);
+    // aligned_alloc 要求大小是对齐值的整数倍
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void* operator new(std::size_t size) {
+    if (void* p = countedAllocate(size, 0)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocate(size, 0);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocate(size, 0);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    if (void* p = countedAllocate(size, static_cast<std::size_t>(alignment))) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+// noinline 避免编译器把 free 内联到 new 表达式旁而误报分配/释放不匹配；
+// malloc 与 aligned_alloc 得到的内存都用 free 释放，各种 delete 的行为相同
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+// ================= 阶段计时与分配统计 =================
+
+// 编译各阶段；阶段可以嵌套（goto 内含 closure，collection 内含 goto），外层的耗时与分配包含内层
+enum ProfilePhase {
+    PHASE_LEX,           // 词法分析
+    PHASE_GRAMMAR,       // 读取文法
+    PHASE_FIRST_FOLLOW,  // FIRST/FOLLOW 集
+    PHASE_CLOSURE,       // 项目集闭包
+    PHASE_GOTO,          // 项目集转移
+    PHASE_COLLECTION,    // LR(0) 项目集规范族
+    PHASE_TABLE,         // 填写 ACTION/GOTO 表
+    PHASE_PARSE,         // 语法分析（规约时同时构造语法树或流式生成四元式）
+    PHASE_IR,            // 由语法树生成四元式
+    PHASE_CODEGEN,       // 目标代码生成
+    PHASE_REGALLOC,      // 线性扫描寄存器分配
+    NUM_PHASES
+};
+
+enum ProfileCounter {
+    COUNTER_TOKENS,
+    COUNTER_STATES,
+    COUNTER_ITEMS,
+    COUNTER_CLOSURE_ITERATIONS,  // 闭包中处理过的项目数
+    COUNTER_AST_NODES,
+    COUNTER_QUADS,
+    COUNTER_REGISTERS,           // 目标代码用到的虚拟寄存器
+    COUNTER_SPILLS,              // 寄存器分配溢出的区间
+    NUM_COUNTERS
+};
+
+// 全局剖析器：关闭时每个插桩点只多读一次标志；打开后各阶段的调用次数、耗时与分配次数/字节数
+// 以及各计数器用原子量累加，多个线程可以同时编译。分配数取自上面替换的全局 operator new
+class Profiler {
+private:
+    struct PhaseTotals {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> nanoseconds{0};
+        std::atomic<uint64_t> allocations{0};
+        std::atomic<uint64_t> allocatedBytes{0};
+    };
+
+    static std::atomic<bool> enabledFlag;
+    static PhaseTotals phases[NUM_PHASES];
+    static std::atomic<uint64_t> counters[NUM_COUNTERS];
+
+public:
+    static const char* phaseName(ProfilePhase phase) {
+        static const char* const names[NUM_PHASES] = {"lex",   "grammar", "first_follow", "closure",
+                                                      "goto",  "collection", "table",     "parse",
+                                                      "ir",    "codegen", "regalloc"};
+        return names[phase];
+    }
+
+    static const char* counterName(ProfileCounter counter) {
+        static const char* const names[NUM_COUNTERS] = {"tokens", "states", "items", "closure_iterations",
+                                                        "ast_nodes", "quads", "registers", "spills"};
+        return names[counter];
+    }
+
+    static bool isEnabled() {
+        return enabledFlag.load(std::memory_order_relaxed);
+    }
+
+    static void setEnabled(bool enabled) {
+        enabledFlag.store(enabled, std::memory_order_relaxed);
+    }
+
+    static void reset() {
+        for (auto& phase : phases) {
+            phase.calls = 0;
+            phase.nanoseconds = 0;
+            phase.allocations = 0;
+            phase.allocatedBytes = 0;
+        }
+        for (auto& counter : counters) counter = 0;
+    }
+
+    static void count(ProfileCounter counter, uint64_t n = 1) {
+        if (isEnabled()) counters[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static void record(ProfilePhase phase, uint64_t nanoseconds, uint64_t allocations, uint64_t bytes) {
+        PhaseTotals& totals = phases[phase];
+        totals.calls.fetch_add(1, std::memory_order_relaxed);
+        totals.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        totals.allocations.fetch_add(allocations, std::memory_order_relaxed);
+        totals.allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    static uint64_t counterValue(ProfileCounter counter) {
+        return counters[counter].load(std::memory_order_relaxed);
+    }
+
+    static uint64_t phaseCalls(ProfilePhase phase) {
+        return phases[phase].calls.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t phaseNanoseconds(ProfilePhase phase) {
+        return phases[phase].nanoseconds.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t phaseAllocations(ProfilePhase phase) {
+        return phases[phase].allocations.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t phaseAllocatedBytes(ProfilePhase phase) {
+        return phases[phase].allocatedBytes.load(std::memory_order_relaxed);
+    }
+
+    // {"phases": {"lex": {"calls", "time_us", "allocations", "allocated_bytes"}, ...}, "counters": {...}}，
+    // 只列出执行过的阶段
+    static void writeJson(std::ostream& os) {
+        os << "{\n  \"phases\": {";
+        bool first = true;
+        for (int p = 0; p < NUM_PHASES; ++p) {
+            const PhaseTotals& totals = phases[p];
+            if (totals.calls == 0) continue;
+            os << (first ? "" : ",") << "\n    \"" << phaseName(static_cast<ProfilePhase>(p))
+               << "\": {\"calls\": " << totals.calls << ", \"time_us\": " << std::fixed << std::setprecision(1)
+               << totals.nanoseconds / 1000.0 << ", \"allocations\": " << totals.allocations
+               << ", \"allocated_bytes\": " << totals.allocatedBytes << "}";
+            os.unsetf(std::ios::fixed);
+            first = false;
+        }
+        os << "\n  },\n  \"counters\": {";
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            os << (c ? ", " : "") << "\"" << counterName(static_cast<ProfileCounter>(c))
+               << "\": " << counters[c];
+        }
+        os << "}\n}" << std::endl;
+    }
+};
+
+std::atomic<bool> Profiler::enabledFlag{false};
+Profiler::PhaseTotals Profiler::phases[NUM_PHASES];
+std::atomic<uint64_t> Profiler::counters[NUM_COUNTERS];
+
+// 作用域计时：构造时若剖析器打开则记下时间与本线程的分配计数，析构时把差值计入阶段
+class ScopedPhase {
+private:
+    ProfilePhase phase;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+    size_t allocations = 0;
+    size_t bytes = 0;
+
+public:
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+    explicit ScopedPhase(ProfilePhase phase) : phase(phase), active(Profiler::isEnabled()) {
+        if (!active) return;
+        allocations = tl_allocationCount;
+        bytes = tl_allocatedBytes;
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedPhase() {
+        if (!active) return;
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        Profiler::record(phase, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                         tl_allocationCount - allocations, tl_allocatedBytes - bytes);
+    }
+};
+
 // Token类型定义
 enum TokenType {
     TOK_IDENTIFIER,   // 标识符
@@ -42,7 +346,7 @@ struct Token {
 // 产生式结构体：左部和右部
 struct Production {
     std::string left;
-    std::string rights; // 右部可能包含多个符号
+    std::vector<std::string> rights; // 右部符号序列，多字符终结符（如 true）是一个符号
 
     bool operator==(const Production& other) const {
         return (left == other.left) && (rights == other.rights); 
@@ -102,12 +406,7 @@ struct Grammar {
     std::vector<std::string> T;  // 终结符
     std::vector<std::string> N;  // 非终结符
     std::vector<Production> prods;  // 产生式
-} grammar;
-
-// FIRST集和FOLLOW集
-std::unordered_map<std::string,std::unordered_set<std::string>> first;  // 非终结符的FIRST集
-std::unordered_map<std::string, std::unordered_set<std::string>> follow; // 非终结符的FOLLOW集
-
+};
 
 enum ActionType {
     SHIFT,  // 移进
@@ -121,8 +420,6 @@ struct ActionItem {
     ActionType actionType;  // 动作类型
     int stateOrRule;        // 如果是移进，表示目标状态；如果是规约，表示产生式编号
 };
-std::map<int, std::map<std::string, ActionItem>> action;
-std::map<int, std::map<std::string, int>> goton; 
 
 // 分析栈
 struct StackItem {
@@ -138,7 +435,7 @@ Token create_token(TokenType type, char ch) {
     return token;
 }
 // 处理标识符或布尔值
-Token handle_identifier_or_boolean(int ch, std::ifstream& source) {
+Token handle_identifier_or_boolean(int ch, std::istream& source) {
     std::string buffer;
     while (isalnum(ch) || ch == '_') {  
         buffer += ch;
@@ -160,7 +457,7 @@ Token handle_identifier_or_boolean(int ch, std::ifstream& source) {
 }
 
 // 获取下一个 token
-Token get_next_token(std::ifstream& source) {
+Token get_next_token(std::istream& source) {
     int ch = source.get();  
     Token token;
 
@@ -219,421 +516,18 @@ Token get_next_token(std::ifstream& source) {
     return create_token(TOK_ILLEGAL, ch);
 }
 
-
-// 读取文法
-void read_grammar_from_file(std::ifstream& source) {
-    // 读取非终结符
-    std::string line;
-    std::getline(source, line);
-    std::istringstream non_terminal_stream(line);
-    std::string symbol;
-    while (std::getline(non_terminal_stream, symbol, ',')) {
-        grammar.N.push_back(symbol);
-    }
-
-    // 读取终结符
-    std::getline(source, line);
-    std::istringstream terminal_stream(line);
-    while (std::getline(terminal_stream, symbol, ',')) {
-        grammar.T.push_back(symbol);
-    }
-
-    // 读取产生式
-    while (std::getline(source, line)) {
-        if (line.empty()) continue;  // 忽略空行
-        // 在当前行 line 中查找字符串 "->" 的位置，返回该位置的索引。如果找到了 "->"，返回的位置会是一个有效的索引；
-        // 如果没有找到，返回 std::string::npos
-        size_t arrow_pos = line.find("->");
-        if (arrow_pos != std::string::npos) {
-            std::string lhs = line.substr(0, arrow_pos);  // 左部
-            std::string rhs = line.substr(arrow_pos + 2);  // 右部
-                        
-            grammar.N.push_back(lhs);  // 将其他左部加入非终结符列表
-            
-            Production p;
-            p.left = lhs;
-
-            // 右部的符号按空格分开
-            std::istringstream rhs_stream(rhs);
-            char symbol;
-            while (rhs_stream >> symbol) {
-                p.rights.push_back(symbol);
-            }
-
-            grammar.prods.push_back(p);
-        }
-    }
-
-    // // 打印非终结符集合
-    // std::cout << "Non-Terminals: ";
-    // for (const auto& nt : grammar.N) {
-    //     std::cout << nt << " ";
-    // }
-    // std::cout << "\n";
-
-    // // 打印终结符集合
-    // std::cout << "Terminals: ";
-    // for (const auto& t : grammar.T) {
-    //     std::cout << t << " ";
-    // }
-    // std::cout << "\n";
-
-    // // 打印每条产生式
-    // std::cout << "Productions:\n";
-    // for (const auto& prod : grammar.prods) {
-    //     std::cout << prod.left << " -> ";
-    //     for (const auto& symbol : prod.rights) {
-    //         std::cout << symbol << " ";
-    //     }
-    //     std::cout << "\n";
-    // }
-}
-
-
-// // 获取FIRST集
-// void getFirstSet() {
-//     // 为所有终结符初始化 FIRST 集
-//     for (const auto& t : grammar.T) {
-//         first[t].insert(t);  // 终结符的 FIRST 集包含它自己
-//     }
-    
-//     bool change = true;
-//     while (change) {
-//         change = false;
-//         for (const auto& p : grammar.prods) {
-//             std::string X = p.left;  // 当前产生式左部
-
-//             if (p.rights == "true" || p.rights == "false"){
-//                 if (first.find(p.rights) != first.end()) {
-//                     // 将 FIRST(symbol) 添加到 FIRST(X) 中
-//                     for (const auto& f : first[p.rights]) {
-//                         if (first[X].insert(f).second) {
-//                             change = true;  // 标记发生了变化
-//                         }
-//                     }
-//                 }
-//             }else{
-//                 // 遍历右部的每个符号（rights 是一个字符串）
-//                 for (const char& symbol : p.rights) {
-                    
-//                     std::string symbol_str(1, symbol);  // 将字符转换为字符串
-                    
-//                     // 如果符号是终结符或已经计算过的非终结符
-//                     if (first.find(symbol_str) != first.end()) {
-//                         // 将 FIRST(symbol) 添加到 FIRST(X) 中
-//                         for (const auto& f : first[symbol_str]) {
-//                             if (first[X].insert(f).second) {
-//                                 change = true;  // 标记发生了变化
-//                             }
-//                         }
-//                     } else {
-//                         // 如果符号是终结符，直接添加到 FIRST(X)
-//                         if (first[X].insert(symbol_str).second) {
-//                             change = true;  // 标记发生了变化
-//                         }
-//                         break;  // 如果是终结符，就没有必要继续处理下一个符号
-//                     }
-//                 }
-//             }
-            
-//         }
-//     }
-// }
-
-// void getFollowSet() {
-//     // 初始化 Follow 集：每个非终结符的 Follow 集包含 $（结束符）
-//     for (const auto& t : grammar.N) {
-//         follow[t].insert("$");
-//     }
-
-//     bool change = true;
-//     while (change) {
-//         change = false;
-//         // 遍历每个产生式
-//         for (const auto& p : grammar.prods) {
-//             std::string A = p.left;  // A -> 右部产生式
-
-//             for (size_t i = 0; i < p.rights.size(); ++i) {
-//                 std::string alpha = p.rights.substr(i);  // 当前右部的剩余部分
-
-//                 for (size_t j = 0; j < alpha.size(); ++j) {
-//                     std::string B(1, alpha[j]);  // 当前符号 B
-//                     if (first.find(B) != first.end()) {  // 如果 B 是非终结符
-//                         // 检查 Beta 是空的情况
-//                         if (j == alpha.size() - 1 || first[alpha.substr(j+1)].count("ε") > 0) {
-//                             // 如果 Beta 可以推导出 ε，Follow(A) 的元素应该进入 Follow(B)
-//                             for (const auto& f : follow[A]) {
-//                                 if (follow[B].insert(f).second) {
-//                                     change = true;  // 标记发生了变化
-//                                 }
-//                             }
-//                         }
-
-//                         // 如果符号后面有非空部分，且这个部分的首符号是终结符
-//                         if (j < alpha.size() - 1) {
-//                             std::string next_symbol(1, alpha[j + 1]);
-//                             if (first.find(next_symbol) != first.end()) {
-//                                 for (const auto& f : first[next_symbol]) {
-//                                     if (follow[B].insert(f).second) {
-//                                         change = true;
-//                                     }
-//                                 }
-//                             }
-//                         }
-//                     }
-//                 }
-//             }
-//         }
-//     }
-// }
-
-
-void closure(LR0Items &items) {
-    bool changed = true;
-    while (changed) {
-        changed = false;
-        for (size_t i = 0; i < items.items.size(); ++i) {
-            LR0Item &item = items.items[i];
-
-            // 如果点没有在右部的最后位置
-            if (item.dot_location < item.p.rights.size()) {
-                std::string rightPart = item.p.rights.substr(item.dot_location, 1);  // 获取当前符号
-                // 如果符号是非终结符，添加相应的产生式
-                if (std::find(grammar.N.begin(), grammar.N.end(), rightPart) != grammar.N.end()) {
-                    // 当前符号是非终结符，添加相应的产生式
-                    for (const auto& prod : grammar.prods) {
-                        if (prod.left == rightPart) {  // 如果产生式的左部与当前符号相同
-                            LR0Item new_item = {prod, 0};  // 点从0开始
-                            // 如果新产生的项还不在当前的项集中，则添加
-                            if (std::find(items.items.begin(), items.items.end(), new_item) == items.items.end()) {
-                                items.items.push_back(new_item);
-                                changed = true;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-}
-
-void go(const LR0Items &items, const std::string& symbol, LR0Items &new_items) {
-    // 遍历当前项集中的每一项
-    // std::cout << "symbol: " << symbol << std::endl;
-    for (const LR0Item &item : items.items) {
-        // 判断点所在位置是否在产生式的右部范围内
-        if (item.dot_location < item.p.rights.size()) {
-            std::string rightSymbol = item.p.rights.substr(item.dot_location, symbol.size());  // 获取当前符号，长度为 symbol 的大小
-            // std::cout << "rightSymbol: " << rightSymbol << std::endl;
-
-            // 如果符号是 "true" 或 "false"，直接比较
-            if (rightSymbol == symbol) {
-                LR0Item new_item = {item.p, item.dot_location + symbol.size()};  // 移动点，跳过整个符号
-                new_items.items.push_back(new_item);  // 将新的项添加到新的项集中
-                // std::cout << "new_item: " << new_item << std::endl;
-            }
-            // 普通情况：右部是单个符号的情况（如终结符或非终结符）
-            else if (symbol.size() == 1 && rightSymbol == symbol) {
-                // 如果符号是单个字符，进行匹配
-                LR0Item new_item = {item.p, item.dot_location + 1};  // 移动点
-                new_items.items.push_back(new_item);  // 将新的项添加到新的项集中
-                // std::cout << "new_item: " << new_item << std::endl;
-            }
-        }
-    }
-
-    // std::cout << "new_items: " << new_items << std::endl;
-    closure(new_items);  // 执行闭包
-}
-
-
-
-std::string getStateKey(const LR0Items& items) {
-    std::string key;
-    for (const auto& item : items.items) {
-        key += item.p.left;
-        key += std::to_string(item.dot_location);
-    }
-    return key;
-}
-
-
-CanonicalCollection buildCanonicalCollection() {
-    CanonicalCollection cc;
-    std::unordered_map<std::string, int> visited;
-    std::queue<LR0Items> stateQueue;
-
-    // 初始项目集
-    LR0Items I0;
-    LR0Item startItem = {grammar.prods[0], 0}; 
-    I0.items.push_back(startItem);
-    closure(I0);  // 计算闭包
-    cc.items.push_back(I0);
-
-    // 初始化状态队列
-    stateQueue.push(I0);
-
-    // 处理项目集
-    while (!stateQueue.empty()) {
-        LR0Items currentItems = stateQueue.front();
-        stateQueue.pop();
-
-        // 处理终结符
-        for (const std::string& terminal : grammar.T) {
-            LR0Items newState;
-            go(currentItems, terminal, newState);  // 用符号（可能是字符串）调用 go
-            if (!newState.items.empty()) {
-                std::string stateKey = getStateKey(newState);
-                if (visited.find(stateKey) == visited.end()) {
-                    visited[stateKey] = cc.items.size();
-                    cc.items.push_back(newState);
-                    stateQueue.push(newState);
-                }
-            }
-        }
-
-        // 处理非终结符
-        for (const std::string& nonTerminal : grammar.N) {
-            LR0Items newState;
-            go(currentItems, nonTerminal, newState);  // 同样处理非终结符
-            if (!newState.items.empty()) {
-                std::string stateKey = getStateKey(newState);
-                if (visited.find(stateKey) == visited.end()) {
-                    visited[stateKey] = cc.items.size();
-                    cc.items.push_back(newState);
-                    stateQueue.push(newState);
-                }
-            }
-        }
+// 对字符串做词法分析，返回各 token 的值（与 main 中 inputs 的形式一致）
+std::vector<std::string> tokenizeExpression(const std::string& text) {
+    std::istringstream stream(text);
+    std::vector<std::string> values;
+    Token token;
+    while ((token = get_next_token(stream)).type != TOK_END) {
+        values.push_back(token.value);
     }
-
-    return cc;
+    return values;
 }
 
 
-
-void generateLR0Table(CanonicalCollection& cc) {
-    // 遍历每个状态
-    for (int i = 0; i < cc.items.size(); ++i) {
-        const LR0Items& items = cc.items[i];
-
-        // 处理终结符，填充 Action 表
-        for (const std::string& terminal : grammar.T) {
-            std::string input = terminal;  // 使用整个终结符字符串作为输入
-            LR0Items newState;
-            go(items, input, newState);  // 传入字符串作为输入
-
-            if (!newState.items.empty()) {
-                // 查找是否有相同状态
-                int newStateIndex = -1;
-                for (int j = 0; j < cc.items.size(); ++j) {
-                    if (cc.items[j].items == newState.items) {
-                        // for (int k = 0; k < cc.items[j].items.size() ; k++){
-                        //     std::cout << "cc.items[j].items:\n" << cc.items[j].items[k] << std::endl;
-                        //     std::cout << "newState.items:\n" << newState.items[k]<< std::endl;
-                        // }
-                        // printf("-----------------------");
-                        // std::cout << "newIndex:"<< j <<std::endl;
-                        newStateIndex = j;
-                        break;
-                    }
-                }
-
-                if (newStateIndex != -1) {
-                    // 如果找到了新的状态，执行移进操作
-                    action[i][input] = {SHIFT, newStateIndex};
-                }
-            }
-        }
-
-        // 处理非终结符，填充 Goto 表
-        for (const std::string& nonTerminal : grammar.N) {
-            std::string input = nonTerminal;  // 使用整个非终结符字符串作为输入
-            LR0Items newState;
-            go(items, input, newState);  // 传入字符串作为输入
-
-            if (!newState.items.empty()) {
-                // 查找是否有相同状态
-                int newStateIndex = -1;
-                for (int j = 0; j < cc.items.size(); ++j) {
-                    if (cc.items[j].items == newState.items) {
-                        newStateIndex = j;
-                        break;
-                    }
-                }
-
-                if (newStateIndex != -1) {
-                    // 如果找到了新的状态，执行 Goto 操作
-                    goton[i][input] = newStateIndex;
-                }
-            }
-        }
-
-        // 处理规约操作，填充 Action 表
-        for (const auto& item : items.items) {
-            if (item.dot_location == item.p.rights.size()) {  // 如果点在右部末尾
-                // 对应的产生式右部完全匹配，可以进行规约
-                std::string left = item.p.left;  // 规约的左部符号
-
-                // 直接使用产生式的位置（即产生式的顺序号）作为规则编号
-                int ruleNumber = 0;
-                for (int j = 0; j < grammar.prods.size(); ++j) {
-                    if (grammar.prods[j].left == item.p.left && grammar.prods[j].rights == item.p.rights) {
-                        ruleNumber = j;  // 记录规约的产生式编号
-                        break;
-                    }
-                }
-                
-                // 特殊处理 'true' 和 'false'，这些应当作为整体处理
-                for (const std::string& terminal : grammar.T) {
-                    if (ruleNumber==0){
-                        break;
-                    }
-                   
-                    action[i][terminal] = {REDUCE, ruleNumber};  // 记录规约操作
-                    
-                    action[i][terminal] = {REDUCE, ruleNumber};  // 默认的规约操作
-                    
-                }
-                action[i]["$"] = {REDUCE,ruleNumber};
-            }
-        }
-        
-        const LR0Item& item = items.items[0];
-        // 检查是否匹配到开始符号的产生式
-        if (item.p.left == "S'" && item.dot_location == item.p.rights.size()) {
-            // 如果栈顶符号是开始符号并且输入流已消耗完
-             action[i]["$"] = {ACCEPT, 0};  // 接受状态
-        }
-        
-    }
-
-    // // 打印 Action 和 Goto 表
-    // std::cout << "Action Table:\n";
-    // for (const auto& entry : action) {
-    //     for (const auto& actionEntry : entry.second) {
-    //         const ActionItem& actionItem = actionEntry.second;
-    //         std::cout << "state " << entry.first << " -> input " << actionEntry.first << " : ";
-    //         if (actionItem.actionType == SHIFT) {
-    //             std::cout << "shift to state " << actionItem.stateOrRule;
-    //         } else if (actionItem.actionType == REDUCE) {
-    //             std::cout << "reduce by rule " << actionItem.stateOrRule;
-    //         } else if (actionItem.actionType == ACCEPT) {
-    //             std::cout << "accept";
-    //         } else {
-    //             std::cout << "error";
-    //         }
-    //         std::cout << std::endl;
-    //     }
-    // }
-
-    // std::cout << "Goto Table:\n";
-    // for (const auto& entry : goton) {
-    //     for (const auto& gotoEntry : entry.second) {
-    //         std::cout << "state " << entry.first << " -> nonTerminal " << gotoEntry.first << " : " << gotoEntry.second << std::endl;
-    //     }
-    // }
-}
 void printStateStack(std::stack<int> stateStack) {
     std::vector<int> temp;
     while (!stateStack.empty()) {
@@ -663,84 +557,6 @@ void printSymbolStack(std::stack<std::string> symbolStack) {
     std::cout << std::endl;
 }
 
-bool parse(const std::vector<Token>& inputTokens) {
-    std::stack<int> stateStack;  // 状态栈
-    std::stack<std::string> symbolStack;  // 符号栈
-    
-    stateStack.push(0);  // 初始状态
-    int inputIndex = 0;
-
-    while (true) {
-        int currentState = stateStack.top();
-        // std::cout << "currentState: " << currentState << std::endl;
-
-        // 检查是否已读取完输入，避免越界
-        if (inputIndex > inputTokens.size()) {
-            std::cout << "Input ended unexpectedly!" << std::endl;
-            return false;  // 输入结束，但没有正确解析
-        }
-
-        // 获取当前输入符号
-        std::string currentInput = inputTokens[inputIndex].value;
-        // std::cout << "currentInput: " << currentInput << std::endl;
-
-        // 查找 Action 表中的操作
-        if (action[currentState].find(currentInput) != action[currentState].end()) {
-            const ActionItem& actionItem = action[currentState][currentInput];
-            
-            if (actionItem.actionType == SHIFT) {  // 移进操作
-                stateStack.push(actionItem.stateOrRule);  // 推入新状态
-                symbolStack.push(currentInput);  // 推入符号
-                // printStateStack(stateStack);
-                // printSymbolStack(symbolStack);
-                // std::cout << currentInput << std::endl;
-                inputIndex++;  // 输入指针前移
-                std::cout << "SHIFT to state " << actionItem.stateOrRule << std::endl;
-            } 
-            else if (actionItem.actionType == REDUCE) {  // 规约操作
-                // printf("in reduce\n");
-                int ruleIndex = actionItem.stateOrRule;  // 规则编号
-                const Production& rule = grammar.prods[ruleIndex];
-                // 根据规则右部长度弹出符号栈和状态栈
-                if (rule.rights == "true" || rule.rights == "false"){
-                    stateStack.pop();
-                    symbolStack.pop();
-                } else{
-                    for (size_t i = 0; i < rule.rights.size(); ++i) {
-                        stateStack.pop();
-                        symbolStack.pop();
-                    }
-                }
-
-                // 根据规约的左部（非终结符）查找 Goto 表中的新状态
-                std::string nonTerminal = rule.left;
-    
-                int newState = goton[stateStack.top()][nonTerminal];
-                if (newState!=stateStack.top()){
-                    stateStack.push(newState);  // 推入新的状态
-                }
-                
-                symbolStack.push(nonTerminal);  // 推入新的符号
-                // printStateStack(stateStack);
-                // printSymbolStack(symbolStack);
-                std::cout << "REDUCE by rule " << ruleIndex << " (" << rule.left << " -> " << rule.rights << ")" << std::endl;
-            } 
-            else if (actionItem.actionType == ACCEPT) {  // 接受操作
-                std::cout << "Input parsed successfully!" << std::endl;
-                return true;
-            } 
-            else {  // 错误操作
-                std::cout << "Parsing error!" << std::endl;
-                return false;
-            }
-        } else {
-            // 如果没有找到匹配的动作
-            std::cout << "No action found for state " << currentState << " and input " << currentInput << std::endl;
-            return false;
-        }
-    }
-}
-
 class ASTNode {
 public:
     std::string type;        // 节点类型：operator, constant, variable
@@ -749,11 +565,23 @@ public:
     ASTNode* right;         // 右子节点
 
     ASTNode(const std::string& t, const std::string& v) 
-        : type(t), value(v), left(nullptr), right(nullptr) {}
+        : type(t), value(v), left(nullptr), right(nullptr) {
+        Profiler::count(COUNTER_AST_NODES);
+    }
 
+    // 先摘下子结点再逐个删除，深度达 10^6 的树（如很长的 V 链或连续的 -）也不会递归爆栈
     ~ASTNode() {
-        delete left;
-        delete right;
+        std::vector<ASTNode*> pending;
+        if (left) pending.push_back(left);
+        if (right) pending.push_back(right);
+        while (!pending.empty()) {
+            ASTNode* node = pending.back();
+            pending.pop_back();
+            if (node->left) pending.push_back(node->left);
+            if (node->right) pending.push_back(node->right);
+            node->left = node->right = nullptr;
+            delete node;
+        }
     }
 };
 
@@ -826,31 +654,51 @@ private:
         return "";
     }
 
+    // 按优先级构造子树：V 最低，^ 其次，- 最高
     ASTNode* parseExpression() {
+        ASTNode* left = parseTerm();
+
+        while (hasMoreTokens() && peekToken() == "V") {
+            currentIndex++; // 消耗操作符
+            left = makeBinary("V", left, &ASTBuilder::parseTerm);
+        }
+
+        return left;
+    }
+
+    ASTNode* parseTerm() {
         ASTNode* left = parsePrimary();
-        
-        while (hasMoreTokens()) {
-            std::string op = peekToken();
-            if (op != "V" && op != "^") {
-                break;
-            }
+
+        while (hasMoreTokens() && peekToken() == "^") {
             currentIndex++; // 消耗操作符
-            ASTNode* right = parsePrimary();
-            ASTNode* newNode = new ASTNode("operator", op);
-            left->left = left;
-            left->right = right;
-            left = newNode;
+            left = makeBinary("^", left, &ASTBuilder::parsePrimary);
         }
-        
+
         return left;
     }
 
+    // 解析右操作数并与左子树组成二元运算节点，出错时释放已构造的左子树
+    ASTNode* makeBinary(const std::string& op, ASTNode* left, ASTNode* (ASTBuilder::*parseRight)()) {
+        ASTNode* right = nullptr;
+        try {
+            right = (this->*parseRight)();
+        } catch (...) {
+            delete left;
+            throw;
+        }
+        ASTNode* newNode = new ASTNode("operator", op);
+        newNode->left = left;
+        newNode->right = right;
+        return newNode;
+    }
+
     ASTNode* parsePrimary() {
         std::string token = getNextToken();
         
         if (token == "(") {
             ASTNode* node = parseExpression();
             if (getNextToken() != ")") {
+                delete node;
                 throw std::runtime_error("Expected ')'");
             }
             return node;
@@ -864,6 +712,12 @@ private:
         else if (token == "true" || token == "false") {
             return new ASTNode("constant", token);
         }
+        else if (token.empty()) {
+            throw std::runtime_error("Unexpected end of expression");
+        }
+        else if (token == ")" || token == "V" || token == "^") {
+            throw std::runtime_error("Unexpected token '" + token + "'");
+        }
         else {
             return new ASTNode("variable", token);
         }
@@ -875,30 +729,625 @@ public:
     ASTNode* buildFromTokens(const std::vector<std::string>& tokenList) {
         tokens = tokenList;
         currentIndex = 0;
-        return parseExpression();
+        ASTNode* root = parseExpression();
+        if (hasMoreTokens()) {
+            delete root;
+            throw std::runtime_error("Unexpected token '" + peekToken() + "'");
+        }
+        return root;
     }
 };
 
 
-// 四元式结构体
-struct Quadruple {
-    std::string op;    // 操作符
-    std::string arg1;  // 操作数1
-    std::string arg2;  // 操作数2
-    std::string result; // 结果
-    Quadruple(std::string op, std::string arg1, std::string arg2, std::string result)
-        : op(op), arg1(arg1), arg2(arg2), result(result) {}
-    std::string toString() const {
-        std::stringstream ss;
-        ss << "(" << op << ", " << arg1 << ", " << arg2 << ", " << result << ")";
-        return ss.str();
+// 大块输出缓冲：格式化结果直接追加到可复用的缓冲区，满了才整块写给 out，不逐行刷新；析构时写出剩余内容
+class OutputBuffer {
+private:
+    std::ostream& out;
+    std::vector<char> buffer;
+    size_t used = 0;
+    uint64_t written = 0;
+
+public:
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    explicit OutputBuffer(std::ostream& out, size_t capacity = 1 << 20)
+        : out(out), buffer(std::max<size_t>(capacity, 64)) {}
+
+    ~OutputBuffer() {
+        flush();
     }
-};
 
-// 四元式生成器类
-class QuaternionGenerator {
-private:
-    std::vector<Quadruple> quaternions;  // 存储生成的四元式
+    void flush() {
+        if (used == 0) return;
+        out.write(buffer.data(), used);
+        written += used;
+        used = 0;
+    }
+
+    void append(const char* data, size_t n) {
+        if (used + n > buffer.size()) {
+            flush();
+            if (n > buffer.size()) {
+                out.write(data, n);
+                written += n;
+                return;
+            }
+        }
+        std::memcpy(buffer.data() + used, data, n);
+        used += n;
+    }
+
+    void append(const std::string& text) {
+        append(text.data(), text.size());
+    }
+
+    void put(char c) {
+        if (used == buffer.size()) flush();
+        buffer[used++] = c;
+    }
+
+    void appendNumber(uint64_t value) {
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value);
+        if (used + n > buffer.size()) flush();
+        while (n) buffer[used++] = digits[--n];
+    }
+
+    // LEB128 无符号变长整数
+    void appendVarint(uint64_t value) {
+        while (value >= 0x80) {
+            put(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        put(static_cast<char>(value));
+    }
+
+    uint64_t bytesWritten() const {
+        return written + used;
+    }
+};
+
+// 四元式结构体
+struct Quadruple {
+    std::string op;    // 操作符
+    std::string arg1;  // 操作数1
+    std::string arg2;  // 操作数2
+    std::string result; // 结果
+    Quadruple(std::string op, std::string arg1, std::string arg2, std::string result)
+        : op(std::move(op)), arg1(std::move(arg1)), arg2(std::move(arg2)), result(std::move(result)) {}
+    std::string toString() const {
+        std::stringstream ss;
+        ss << "(" << op << ", " << arg1 << ", " << arg2 << ", " << result << ")";
+        return ss.str();
+    }
+    // 与 toString 相同的格式，直接写入输出缓冲
+    void appendTo(OutputBuffer& out) const {
+        out.put('(');
+        out.append(op);
+        out.append(", ", 2);
+        out.append(arg1);
+        out.append(", ", 2);
+        out.append(arg2);
+        out.append(", ", 2);
+        out.append(result);
+        out.put(')');
+    }
+};
+
+// 四元式的接收者：流式生成时每条四元式一产生就交给它，finish 在表达式结束时给出结果变量
+class QuadrupleSink {
+public:
+    virtual ~QuadrupleSink() {}
+    virtual void emit(const Quadruple& quad) = 0;
+    virtual void finish(const std::string& /*result*/) {}
+};
+
+// 按 printQuaternions 的格式逐条写入输出缓冲，finish 时写出
+class QuadrupleTextWriter : public QuadrupleSink {
+private:
+    OutputBuffer buffer;
+    size_t index = 0;
+
+public:
+    explicit QuadrupleTextWriter(std::ostream& out) : buffer(out) {}
+
+    void emit(const Quadruple& quad) override {
+        buffer.appendNumber(index++);
+        buffer.append(": ", 2);
+        quad.appendTo(buffer);
+        buffer.put('\n');
+    }
+
+    void finish(const std::string& /*result*/) override {
+        buffer.flush();
+    }
+};
+
+// 四元式二进制格式（整数均为 LEB128 变长编码），供下游工具读取：
+//   "QBIN" | 版本 | 每条四元式：操作码 + arg1 + arg2 + result | 0xFF + 结果操作数
+// 操作码 0..7 依次为 ! V ^ = j jnz jz label，8 表示其后跟一个操作数形式的操作符名。
+// 操作数 v：0 为空，1 为 true，2 为 false；v = 3 + 3k 为临时变量 t<k>，3 + 3k + 1 为第 k 个出现过的名字，
+// 3 + 3k + 2 为新名字，其后跟 k 字节名字本身，按出现顺序编号
+class BinaryQuadrupleWriter : public QuadrupleSink {
+private:
+    static const char* const OPCODES[8];
+    static const uint64_t VERSION = 1;
+    static const uint8_t END_MARKER = 0xFF;
+
+    OutputBuffer buffer;
+    std::unordered_map<std::string, uint64_t> names;
+
+    // t 后跟不带前导零的数字时取出编号
+    static bool parseTemporary(const std::string& s, uint64_t& number) {
+        if (s.size() < 2 || s.size() > 19 || s[0] != 't' || (s[1] == '0' && s.size() > 2)) return false;
+        number = 0;
+        for (size_t i = 1; i < s.size(); ++i) {
+            if (s[i] < '0' || s[i] > '9') return false;
+            number = number * 10 + (s[i] - '0');
+        }
+        return true;
+    }
+
+    void appendOperand(const std::string& s) {
+        uint64_t number;
+        if (s.empty()) {
+            buffer.appendVarint(0);
+        } else if (s == "true") {
+            buffer.appendVarint(1);
+        } else if (s == "false") {
+            buffer.appendVarint(2);
+        } else if (parseTemporary(s, number)) {
+            buffer.appendVarint(3 + 3 * number);
+        } else {
+            auto it = names.find(s);
+            if (it != names.end()) {
+                buffer.appendVarint(3 + 3 * it->second + 1);
+            } else {
+                names.emplace(s, names.size());
+                buffer.appendVarint(3 + 3 * s.size() + 2);
+                buffer.append(s);
+            }
+        }
+    }
+
+public:
+    explicit BinaryQuadrupleWriter(std::ostream& out) : buffer(out) {
+        buffer.append("QBIN", 4);
+        buffer.appendVarint(VERSION);
+    }
+
+    void emit(const Quadruple& quad) override {
+        int code = 0;
+        while (code < 8 && quad.op != OPCODES[code]) ++code;
+        buffer.put(static_cast<char>(code));
+        if (code == 8) appendOperand(quad.op);
+        appendOperand(quad.arg1);
+        appendOperand(quad.arg2);
+        appendOperand(quad.result);
+    }
+
+    void finish(const std::string& result) override {
+        buffer.put(static_cast<char>(END_MARKER));
+        appendOperand(result);
+        buffer.flush();
+    }
+
+    uint64_t bytesWritten() const {
+        return buffer.bytesWritten();
+    }
+
+    // 读回 BinaryQuadrupleWriter 写出的完整程序，result 为结果操作数
+    static std::vector<Quadruple> read(std::istream& in, std::string* result = nullptr) {
+        std::vector<std::string> seen;
+        auto byte = [&]() {
+            int c = in.get();
+            if (c == EOF) throw std::runtime_error("Truncated quadruple file");
+            return static_cast<uint8_t>(c);
+        };
+        auto varint = [&]() {
+            uint64_t value = 0;
+            for (int shift = 0;; shift += 7) {
+                if (shift > 63) throw std::runtime_error("Bad varint in quadruple file");
+                uint8_t b = byte();
+                value |= static_cast<uint64_t>(b & 0x7F) << shift;
+                if (!(b & 0x80)) return value;
+            }
+        };
+        auto operand = [&]() -> std::string {
+            uint64_t v = varint();
+            if (v == 0) return "";
+            if (v == 1) return "true";
+            if (v == 2) return "false";
+            uint64_t k = (v - 3) / 3;
+            switch ((v - 3) % 3) {
+                case 0:
+                    return "t" + std::to_string(k);
+                case 1:
+                    if (k >= seen.size()) throw std::runtime_error("Bad name reference in quadruple file");
+                    return seen[k];
+                default: {
+                    std::string name(k, '\0');
+                    if (!in.read(&name[0], k)) throw std::runtime_error("Truncated quadruple file");
+                    seen.push_back(name);
+                    return name;
+                }
+            }
+        };
+
+        char magic[4];
+        if (!in.read(magic, 4) || std::memcmp(magic, "QBIN", 4) != 0) {
+            throw std::runtime_error("Not a quadruple file (bad magic)");
+        }
+        if (varint() != VERSION) throw std::runtime_error("Unsupported quadruple file version");
+        std::vector<Quadruple> quads;
+        while (true) {
+            uint8_t code = byte();
+            if (code == END_MARKER) break;
+            if (code > 8) throw std::runtime_error("Bad opcode in quadruple file");
+            std::string op = code < 8 ? OPCODES[code] : operand();
+            std::string arg1 = operand();
+            std::string arg2 = operand();
+            quads.emplace_back(op, arg1, arg2, operand());
+        }
+        std::string last = operand();
+        if (result) *result = last;
+        return quads;
+    }
+};
+
+const char* const BinaryQuadrupleWriter::OPCODES[8] = {"!", "V", "^", "=", "j", "jnz", "jz", "label"};
+
+// 判断四元式的操作数是否为变量（常量与空操作数不参与活跃分析）
+bool isVariableOperand(const std::string& arg) {
+    return !arg.empty() && arg != "true" && arg != "false";
+}
+
+// 活跃区间：变量从定义点到最后一次使用点（均为四元式下标）
+struct LiveRange {
+    std::string var;
+    int start;  // 定义位置，程序输入变量为 -1
+    int end;    // 最后一次使用位置，结果变量延伸到四元式末尾
+};
+
+// 活跃变量分析：按基本块做反向数据流分析，活跃集合用位向量表示
+class LivenessAnalyzer {
+private:
+    typedef std::vector<uint64_t> BitSet;
+
+    std::vector<std::string> varNames;                 // 变量编号 -> 变量名
+    std::unordered_map<std::string, int> varIndex;     // 变量名 -> 变量编号
+    std::vector<int> blockStart;                       // 每个基本块的第一条四元式
+    std::vector<int> blockOf;                          // 四元式所在的基本块
+    std::vector<BitSet> blockLiveIn;                   // 基本块入口处的活跃变量
+    std::vector<BitSet> blockLiveOut;                  // 基本块出口处的活跃变量
+    std::vector<LiveRange> ranges;
+    std::vector<Quadruple> program;                    // 分析时的四元式副本，用于按需求出单条四元式的活跃集合
+
+    static bool isJump(const Quadruple& q) {
+        return q.op == "j" || q.op == "jnz" || q.op == "jz";
+    }
+
+    static bool test(const BitSet& set, int v) {
+        return (set[v >> 6] >> (v & 63)) & 1;
+    }
+
+    static void setBit(BitSet& set, int v) {
+        set[v >> 6] |= 1ULL << (v & 63);
+    }
+
+    static void clearBit(BitSet& set, int v) {
+        set[v >> 6] &= ~(1ULL << (v & 63));
+    }
+
+    int indexOf(const std::string& var) {
+        auto it = varIndex.find(var);
+        if (it != varIndex.end()) return it->second;
+        int v = varNames.size();
+        varNames.push_back(var);
+        varIndex[var] = v;
+        return v;
+    }
+
+    // 在基本块内从出口向前推到四元式 i 的出口处
+    BitSet liveOutAt(int i) const {
+        int b = blockOf[i];
+        int end = (b + 1 < static_cast<int>(blockStart.size())) ? blockStart[b + 1] : program.size();
+        BitSet live = blockLiveOut[b];
+        for (int k = end - 1; k > i; --k) {
+            transfer(program[k], live);
+        }
+        return live;
+    }
+
+    // in = use ∪ (out - def)
+    void transfer(const Quadruple& q, BitSet& live) const {
+        if (definesVariable(q)) {
+            clearBit(live, varIndex.at(q.result));
+        }
+        if (isVariableOperand(q.arg1)) setBit(live, varIndex.at(q.arg1));
+        if (isVariableOperand(q.arg2)) setBit(live, varIndex.at(q.arg2));
+    }
+
+    std::unordered_set<std::string> toSet(const BitSet& set) const {
+        std::unordered_set<std::string> result;
+        for (int v = 0; v < static_cast<int>(varNames.size()); ++v) {
+            if (test(set, v)) result.insert(varNames[v]);
+        }
+        return result;
+    }
+
+public:
+    // 四元式是否定义变量（控制流四元式的结果字段是标签）
+    static bool definesVariable(const Quadruple& q) {
+        return q.op != "label" && !isJump(q) && isVariableOperand(q.result);
+    }
+
+    // 计算活跃信息，roots 为程序出口处仍然活跃的变量（表达式的结果）
+    void analyze(const std::vector<Quadruple>& quads, const std::vector<std::string>& roots) {
+        program = quads;
+        int n = quads.size();
+        varNames.clear();
+        varIndex.clear();
+        for (const auto& q : quads) {
+            if (isVariableOperand(q.arg1)) indexOf(q.arg1);
+            if (isVariableOperand(q.arg2)) indexOf(q.arg2);
+            if (definesVariable(q)) indexOf(q.result);
+        }
+        for (const auto& r : roots) {
+            if (isVariableOperand(r)) indexOf(r);
+        }
+        size_t words = (varNames.size() + 63) / 64;
+
+        // 划分基本块：入口、标签处、跳转之后
+        blockStart.clear();
+        blockOf.assign(n, 0);
+        std::unordered_map<std::string, int> labelBlock;
+        for (int i = 0; i < n; ++i) {
+            if (i == 0 || quads[i].op == "label" || isJump(quads[i - 1])) {
+                if (blockStart.empty() || blockStart.back() != i) blockStart.push_back(i);
+            }
+            blockOf[i] = blockStart.size() - 1;
+            if (quads[i].op == "label") labelBlock[quads[i].result] = blockOf[i];
+        }
+        int numBlocks = blockStart.size();
+
+        // 基本块的 use/def 集合与后继
+        std::vector<BitSet> use(numBlocks, BitSet(words, 0)), def(numBlocks, BitSet(words, 0));
+        std::vector<std::vector<int>> succ(numBlocks);
+        for (int b = 0; b < numBlocks; ++b) {
+            int end = (b + 1 < numBlocks) ? blockStart[b + 1] : n;
+            for (int i = blockStart[b]; i < end; ++i) {
+                const Quadruple& q = quads[i];
+                for (const std::string* arg : {&q.arg1, &q.arg2}) {
+                    if (isVariableOperand(*arg)) {
+                        int v = varIndex[*arg];
+                        if (!test(def[b], v)) setBit(use[b], v);
+                    }
+                }
+                if (definesVariable(q)) setBit(def[b], varIndex[q.result]);
+            }
+            const Quadruple& last = quads[end - 1];
+            if (isJump(last)) {
+                auto it = labelBlock.find(last.result);
+                if (it != labelBlock.end()) succ[b].push_back(it->second);
+            }
+            if (last.op != "j" && b + 1 < numBlocks) succ[b].push_back(b + 1);
+        }
+
+        BitSet exitLive(words, 0);
+        for (const auto& r : roots) {
+            if (isVariableOperand(r)) setBit(exitLive, varIndex[r]);
+        }
+        blockLiveIn.assign(numBlocks, BitSet(words, 0));
+        blockLiveOut.assign(numBlocks, BitSet(words, 0));
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int b = numBlocks - 1; b >= 0; --b) {
+                BitSet out = succ[b].empty() ? exitLive : BitSet(words, 0);
+                for (int s : succ[b]) {
+                    for (size_t w = 0; w < words; ++w) out[w] |= blockLiveIn[s][w];
+                }
+                BitSet in(words);
+                for (size_t w = 0; w < words; ++w) in[w] = use[b][w] | (out[w] & ~def[b][w]);
+                if (out != blockLiveOut[b] || in != blockLiveIn[b]) {
+                    blockLiveOut[b].swap(out);
+                    blockLiveIn[b].swap(in);
+                    changed = true;
+                }
+            }
+        }
+
+        // 活跃区间：定义与使用位置的包络
+        std::vector<LiveRange> rangeOf(varNames.size());
+        std::vector<bool> seen(varNames.size(), false);
+        auto extend = [&](int v, int pos) {
+            if (!seen[v]) {
+                rangeOf[v] = {varNames[v], pos, pos};
+                seen[v] = true;
+            } else {
+                rangeOf[v].start = std::min(rangeOf[v].start, pos);
+                rangeOf[v].end = std::max(rangeOf[v].end, pos);
+            }
+        };
+        for (int i = 0; i < n; ++i) {
+            if (definesVariable(quads[i])) extend(varIndex[quads[i].result], i);
+            if (isVariableOperand(quads[i].arg1)) extend(varIndex[quads[i].arg1], i);
+            if (isVariableOperand(quads[i].arg2)) extend(varIndex[quads[i].arg2], i);
+        }
+        // 程序入口活跃的变量从 -1 开始，出口活跃的变量延伸到末尾
+        if (n > 0) {
+            for (int v = 0; v < static_cast<int>(varNames.size()); ++v) {
+                if (test(blockLiveIn[0], v)) extend(v, -1);
+            }
+        }
+        for (const auto& r : roots) {
+            if (isVariableOperand(r)) extend(varIndex[r], n > 0 ? n - 1 : 0);
+        }
+
+        ranges.clear();
+        for (size_t v = 0; v < varNames.size(); ++v) {
+            if (seen[v]) ranges.push_back(rangeOf[v]);
+        }
+        std::sort(ranges.begin(), ranges.end(), [](const LiveRange& a, const LiveRange& b) {
+            return a.start != b.start ? a.start < b.start : a.var < b.var;
+        });
+    }
+
+    std::unordered_set<std::string> getLiveIn(int i) const {
+        BitSet live = liveOutAt(i);
+        transfer(program[i], live);
+        return toSet(live);
+    }
+    std::unordered_set<std::string> getLiveOut(int i) const { return toSet(liveOutAt(i)); }
+    const std::vector<LiveRange>& getLiveRanges() const { return ranges; }
+
+    // 死代码消除：删除结果在出口处不活跃的四元式，返回删除的条数。
+    // 块内从出口向前扫描即可连锁删除，跨块的影响通过重新分析直到不动点
+    static int eliminateDeadCode(std::vector<Quadruple>& quads, const std::vector<std::string>& roots) {
+        int removed = 0;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            LivenessAnalyzer analyzer;
+            analyzer.analyze(quads, roots);
+
+            std::vector<bool> dead(quads.size(), false);
+            int numBlocks = analyzer.blockStart.size();
+            for (int b = 0; b < numBlocks; ++b) {
+                int end = (b + 1 < numBlocks) ? analyzer.blockStart[b + 1] : quads.size();
+                BitSet live = analyzer.blockLiveOut[b];
+                for (int i = end - 1; i >= analyzer.blockStart[b]; --i) {
+                    const Quadruple& q = quads[i];
+                    if (definesVariable(q) && !test(live, analyzer.varIndex[q.result])) {
+                        dead[i] = true;
+                        continue;
+                    }
+                    analyzer.transfer(q, live);
+                }
+            }
+
+            std::vector<Quadruple> kept;
+            kept.reserve(quads.size());
+            for (size_t i = 0; i < quads.size(); ++i) {
+                if (dead[i]) {
+                    ++removed;
+                    changed = true;
+                } else {
+                    kept.push_back(std::move(quads[i]));
+                }
+            }
+            quads.swap(kept);
+        }
+        return removed;
+    }
+
+    // 打印活跃区间
+    void printLiveRanges() const {
+        std::cout << "Live Ranges:" << std::endl;
+        for (const auto& r : ranges) {
+            std::cout << r.var << ": [" << r.start << ", " << r.end << "]" << std::endl;
+        }
+    }
+};
+
+// 目标指令：dst 为写入的寄存器（ST 时为内存位置），src1/src2 为寄存器 Rn、立即数 #k、
+// 内存中的程序变量或溢出槽 [sn]；跳转与标签使用 label
+struct TargetInstruction {
+    std::string opcode;
+    std::string dst;
+    std::string src1;
+    std::string src2;
+    std::string label;
+
+    static TargetInstruction make(const std::string& opcode, const std::string& dst,
+                                  const std::string& src1, const std::string& src2 = "") {
+        return {opcode, dst, src1, src2, ""};
+    }
+
+    static TargetInstruction jump(const std::string& opcode, const std::string& label) {
+        return {opcode, "", "", "", label};
+    }
+
+    bool isLabel() const {
+        return opcode == "LABEL";
+    }
+
+    bool isJump() const {
+        return opcode == "JMP" || opcode == "JNE" || opcode == "JEQ";
+    }
+
+    // 是否写寄存器 dst
+    bool writesRegister() const {
+        return opcode == "MOV" || opcode == "LD" || opcode == "NOT" || opcode == "OR" || opcode == "AND";
+    }
+
+    bool reads(const std::string& operand) const {
+        return !operand.empty() && (src1 == operand || src2 == operand);
+    }
+
+    // 输出格式与原先的字符串目标代码一致
+    std::string toString() const {
+        if (opcode == "LABEL") return label + ":";
+        if (isJump()) return opcode + " " + label;
+        if (opcode == "OR" || opcode == "AND") return opcode + " " + src1 + ", " + src2 + ", " + dst;
+        if (opcode == "NOT") return "NOT " + src1 + ", " + dst;
+        if (opcode == "CMP") return "CMP " + src1 + ", " + src2;
+        if (opcode == "ST") return "ST " + src1 + ", " + dst;
+        return opcode + " " + dst + ", " + src1;
+    }
+    // 与 toString 相同的格式，直接写入输出缓冲
+    void appendTo(OutputBuffer& out) const {
+        if (opcode == "LABEL") {
+            out.append(label);
+            out.put(':');
+            return;
+        }
+        out.append(opcode);
+        out.put(' ');
+        if (isJump()) {
+            out.append(label);
+        } else if (opcode == "OR" || opcode == "AND") {
+            out.append(src1);
+            out.append(", ", 2);
+            out.append(src2);
+            out.append(", ", 2);
+            out.append(dst);
+        } else if (opcode == "NOT" || opcode == "ST") {
+            out.append(src1);
+            out.append(", ", 2);
+            out.append(dst);
+        } else if (opcode == "CMP") {
+            out.append(src1);
+            out.append(", ", 2);
+            out.append(src2);
+        } else {
+            out.append(dst);
+            out.append(", ", 2);
+            out.append(src1);
+        }
+    }
+};
+
+// 按 printTargetCode 的格式（"i: 指令"）逐行写入输出缓冲
+void writeTargetCode(const std::vector<TargetInstruction>& code, OutputBuffer& out) {
+    for (size_t i = 0; i < code.size(); ++i) {
+        out.appendNumber(i);
+        out.append(": ", 2);
+        code[i].appendTo(out);
+        out.put('\n');
+    }
+}
+
+// 四元式生成器类
+class QuaternionGenerator {
+private:
+    std::vector<Quadruple> quaternions;  // 存储生成的四元式
     int tempVarCounter = 0;  // 临时变量计数器
     int labelCounter = 0;    // 标签计数器
     int tempVarCount = 0; 
@@ -907,6 +1356,111 @@ private:
         return "t" + std::to_string(++tempVarCounter);
     }
 
+    // 生成新的标签
+    std::string newLabel() {
+        return "L" + std::to_string(++labelCounter);
+    }
+
+    // 短路跳转代码的真出口链与假出口链，记录等待回填目标标签的跳转四元式下标
+    struct JumpLists {
+        std::vector<int> truelist;
+        std::vector<int> falselist;
+    };
+
+    int nextQuad() const {
+        return quaternions.size();
+    }
+
+    static std::vector<int> merge(std::vector<int> a, const std::vector<int>& b) {
+        a.insert(a.end(), b.begin(), b.end());
+        return a;
+    }
+
+    static bool removeFromList(std::vector<int>& list, int index) {
+        auto it = std::find(list.begin(), list.end(), index);
+        if (it == list.end()) return false;
+        list.erase(it);
+        return true;
+    }
+
+    // 回填：为链上所有跳转填入目标标签
+    void backpatch(const std::vector<int>& list, const std::string& label) {
+        for (int i : list) {
+            quaternions[i].result = label;
+        }
+    }
+
+    // 让 onTrue 指定的出口链落到当前位置：
+    // 末尾跳到此处的 j 直接删除；"jnz x; j" 这种组合翻转为 "jz x" 后顺序执行；
+    // 其余跳转放置新标签并回填
+    void fallThrough(JumpLists& e, bool onTrue) {
+        std::vector<int>& target = onTrue ? e.truelist : e.falselist;
+        std::vector<int>& other = onTrue ? e.falselist : e.truelist;
+        int last = nextQuad() - 1;
+        if (last >= 0 && quaternions[last].op == "j") {
+            if (removeFromList(target, last)) {
+                quaternions.pop_back();
+            } else if (last >= 1 && (quaternions[last - 1].op == "jnz" || quaternions[last - 1].op == "jz")
+                       && removeFromList(target, last - 1)) {
+                Quadruple& cond = quaternions[last - 1];
+                cond.op = (cond.op == "jnz") ? "jz" : "jnz";
+                removeFromList(other, last);
+                other.push_back(last - 1);
+                quaternions.pop_back();
+            }
+        }
+        if (!target.empty()) {
+            std::string label = newLabel();
+            addQuaternion("label", "", "", label);
+            backpatch(target, label);
+            target.clear();
+        }
+    }
+
+    // 为条件表达式生成跳转代码，返回其真/假出口链
+    JumpLists genCondition(ASTNode* node) {
+        JumpLists e;
+        if (node->type == "constant") {
+            // 常量直接无条件跳转到对应出口
+            (node->value == "true" ? e.truelist : e.falselist).push_back(nextQuad());
+            addQuaternion("j", "", "", "");
+        }
+        else if (node->type == "variable") {
+            e.truelist.push_back(nextQuad());
+            addQuaternion("jnz", node->value, "", "");
+            e.falselist.push_back(nextQuad());
+            addQuaternion("j", "", "", "");
+        }
+        else if (node->value == "!") {
+            e = genCondition(node->left);
+            std::swap(e.truelist, e.falselist);
+        }
+        else if (node->value == "V") {
+            JumpLists e1 = genCondition(node->left);
+            if (e1.falselist.empty()) {
+                return e1;  // 左操作数恒真，右操作数不会被求值
+            }
+            fallThrough(e1, false);
+            JumpLists e2 = genCondition(node->right);
+            e.truelist = merge(e1.truelist, e2.truelist);
+            e.falselist = e2.falselist;
+        }
+        else if (node->value == "^") {
+            JumpLists e1 = genCondition(node->left);
+            if (e1.truelist.empty()) {
+                return e1;  // 左操作数恒假，右操作数不会被求值
+            }
+            fallThrough(e1, true);
+            JumpLists e2 = genCondition(node->right);
+            e.truelist = e2.truelist;
+            e.falselist = merge(e1.falselist, e2.falselist);
+        }
+        else {
+            throw std::runtime_error("Unknown operator '" + node->value + "'");
+        }
+        return e;
+    }
+
 public:
     // 添加四元式
     bool isEmpty() const {
@@ -965,15 +1519,87 @@ public:
         addQuaternion(op, arg1, arg2, temp);
         return temp;
     }
+
+    // 数值方式生成：按语法树后序遍历，每个运算生成一条四元式
+    // 显式栈上的后序遍历（先左后右，四元式与递归写法相同），服务与批量模式收到极深的树也不会爆栈
+    std::string genExpression(ASTNode* root) {
+        std::vector<std::pair<ASTNode*, bool>> pending = {{root, false}};
+        std::vector<std::string> values;
+        while (!pending.empty()) {
+            auto [node, expanded] = pending.back();
+            pending.pop_back();
+            if (node->type == "constant" || node->type == "variable") {
+                values.push_back(node->value);
+            } else if (!expanded) {
+                pending.push_back({node, true});
+                if (node->value != "!") pending.push_back({node->right, false});
+                pending.push_back({node->left, false});
+            } else if (node->value == "!") {
+                values.back() = genNot(values.back());
+            } else {
+                std::string arg2 = std::move(values.back());
+                values.pop_back();
+                values.back() = genLogicalOp(node->value, values.back(), arg2);
+            }
+        }
+        return values.back();
+    }
+
+    // 控制流方式生成：V/^ 按短路求值翻译为条件跳转，最后在真/假出口处为结果赋值
+    std::string genJumpingCode(ASTNode* root) {
+        JumpLists e = genCondition(root);
+        std::string temp = newTemp();
+        if (e.truelist.empty()) {
+            fallThrough(e, false);
+            addQuaternion("=", "false", "", temp);
+        } else if (e.falselist.empty()) {
+            fallThrough(e, true);
+            addQuaternion("=", "true", "", temp);
+        } else {
+            fallThrough(e, true);
+            addQuaternion("=", "true", "", temp);
+            std::vector<int> exitList = {nextQuad()};
+            addQuaternion("j", "", "", "");
+            fallThrough(e, false);
+            addQuaternion("=", "false", "", temp);
+            std::string exitLabel = newLabel();
+            addQuaternion("label", "", "", exitLabel);
+            backpatch(exitList, exitLabel);
+        }
+        return temp;
+    }
     // 打印所有生成的四元式
     void printQuaternions() const {
-        for (size_t i = 0; i < quaternions.size(); ++i) {
-            std::cout << i << ": " << quaternions[i].toString() << std::endl;
-        }
+        QuadrupleTextWriter writer(std::cout);
+        for (const auto& quad : quaternions) writer.emit(quad);
+        writer.finish("");
+        std::cout.flush();
     }
 
-    std::vector<std::string> generateTargetCode() const {
-        std::vector<std::string> targetCode;
+    const std::vector<Quadruple>& getQuaternions() const {
+        return quaternions;
+    }
+
+    void setQuaternions(std::vector<Quadruple> quads) {
+        quaternions = std::move(quads);
+    }
+
+    // 以表达式结果为根做活跃变量分析
+    LivenessAnalyzer analyzeLiveness(const std::string& resultVar) const {
+        LivenessAnalyzer analyzer;
+        analyzer.analyze(quaternions, {resultVar});
+        return analyzer;
+    }
+
+    // 以表达式结果为根删除死代码，返回删除的四元式条数
+    int eliminateDeadCode(const std::string& resultVar) {
+        return LivenessAnalyzer::eliminateDeadCode(quaternions, {resultVar});
+    }
+
+    // 生成结构化目标指令，registerMapOut 非空时返回变量到寄存器的映射
+    std::vector<TargetInstruction> generateTargetInstructions(std::map<std::string, std::string>* registerMapOut = nullptr) const {
+        ScopedPhase scope(PHASE_CODEGEN);
+        std::vector<TargetInstruction> targetCode;
         std::map<std::string, std::string> registerMap;  // 变量到寄存器的映射
         int registerCounter = 0;  // 寄存器计数器
 
@@ -989,19 +1615,49 @@ public:
         auto loadConstant = [&](const std::string& value) -> std::string {
             std::string reg = "R" + std::to_string(registerCounter++);
             if (value == "true") {
-                targetCode.push_back("MOV " + reg + ", #1");
+                targetCode.push_back(TargetInstruction::make("MOV", reg, "#1"));
             } else if (value == "false") {
-                targetCode.push_back("MOV " + reg + ", #0");
+                targetCode.push_back(TargetInstruction::make("MOV", reg, "#0"));
             } else {
-                targetCode.push_back("MOV " + reg + ", " + value);
+                targetCode.push_back(TargetInstruction::make("MOV", reg, value));
             }
             return reg;
         };
 
         for (const auto& q : quaternions) {
+            // 控制流四元式：结果字段是标签而不是变量
+            if (q.op == "label") {
+                targetCode.push_back(TargetInstruction::jump("LABEL", q.result));
+                continue;
+            }
+            if (q.op == "j") {
+                targetCode.push_back(TargetInstruction::jump("JMP", q.result));
+                continue;
+            }
+            if (q.op == "jnz" || q.op == "jz") {
+                if (q.arg1 == "true" || q.arg1 == "false") {
+                    if ((q.arg1 == "true") == (q.op == "jnz")) {
+                        targetCode.push_back(TargetInstruction::jump("JMP", q.result));
+                    }
+                } else {
+                    targetCode.push_back(TargetInstruction::make("CMP", "", getRegister(q.arg1), "#0"));
+                    targetCode.push_back(TargetInstruction::jump(q.op == "jnz" ? "JNE" : "JEQ", q.result));
+                }
+                continue;
+            }
+
             std::string resultReg = getRegister(q.result);
             
-            if (q.op == "!") {
+            if (q.op == "=") {
+                if (q.arg1 == "true") {
+                    targetCode.push_back(TargetInstruction::make("MOV", resultReg, "#1"));
+                } else if (q.arg1 == "false") {
+                    targetCode.push_back(TargetInstruction::make("MOV", resultReg, "#0"));
+                } else {
+                    targetCode.push_back(TargetInstruction::make("MOV", resultReg, getRegister(q.arg1)));
+                }
+            }
+            else if (q.op == "!") {
                 // 处理NOT操作
                 std::string arg1Reg;
                 if (q.arg1 == "true" || q.arg1 == "false") {
@@ -1009,7 +1665,7 @@ public:
                 } else {
                     arg1Reg = getRegister(q.arg1);
                 }
-                targetCode.push_back("NOT " + arg1Reg + ", " + resultReg);
+                targetCode.push_back(TargetInstruction::make("NOT", resultReg, arg1Reg));
             }
             else if (q.op == "V") {
                 // 处理OR操作
@@ -1027,7 +1683,7 @@ public:
                     arg2Reg = getRegister(q.arg2);
                 }
                 
-                targetCode.push_back("OR " + arg1Reg + ", " + arg2Reg + ", " + resultReg);
+                targetCode.push_back(TargetInstruction::make("OR", resultReg, arg1Reg, arg2Reg));
             }
             else if (q.op == "^") {
                 // 处理AND操作
@@ -1045,38 +1701,909 @@ public:
                     arg2Reg = getRegister(q.arg2);
                 }
                 
-                targetCode.push_back("AND " + arg1Reg + ", " + arg2Reg + ", " + resultReg);
+                targetCode.push_back(TargetInstruction::make("AND", resultReg, arg1Reg, arg2Reg));
             }
         }
 
+        Profiler::count(COUNTER_REGISTERS, registerCounter);
+        if (registerMapOut) {
+            *registerMapOut = registerMap;
+        }
+        return targetCode;
+    }
+
+    std::vector<std::string> generateTargetCode() const {
+        std::vector<std::string> targetCode;
+        for (const auto& instruction : generateTargetInstructions()) {
+            targetCode.push_back(instruction.toString());
+        }
         return targetCode;
     }
 
     // 打印目标代码
     void printTargetCode() const {
-        std::vector<std::string> targetCode = generateTargetCode();
-        std::cout << "Target Code:" << std::endl;
-        for (size_t i = 0; i < targetCode.size(); ++i) {
-            std::cout << i << ": " << targetCode[i] << std::endl;
+        {
+            OutputBuffer out(std::cout);
+            out.append("Target Code:\n");
+            writeTargetCode(generateTargetInstructions(), out);
         }
+        std::cout.flush();
     }
 };
 
+// 分析引擎：LR 按文法的 SLR(1) 表分析；PRATT 是固定布尔表达式语言的算符优先分析，不读文法
+enum ParserEngine {
+    ENGINE_LR,
+    ENGINE_PRATT
+};
 
-bool isLogicalOperator(const std::string& op) {
-    return op == "&&" || op == "||" || op == "!" || op == "V" || op == "^" || op == "-";
-}
-
+// 算符优先（Pratt）分析器：按运算符表的绑定强度（- 前缀最高，^ 高于 V，均左结合）用两个显式栈
+// 构造与 LR 分析相同的语法树，没有递归，也没有单产生式 S->T、T->F 的规约和查表
+class PrattParser {
+private:
+    enum Operator { OP_OR, OP_AND, OP_NOT, OP_LPAREN };
 
-std::string parseAndGenerateQuadruples(const std::vector<std::string>& expression, QuaternionGenerator& generator, int& index) {
-    std::string operand1, operand2, result;
-    std::string currentOp;  // 当前操作符
+    struct OperatorInfo {
+        const char* symbol;  // 语法树结点的值
+        int precedence;      // 绑定强度，括号为 0 不参与规约
+        int arity;
+    };
 
-    while (index < expression.size()) {
-        std::string token = expression[index++];
+    static const OperatorInfo& info(Operator op) {
+        static const OperatorInfo table[] = {{"V", 1, 2}, {"^", 2, 2}, {"!", 3, 1}, {"(", 0, 0}};
+        return table[op];
+    }
 
-        if (token == "(") {
-            operand2 = parseAndGenerateQuadruples(expression, generator, index);
+public:
+    // tokens 可以带也可以不带结束符，出错时抛出 runtime_error
+    static ASTNode* buildTree(const std::vector<Token>& tokens) {
+        ScopedPhase scope(PHASE_PARSE);
+        std::vector<ASTNode*> operands;
+        std::vector<Operator> operators;
+        auto cleanup = [&]() {
+            for (ASTNode* node : operands) delete node;
+        };
+        auto fail = [&](const std::string& message) {
+            cleanup();
+            throw std::runtime_error(message);
+        };
+        auto reduceTop = [&]() {
+            const OperatorInfo& op = info(operators.back());
+            operators.pop_back();
+            ASTNode* node = new ASTNode("operator", op.symbol);
+            if (op.arity == 2) {
+                node->right = operands.back();
+                operands.pop_back();
+            }
+            node->left = operands.back();
+            operands.back() = node;
+        };
+        // 栈顶运算符的绑定强度不低于 precedence 时先规约（左结合）
+        auto reduceWhile = [&](int precedence) {
+            while (!operators.empty() && info(operators.back()).precedence >= precedence &&
+                   operators.back() != OP_LPAREN) {
+                reduceTop();
+            }
+        };
+
+        bool expectOperand = true;
+        for (size_t i = 0;; ++i) {
+            TokenType type = i < tokens.size() ? tokens[i].type : TOK_END;
+            if (expectOperand) {
+                if (type == TOK_NOT) {
+                    operators.push_back(OP_NOT);
+                } else if (type == TOK_LPAREN) {
+                    operators.push_back(OP_LPAREN);
+                } else if (type == TOK_IDENTIFIER) {
+                    operands.push_back(new ASTNode("variable", tokens[i].value));
+                    expectOperand = false;
+                } else if (type == TOK_TRUE || type == TOK_FALSE) {
+                    operands.push_back(new ASTNode("constant", tokens[i].value));
+                    expectOperand = false;
+                } else {
+                    fail(type == TOK_END ? "Unexpected end of input" : "Unexpected token '" + tokens[i].value + "'");
+                }
+            } else if (type == TOK_UNION || type == TOK_OR || type == TOK_INTERSECTION || type == TOK_AND) {
+                Operator op = (type == TOK_UNION || type == TOK_OR) ? OP_OR : OP_AND;
+                reduceWhile(info(op).precedence);
+                operators.push_back(op);
+                expectOperand = true;
+            } else if (type == TOK_RPAREN) {
+                reduceWhile(1);
+                if (operators.empty()) fail("Unmatched ')'");
+                operators.pop_back();
+            } else if (type == TOK_END) {
+                reduceWhile(1);
+                if (!operators.empty()) fail("Unmatched '('");
+                return operands.back();
+            } else {
+                fail("Unexpected token '" + tokens[i].value + "'");
+            }
+        }
+    }
+
+    static bool parse(const std::vector<Token>& tokens) {
+        try {
+            delete buildTree(tokens);
+            return true;
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+    }
+};
+
+// 流式编译的统计：分析栈的最大深度只随括号与取反的嵌套加深，与输入长度无关
+struct StreamCompileStats {
+    size_t tokens = 0;
+    size_t quadruples = 0;
+    size_t maxStackDepth = 0;
+};
+
+// 编译器上下文：拥有文法及由它构造的 FIRST/FOLLOW 集和 SLR(1) 分析表。
+// 构造完成后不再修改，所有成员函数都是 const，分析栈等可变状态只存在于调用方的局部变量中，
+// 因此同一个上下文可以用 shared_ptr<const CompilerContext> 在多个线程间无锁共享
+class CompilerContext {
+private:
+    Grammar grammar;
+    std::unordered_map<std::string, std::unordered_set<std::string>> first;   // 非终结符的 FIRST 集
+    std::unordered_map<std::string, std::unordered_set<std::string>> follow;  // 非终结符的 FOLLOW 集
+    std::unordered_set<std::string> nullable;                                 // 可推导出空串的非终结符
+    CanonicalCollection collection;
+
+    // 分析表按下标稠密存放：action[state * T.size() + t]，goton[state * N.size() + n]（-1 表示无转移）
+    std::unordered_map<std::string, int> terminalIndex;
+    std::unordered_map<std::string, int> nonTerminalIndex;
+    std::vector<ActionItem> action;
+    std::vector<int> goton;
+    int tokenTerminal[TOK_END + 1];  // 每种 token 对应的终结符下标，-1 表示文法中没有
+
+    bool isNonTerminal(const std::string& symbol) const {
+        return nonTerminalIndex.count(symbol) > 0;
+    }
+
+    // 读取文法：第一行非终结符，第二行终结符，之后每行一条产生式，第一条为增广产生式 S'->S。
+    // 右部按已声明的符号做最长匹配切分，因此 true/false 这样的多字符终结符是一个符号
+    void readGrammar(std::istream& source) {
+        ScopedPhase scope(PHASE_GRAMMAR);
+        std::string line, symbol;
+        std::getline(source, line);
+        std::istringstream non_terminal_stream(line);
+        while (std::getline(non_terminal_stream, symbol, ',')) {
+            if (!symbol.empty()) grammar.N.push_back(symbol);
+        }
+        std::getline(source, line);
+        std::istringstream terminal_stream(line);
+        while (std::getline(terminal_stream, symbol, ',')) {
+            if (!symbol.empty()) grammar.T.push_back(symbol);
+        }
+
+        std::vector<std::string> symbols = grammar.N;
+        symbols.insert(symbols.end(), grammar.T.begin(), grammar.T.end());
+        while (std::getline(source, line)) {
+            line.erase(std::remove_if(line.begin(), line.end(), ::isspace), line.end());
+            if (line.empty()) continue;
+            size_t arrow_pos = line.find("->");
+            if (arrow_pos == std::string::npos) continue;
+            Production p;
+            p.left = line.substr(0, arrow_pos);
+            if (std::find(grammar.N.begin(), grammar.N.end(), p.left) == grammar.N.end()) {
+                grammar.N.push_back(p.left);
+                symbols.push_back(p.left);
+            }
+            std::string rhs = line.substr(arrow_pos + 2);
+            for (size_t pos = 0; pos < rhs.size();) {
+                size_t best = 0;
+                for (const auto& s : symbols) {
+                    if (s.size() > best && rhs.compare(pos, s.size(), s) == 0) best = s.size();
+                }
+                if (best == 0) throw std::runtime_error("Unknown grammar symbol in '" + line + "'");
+                p.rights.push_back(rhs.substr(pos, best));
+                pos += best;
+            }
+            grammar.prods.push_back(p);
+        }
+        if (grammar.prods.empty()) throw std::runtime_error("Grammar has no productions");
+
+        // 文法文件没有标识符终结符时，标识符与布尔常量处在相同的语法位置：为每条 X->true 补一条 X->id
+        if (std::find(grammar.T.begin(), grammar.T.end(), "id") == grammar.T.end()) {
+            grammar.T.push_back("id");
+            size_t count = grammar.prods.size();
+            for (size_t i = 0; i < count; ++i) {
+                if (grammar.prods[i].rights == std::vector<std::string>{"true"}) {
+                    grammar.prods.push_back({grammar.prods[i].left, {"id"}});
+                }
+            }
+        }
+        grammar.num = grammar.prods.size();
+    }
+
+    void computeFirstAndFollow() {
+        ScopedPhase scope(PHASE_FIRST_FOLLOW);
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (const auto& p : grammar.prods) {
+                std::unordered_set<std::string>& target = first[p.left];
+                bool allNullable = true;
+                for (const auto& s : p.rights) {
+                    if (isNonTerminal(s)) {
+                        for (const auto& f : first[s]) changed |= target.insert(f).second;
+                        if (!nullable.count(s)) {
+                            allNullable = false;
+                            break;
+                        }
+                    } else {
+                        changed |= target.insert(s).second;
+                        allNullable = false;
+                        break;
+                    }
+                }
+                if (allNullable) changed |= nullable.insert(p.left).second;
+            }
+        }
+
+        follow[grammar.prods[0].left].insert("$");
+        changed = true;
+        while (changed) {
+            changed = false;
+            for (const auto& p : grammar.prods) {
+                // 从右向左扫描，trailer 为当前符号之后的串的 FIRST（若其可空则并入 FOLLOW(左部)）
+                std::unordered_set<std::string> trailer = follow[p.left];
+                for (size_t i = p.rights.size(); i-- > 0;) {
+                    const std::string& s = p.rights[i];
+                    if (isNonTerminal(s)) {
+                        for (const auto& f : trailer) changed |= follow[s].insert(f).second;
+                        if (nullable.count(s)) {
+                            trailer.insert(first[s].begin(), first[s].end());
+                        } else {
+                            trailer = first[s];
+                        }
+                    } else {
+                        trailer = {s};
+                    }
+                }
+            }
+        }
+    }
+
+    void closure(LR0Items& items) const {
+        ScopedPhase scope(PHASE_CLOSURE);
+        size_t i = 0;
+        for (; i < items.items.size(); ++i) {
+            const LR0Item item = items.items[i];
+            if (item.dot_location >= static_cast<int>(item.p.rights.size())) continue;
+            const std::string& next = item.p.rights[item.dot_location];
+            if (!isNonTerminal(next)) continue;
+            for (const auto& prod : grammar.prods) {
+                if (prod.left != next) continue;
+                LR0Item new_item = {prod, 0};
+                if (std::find(items.items.begin(), items.items.end(), new_item) == items.items.end()) {
+                    items.items.push_back(new_item);
+                }
+            }
+        }
+        Profiler::count(COUNTER_CLOSURE_ITERATIONS, i);
+    }
+
+    void go(const LR0Items& items, const std::string& symbol, LR0Items& new_items) const {
+        ScopedPhase scope(PHASE_GOTO);
+        for (const LR0Item& item : items.items) {
+            if (item.dot_location < static_cast<int>(item.p.rights.size()) &&
+                item.p.rights[item.dot_location] == symbol) {
+                new_items.items.push_back({item.p, item.dot_location + 1});
+            }
+        }
+        closure(new_items);
+    }
+
+    // 项目集的键：各项目（产生式编号与点位置）排序后拼接，与项目加入的先后顺序无关
+    std::string getStateKey(const LR0Items& items) const {
+        std::vector<std::pair<int, int>> keys;
+        for (const auto& item : items.items) {
+            int rule = std::find(grammar.prods.begin(), grammar.prods.end(), item.p) - grammar.prods.begin();
+            keys.push_back({rule, item.dot_location});
+        }
+        std::sort(keys.begin(), keys.end());
+        std::string key;
+        for (const auto& k : keys) key += std::to_string(k.first) + "." + std::to_string(k.second) + ";";
+        return key;
+    }
+
+    // 构造 LR(0) 项目集规范族，同时填充移进与 Goto；规约只在 FOLLOW(左部) 上进行（SLR(1)）
+    void buildTables() {
+        for (size_t i = 0; i < grammar.T.size(); ++i) terminalIndex[grammar.T[i]] = i;
+        terminalIndex["$"] = grammar.T.size();
+        const size_t numTerminals = grammar.T.size() + 1;
+        const size_t numNonTerminals = grammar.N.size();
+
+        std::vector<std::vector<std::pair<std::string, int>>> transitions;
+        {
+            ScopedPhase scope(PHASE_COLLECTION);
+            std::unordered_map<std::string, int> visited;
+            LR0Items I0;
+            I0.items.push_back({grammar.prods[0], 0});
+            closure(I0);
+            visited[getStateKey(I0)] = 0;
+            collection.items.push_back(I0);
+
+            std::vector<std::string> symbols = grammar.T;
+            symbols.insert(symbols.end(), grammar.N.begin(), grammar.N.end());
+            for (size_t state = 0; state < collection.items.size(); ++state) {
+                transitions.emplace_back();
+                for (const auto& symbol : symbols) {
+                    LR0Items newState;
+                    go(collection.items[state], symbol, newState);
+                    if (newState.items.empty()) continue;
+                    std::string key = getStateKey(newState);
+                    auto it = visited.find(key);
+                    int target;
+                    if (it == visited.end()) {
+                        target = collection.items.size();
+                        visited[key] = target;
+                        collection.items.push_back(newState);
+                    } else {
+                        target = it->second;
+                    }
+                    transitions[state].push_back({symbol, target});
+                }
+            }
+        }
+
+        const size_t numStates = collection.items.size();
+        Profiler::count(COUNTER_STATES, numStates);
+        for (const auto& state : collection.items) Profiler::count(COUNTER_ITEMS, state.items.size());
+        ScopedPhase scope(PHASE_TABLE);
+        action.assign(numStates * numTerminals, ActionItem{ERROR, 0});
+        goton.assign(numStates * numNonTerminals, -1);
+        auto setAction = [&](size_t state, const std::string& terminal, ActionItem item) {
+            ActionItem& cell = action[state * numTerminals + terminalIndex.at(terminal)];
+            if (cell.actionType != ERROR && (cell.actionType != item.actionType || cell.stateOrRule != item.stateOrRule)) {
+                throw std::runtime_error("Grammar is not SLR(1): conflict in state " + std::to_string(state) +
+                                         " on '" + terminal + "'");
+            }
+            cell = item;
+        };
+        for (size_t state = 0; state < numStates; ++state) {
+            for (const auto& t : transitions[state]) {
+                if (isNonTerminal(t.first)) {
+                    goton[state * numNonTerminals + nonTerminalIndex.at(t.first)] = t.second;
+                } else {
+                    setAction(state, t.first, {SHIFT, t.second});
+                }
+            }
+            for (const auto& item : collection.items[state].items) {
+                if (item.dot_location != static_cast<int>(item.p.rights.size())) continue;
+                int rule = std::find(grammar.prods.begin(), grammar.prods.end(), item.p) - grammar.prods.begin();
+                if (rule == 0) {
+                    setAction(state, "$", {ACCEPT, 0});
+                    continue;
+                }
+                for (const auto& terminal : follow.at(item.p.left)) setAction(state, terminal, {REDUCE, rule});
+            }
+        }
+    }
+
+    // 单符号右部直接传递子节点（终结符在移进时已建成叶子），-F 为取反，(S) 为括号，其余三符号右部为二元运算
+    static ASTNode* reduceNode(const Production& rule, std::vector<ASTNode*>& children) {
+        const std::vector<std::string>& r = rule.rights;
+        if (r.size() == 1) return children[0];
+        if (r.size() == 2 && r[0] == "-") {
+            ASTNode* node = new ASTNode("operator", "!");
+            node->left = children[1];
+            return node;
+        }
+        if (r.size() == 3 && r[0] == "(" && r[2] == ")") return children[1];
+        if (r.size() == 3) {
+            ASTNode* node = new ASTNode("operator", r[1]);
+            node->left = children[0];
+            node->right = children[2];
+            return node;
+        }
+        throw std::runtime_error("No semantic action for production " + rule.left);
+    }
+
+public:
+    CompilerContext(const CompilerContext&) = delete;
+    CompilerContext& operator=(const CompilerContext&) = delete;
+
+    explicit CompilerContext(std::istream& grammarSource) {
+        readGrammar(grammarSource);
+        for (size_t i = 0; i < grammar.N.size(); ++i) nonTerminalIndex[grammar.N[i]] = i;
+        computeFirstAndFollow();
+        buildTables();
+
+        static const char* const tokenSymbols[TOK_END + 1] = {"id", "true", "false", "V", "^", "V", "^",
+                                                               "(",  ")",    "-",     "",  "$"};
+        for (int type = 0; type <= TOK_END; ++type) {
+            auto it = terminalIndex.find(tokenSymbols[type]);
+            tokenTerminal[type] = it == terminalIndex.end() ? -1 : it->second;
+        }
+    }
+
+    static std::shared_ptr<const CompilerContext> fromFile(const std::string& path) {
+        std::ifstream source(path);
+        if (!source.is_open()) throw std::runtime_error("Cannot open grammar file " + path);
+        return std::make_shared<const CompilerContext>(source);
+    }
+
+    const Grammar& getGrammar() const {
+        return grammar;
+    }
+
+    // 文法的指纹（非终结符、终结符与产生式的 FNV-1a 散列），用来区分按不同文法得到的编译产物
+    uint64_t grammarHash() const {
+        uint64_t hash = 1469598103934665603ULL;
+        auto mix = [&](const std::string& s) {
+            for (unsigned char c : s) {
+                hash ^= c;
+                hash *= 1099511628211ULL;
+            }
+            hash ^= 0xFF;  // 分隔符，使 "ab","c" 与 "a","bc" 不同
+            hash *= 1099511628211ULL;
+        };
+        for (const auto& symbol : grammar.N) mix(symbol);
+        mix("|");
+        for (const auto& symbol : grammar.T) mix(symbol);
+        for (const auto& production : grammar.prods) {
+            mix("|" + production.left);
+            for (const auto& symbol : production.rights) mix(symbol);
+        }
+        return hash;
+    }
+
+    const CanonicalCollection& getCollection() const {
+        return collection;
+    }
+
+    // 供自行驱动分析表的分析器（如增量分析）查询：token 对应的终结符（-1 表示没有）、
+    // 非终结符下标、ACTION 与 GOTO 表项（-1 表示无转移）
+    int terminalOf(TokenType type) const {
+        return tokenTerminal[type];
+    }
+
+    int nonTerminalOf(const std::string& symbol) const {
+        auto it = nonTerminalIndex.find(symbol);
+        return it == nonTerminalIndex.end() ? -1 : it->second;
+    }
+
+    ActionItem actionAt(int state, int terminal) const {
+        return terminal < 0 ? ActionItem{ERROR, 0} : action[state * (grammar.T.size() + 1) + terminal];
+    }
+
+    int gotoAt(int state, int nonTerminal) const {
+        return goton[state * grammar.N.size() + nonTerminal];
+    }
+
+    // 词法分析整段文本，末尾不含结束符
+    static std::vector<Token> tokenize(const std::string& text) {
+        ScopedPhase scope(PHASE_LEX);
+        std::istringstream stream(text);
+        std::vector<Token> tokens;
+        Token token;
+        while ((token = get_next_token(stream)).type != TOK_END) tokens.push_back(token);
+        Profiler::count(COUNTER_TOKENS, tokens.size());
+        return tokens;
+    }
+
+    // 表驱动 LR 分析并在规约时构造语法树；tokens 可以带也可以不带结束符 $。
+    // trace 非空时逐步输出移进/规约动作，出错时抛出 runtime_error
+    ASTNode* buildTree(const std::vector<Token>& tokens, std::ostream* trace = nullptr) const {
+        ScopedPhase scope(PHASE_PARSE);
+        const size_t numTerminals = grammar.T.size() + 1;
+        const size_t numNonTerminals = grammar.N.size();
+        std::vector<int> stateStack = {0};
+        std::vector<ASTNode*> valueStack;
+        auto cleanup = [&]() {
+            for (ASTNode* node : valueStack) delete node;
+        };
+
+        size_t inputIndex = 0;
+        while (true) {
+            bool atEnd = inputIndex >= tokens.size() || tokens[inputIndex].type == TOK_END;
+            const Token& token = atEnd ? Token{TOK_END, "$"} : tokens[inputIndex];
+            int terminal = tokenTerminal[token.type];
+            int currentState = stateStack.back();
+            ActionItem item = terminal < 0 ? ActionItem{ERROR, 0} : action[currentState * numTerminals + terminal];
+
+            if (item.actionType == SHIFT) {
+                stateStack.push_back(item.stateOrRule);
+                if (token.type == TOK_IDENTIFIER) {
+                    valueStack.push_back(new ASTNode("variable", token.value));
+                } else if (token.type == TOK_TRUE || token.type == TOK_FALSE) {
+                    valueStack.push_back(new ASTNode("constant", token.value));
+                } else {
+                    valueStack.push_back(nullptr);
+                }
+                ++inputIndex;
+                if (trace) *trace << "SHIFT to state " << item.stateOrRule << std::endl;
+            } else if (item.actionType == REDUCE) {
+                const Production& rule = grammar.prods[item.stateOrRule];
+                size_t length = rule.rights.size();
+                std::vector<ASTNode*> children(valueStack.end() - length, valueStack.end());
+                valueStack.resize(valueStack.size() - length);
+                stateStack.resize(stateStack.size() - length);
+                ASTNode* node = nullptr;
+                try {
+                    node = length == 0 ? nullptr : reduceNode(rule, children);
+                } catch (...) {
+                    for (ASTNode* child : children) delete child;
+                    cleanup();
+                    throw;
+                }
+                valueStack.push_back(node);
+                stateStack.push_back(goton[stateStack.back() * numNonTerminals + nonTerminalIndex.at(rule.left)]);
+                if (trace) {
+                    *trace << "REDUCE by rule " << item.stateOrRule << " (" << rule.left << " -> ";
+                    for (const auto& s : rule.rights) *trace << s;
+                    *trace << ")" << std::endl;
+                }
+            } else if (item.actionType == ACCEPT) {
+                if (trace) *trace << "Input parsed successfully!" << std::endl;
+                return valueStack.back();
+            } else {
+                cleanup();
+                throw std::runtime_error("No action found for state " + std::to_string(currentState) + " and input " +
+                                         (atEnd ? std::string("$") : token.value));
+            }
+        }
+    }
+
+    // 流式编译：每次从 source 拉取一个 token 驱动 LR 分析，规约时直接把四元式交给 sink，
+    // 分析栈上只保存操作数名，token 序列和语法树都不保存。产生式的语义与 reduceNode 相同，
+    // 临时变量的编号与 QuaternionGenerator::genExpression 一致。返回结果变量，出错时抛出 runtime_error
+    std::string compileStream(std::istream& source, QuadrupleSink& sink, StreamCompileStats* stats = nullptr) const {
+        return compileTokenStream([&]() { return get_next_token(source); }, sink, stats);
+    }
+
+    // 同上，token 取自已经词法分析好的区间 [first, last)
+    std::string compileStream(const Token* first, const Token* last, QuadrupleSink& sink,
+                              StreamCompileStats* stats = nullptr) const {
+        return compileTokenStream([&]() { return first < last ? *first++ : create_token(TOK_END, '\0'); }, sink, stats);
+    }
+
+private:
+    // nextToken() 依次返回 token，结束时返回 TOK_END
+    template <typename NextToken>
+    std::string compileTokenStream(NextToken nextToken, QuadrupleSink& sink, StreamCompileStats* stats) const {
+        ScopedPhase scope(PHASE_PARSE);
+        const size_t numTerminals = grammar.T.size() + 1;
+        const size_t numNonTerminals = grammar.N.size();
+        struct Entry {
+            int state;
+            std::string value;  // 操作数：变量名、常量或临时变量，运算符等 token 为空
+        };
+        std::vector<Entry> stack = {{0, ""}};
+        StreamCompileStats local;
+        long long temps = 0;
+        Token token = nextToken();
+        while (true) {
+            int terminal = tokenTerminal[token.type];
+            int currentState = stack.back().state;
+            ActionItem item = terminal < 0 ? ActionItem{ERROR, 0} : action[currentState * numTerminals + terminal];
+
+            if (item.actionType == SHIFT) {
+                bool operand = token.type == TOK_IDENTIFIER || token.type == TOK_TRUE || token.type == TOK_FALSE;
+                stack.push_back({item.stateOrRule, operand ? std::move(token.value) : std::string()});
+                ++local.tokens;
+                local.maxStackDepth = std::max(local.maxStackDepth, stack.size());
+                token = nextToken();
+            } else if (item.actionType == REDUCE) {
+                const Production& rule = grammar.prods[item.stateOrRule];
+                const std::vector<std::string>& r = rule.rights;
+                size_t base = stack.size() - r.size();
+                std::string value;
+                if (r.size() == 1) {
+                    value = std::move(stack[base].value);
+                } else if (r.size() == 2 && r[0] == "-") {
+                    value = "t" + std::to_string(++temps);
+                    sink.emit(Quadruple("!", stack[base + 1].value, "", value));
+                } else if (r.size() == 3 && r[0] == "(" && r[2] == ")") {
+                    value = std::move(stack[base + 1].value);
+                } else if (r.size() == 3) {
+                    value = "t" + std::to_string(++temps);
+                    sink.emit(Quadruple(r[1], stack[base].value, stack[base + 2].value, value));
+                } else if (!r.empty()) {
+                    throw std::runtime_error("No semantic action for production " + rule.left);
+                }
+                stack.resize(base);
+                stack.push_back({goton[stack.back().state * numNonTerminals + nonTerminalIndex.at(rule.left)],
+                                 std::move(value)});
+            } else if (item.actionType == ACCEPT) {
+                // 四元式在规约时生成，IR 的耗时计入 PHASE_PARSE，条数与建树再生成的路径一样计入 COUNTER_QUADS
+                local.quadruples = temps;
+                Profiler::count(COUNTER_QUADS, temps);
+                if (stats) *stats = local;
+                sink.finish(stack.back().value);
+                return stack.back().value;
+            } else {
+                throw std::runtime_error("No action found for state " + std::to_string(currentState) + " and input " +
+                                         (token.type == TOK_END ? std::string("$") : token.value));
+            }
+        }
+    }
+
+public:
+    // 按指定引擎构造语法树；PRATT 只适用于内置的布尔表达式语言，与文法文件无关
+    ASTNode* buildTree(const std::vector<Token>& tokens, ParserEngine engine) const {
+        return engine == ENGINE_PRATT ? PrattParser::buildTree(tokens) : buildTree(tokens);
+    }
+
+    // 只做语法检查
+    bool parse(const std::vector<Token>& tokens, std::ostream* trace = nullptr) const {
+        try {
+            delete buildTree(tokens, trace);
+            return true;
+        } catch (const std::runtime_error& e) {
+            if (trace) *trace << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    // 词法分析、语法分析并用调用方的生成器生成数值四元式，返回结果变量
+    std::string compile(const std::string& text, QuaternionGenerator& generator) const {
+        std::unique_ptr<ASTNode> tree(buildTree(tokenize(text)));
+        ScopedPhase scope(PHASE_IR);
+        size_t before = generator.getQuaternions().size();
+        std::string result = generator.genExpression(tree.get());
+        Profiler::count(COUNTER_QUADS, generator.getQuaternions().size() - before);
+        return result;
+    }
+};
+
+// 寄存器分配统计
+struct RegisterAllocationStats {
+    int physicalRegisters = 0;  // 物理寄存器总数（含两个临时寄存器）
+    int intervals = 0;          // 活跃区间数
+    int spilledIntervals = 0;   // 被溢出到内存的区间数
+    int spillStores = 0;        // 溢出写回内存的指令数
+    int spillLoads = 0;         // 从溢出槽重新装入的指令数
+    int variableLoads = 0;      // 从内存装入程序变量的指令数
+    int maxPressure = 0;        // 同时活跃的区间数峰值
+};
+
+// 线性扫描寄存器分配：在有限寄存器上按活跃区间分配，寄存器在区间结束后复用，
+// 压力过大时溢出结束最晚的区间；常量直接作为立即数，最后两个寄存器留作装入溢出值的临时寄存器
+class LinearScanAllocator {
+private:
+    struct Interval {
+        std::string var;
+        int start;
+        int end;
+        bool isInput;   // 程序变量：位于内存，首次使用前装入
+        int reg = -1;   // 分配的寄存器，-1 表示溢出
+        int slot = -1;  // 溢出槽编号（仅临时变量需要）
+    };
+
+    int numRegisters;
+    std::vector<Interval> intervals;
+    std::unordered_map<std::string, int> intervalOf;
+    RegisterAllocationStats stats;
+
+    static std::string reg(int r) {
+        return "R" + std::to_string(r);
+    }
+
+    static std::string slotName(int slot) {
+        return "[s" + std::to_string(slot) + "]";
+    }
+
+    void allocate(const std::vector<Quadruple>& quads, const std::vector<std::string>& roots) {
+        ScopedPhase scope(PHASE_REGALLOC);
+        int spilledBefore = stats.spilledIntervals;
+        LivenessAnalyzer analyzer;
+        analyzer.analyze(quads, roots);
+
+        // 直线代码中程序变量的区间从第一次使用开始，避免过早占用寄存器；
+        // 含跳转时第一次使用可能被跳过，改为在入口装入
+        bool hasJumps = std::any_of(quads.begin(), quads.end(), [](const Quadruple& q) {
+            return q.op == "j" || q.op == "jnz" || q.op == "jz";
+        });
+        std::unordered_map<std::string, int> firstDef;
+        for (int i = 0; i < static_cast<int>(quads.size()); ++i) {
+            if (LivenessAnalyzer::definesVariable(quads[i]) && !firstDef.count(quads[i].result)) {
+                firstDef[quads[i].result] = i;
+            }
+        }
+        for (const auto& r : analyzer.getLiveRanges()) {
+            Interval interval;
+            interval.var = r.var;
+            interval.isInput = !firstDef.count(r.var);
+            interval.start = interval.isInput ? std::max(r.start, 0) : r.start;
+            interval.end = r.end;
+            if (interval.isInput && !hasJumps) {
+                for (int i = 0; i < static_cast<int>(quads.size()); ++i) {
+                    if (quads[i].arg1 == r.var || quads[i].arg2 == r.var) {
+                        interval.start = i;
+                        break;
+                    }
+                }
+            }
+            intervals.push_back(interval);
+        }
+        std::sort(intervals.begin(), intervals.end(), [](const Interval& a, const Interval& b) {
+            return a.start != b.start ? a.start < b.start : a.end < b.end;
+        });
+
+        int allocatable = numRegisters - 2;
+        std::vector<int> freeRegs;
+        for (int r = allocatable - 1; r >= 0; --r) freeRegs.push_back(r);
+        std::vector<int> active;  // 按结束位置递增排列的已分配区间
+        int nextSlot = 0;
+
+        for (int idx = 0; idx < static_cast<int>(intervals.size()); ++idx) {
+            Interval& cur = intervals[idx];
+            // 释放已结束的区间：在同一条指令先读后写，因此以定义开始的区间可以复用此处结束的寄存器；
+            // 程序变量在指令前装入，只能复用更早结束的寄存器
+            while (!active.empty()) {
+                const Interval& first = intervals[active.front()];
+                bool expired = cur.isInput ? first.end < cur.start : first.end <= cur.start;
+                if (!expired) break;
+                freeRegs.push_back(first.reg);
+                active.erase(active.begin());
+            }
+
+            auto insertActive = [&](int i) {
+                auto pos = std::upper_bound(active.begin(), active.end(), i, [&](int a, int b) {
+                    return intervals[a].end < intervals[b].end;
+                });
+                active.insert(pos, i);
+            };
+
+            if (!freeRegs.empty()) {
+                cur.reg = freeRegs.back();
+                freeRegs.pop_back();
+                insertActive(idx);
+            } else {
+                // 溢出结束最晚的区间
+                int victim = active.back();
+                if (intervals[victim].end > cur.end) {
+                    cur.reg = intervals[victim].reg;
+                    intervals[victim].reg = -1;
+                    active.pop_back();
+                    insertActive(idx);
+                } else {
+                    victim = idx;
+                }
+                Interval& spilled = intervals[victim];
+                if (!spilled.isInput) spilled.slot = nextSlot++;
+                ++stats.spilledIntervals;
+            }
+            stats.maxPressure = std::max(stats.maxPressure, static_cast<int>(active.size()) + (cur.reg == -1 ? 1 : 0));
+        }
+        for (int i = 0; i < static_cast<int>(intervals.size()); ++i) {
+            intervalOf[intervals[i].var] = i;
+        }
+        stats.intervals = intervals.size();
+        Profiler::count(COUNTER_SPILLS, stats.spilledIntervals - spilledBefore);
+    }
+
+public:
+    explicit LinearScanAllocator(int numRegisters) : numRegisters(numRegisters) {
+        if (numRegisters < 3) {
+            throw std::runtime_error("Register allocation needs at least 3 registers");
+        }
+        stats.physicalRegisters = numRegisters;
+    }
+
+    // 为四元式分配寄存器并生成目标代码，roots 为出口处需要保留的结果
+    std::vector<TargetInstruction> generate(const std::vector<Quadruple>& quads, const std::vector<std::string>& roots) {
+        allocate(quads, roots);
+        std::vector<TargetInstruction> code;
+        int scratch[2] = {numRegisters - 2, numRegisters - 1};
+
+        // 读取操作数：常量为立即数，溢出的值装入第 k 个临时寄存器
+        auto operand = [&](const std::string& arg, int k) -> std::string {
+            if (arg == "true") return "#1";
+            if (arg == "false") return "#0";
+            const Interval& interval = intervals[intervalOf.at(arg)];
+            if (interval.reg >= 0) return reg(interval.reg);
+            if (interval.isInput) {
+                code.push_back(TargetInstruction::make("LD", reg(scratch[k]), arg));
+                ++stats.variableLoads;
+            } else {
+                code.push_back(TargetInstruction::make("LD", reg(scratch[k]), slotName(interval.slot)));
+                ++stats.spillLoads;
+            }
+            return reg(scratch[k]);
+        };
+        // 写结果：溢出的结果先写入临时寄存器，指令之后存回溢出槽
+        auto destination = [&](const std::string& var) -> std::string {
+            const Interval& interval = intervals[intervalOf.at(var)];
+            return reg(interval.reg >= 0 ? interval.reg : scratch[0]);
+        };
+        auto storeIfSpilled = [&](const std::string& var) {
+            const Interval& interval = intervals[intervalOf.at(var)];
+            if (interval.reg < 0) {
+                code.push_back(TargetInstruction::make("ST", slotName(interval.slot), reg(scratch[0])));
+                ++stats.spillStores;
+            }
+        };
+
+        size_t nextInterval = 0;
+        for (int i = 0; i < static_cast<int>(quads.size()); ++i) {
+            const Quadruple& q = quads[i];
+            // 分配到寄存器的程序变量在第一次使用前装入
+            while (nextInterval < intervals.size() && intervals[nextInterval].start <= i) {
+                const Interval& interval = intervals[nextInterval++];
+                if (interval.isInput && interval.reg >= 0) {
+                    code.push_back(TargetInstruction::make("LD", reg(interval.reg), interval.var));
+                    ++stats.variableLoads;
+                }
+            }
+
+            if (q.op == "label") {
+                code.push_back(TargetInstruction::jump("LABEL", q.result));
+            } else if (q.op == "j") {
+                code.push_back(TargetInstruction::jump("JMP", q.result));
+            } else if (q.op == "jnz" || q.op == "jz") {
+                if (q.arg1 == "true" || q.arg1 == "false") {
+                    if ((q.arg1 == "true") == (q.op == "jnz")) code.push_back(TargetInstruction::jump("JMP", q.result));
+                } else {
+                    code.push_back(TargetInstruction::make("CMP", "", operand(q.arg1, 0), "#0"));
+                    code.push_back(TargetInstruction::jump(q.op == "jnz" ? "JNE" : "JEQ", q.result));
+                }
+            } else if (q.op == "=") {
+                std::string src = operand(q.arg1, 0);
+                code.push_back(TargetInstruction::make("MOV", destination(q.result), src));
+                storeIfSpilled(q.result);
+            } else if (q.op == "!") {
+                if (q.arg1 == "true" || q.arg1 == "false") {
+                    code.push_back(TargetInstruction::make("MOV", destination(q.result), q.arg1 == "true" ? "#0" : "#1"));
+                } else {
+                    std::string src = operand(q.arg1, 0);
+                    code.push_back(TargetInstruction::make("NOT", destination(q.result), src));
+                }
+                storeIfSpilled(q.result);
+            } else if (q.op == "V" || q.op == "^") {
+                std::string src1 = operand(q.arg1, 0);
+                std::string src2 = operand(q.arg2, 1);
+                code.push_back(TargetInstruction::make(q.op == "V" ? "OR" : "AND", destination(q.result), src1, src2));
+                storeIfSpilled(q.result);
+            }
+        }
+        // 只在出口处活跃的程序变量（例如结果就是一个变量）在末尾装入
+        for (; nextInterval < intervals.size(); ++nextInterval) {
+            const Interval& interval = intervals[nextInterval];
+            if (interval.isInput && interval.reg >= 0) {
+                code.push_back(TargetInstruction::make("LD", reg(interval.reg), interval.var));
+                ++stats.variableLoads;
+            }
+        }
+        return code;
+    }
+
+    // 变量所在位置（寄存器、溢出槽或内存中的程序变量）
+    std::string locationOf(const std::string& var) const {
+        if (var == "true") return "#1";
+        if (var == "false") return "#0";
+        auto it = intervalOf.find(var);
+        if (it == intervalOf.end()) return var;
+        const Interval& interval = intervals[it->second];
+        if (interval.reg >= 0) return reg(interval.reg);
+        return interval.isInput ? var : slotName(interval.slot);
+    }
+
+    const RegisterAllocationStats& getStats() const {
+        return stats;
+    }
+};
+
+
+
+bool isLogicalOperator(const std::string& op) {
+    return op == "&&" || op == "||" || op == "!" || op == "V" || op == "^" || op == "-";
+}
+
+
+std::string parseAndGenerateQuadruples(const std::vector<std::string>& expression, QuaternionGenerator& generator, int& index) {
+    std::string operand1, operand2, result;
+    std::string currentOp;  // 当前操作符
+
+    while (index < expression.size()) {
+        std::string token = expression[index++];
+
+        if (token == "(") {
+            operand2 = parseAndGenerateQuadruples(expression, generator, index);
             if (!currentOp.empty() && !operand1.empty()) {
                 result = generator.genLogicalOp(currentOp, operand1, operand2);
                 operand1 = result;
@@ -1217,47 +2744,7517 @@ std::string optimization(const std::vector<std::string>& expression, QuaternionG
 }
 
 
+// ================= 优化遍管理器 =================
 
-// 显示菜单
-void display_menu() {
-    std::cout << "选择功能：" << std::endl;
-    std::cout << "1. 词法分析" << std::endl;
-    std::cout << "2. 语法分析" << std::endl;
-    std::cout << "3. 语义分析" << std::endl;
-    std::cout << "4. 中间代码生成" << std::endl;
-    std::cout << "5. 中间代码优化" << std::endl;
-    std::cout << "6. 目标代码生成" << std::endl;
-    std::cout << "0. 退出" << std::endl;
+// 统计每个变量被定义的次数（只对单次定义的临时变量做替换）
+std::unordered_map<std::string, int> countDefinitions(const std::vector<Quadruple>& quads) {
+    std::unordered_map<std::string, int> defCount;
+    for (const auto& q : quads) {
+        if (LivenessAnalyzer::definesVariable(q)) {
+            ++defCount[q.result];
+        }
+    }
+    return defCount;
 }
 
-int main() {
-    // 打开源文件用于词法分析
-    std::ifstream source("source.txt");
-    if (!source.is_open()) {
-        std::cerr << "无法打开源文件！" << std::endl;
-        return 1;
-    }
+// 按替换表改写操作数
+std::string resolveOperand(const std::unordered_map<std::string, std::string>& replace, const std::string& arg) {
+    auto it = replace.find(arg);
+    return it == replace.end() ? arg : it->second;
+}
 
-    std::ifstream input("input.txt"); // 打开语法文件
-    if (!input.is_open()) {
-        std::cerr << "无法打开语法文件！" << std::endl;
-        return 1;
+void resolveRoots(const std::unordered_map<std::string, std::string>& replace, std::vector<std::string>& roots) {
+    for (auto& r : roots) {
+        r = resolveOperand(replace, r);
     }
+}
 
-    std::vector<Token> inputTokens;
-    Token token;
-    while ((token = get_next_token(source)).type != TOK_END) {
-        inputTokens.push_back(token);
-    }
-    QuaternionGenerator generator;
-    std::vector<std::string> inputs;
+// 优化遍基类：run 返回是否修改了四元式，roots 为需要保留的结果变量
+class OptimizationPass {
+public:
+    virtual ~OptimizationPass() {}
+    virtual std::string name() const = 0;
+    virtual bool run(std::vector<Quadruple>& quads, std::vector<std::string>& roots) = 0;
+};
 
-    for (int i=0 ; i<inputTokens.size();++i) {
-        inputs.push_back(inputTokens[i].value);
-    }
-    int choice;
-    while (true) {
-        display_menu();
+// 常量折叠与代数化简：x V true = true, x ^ true = x, --x = x, x V -x = true 等
+class ConstantFoldingPass : public OptimizationPass {
+public:
+    std::string name() const override { return "fold"; }
+
+    bool run(std::vector<Quadruple>& quads, std::vector<std::string>& roots) override {
+        std::unordered_map<std::string, int> defCount = countDefinitions(quads);
+        std::unordered_map<std::string, std::string> replace;
+        std::unordered_map<std::string, std::string> notOf;  // t = !x 中 t 到 x 的映射
+        std::vector<Quadruple> kept;
+        kept.reserve(quads.size());
+        bool changed = false;
+
+        for (Quadruple q : quads) {
+            q.arg1 = resolveOperand(replace, q.arg1);
+            q.arg2 = resolveOperand(replace, q.arg2);
+
+            // 条件为常量的跳转变为无条件跳转或直接删除
+            if ((q.op == "jnz" || q.op == "jz") && (q.arg1 == "true" || q.arg1 == "false")) {
+                changed = true;
+                if ((q.arg1 == "true") == (q.op == "jnz")) {
+                    kept.emplace_back("j", "", "", q.result);
+                }
+                continue;
+            }
+
+            if (LivenessAnalyzer::definesVariable(q) && defCount[q.result] == 1) {
+                std::string value;
+                if (fold(q, notOf, value)) {
+                    replace[q.result] = value;
+                    changed = true;
+                    continue;
+                }
+                if (q.op == "!") {
+                    notOf[q.result] = q.arg1;
+                }
+            }
+            kept.push_back(q);
+        }
+
+        resolveRoots(replace, roots);
+        quads.swap(kept);
+        return changed;
+    }
+
+private:
+    static bool isNegation(const std::unordered_map<std::string, std::string>& notOf,
+                           const std::string& a, const std::string& b) {
+        auto it = notOf.find(a);
+        if (it != notOf.end() && it->second == b) return true;
+        it = notOf.find(b);
+        return it != notOf.end() && it->second == a;
+    }
+
+    // 能化简时返回 true，并在 value 中给出结果（常量或已有变量）
+    static bool fold(const Quadruple& q, const std::unordered_map<std::string, std::string>& notOf, std::string& value) {
+        if (q.op == "!") {
+            if (q.arg1 == "true") { value = "false"; return true; }
+            if (q.arg1 == "false") { value = "true"; return true; }
+            auto it = notOf.find(q.arg1);
+            if (it != notOf.end()) { value = it->second; return true; }
+            return false;
+        }
+        if (q.op == "V" || q.op == "^") {
+            // V 的吸收元为 true、单位元为 false；^ 相反
+            std::string absorbing = (q.op == "V") ? "true" : "false";
+            std::string identity = (q.op == "V") ? "false" : "true";
+            if (q.arg1 == absorbing || q.arg2 == absorbing) { value = absorbing; return true; }
+            if (q.arg1 == identity) { value = q.arg2; return true; }
+            if (q.arg2 == identity) { value = q.arg1; return true; }
+            if (q.arg1 == q.arg2) { value = q.arg1; return true; }
+            if (isNegation(notOf, q.arg1, q.arg2)) { value = absorbing; return true; }
+        }
+        return false;
+    }
+};
+
+// 复写传播：t = x 且 t 只定义一次时，用 x 替换 t 的所有使用
+class CopyPropagationPass : public OptimizationPass {
+public:
+    std::string name() const override { return "copy"; }
+
+    bool run(std::vector<Quadruple>& quads, std::vector<std::string>& roots) override {
+        std::unordered_map<std::string, int> defCount = countDefinitions(quads);
+        std::unordered_map<std::string, std::string> replace;
+        std::vector<Quadruple> kept;
+        kept.reserve(quads.size());
+        bool changed = false;
+
+        for (Quadruple q : quads) {
+            q.arg1 = resolveOperand(replace, q.arg1);
+            q.arg2 = resolveOperand(replace, q.arg2);
+            if (q.op == "=" && defCount[q.result] == 1) {
+                replace[q.result] = q.arg1;
+                changed = true;
+                continue;
+            }
+            kept.push_back(q);
+        }
+
+        resolveRoots(replace, roots);
+        quads.swap(kept);
+        return changed;
+    }
+};
+
+// 公共子表达式消除：基本块内按 (op, arg1, arg2) 做值编号，V/^ 满足交换律
+class CommonSubexpressionPass : public OptimizationPass {
+public:
+    std::string name() const override { return "cse"; }
+
+    bool run(std::vector<Quadruple>& quads, std::vector<std::string>& roots) override {
+        std::unordered_map<std::string, int> defCount = countDefinitions(quads);
+        std::unordered_map<std::string, std::string> replace;
+        std::unordered_map<std::string, std::string> available;  // 表达式到已有结果的映射
+        std::vector<Quadruple> kept;
+        kept.reserve(quads.size());
+        bool changed = false;
+
+        for (Quadruple q : quads) {
+            q.arg1 = resolveOperand(replace, q.arg1);
+            q.arg2 = resolveOperand(replace, q.arg2);
+
+            if (!LivenessAnalyzer::definesVariable(q)) {
+                if (q.op == "label") {
+                    available.clear();  // 进入新的基本块
+                }
+                kept.push_back(q);
+                continue;
+            }
+
+            if (defCount[q.result] == 1 && q.op != "=") {
+                std::string a = q.arg1, b = q.arg2;
+                if ((q.op == "V" || q.op == "^") && b < a) {
+                    std::swap(a, b);
+                }
+                std::string key = q.op + "," + a + "," + b;
+                auto it = available.find(key);
+                if (it != available.end()) {
+                    replace[q.result] = it->second;
+                    changed = true;
+                    continue;
+                }
+                available[key] = q.result;
+            }
+            kept.push_back(q);
+        }
+
+        resolveRoots(replace, roots);
+        quads.swap(kept);
+        return changed;
+    }
+};
+
+// 死代码消除
+class DeadCodeEliminationPass : public OptimizationPass {
+public:
+    std::string name() const override { return "dce"; }
+
+    bool run(std::vector<Quadruple>& quads, std::vector<std::string>& roots) override {
+        return LivenessAnalyzer::eliminateDeadCode(quads, roots) > 0;
+    }
+};
+
+// 单次运行某个优化遍的统计
+struct PassRunStats {
+    std::string pass;
+    int iteration;
+    double timeUs;            // 墙钟时间（微秒）
+    size_t quadsIn;
+    size_t quadsOut;
+    size_t allocations;       // 运行期间的分配次数
+    size_t allocatedBytes;    // 运行期间分配的字节数
+    bool changed;
+};
+
+// 优化遍管理器：按配置顺序反复运行已注册的优化遍直到不动点，并记录每次运行的统计
+class PassManager {
+private:
+    std::map<std::string, std::function<std::unique_ptr<OptimizationPass>()>> registry;
+    std::vector<std::unique_ptr<OptimizationPass>> pipeline;
+    std::vector<PassRunStats> stats;
+    int maxIterations = 16;
+    int iterations = 0;
+    size_t quadsBefore = 0;
+    size_t quadsAfter = 0;
+
+public:
+    PassManager() {
+        registerPass("fold", [] { return std::unique_ptr<OptimizationPass>(new ConstantFoldingPass()); });
+        registerPass("copy", [] { return std::unique_ptr<OptimizationPass>(new CopyPropagationPass()); });
+        registerPass("cse", [] { return std::unique_ptr<OptimizationPass>(new CommonSubexpressionPass()); });
+        registerPass("dce", [] { return std::unique_ptr<OptimizationPass>(new DeadCodeEliminationPass()); });
+    }
+
+    static const char* defaultPipeline() {
+        return "fold,copy,cse,dce";
+    }
+
+    void registerPass(const std::string& name, std::function<std::unique_ptr<OptimizationPass>()> factory) {
+        registry[name] = std::move(factory);
+    }
+
+    void setMaxIterations(int n) {
+        maxIterations = n;
+    }
+
+    // 以逗号分隔的遍名设置运行顺序，存在未注册的遍名时返回 false
+    bool setPipeline(const std::string& spec) {
+        std::vector<std::unique_ptr<OptimizationPass>> newPipeline;
+        std::istringstream stream(spec);
+        std::string name;
+        while (std::getline(stream, name, ',')) {
+            name.erase(std::remove_if(name.begin(), name.end(), ::isspace), name.end());
+            if (name.empty()) continue;
+            auto it = registry.find(name);
+            if (it == registry.end()) {
+                std::cerr << "未知的优化遍: " << name << std::endl;
+                return false;
+            }
+            newPipeline.push_back(it->second());
+        }
+        pipeline = std::move(newPipeline);
+        return true;
+    }
+
+    // 运行优化流水线直到没有遍再修改四元式，返回迭代轮数
+    int run(std::vector<Quadruple>& quads, std::vector<std::string>& roots) {
+        stats.clear();
+        quadsBefore = quads.size();
+        iterations = 0;
+        bool changed = true;
+        while (changed && iterations < maxIterations) {
+            changed = false;
+            ++iterations;
+            for (auto& pass : pipeline) {
+                PassRunStats s;
+                s.pass = pass->name();
+                s.iteration = iterations;
+                s.quadsIn = quads.size();
+                size_t allocsBefore = tl_allocationCount;
+                size_t bytesBefore = tl_allocatedBytes;
+                auto start = std::chrono::steady_clock::now();
+
+                s.changed = pass->run(quads, roots);
+
+                auto end = std::chrono::steady_clock::now();
+                s.timeUs = std::chrono::duration<double, std::micro>(end - start).count();
+                s.allocations = tl_allocationCount - allocsBefore;
+                s.allocatedBytes = tl_allocatedBytes - bytesBefore;
+                s.quadsOut = quads.size();
+                stats.push_back(s);
+                changed = changed || s.changed;
+            }
+        }
+        quadsAfter = quads.size();
+        return iterations;
+    }
+
+    const std::vector<PassRunStats>& getStats() const {
+        return stats;
+    }
+
+    // 以 JSON 输出统计结果，便于在语料上调整流水线
+    void writeStatsJson(std::ostream& os) const {
+        os << "{\n  \"pipeline\": [";
+        for (size_t i = 0; i < pipeline.size(); ++i) {
+            os << (i ? ", " : "") << "\"" << pipeline[i]->name() << "\"";
+        }
+        os << "],\n  \"iterations\": " << iterations
+           << ",\n  \"quads_before\": " << quadsBefore
+           << ",\n  \"quads_after\": " << quadsAfter
+           << ",\n  \"runs\": [";
+        for (size_t i = 0; i < stats.size(); ++i) {
+            const PassRunStats& s = stats[i];
+            os << (i ? "," : "") << "\n    {\"pass\": \"" << s.pass << "\", \"iteration\": " << s.iteration
+               << ", \"time_us\": " << s.timeUs << ", \"quads_in\": " << s.quadsIn
+               << ", \"quads_out\": " << s.quadsOut << ", \"allocations\": " << s.allocations
+               << ", \"allocated_bytes\": " << s.allocatedBytes
+               << ", \"changed\": " << (s.changed ? "true" : "false") << "}";
+        }
+        os << "\n  ]\n}" << std::endl;
+    }
+};
+
+
+// ================= 测试表达式生成 =================
+
+// 生成随机布尔表达式：numLeaves 个叶子（变量 x0..x{numVars-1} 或常量），随机组合 V/^/-；
+// readOnce 为 true 时每个变量恰好出现一次（叶子数等于变量数，不含常量）
+std::string generateRandomExpression(int numVars, int numLeaves, std::mt19937& rng, bool readOnce = false) {
+    std::uniform_int_distribution<int> varDist(0, numVars - 1);
+    std::uniform_int_distribution<int> pctDist(0, 99);
+    std::vector<int> permutation;
+    if (readOnce) {
+        numLeaves = numVars;
+        for (int v = 0; v < numVars; ++v) permutation.push_back(v);
+        std::shuffle(permutation.begin(), permutation.end(), rng);
+    }
+
+    // 叶子先入栈，随后不断随机取两个子表达式合并，得到深度约为 log n 的树
+    std::vector<std::string> parts;
+    parts.reserve(numLeaves);
+    for (int i = 0; i < numLeaves; ++i) {
+        int pct = readOnce ? 100 : pctDist(rng);
+        std::string leaf = (pct < 2) ? "true" : (pct < 4) ? "false"
+                         : "x" + std::to_string(readOnce ? permutation[i] : varDist(rng));
+        if (pctDist(rng) < 20) {
+            leaf = "-" + leaf;
+        }
+        parts.push_back(leaf);
+    }
+    while (parts.size() > 1) {
+        std::vector<std::string> next;
+        next.reserve(parts.size() / 2 + 1);
+        for (size_t i = 0; i + 1 < parts.size(); i += 2) {
+            std::string op = (pctDist(rng) < 50) ? " V " : " ^ ";
+            std::string expr = "(" + parts[i] + op + parts[i + 1] + ")";
+            if (pctDist(rng) < 10) {
+                expr = "-" + expr;
+            }
+            next.push_back(std::move(expr));
+        }
+        if (parts.size() % 2) {
+            next.push_back(std::move(parts.back()));
+        }
+        parts.swap(next);
+    }
+    return parts.empty() ? "true" : parts[0];
+}
+
+
+// ================= 约简有序二元决策图 (ROBDD) =================
+
+// BDD 管理器：唯一表保证结点哈希共享，ITE 运算带计算缓存，支持相邻层交换与 sifting 变量重排
+class BDDManager {
+public:
+    static constexpr int FALSE_NODE = 0;
+    static constexpr int TRUE_NODE = 1;
+
+private:
+    struct Node {
+        int var;   // 变量编号，终结点为 -1
+        int low;   // 变量取 false 时的后继
+        int high;  // 变量取 true 时的后继
+    };
+
+    struct Triple {
+        int a, b, c;
+        bool operator==(const Triple& other) const {
+            return a == other.a && b == other.b && c == other.c;
+        }
+    };
+
+    struct TripleHash {
+        size_t operator()(const Triple& t) const {
+            uint64_t h = static_cast<uint32_t>(t.a) * 0x9E3779B97F4A7C15ULL;
+            h ^= (static_cast<uint64_t>(static_cast<uint32_t>(t.b)) << 32 | static_cast<uint32_t>(t.c)) * 0xC2B2AE3D27D4EB4FULL;
+            return h ^ (h >> 31);
+        }
+    };
+
+    std::vector<Node> nodes;
+    std::unordered_map<Triple, int, TripleHash> uniqueTable;    // (var, low, high) -> 结点
+    std::unordered_map<Triple, int, TripleHash> computedTable;  // ITE(f, g, h) -> 结点
+    std::vector<std::string> varNames;
+    std::unordered_map<std::string, int> varIndex;
+    std::vector<int> var2level;
+    std::vector<int> level2var;
+    std::vector<std::vector<int>> nodesOfVar;  // 每个变量上的结点（可能含已不可达的结点）
+    std::vector<int> refCount;                  // 变量重排期间维护的引用计数
+    size_t liveNodes = 0;                       // 变量重排期间引用计数非零的内部结点数
+    std::vector<unsigned> visitMark;
+    unsigned visitStamp = 0;
+    size_t maxComputedEntries = 1 << 22;
+
+    int level(int f) const {
+        return f < 2 ? INT_MAX : var2level[nodes[f].var];
+    }
+
+    // 求 f 关于变量 v 的余因子
+    int cofactor(int f, int v, bool positive) const {
+        if (f < 2 || nodes[f].var != v) return f;
+        return positive ? nodes[f].high : nodes[f].low;
+    }
+
+public:
+    BDDManager() {
+        nodes.push_back({-1, FALSE_NODE, FALSE_NODE});
+        nodes.push_back({-1, TRUE_NODE, TRUE_NODE});
+        refCount.assign(2, 0);
+    }
+
+    // 声明变量，新变量放在当前次序的最底层；已存在时返回原编号
+    int declareVariable(const std::string& name) {
+        auto it = varIndex.find(name);
+        if (it != varIndex.end()) return it->second;
+        int v = varNames.size();
+        varNames.push_back(name);
+        varIndex[name] = v;
+        var2level.push_back(level2var.size());
+        level2var.push_back(v);
+        nodesOfVar.emplace_back();
+        return v;
+    }
+
+    int numVariables() const {
+        return varNames.size();
+    }
+
+    // 结点构造：两个后继相同则约简，否则在唯一表中查找或新建
+    int mk(int var, int low, int high) {
+        if (low == high) return low;
+        Triple key = {var, low, high};
+        auto it = uniqueTable.find(key);
+        if (it != uniqueTable.end()) return it->second;
+        int id = nodes.size();
+        nodes.push_back({var, low, high});
+        refCount.push_back(0);
+        uniqueTable.emplace(key, id);
+        nodesOfVar[var].push_back(id);
+        return id;
+    }
+
+    int variable(const std::string& name) {
+        return mk(declareVariable(name), FALSE_NODE, TRUE_NODE);
+    }
+
+    // if-then-else：所有二元布尔运算都归结为 ITE
+    int ite(int f, int g, int h) {
+        if (f == TRUE_NODE) return g;
+        if (f == FALSE_NODE) return h;
+        if (g == h) return g;
+        if (g == TRUE_NODE && h == FALSE_NODE) return f;
+
+        Triple key = {f, g, h};
+        auto it = computedTable.find(key);
+        if (it != computedTable.end()) return it->second;
+
+        int top = std::min(level(f), std::min(level(g), level(h)));
+        int v = level2var[top];
+        int t = ite(cofactor(f, v, true), cofactor(g, v, true), cofactor(h, v, true));
+        int e = ite(cofactor(f, v, false), cofactor(g, v, false), cofactor(h, v, false));
+        int result = mk(v, e, t);
+
+        if (computedTable.size() >= maxComputedEntries) {
+            computedTable.clear();
+        }
+        computedTable.emplace(key, result);
+        return result;
+    }
+
+    int bddNot(int f) { return ite(f, FALSE_NODE, TRUE_NODE); }
+    int bddAnd(int f, int g) { return ite(f, g, FALSE_NODE); }
+    int bddOr(int f, int g) { return ite(f, TRUE_NODE, g); }
+
+    int applyOperator(const std::string& op, int f, int g) {
+        if (op == "V") return bddOr(f, g);
+        if (op == "^") return bddAnd(f, g);
+        throw std::runtime_error("Unknown operator '" + op + "'");
+    }
+
+    int operandNode(const std::string& operand) {
+        if (operand == "true") return TRUE_NODE;
+        if (operand == "false") return FALSE_NODE;
+        return variable(operand);
+    }
+
+    // 由语法树构造 BDD（显式栈后序遍历，避免深树递归溢出）
+    int buildFromAST(ASTNode* root) {
+        std::vector<std::pair<ASTNode*, bool>> work = {{root, false}};
+        std::vector<int> values;
+        while (!work.empty()) {
+            auto [node, expanded] = work.back();
+            work.pop_back();
+            if (node->type == "constant" || node->type == "variable") {
+                values.push_back(operandNode(node->value));
+            } else if (!expanded) {
+                work.push_back({node, true});
+                if (node->right) work.push_back({node->right, false});
+                work.push_back({node->left, false});
+            } else if (node->value == "!") {
+                int f = values.back();
+                values.back() = bddNot(f);
+            } else {
+                int g = values.back();
+                values.pop_back();
+                int f = values.back();
+                values.back() = applyOperator(node->value, f, g);
+            }
+        }
+        return values.back();
+    }
+
+    // 由数值形式的四元式构造 BDD（不支持跳转四元式）
+    int buildFromQuadruples(const std::vector<Quadruple>& quads, const std::string& result) {
+        std::unordered_map<std::string, int> value;
+        auto operand = [&](const std::string& a) {
+            auto it = value.find(a);
+            return it != value.end() ? it->second : operandNode(a);
+        };
+        for (const auto& q : quads) {
+            if (q.op == "!") {
+                value[q.result] = bddNot(operand(q.arg1));
+            } else if (q.op == "=") {
+                value[q.result] = operand(q.arg1);
+            } else if (q.op == "V" || q.op == "^") {
+                value[q.result] = applyOperator(q.op, operand(q.arg1), operand(q.arg2));
+            } else {
+                throw std::runtime_error("BDD cannot be built from quadruple op '" + q.op + "'");
+            }
+        }
+        return operand(result);
+    }
+
+    // 统计从 roots 可达的结点数（含终结点）
+    size_t countNodes(const std::vector<int>& roots) {
+        if (visitMark.size() < nodes.size()) {
+            visitMark.resize(nodes.size(), 0);
+        }
+        if (++visitStamp == 0) {
+            std::fill(visitMark.begin(), visitMark.end(), 0);
+            visitStamp = 1;
+        }
+        size_t count = 0;
+        std::vector<int> work(roots.begin(), roots.end());
+        while (!work.empty()) {
+            int f = work.back();
+            work.pop_back();
+            if (visitMark[f] == visitStamp) continue;
+            visitMark[f] = visitStamp;
+            ++count;
+            if (f >= 2) {
+                work.push_back(nodes[f].low);
+                work.push_back(nodes[f].high);
+            }
+        }
+        return count;
+    }
+
+    size_t allocatedNodes() const {
+        return nodes.size();
+    }
+
+    // 垃圾回收：只保留 roots 可达的结点并重新编号，roots 原地更新
+    void collectGarbage(std::vector<int>& roots) {
+        std::vector<int> remap(nodes.size(), -1);
+        std::vector<Node> newNodes = {nodes[FALSE_NODE], nodes[TRUE_NODE]};
+        remap[FALSE_NODE] = FALSE_NODE;
+        remap[TRUE_NODE] = TRUE_NODE;
+
+        // 后序编号保证子结点先于父结点
+        std::vector<std::pair<int, bool>> work;
+        for (int r : roots) work.push_back({r, false});
+        while (!work.empty()) {
+            auto [f, expanded] = work.back();
+            work.pop_back();
+            if (remap[f] != -1) continue;
+            if (!expanded) {
+                work.push_back({f, true});
+                work.push_back({nodes[f].high, false});
+                work.push_back({nodes[f].low, false});
+            } else {
+                remap[f] = newNodes.size();
+                newNodes.push_back({nodes[f].var, remap[nodes[f].low], remap[nodes[f].high]});
+            }
+        }
+
+        nodes.swap(newNodes);
+        uniqueTable.clear();
+        computedTable.clear();
+        for (auto& list : nodesOfVar) list.clear();
+        for (int id = 2; id < static_cast<int>(nodes.size()); ++id) {
+            uniqueTable.emplace(Triple{nodes[id].var, nodes[id].low, nodes[id].high}, id);
+            nodesOfVar[nodes[id].var].push_back(id);
+        }
+        for (auto& r : roots) r = remap[r];
+        visitMark.assign(nodes.size(), 0);
+        visitStamp = 0;
+        refCount.assign(nodes.size(), 0);
+        liveNodes = 0;
+    }
+
+private:
+    // 引用计数：只有存活结点计入其子结点的引用，结点复活或死亡时级联更新
+    void incRef(int f) {
+        if (refCount[f]++ == 0 && f >= 2) {
+            ++liveNodes;
+            incRef(nodes[f].low);
+            incRef(nodes[f].high);
+        }
+    }
+
+    void decRef(int f) {
+        if (--refCount[f] == 0 && f >= 2) {
+            --liveNodes;
+            decRef(nodes[f].low);
+            decRef(nodes[f].high);
+        }
+    }
+
+    // 回收后所有结点都可达，按 roots 建立引用计数
+    void initReferenceCounts(std::vector<int>& roots) {
+        collectGarbage(roots);
+        for (int r : roots) incRef(r);
+    }
+
+public:
+
+    // 交换第 i 层与第 i+1 层的变量，结点原地改写，原有结点表示的函数不变
+    void swapLevels(int i) {
+        int x = level2var[i];
+        int y = level2var[i + 1];
+        std::vector<int> xs;
+        xs.swap(nodesOfVar[x]);
+        for (int f : xs) {
+            Node n = nodes[f];
+            if (n.var != x) continue;
+            if (refCount[f] == 0) {
+                // 不可达结点直接从唯一表删除，避免交换后违反变量次序的结点被复用
+                uniqueTable.erase(Triple{x, n.low, n.high});
+                nodes[f].var = -1;
+                continue;
+            }
+            bool highHasY = n.high >= 2 && nodes[n.high].var == y;
+            bool lowHasY = n.low >= 2 && nodes[n.low].var == y;
+            if (!highHasY && !lowHasY) {
+                nodesOfVar[x].push_back(f);  // 与 y 无关，结点不变，只是下移一层
+                continue;
+            }
+            int f11 = highHasY ? nodes[n.high].high : n.high;
+            int f10 = highHasY ? nodes[n.high].low : n.high;
+            int f01 = lowHasY ? nodes[n.low].high : n.low;
+            int f00 = lowHasY ? nodes[n.low].low : n.low;
+            int newHigh = mk(x, f01, f11);
+            int newLow = mk(x, f00, f10);
+            incRef(newHigh);
+            incRef(newLow);
+            uniqueTable.erase(Triple{x, n.low, n.high});
+            nodes[f] = {y, newLow, newHigh};
+            uniqueTable.emplace(Triple{y, newLow, newHigh}, f);
+            nodesOfVar[y].push_back(f);
+            decRef(n.high);
+            decRef(n.low);
+        }
+        std::swap(level2var[i], level2var[i + 1]);
+        var2level[x] = i + 1;
+        var2level[y] = i;
+    }
+
+    // sifting 变量重排：依次把每个变量移过所有层，停在使结点数最少的位置；
+    // 当结点数超过当前最优的 maxGrowth 倍时提前回头。结点数由引用计数增量维护
+    size_t sift(std::vector<int>& roots, double maxGrowth = 1.2) {
+        initReferenceCounts(roots);
+        int n = numVariables();
+        if (n < 2) return countNodes(roots);
+
+        std::vector<int> order(n);
+        for (int v = 0; v < n; ++v) order[v] = v;
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            return nodesOfVar[a].size() > nodesOfVar[b].size();
+        });
+
+        size_t best = liveNodes;
+        for (int v : order) {
+            int bestLevel = var2level[v];
+            // 先向较近的一端移动，减少交换次数
+            bool downFirst = var2level[v] > n / 2;
+            for (int pass = 0; pass < 2; ++pass) {
+                bool down = (pass == 0) == downFirst;
+                while (down ? var2level[v] < n - 1 : var2level[v] > 0) {
+                    swapLevels(down ? var2level[v] : var2level[v] - 1);
+                    if (liveNodes < best) {
+                        best = liveNodes;
+                        bestLevel = var2level[v];
+                    } else if (liveNodes > best * maxGrowth) {
+                        break;
+                    }
+                }
+            }
+            while (var2level[v] < bestLevel) swapLevels(var2level[v]);
+            while (var2level[v] > bestLevel) swapLevels(var2level[v] - 1);
+
+            if (nodes.size() > 4 * liveNodes + 1024) {
+                initReferenceCounts(roots);
+            }
+        }
+        collectGarbage(roots);
+        return countNodes(roots);
+    }
+
+    const std::string& variableName(int v) const {
+        return varNames[v];
+    }
+
+    // 枚举从 f 到指定终结点的所有路径，每条路径以 (变量编号, 取值) 序列给出
+    void enumeratePaths(int f, bool target, const std::function<void(const std::vector<std::pair<int, bool>>&)>& visit) const {
+        std::vector<std::pair<int, bool>> path;
+        std::function<void(int)> walk = [&](int g) {
+            if (g < 2) {
+                if ((g == TRUE_NODE) == target) visit(path);
+                return;
+            }
+            path.push_back({nodes[g].var, false});
+            walk(nodes[g].low);
+            path.back().second = true;
+            walk(nodes[g].high);
+            path.pop_back();
+        };
+        walk(f);
+    }
+
+    // 在给定赋值下求值（未赋值的变量视为 false）
+    bool evaluate(int f, const std::unordered_map<std::string, bool>& values) const {
+        while (f >= 2) {
+            auto it = values.find(varNames[nodes[f].var]);
+            f = (it != values.end() && it->second) ? nodes[f].high : nodes[f].low;
+        }
+        return f == TRUE_NODE;
+    }
+
+    std::vector<std::string> variableOrder() const {
+        std::vector<std::string> order;
+        for (int v : level2var) order.push_back(varNames[v]);
+        return order;
+    }
+
+    // 把 BDD 展开为四元式：每个结点是一个多路选择 x ? high : low，后继为常量时退化为单条 V/^/!
+    std::string emitQuadruples(int root, QuaternionGenerator& generator) const {
+        if (root == TRUE_NODE) return "true";
+        if (root == FALSE_NODE) return "false";
+
+        std::unordered_map<int, std::string> memo = {{FALSE_NODE, "false"}, {TRUE_NODE, "true"}};
+        std::unordered_map<int, std::string> negated;  // 变量的取反结果只生成一次
+        auto notVar = [&](int v) {
+            auto it = negated.find(v);
+            if (it != negated.end()) return it->second;
+            return negated[v] = generator.genNot(varNames[v]);
+        };
+
+        std::vector<std::pair<int, bool>> work = {{root, false}};
+        while (!work.empty()) {
+            auto [f, expanded] = work.back();
+            work.pop_back();
+            if (memo.count(f)) continue;
+            const Node& n = nodes[f];
+            if (!expanded) {
+                work.push_back({f, true});
+                work.push_back({n.high, false});
+                work.push_back({n.low, false});
+                continue;
+            }
+            const std::string& x = varNames[n.var];
+            const std::string& hi = memo[n.high];
+            const std::string& lo = memo[n.low];
+            std::string value;
+            if (n.high == TRUE_NODE && n.low == FALSE_NODE) {
+                value = x;
+            } else if (n.high == FALSE_NODE && n.low == TRUE_NODE) {
+                value = notVar(n.var);
+            } else if (n.high == TRUE_NODE) {
+                value = generator.genLogicalOp("V", x, lo);
+            } else if (n.low == FALSE_NODE) {
+                value = generator.genLogicalOp("^", x, hi);
+            } else if (n.high == FALSE_NODE) {
+                value = generator.genLogicalOp("^", notVar(n.var), lo);
+            } else if (n.low == TRUE_NODE) {
+                value = generator.genLogicalOp("V", notVar(n.var), hi);
+            } else {
+                std::string t = generator.genLogicalOp("^", x, hi);
+                std::string e = generator.genLogicalOp("^", notVar(n.var), lo);
+                value = generator.genLogicalOp("V", t, e);
+            }
+            memo[f] = value;
+        }
+        return memo[root];
+    }
+};
+
+// 由表达式文本构造 BDD
+int buildBDDFromText(BDDManager& manager, const std::string& text) {
+    ASTBuilder builder;
+    ASTNode* tree = builder.buildFromTokens(tokenizeExpression(text));
+    int root;
+    try {
+        root = manager.buildFromAST(tree);
+    } catch (...) {
+        delete tree;
+        throw;
+    }
+    delete tree;
+    return root;
+}
+
+// BDD 基准测试：统计结点数、构造时间与 sifting 时间
+void runBDDBenchmark(std::ostream& os) {
+    struct Case {
+        std::string name;
+        std::string expr;
+        std::vector<std::string> initialOrder;  // 预先声明的变量次序
+    };
+    std::vector<Case> cases;
+
+    // (x1 ^ y1) V (x2 ^ y2) V ...：交错次序线性大小，先 x 后 y 的次序为指数大小
+    for (int n : {8, 12, 16}) {
+        Case c;
+        c.name = "pairs_separated_" + std::to_string(n);
+        for (int i = 0; i < n; ++i) {
+            c.expr += (i ? " V " : "") + std::string("(x") + std::to_string(i) + " ^ y" + std::to_string(i) + ")";
+        }
+        for (int i = 0; i < n; ++i) c.initialOrder.push_back("x" + std::to_string(i));
+        for (int i = 0; i < n; ++i) c.initialOrder.push_back("y" + std::to_string(i));
+        cases.push_back(c);
+    }
+    for (int n : {100, 250, 500}) {
+        Case c;
+        c.name = "pairs_interleaved_" + std::to_string(n);
+        for (int i = 0; i < n; ++i) {
+            c.expr += (i ? " V " : "") + std::string("(x") + std::to_string(i) + " ^ y" + std::to_string(i) + ")";
+        }
+        cases.push_back(c);
+    }
+    // 变量重复出现的随机表达式 BDD 可能指数增长，规模较小；只读一次的表达式用于测试数百个变量
+    std::mt19937 rng(12345);
+    for (int vars : {60, 100}) {
+        Case c;
+        c.name = "random_" + std::to_string(vars);
+        c.expr = generateRandomExpression(vars, vars, rng);
+        cases.push_back(c);
+    }
+    for (int vars : {200, 500, 1000}) {
+        Case c;
+        c.name = "read_once_" + std::to_string(vars);
+        c.expr = generateRandomExpression(vars, vars, rng, true);
+        cases.push_back(c);
+    }
+
+    os << std::left << std::setw(24) << "case" << std::right << std::setw(8) << "vars"
+       << std::setw(12) << "nodes" << std::setw(12) << "sifted" << std::setw(12) << "build_ms"
+       << std::setw(12) << "sift_ms" << std::setw(10) << "quads" << std::endl;
+    for (const auto& c : cases) {
+        BDDManager manager;
+        for (const auto& v : c.initialOrder) manager.declareVariable(v);
+
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<int> roots = {buildBDDFromText(manager, c.expr)};
+        auto t1 = std::chrono::steady_clock::now();
+        size_t before = manager.countNodes(roots);
+        size_t after = manager.sift(roots);
+        auto t2 = std::chrono::steady_clock::now();
+
+        QuaternionGenerator generator;
+        manager.emitQuadruples(roots[0], generator);
+
+        os << std::left << std::setw(24) << c.name << std::right << std::setw(8) << manager.numVariables()
+           << std::setw(12) << before << std::setw(12) << after
+           << std::setw(12) << std::chrono::duration<double, std::milli>(t1 - t0).count()
+           << std::setw(12) << std::chrono::duration<double, std::milli>(t2 - t1).count()
+           << std::setw(10) << generator.getQuaternions().size() << std::endl;
+    }
+}
+
+// ================= 两级逻辑最小化 =================
+
+// 乘积项（立方体）：位打包表示，mask 中为 1 的位表示该变量出现，value 中对应位给出其取值
+struct Cube {
+    uint64_t mask;
+    uint64_t value;
+
+    bool operator==(const Cube& other) const {
+        return mask == other.mask && value == other.value;
+    }
+
+    int literals() const {
+        return __builtin_popcountll(mask);
+    }
+
+    // 两个立方体是否有公共最小项
+    bool intersects(const Cube& other) const {
+        return (mask & other.mask & (value ^ other.value)) == 0;
+    }
+
+    // 本立方体是否包含 other
+    bool contains(const Cube& other) const {
+        return (mask & ~other.mask) == 0 && ((value ^ other.value) & mask) == 0;
+    }
+};
+
+struct CubeHash {
+    size_t operator()(const Cube& c) const {
+        uint64_t h = c.mask * 0x9E3779B97F4A7C15ULL ^ c.value * 0xC2B2AE3D27D4EB4FULL;
+        return h ^ (h >> 29);
+    }
+};
+
+// 两级逻辑最小化：变量数不超过 exactLimit 时用 Quine–McCluskey 求素蕴含项并选取覆盖，
+// 否则以 BDD 路径作为初始覆盖，循环执行 Espresso 风格的 EXPAND / IRREDUNDANT / REDUCE
+class TwoLevelMinimizer {
+private:
+    int exactLimit;
+    int numVars = 0;
+    std::vector<std::string> varNames;
+    bool exact = false;
+
+    // 覆盖代价：先比较乘积项数，再比较文字数
+    static std::pair<size_t, size_t> cost(const std::vector<Cube>& cover) {
+        size_t lits = 0;
+        for (const auto& c : cover) lits += c.literals();
+        return {cover.size(), lits};
+    }
+
+    // 覆盖 F 关于立方体 c 的余因子
+    static std::vector<Cube> cofactor(const std::vector<Cube>& cover, const Cube& c) {
+        std::vector<Cube> result;
+        for (const auto& d : cover) {
+            if (d.intersects(c)) {
+                result.push_back({d.mask & ~c.mask, d.value & ~c.mask});
+            }
+        }
+        return result;
+    }
+
+    // 单调递归判定覆盖是否为重言式，freeVars 为尚未被余因子消去的变量数
+    static bool isTautology(const std::vector<Cube>& cover, int freeVars) {
+        if (cover.empty()) return false;
+        double volume = 0;
+        uint64_t positive = 0, negative = 0;
+        for (const auto& c : cover) {
+            if (c.mask == 0) return true;
+            volume += std::ldexp(1.0, freeVars - c.literals());
+            positive |= c.mask & c.value;
+            negative |= c.mask & ~c.value;
+        }
+        // 所有立方体体积之和小于全空间时不可能覆盖
+        if (volume < std::ldexp(1.0, freeVars) * (1 - 1e-9)) return false;
+        // 单调覆盖（每个变量只以一种极性出现）是重言式当且仅当含全集立方体
+        uint64_t binate = positive & negative;
+        if (binate == 0) return false;
+
+        // 选择出现次数最多的双极性变量展开
+        int bestVar = -1, bestCount = -1;
+        for (int v = 0; v < 64; ++v) {
+            if (!((binate >> v) & 1)) continue;
+            int count = 0;
+            for (const auto& c : cover) count += (c.mask >> v) & 1;
+            if (count > bestCount) {
+                bestCount = count;
+                bestVar = v;
+            }
+        }
+        uint64_t bit = 1ULL << bestVar;
+        return isTautology(cofactor(cover, {bit, bit}), freeVars - 1)
+            && isTautology(cofactor(cover, {bit, 0}), freeVars - 1);
+    }
+
+    // 立方体 c 是否被 cover 中其余立方体（跳过下标 skip）覆盖
+    bool coveredByOthers(const std::vector<Cube>& cover, size_t skip, const Cube& c) const {
+        std::vector<Cube> others;
+        others.reserve(cover.size());
+        for (size_t i = 0; i < cover.size(); ++i) {
+            if (i != skip) others.push_back(cover[i]);
+        }
+        return isTautology(cofactor(others, c), numVars - c.literals());
+    }
+
+    static bool intersectsAny(const Cube& c, const std::vector<Cube>& cover) {
+        for (const auto& d : cover) {
+            if (c.intersects(d)) return true;
+        }
+        return false;
+    }
+
+    // EXPAND：在不与 OFF 集相交的前提下逐个去掉文字，并删除被扩展后立方体包含的立方体
+    void expand(std::vector<Cube>& cover, const std::vector<Cube>& offSet) const {
+        std::sort(cover.begin(), cover.end(), [](const Cube& a, const Cube& b) {
+            return a.literals() < b.literals();
+        });
+        std::vector<Cube> result;
+        for (Cube c : cover) {
+            bool alreadyCovered = false;
+            for (const auto& r : result) {
+                if (r.contains(c)) {
+                    alreadyCovered = true;
+                    break;
+                }
+            }
+            if (alreadyCovered) continue;
+            for (int v = 0; v < numVars; ++v) {
+                uint64_t bit = 1ULL << v;
+                if (!(c.mask & bit)) continue;
+                Cube raised = {c.mask & ~bit, c.value & ~bit};
+                if (!intersectsAny(raised, offSet)) {
+                    c = raised;
+                }
+            }
+            result.erase(std::remove_if(result.begin(), result.end(), [&](const Cube& r) {
+                return c.contains(r);
+            }), result.end());
+            result.push_back(c);
+        }
+        cover.swap(result);
+    }
+
+    // IRREDUNDANT：删除被其余立方体覆盖的立方体，文字多的（较小的）立方体优先删除
+    void irredundant(std::vector<Cube>& cover) const {
+        std::sort(cover.begin(), cover.end(), [](const Cube& a, const Cube& b) {
+            return a.literals() > b.literals();
+        });
+        for (size_t i = 0; i < cover.size();) {
+            if (coveredByOthers(cover, i, cover[i])) {
+                cover.erase(cover.begin() + i);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    // REDUCE：把每个立方体缩小到仍能保证整体覆盖不变的最小立方体，为下一轮 EXPAND 换方向
+    void reduce(std::vector<Cube>& cover) const {
+        for (size_t i = 0; i < cover.size(); ++i) {
+            for (int v = 0; v < numVars; ++v) {
+                uint64_t bit = 1ULL << v;
+                Cube& c = cover[i];
+                if (c.mask & bit) continue;
+                Cube withTrue = {c.mask | bit, c.value | bit};
+                Cube withFalse = {c.mask | bit, c.value & ~bit};
+                if (coveredByOthers(cover, i, withTrue)) {
+                    c = withFalse;
+                } else if (coveredByOthers(cover, i, withFalse)) {
+                    c = withTrue;
+                }
+            }
+        }
+    }
+
+    std::vector<Cube> espresso(std::vector<Cube> onSet, const std::vector<Cube>& offSet) const {
+        expand(onSet, offSet);
+        irredundant(onSet);
+        std::vector<Cube> best = onSet;
+        for (int iteration = 0; iteration < 16; ++iteration) {
+            reduce(onSet);
+            expand(onSet, offSet);
+            irredundant(onSet);
+            if (cost(onSet) < cost(best)) {
+                best = onSet;
+            } else {
+                break;
+            }
+        }
+        return best;
+    }
+
+    // Quine–McCluskey：合并只差一位的立方体求全部素蕴含项，再选取本质素项并贪心补全覆盖
+    std::vector<Cube> quineMcCluskey(const std::vector<uint64_t>& minterms) const {
+        uint64_t full = (numVars == 64) ? ~0ULL : ((1ULL << numVars) - 1);
+        std::unordered_set<Cube, CubeHash> current;
+        for (uint64_t m : minterms) current.insert({full, m});
+
+        std::vector<Cube> primes;
+        while (!current.empty()) {
+            std::unordered_set<Cube, CubeHash> next;
+            std::unordered_set<Cube, CubeHash> merged;
+            for (const auto& c : current) {
+                for (int v = 0; v < numVars; ++v) {
+                    uint64_t bit = 1ULL << v;
+                    if (!(c.mask & bit) || (c.value & bit)) continue;
+                    Cube partner = {c.mask, c.value | bit};
+                    if (current.count(partner)) {
+                        next.insert({c.mask & ~bit, c.value});
+                        merged.insert(c);
+                        merged.insert(partner);
+                    }
+                }
+            }
+            for (const auto& c : current) {
+                if (!merged.count(c)) primes.push_back(c);
+            }
+            current.swap(next);
+        }
+
+        std::vector<std::vector<int>> coveringPrimes(minterms.size());  // 最小项 -> 覆盖它的素项
+        std::vector<std::vector<int>> primeMinterms(primes.size());     // 素项 -> 它覆盖的最小项
+        for (size_t m = 0; m < minterms.size(); ++m) {
+            for (size_t p = 0; p < primes.size(); ++p) {
+                if (primes[p].contains({full, minterms[m]})) {
+                    coveringPrimes[m].push_back(p);
+                    primeMinterms[p].push_back(m);
+                }
+            }
+        }
+
+        std::vector<bool> covered(minterms.size(), false);
+        std::vector<bool> chosen(primes.size(), false);
+        size_t remaining = minterms.size();
+        std::vector<Cube> cover;
+        auto choose = [&](int p) {
+            chosen[p] = true;
+            cover.push_back(primes[p]);
+            for (int m : primeMinterms[p]) {
+                if (!covered[m]) {
+                    covered[m] = true;
+                    --remaining;
+                }
+            }
+        };
+        // 本质素蕴含项：某个最小项只被它覆盖
+        for (size_t m = 0; m < minterms.size(); ++m) {
+            if (!covered[m] && coveringPrimes[m].size() == 1) choose(coveringPrimes[m][0]);
+        }
+        // 剩余部分贪心：每次选覆盖未覆盖最小项最多的素项，文字少者优先
+        while (remaining > 0) {
+            int bestPrime = -1;
+            size_t bestGain = 0;
+            for (size_t p = 0; p < primes.size(); ++p) {
+                if (chosen[p]) continue;
+                size_t gain = 0;
+                for (int m : primeMinterms[p]) gain += !covered[m];
+                if (gain > bestGain || (gain == bestGain && gain > 0 && primes[p].literals() < primes[bestPrime].literals())) {
+                    bestGain = gain;
+                    bestPrime = p;
+                }
+            }
+            choose(bestPrime);
+        }
+        return cover;
+    }
+
+    static Cube pathToCube(const std::vector<std::pair<int, bool>>& path) {
+        Cube c = {0, 0};
+        for (const auto& lit : path) {
+            c.mask |= 1ULL << lit.first;
+            if (lit.second) c.value |= 1ULL << lit.first;
+        }
+        return c;
+    }
+
+public:
+    explicit TwoLevelMinimizer(int exactLimit = 12) : exactLimit(exactLimit) {}
+
+    // 求表达式的最小（或近似最小）积之和覆盖；空覆盖表示恒假，含全集立方体表示恒真
+    std::vector<Cube> minimize(ASTNode* root) {
+        BDDManager manager;
+        int f = manager.buildFromAST(root);
+        numVars = manager.numVariables();
+        if (numVars > 64) {
+            throw std::runtime_error("Two-level minimization supports at most 64 variables");
+        }
+        varNames.clear();
+        for (int v = 0; v < numVars; ++v) varNames.push_back(manager.variableName(v));
+
+        std::vector<Cube> onSet, offSet;
+        manager.enumeratePaths(f, true, [&](const std::vector<std::pair<int, bool>>& path) {
+            onSet.push_back(pathToCube(path));
+        });
+
+        exact = numVars <= exactLimit;
+        if (onSet.empty() || (onSet.size() == 1 && onSet[0].mask == 0)) {
+            return onSet;
+        }
+        if (exact) {
+            // BDD 路径互不相交，展开自由变量即得全部最小项
+            std::vector<uint64_t> minterms;
+            for (const auto& c : onSet) {
+                uint64_t freeMask = ((numVars == 64) ? ~0ULL : ((1ULL << numVars) - 1)) & ~c.mask;
+                uint64_t sub = 0;
+                do {
+                    minterms.push_back(c.value | sub);
+                    sub = (sub - freeMask) & freeMask;
+                } while (sub != 0);
+            }
+            return quineMcCluskey(minterms);
+        }
+
+        manager.enumeratePaths(f, false, [&](const std::vector<std::pair<int, bool>>& path) {
+            offSet.push_back(pathToCube(path));
+        });
+        return espresso(onSet, offSet);
+    }
+
+    bool usedExactMethod() const {
+        return exact;
+    }
+
+    const std::vector<std::string>& variables() const {
+        return varNames;
+    }
+
+    std::string coverToString(const std::vector<Cube>& cover) const {
+        if (cover.empty()) return "false";
+        std::string text;
+        for (size_t i = 0; i < cover.size(); ++i) {
+            if (cover[i].mask == 0) return "true";
+            std::string term;
+            for (int v = 0; v < numVars; ++v) {
+                uint64_t bit = 1ULL << v;
+                if (!(cover[i].mask & bit)) continue;
+                term += (term.empty() ? "" : " ^ ") + std::string((cover[i].value & bit) ? "" : "-") + varNames[v];
+            }
+            text += (i ? " V " : "") + (cover.size() > 1 && cover[i].literals() > 1 ? "(" + term + ")" : term);
+        }
+        return text;
+    }
+
+    // 把积之和覆盖交给四元式生成器：每个乘积项一串 ^，再用 V 连接
+    std::string emitQuadruples(const std::vector<Cube>& cover, QuaternionGenerator& generator) const {
+        if (cover.empty()) return "false";
+        std::unordered_map<int, std::string> negated;
+        std::string sum;
+        for (const auto& c : cover) {
+            if (c.mask == 0) return "true";
+            std::string product;
+            for (int v = 0; v < numVars; ++v) {
+                uint64_t bit = 1ULL << v;
+                if (!(c.mask & bit)) continue;
+                std::string literal = varNames[v];
+                if (!(c.value & bit)) {
+                    auto it = negated.find(v);
+                    literal = (it != negated.end()) ? it->second : (negated[v] = generator.genNot(varNames[v]));
+                }
+                product = product.empty() ? literal : generator.genLogicalOp("^", product, literal);
+            }
+            sum = sum.empty() ? product : generator.genLogicalOp("V", sum, product);
+        }
+        return sum;
+    }
+};
+
+// 在大规模随机表达式上报告不同寄存器数下的溢出情况
+void runRegisterAllocationReport(std::ostream& os) {
+    std::mt19937 rng(2024);
+    os << std::left << std::setw(10) << "leaves" << std::right << std::setw(6) << "regs" << std::setw(10) << "quads"
+       << std::setw(10) << "spilled" << std::setw(10) << "stores" << std::setw(10) << "reloads"
+       << std::setw(10) << "varLoads" << std::setw(10) << "code" << std::endl;
+    for (int leaves : {1000, 10000}) {
+        std::string expr = generateRandomExpression(leaves / 4, leaves, rng);
+        ASTBuilder builder;
+        ASTNode* tree = builder.buildFromTokens(tokenizeExpression(expr));
+        QuaternionGenerator generator;
+        std::string resultVar = generator.genExpression(tree);
+        delete tree;
+        generator.eliminateDeadCode(resultVar);
+        for (int regs : {4, 8, 16, 32}) {
+            LinearScanAllocator allocator(regs);
+            std::vector<TargetInstruction> code = allocator.generate(generator.getQuaternions(), {resultVar});
+            const RegisterAllocationStats& s = allocator.getStats();
+            os << std::left << std::setw(10) << leaves << std::right << std::setw(6) << regs
+               << std::setw(10) << generator.getQuaternions().size() << std::setw(10) << s.spilledIntervals
+               << std::setw(10) << s.spillStores << std::setw(10) << s.spillLoads
+               << std::setw(10) << s.variableLoads << std::setw(10) << code.size() << std::endl;
+        }
+    }
+}
+
+// 窥孔优化统计
+struct PeepholeStats {
+    size_t instructionsBefore = 0;
+    size_t instructionsAfter = 0;
+    int sweeps = 0;
+    std::map<std::string, int> ruleHits;  // 每条规则的命中次数
+};
+
+// 窥孔优化器：在结构化目标指令上用固定大小的窗口匹配规则并就地改写，直到没有规则命中。
+// 寄存器的全局读取次数随改写增量维护，用于判定窗口之外也不会再被读取的定义
+class PeepholeOptimizer {
+private:
+    struct Rule {
+        std::string name;
+        std::function<bool(size_t)> apply;  // 以第 i 条指令为窗口起点尝试改写
+    };
+
+    std::vector<TargetInstruction> code;
+    std::vector<Rule> rules;
+    std::unordered_set<std::string> liveOut;     // 出口处仍需保留的寄存器（表达式结果所在位置）
+    std::unordered_map<std::string, int> readCount;
+    size_t window;
+    PeepholeStats stats;
+
+    static bool isRegister(const std::string& operand) {
+        return operand.size() > 1 && operand[0] == 'R' &&
+               std::all_of(operand.begin() + 1, operand.end(),
+                           [](char c) { return std::isdigit(static_cast<unsigned char>(c)); });
+    }
+
+    // LD 的 src1 是内存操作数（变量名或溢出槽），变量也可能叫 R3，所以按位置而不是按名字区分：
+    // 只有其它指令的 src1 与所有指令的 src2 是对寄存器的读取
+    static bool readsRegisterSrc1(const TargetInstruction& instruction) {
+        return instruction.opcode != "LD";
+    }
+
+    static bool readsRegister(const TargetInstruction& instruction, const std::string& reg) {
+        return (readsRegisterSrc1(instruction) && instruction.src1 == reg) || instruction.src2 == reg;
+    }
+
+    static bool isImmediate(const std::string& operand) {
+        return !operand.empty() && operand[0] == '#';
+    }
+
+    static bool endsBlock(const TargetInstruction& instruction) {
+        return instruction.isLabel() || instruction.isJump();
+    }
+
+    // 维护读取计数：指令加入或移出代码时调用
+    void account(const TargetInstruction& instruction, int delta) {
+        if (readsRegisterSrc1(instruction) && isRegister(instruction.src1)) readCount[instruction.src1] += delta;
+        if (isRegister(instruction.src2)) readCount[instruction.src2] += delta;
+    }
+
+    void replaceInstruction(size_t i, const TargetInstruction& instruction) {
+        account(code[i], -1);
+        code[i] = instruction;
+        account(code[i], 1);
+    }
+
+    void eraseInstruction(size_t i) {
+        account(code[i], -1);
+        code.erase(code.begin() + i);
+    }
+
+    // 把第 j 条指令中对 from 的读取改为 to（ST 的源必须是寄存器，不替换为立即数；LD 的内存操作数不替换）
+    bool substituteReads(size_t j, const std::string& from, const std::string& to) {
+        TargetInstruction instruction = code[j];
+        bool changed = false;
+        if (instruction.src1 == from && readsRegisterSrc1(instruction) &&
+            !(instruction.opcode == "ST" && isImmediate(to))) {
+            instruction.src1 = to;
+            changed = true;
+        }
+        if (instruction.src2 == from) {
+            instruction.src2 = to;
+            changed = true;
+        }
+        if (changed) replaceInstruction(j, instruction);
+        return changed;
+    }
+
+    // 第 i 条指令写入的寄存器此后是否不再被读取：全局没有任何读取，
+    // 或在窗口内、基本块结束前先被重新定义；遇到标签、跳转或窗口用尽时保守地认为仍然活跃
+    bool deadAfter(size_t i, const std::string& reg) {
+        if (liveOut.count(reg)) return false;
+        if (readCount[reg] == 0) return true;
+        for (size_t k = i + 1; k < code.size() && k <= i + window; ++k) {
+            if (readsRegister(code[k], reg)) return false;
+            if (code[k].writesRegister() && code[k].dst == reg) return true;
+            if (endsBlock(code[k])) return false;
+        }
+        return false;
+    }
+
+    // 把定义 reg 为 value 的事实向后传播到窗口内同一基本块中的读取，直到 reg 或 value 被改写
+    bool propagate(size_t i, const std::string& reg, const std::string& value) {
+        bool changed = false;
+        for (size_t j = i + 1; j < code.size() && j <= i + window; ++j) {
+            if (code[j].isLabel()) break;
+            changed = substituteReads(j, reg, value) || changed;
+            if (code[j].writesRegister() && (code[j].dst == reg || code[j].dst == value)) break;
+            if (code[j].isJump()) break;
+        }
+        return changed;
+    }
+
+    void registerDefaultRules() {
+        // MOV r, r
+        rules.push_back({"self-move", [this](size_t i) {
+            if (code[i].opcode == "MOV" && code[i].dst == code[i].src1) {
+                eraseInstruction(i);
+                return true;
+            }
+            return false;
+        }});
+        // JMP L 紧跟 L:
+        rules.push_back({"jump-to-next", [this](size_t i) {
+            if (code[i].opcode == "JMP" && i + 1 < code.size() && code[i + 1].isLabel() && code[i + 1].label == code[i].label) {
+                eraseInstruction(i);
+                return true;
+            }
+            return false;
+        }});
+        // 含立即数或相同操作数的运算化简为 MOV
+        rules.push_back({"fold-immediate", [this](size_t i) {
+            const TargetInstruction& in = code[i];
+            std::string value;
+            if (in.opcode == "NOT" && isImmediate(in.src1)) {
+                value = (in.src1 == "#0") ? "#1" : "#0";
+            } else if (in.opcode == "OR" || in.opcode == "AND") {
+                std::string absorbing = (in.opcode == "OR") ? "#1" : "#0";
+                std::string identity = (in.opcode == "OR") ? "#0" : "#1";
+                if (in.src1 == absorbing || in.src2 == absorbing) value = absorbing;
+                else if (in.src1 == identity) value = in.src2;
+                else if (in.src2 == identity) value = in.src1;
+                else if (in.src1 == in.src2) value = in.src1;
+            }
+            if (value.empty()) return false;
+            replaceInstruction(i, TargetInstruction::make("MOV", in.dst, value));
+            return true;
+        }});
+        // MOV r, #k 之后对 r 的读取直接使用立即数，避免常量在每次使用时重新装入
+        rules.push_back({"propagate-constant", [this](size_t i) {
+            return code[i].opcode == "MOV" && isImmediate(code[i].src1) && propagate(i, code[i].dst, code[i].src1);
+        }});
+        // MOV d, s 之后对 d 的读取改为读 s，使只用一次的传送变为死代码
+        rules.push_back({"propagate-copy", [this](size_t i) {
+            return code[i].opcode == "MOV" && isRegister(code[i].src1) && propagate(i, code[i].dst, code[i].src1);
+        }});
+        // NOT a, b ... NOT b, c  =>  NOT a, b ... MOV c, a
+        rules.push_back({"not-not", [this](size_t i) {
+            if (code[i].opcode != "NOT" || !isRegister(code[i].src1) || code[i].src1 == code[i].dst) return false;
+            const std::string a = code[i].src1, b = code[i].dst;
+            for (size_t j = i + 1; j < code.size() && j <= i + window; ++j) {
+                if (code[j].isLabel()) break;
+                if (code[j].opcode == "NOT" && code[j].src1 == b) {
+                    replaceInstruction(j, TargetInstruction::make("MOV", code[j].dst, a));
+                    return true;
+                }
+                if (code[j].writesRegister() && (code[j].dst == a || code[j].dst == b)) break;
+                if (code[j].isJump()) break;
+            }
+            return false;
+        }});
+        // LD r, m ... LD r2, m  或  ST r, m ... LD r2, m  =>  MOV r2, r
+        rules.push_back({"redundant-load", [this](size_t i) {
+            if (code[i].opcode != "LD" && code[i].opcode != "ST") return false;
+            const std::string reg = (code[i].opcode == "LD") ? code[i].dst : code[i].src1;
+            const std::string mem = (code[i].opcode == "LD") ? code[i].src1 : code[i].dst;
+            for (size_t j = i + 1; j < code.size() && j <= i + window; ++j) {
+                if (code[j].isLabel()) break;
+                if (code[j].opcode == "LD" && code[j].src1 == mem) {
+                    replaceInstruction(j, TargetInstruction::make("MOV", code[j].dst, reg));
+                    return true;
+                }
+                if (code[j].opcode == "ST" && code[j].dst == mem) break;
+                if (code[j].writesRegister() && code[j].dst == reg) break;
+                if (code[j].isJump()) break;
+            }
+            return false;
+        }});
+        // 写入后不再被读取的寄存器定义
+        rules.push_back({"dead-def", [this](size_t i) {
+            if (code[i].writesRegister() && deadAfter(i, code[i].dst)) {
+                eraseInstruction(i);
+                return true;
+            }
+            return false;
+        }});
+    }
+
+public:
+    explicit PeepholeOptimizer(const std::unordered_set<std::string>& liveOut, size_t window = 16)
+        : liveOut(liveOut), window(window) {
+        registerDefaultRules();
+    }
+
+    std::vector<TargetInstruction> optimize(std::vector<TargetInstruction> input) {
+        code = std::move(input);
+        stats = PeepholeStats();
+        stats.instructionsBefore = code.size();
+        readCount.clear();
+        for (const auto& instruction : code) account(instruction, 1);
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            ++stats.sweeps;
+            for (size_t i = 0; i < code.size(); ++i) {
+                for (const auto& rule : rules) {
+                    if (i >= code.size()) break;
+                    if (rule.apply(i)) {
+                        ++stats.ruleHits[rule.name];
+                        changed = true;
+                    }
+                }
+            }
+        }
+        stats.instructionsAfter = code.size();
+        return std::move(code);
+    }
+
+    const PeepholeStats& getStats() const {
+        return stats;
+    }
+};
+
+// 在基准语料上报告窥孔优化前后的指令数
+void runPeepholeBenchmark(std::ostream& os) {
+    std::mt19937 rng(99);
+    std::vector<std::pair<std::string, std::string>> corpus = {
+        {"source_like", "-true V false V (a ^ -(-b))"},
+        {"constants", "(a ^ true) V (false ^ b) V (true V c) ^ -(-(d V false))"},
+    };
+    for (int leaves : {10, 100, 1000, 10000}) {
+        corpus.push_back({"random_" + std::to_string(leaves), generateRandomExpression(std::max(2, leaves / 4), leaves, rng)});
+    }
+
+    std::map<std::string, int> totalHits;
+    os << std::left << std::setw(16) << "expr" << std::setw(12) << "codegen" << std::right << std::setw(10) << "before"
+       << std::setw(10) << "after" << std::setw(10) << "saved%" << std::endl;
+    for (const auto& entry : corpus) {
+        ASTBuilder builder;
+        ASTNode* tree = builder.buildFromTokens(tokenizeExpression(entry.second));
+        for (const std::string kind : {"naive", "jumping", "linscan8"}) {
+            QuaternionGenerator generator;
+            std::string resultVar = (kind == "jumping") ? generator.genJumpingCode(tree) : generator.genExpression(tree);
+            generator.eliminateDeadCode(resultVar);
+
+            std::vector<TargetInstruction> code;
+            std::string location;
+            if (kind == "linscan8") {
+                LinearScanAllocator allocator(8);
+                code = allocator.generate(generator.getQuaternions(), {resultVar});
+                location = allocator.locationOf(resultVar);
+            } else {
+                std::map<std::string, std::string> registerMap;
+                code = generator.generateTargetInstructions(&registerMap);
+                location = registerMap.count(resultVar) ? registerMap[resultVar] : resultVar;
+            }
+
+            PeepholeOptimizer optimizer({location});
+            std::vector<TargetInstruction> optimized = optimizer.optimize(code);
+            const PeepholeStats& s = optimizer.getStats();
+            for (const auto& hit : s.ruleHits) totalHits[hit.first] += hit.second;
+            double saved = s.instructionsBefore ? 100.0 * (s.instructionsBefore - s.instructionsAfter) / s.instructionsBefore : 0;
+            os << std::left << std::setw(16) << entry.first << std::setw(12) << kind << std::right
+               << std::setw(10) << s.instructionsBefore << std::setw(10) << s.instructionsAfter
+               << std::setw(10) << std::fixed << std::setprecision(1) << saved << std::endl;
+            os.unsetf(std::ios::fixed);
+        }
+        delete tree;
+    }
+    os << "rule hits:";
+    for (const auto& hit : totalHits) os << " " << hit.first << "=" << hit.second;
+    os << std::endl;
+
+    // 名为 R3 的变量：LD 的内存操作数不能被当作寄存器 R3 代入常量
+    PeepholeOptimizer optimizer({"R1"});
+    std::vector<TargetInstruction> optimized = optimizer.optimize({
+        TargetInstruction::make("MOV", "R3", "#1"),
+        TargetInstruction::make("LD", "R0", "R3"),
+        TargetInstruction::make("AND", "R1", "R0", "R3"),
+    });
+    bool kept = std::any_of(optimized.begin(), optimized.end(), [](const TargetInstruction& instruction) {
+        return instruction.opcode == "LD" && instruction.src1 == "R3";
+    });
+    os << "memory operand named like a register: " << (kept ? "ok" : "FAIL") << std::endl;
+}
+
+// 位并行求值器：把直线型四元式编译为槽位程序，每个 64 位字的每一位是一组变量赋值，
+// 一条按位指令同时求出 64（AVX2 为 256，AVX-512 为 512）组赋值的结果
+class BitParallelEvaluator {
+public:
+    enum class Backend { Scalar, AVX2, AVX512 };
+
+    // 每次运行槽位程序处理的字数（4096 组赋值）
+    static constexpr size_t CHUNK_WORDS = 64;
+
+private:
+    enum Opcode : uint8_t { OP_COPY, OP_NOT, OP_AND, OP_OR };
+
+    struct Instruction {
+        Opcode op;
+        uint32_t dst;
+        uint32_t a;
+        uint32_t b;
+    };
+
+    std::vector<std::string> inputVars;        // 槽位 0..n-1 为输入变量
+    std::vector<Instruction> program;
+    uint32_t zeroSlot = 0;
+    uint32_t onesSlot = 0;
+    // 执行完前 position 条指令时第 output 个输出就在槽位 slot 中，此时取出；
+    // 输出不必占住槽位到程序结束，多输出程序的槽位数仍只取决于同时活跃的值
+    struct OutputPoint {
+        size_t position;
+        size_t output;
+        uint32_t slot;
+    };
+    std::vector<OutputPoint> outputPoints;     // 按 position 排序
+    size_t numOutputs = 0;
+    uint32_t numSlots = 0;
+    Backend backend;
+
+    static void runScalar(const Instruction* code, size_t n, uint64_t* slots) {
+        for (size_t i = 0; i < n; ++i) {
+            const Instruction& in = code[i];
+            uint64_t* d = slots + in.dst * CHUNK_WORDS;
+            const uint64_t* a = slots + in.a * CHUNK_WORDS;
+            const uint64_t* b = slots + in.b * CHUNK_WORDS;
+            switch (in.op) {
+                case OP_COPY: for (size_t k = 0; k < CHUNK_WORDS; ++k) d[k] = a[k]; break;
+                case OP_NOT: for (size_t k = 0; k < CHUNK_WORDS; ++k) d[k] = ~a[k]; break;
+                case OP_AND: for (size_t k = 0; k < CHUNK_WORDS; ++k) d[k] = a[k] & b[k]; break;
+                case OP_OR: for (size_t k = 0; k < CHUNK_WORDS; ++k) d[k] = a[k] | b[k]; break;
+            }
+        }
+    }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    __attribute__((target("avx2")))
+    static void runAVX2(const Instruction* code, size_t n, uint64_t* slots) {
+        const __m256i ones = _mm256_set1_epi64x(-1);
+        for (size_t i = 0; i < n; ++i) {
+            const Instruction& in = code[i];
+            __m256i* d = reinterpret_cast<__m256i*>(slots + in.dst * CHUNK_WORDS);
+            const __m256i* a = reinterpret_cast<const __m256i*>(slots + in.a * CHUNK_WORDS);
+            const __m256i* b = reinterpret_cast<const __m256i*>(slots + in.b * CHUNK_WORDS);
+            for (size_t k = 0; k < CHUNK_WORDS / 4; ++k) {
+                __m256i x = _mm256_loadu_si256(a + k);
+                __m256i r;
+                switch (in.op) {
+                    case OP_COPY: r = x; break;
+                    case OP_NOT: r = _mm256_xor_si256(x, ones); break;
+                    case OP_AND: r = _mm256_and_si256(x, _mm256_loadu_si256(b + k)); break;
+                    default: r = _mm256_or_si256(x, _mm256_loadu_si256(b + k)); break;
+                }
+                _mm256_storeu_si256(d + k, r);
+            }
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    static void runAVX512(const Instruction* code, size_t n, uint64_t* slots) {
+        const __m512i ones = _mm512_set1_epi64(-1);
+        for (size_t i = 0; i < n; ++i) {
+            const Instruction& in = code[i];
+            uint64_t* d = slots + in.dst * CHUNK_WORDS;
+            const uint64_t* a = slots + in.a * CHUNK_WORDS;
+            const uint64_t* b = slots + in.b * CHUNK_WORDS;
+            for (size_t k = 0; k < CHUNK_WORDS; k += 8) {
+                __m512i x = _mm512_loadu_si512(a + k);
+                __m512i r;
+                switch (in.op) {
+                    case OP_COPY: r = x; break;
+                    case OP_NOT: r = _mm512_xor_si512(x, ones); break;
+                    case OP_AND: r = _mm512_and_si512(x, _mm512_loadu_si512(b + k)); break;
+                    default: r = _mm512_or_si512(x, _mm512_loadu_si512(b + k)); break;
+                }
+                _mm512_storeu_si512(d + k, r);
+            }
+        }
+    }
+#endif
+
+    // 执行指令 [begin, end)
+    void run(uint64_t* slots, size_t begin, size_t end) const {
+        switch (backend) {
+#if defined(__x86_64__) && defined(__GNUC__)
+            case Backend::AVX512: runAVX512(program.data() + begin, end - begin, slots); break;
+            case Backend::AVX2: runAVX2(program.data() + begin, end - begin, slots); break;
+#endif
+            default: runScalar(program.data() + begin, end - begin, slots); break;
+        }
+    }
+
+public:
+    // quads 必须是不含跳转的值代码（genExpression 的输出），resultVar 为要求值的结果
+    BitParallelEvaluator(const std::vector<Quadruple>& quads, const std::string& resultVar)
+        : BitParallelEvaluator(quads, std::vector<std::string>{resultVar}) {}
+
+    // 多个输出共用一段程序（如跨表达式值编号后的批量程序），每条四元式每轮只执行一次
+    BitParallelEvaluator(const std::vector<Quadruple>& quads, const std::vector<std::string>& resultVars)
+        : backend(bestBackend()) {
+        std::unordered_set<std::string> resultSet(resultVars.begin(), resultVars.end());
+        std::unordered_map<std::string, OutputPoint> lastDefinition;  // 输出变量最后一次定义之后的位置与槽位
+        std::unordered_map<std::string, int> lastUse;
+        std::unordered_set<std::string> defined;
+        std::unordered_set<std::string> inputSet;
+        for (int i = 0; i < static_cast<int>(quads.size()); ++i) {
+            const Quadruple& q = quads[i];
+            if (q.op != "!" && q.op != "V" && q.op != "^" && q.op != "=") {
+                throw std::runtime_error("Bit-parallel evaluation needs straight-line code, found '" + q.op + "'");
+            }
+            for (const std::string* arg : {&q.arg1, &q.arg2}) {
+                if (!isVariableOperand(*arg)) continue;
+                lastUse[*arg] = i;
+                if (!defined.count(*arg) && inputSet.insert(*arg).second) {
+                    inputVars.push_back(*arg);
+                }
+            }
+            defined.insert(q.result);
+        }
+        for (const auto& resultVar : resultVars) {
+            if (isVariableOperand(resultVar) && !defined.count(resultVar) && inputSet.insert(resultVar).second) {
+                inputVars.push_back(resultVar);
+            }
+        }
+
+        std::unordered_map<std::string, uint32_t> slotOf;
+        for (const auto& var : inputVars) slotOf[var] = numSlots++;
+        zeroSlot = numSlots++;
+        onesSlot = numSlots++;
+
+        // 临时值的槽位在最后一次使用后回收；按位运算逐字进行，目的槽位与源槽位相同也安全
+        std::vector<uint32_t> freeSlots;
+        auto operand = [&](const std::string& arg) -> uint32_t {
+            if (arg == "true") return onesSlot;
+            if (arg == "false") return zeroSlot;
+            auto it = slotOf.find(arg);
+            if (it == slotOf.end()) throw std::runtime_error("Use of undefined value '" + arg + "'");
+            return it->second;
+        };
+        auto release = [&](const std::string& var, int i) {
+            auto it = lastUse.find(var);
+            bool expired = it == lastUse.end() || it->second <= i;
+            if (expired && defined.count(var) && slotOf.count(var)) {
+                freeSlots.push_back(slotOf[var]);
+                slotOf.erase(var);
+            }
+        };
+        for (int i = 0; i < static_cast<int>(quads.size()); ++i) {
+            const Quadruple& q = quads[i];
+            Instruction in;
+            in.op = (q.op == "!") ? OP_NOT : (q.op == "^") ? OP_AND : (q.op == "V") ? OP_OR : OP_COPY;
+            in.a = operand(q.arg1);
+            in.b = (in.op == OP_AND || in.op == OP_OR) ? operand(q.arg2) : in.a;
+            release(q.arg1, i);
+            if (q.arg2 != q.arg1) release(q.arg2, i);
+
+            auto it = slotOf.find(q.result);
+            if (it != slotOf.end()) {
+                in.dst = it->second;
+            } else if (!freeSlots.empty()) {
+                in.dst = freeSlots.back();
+                freeSlots.pop_back();
+            } else {
+                in.dst = numSlots++;
+            }
+            slotOf[q.result] = in.dst;
+            program.push_back(in);
+            if (resultSet.count(q.result)) lastDefinition[q.result] = {program.size(), 0, in.dst};
+            release(q.result, i);
+        }
+        // 输入变量与常量的槽位从不被覆盖，一开始就可以取出
+        numOutputs = resultVars.size();
+        for (size_t r = 0; r < numOutputs; ++r) {
+            auto it = lastDefinition.find(resultVars[r]);
+            OutputPoint point = it != lastDefinition.end() ? it->second : OutputPoint{0, 0, operand(resultVars[r])};
+            point.output = r;
+            outputPoints.push_back(point);
+        }
+        std::stable_sort(outputPoints.begin(), outputPoints.end(),
+                         [](const OutputPoint& a, const OutputPoint& b) { return a.position < b.position; });
+    }
+
+    // 当前 CPU 支持的最宽后端
+    static Backend bestBackend() {
+#if defined(__x86_64__) && defined(__GNUC__)
+        if (__builtin_cpu_supports("avx512f")) return Backend::AVX512;
+        if (__builtin_cpu_supports("avx2")) return Backend::AVX2;
+#endif
+        return Backend::Scalar;
+    }
+
+    static bool isSupported(Backend b) {
+        if (b == Backend::Scalar) return true;
+#if defined(__x86_64__) && defined(__GNUC__)
+        if (b == Backend::AVX2) return __builtin_cpu_supports("avx2");
+        if (b == Backend::AVX512) return __builtin_cpu_supports("avx512f");
+#endif
+        return false;
+    }
+
+    static const char* backendName(Backend b) {
+        return b == Backend::AVX512 ? "avx512" : b == Backend::AVX2 ? "avx2" : "scalar64";
+    }
+
+    void setBackend(Backend b) {
+        if (!isSupported(b)) {
+            throw std::runtime_error(std::string("Backend not supported on this CPU: ") + backendName(b));
+        }
+        backend = b;
+    }
+
+    Backend getBackend() const {
+        return backend;
+    }
+
+    // 输入变量，按 evaluate 所需列的顺序
+    const std::vector<std::string>& variables() const {
+        return inputVars;
+    }
+
+    size_t instructionCount() const {
+        return program.size();
+    }
+
+    size_t outputCount() const {
+        return numOutputs;
+    }
+
+    // columns[i] 为 variables()[i] 的位图（第 j 组赋值位于字 j/64 的第 j%64 位），
+    // 结果写入 out 的 numWords 个字
+    void evaluate(const std::vector<const uint64_t*>& columns, size_t numWords, uint64_t* out) const {
+        evaluate(columns, numWords, std::vector<uint64_t*>{out});
+    }
+
+    // 多输出：第 i 个输出写入 outs[i] 的 numWords 个字
+    void evaluate(const std::vector<const uint64_t*>& columns, size_t numWords,
+                  const std::vector<uint64_t*>& outs) const {
+        if (outs.size() != numOutputs) {
+            throw std::runtime_error("Expected " + std::to_string(numOutputs) + " outputs, got " +
+                                     std::to_string(outs.size()));
+        }
+        if (columns.size() != inputVars.size()) {
+            throw std::runtime_error("Expected " + std::to_string(inputVars.size()) + " columns, got " +
+                                     std::to_string(columns.size()));
+        }
+        std::vector<uint64_t> slots(static_cast<size_t>(numSlots) * CHUNK_WORDS, 0);
+        std::fill_n(slots.begin() + onesSlot * CHUNK_WORDS, CHUNK_WORDS, ~0ULL);
+        for (size_t w = 0; w < numWords; w += CHUNK_WORDS) {
+            size_t n = std::min(CHUNK_WORDS, numWords - w);
+            for (size_t v = 0; v < columns.size(); ++v) {
+                std::memcpy(slots.data() + v * CHUNK_WORDS, columns[v] + w, n * sizeof(uint64_t));
+            }
+            // 最后一个输出之后的指令不影响任何输出，不必执行
+            size_t executed = 0;
+            for (const auto& point : outputPoints) {
+                if (point.position > executed) {
+                    run(slots.data(), executed, point.position);
+                    executed = point.position;
+                }
+                std::memcpy(outs[point.output] + w, slots.data() + point.slot * CHUNK_WORDS, n * sizeof(uint64_t));
+            }
+        }
+    }
+
+    // 按变量名给出列位图，返回 numAssignments 位的结果位图（末尾多余的位清零）
+    std::vector<uint64_t> evaluate(const std::unordered_map<std::string, std::vector<uint64_t>>& columns,
+                                   size_t numAssignments) const {
+        size_t numWords = (numAssignments + 63) / 64;
+        std::vector<const uint64_t*> ordered;
+        for (const auto& var : inputVars) {
+            auto it = columns.find(var);
+            if (it == columns.end()) throw std::runtime_error("Missing column for variable '" + var + "'");
+            if (it->second.size() < numWords) throw std::runtime_error("Column for '" + var + "' is too short");
+            ordered.push_back(it->second.data());
+        }
+        std::vector<uint64_t> result(numWords);
+        evaluate(ordered, numWords, result.data());
+        if (numAssignments % 64) result.back() &= (1ULL << (numAssignments % 64)) - 1;
+        return result;
+    }
+
+    // 穷举 numVars 个变量全部 2^numVars 组赋值的列位图：第 j 组赋值中变量 i 取 j 的第 i 位
+    static std::vector<std::vector<uint64_t>> truthTableColumns(size_t numVars) {
+        static const uint64_t pattern[6] = {
+            0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+            0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL,
+        };
+        size_t numWords = numVars <= 6 ? 1 : (size_t(1) << (numVars - 6));
+        std::vector<std::vector<uint64_t>> columns(numVars, std::vector<uint64_t>(numWords));
+        for (size_t v = 0; v < numVars; ++v) {
+            for (size_t w = 0; w < numWords; ++w) {
+                columns[v][w] = v < 6 ? pattern[v] : (((w >> (v - 6)) & 1) ? ~0ULL : 0);
+            }
+        }
+        return columns;
+    }
+};
+
+// 位并行求值吞吐量：各后端在随机列位图上求值，并与 BDD 逐组赋值的结果抽样比对
+void runBitParallelBenchmark(std::ostream& os) {
+    std::mt19937 rng(7);
+    std::mt19937_64 bits(11);
+    const size_t numWords = size_t(1) << 16;  // 4M 组赋值
+    os << std::left << std::setw(14) << "expr" << std::right << std::setw(8) << "vars" << std::setw(8) << "ops"
+       << std::setw(10) << "backend" << std::setw(12) << "ms" << std::setw(14) << "Gassign/s" << std::endl;
+    for (int leaves : {8, 64, 512}) {
+        int numVars = std::max(3, leaves / 2);
+        std::string expr = generateRandomExpression(numVars, leaves, rng);
+        ASTBuilder builder;
+        ASTNode* tree = builder.buildFromTokens(tokenizeExpression(expr));
+        QuaternionGenerator generator;
+        std::string resultVar = generator.genExpression(tree);
+        generator.eliminateDeadCode(resultVar);
+        BitParallelEvaluator evaluator(generator.getQuaternions(), resultVar);
+
+        std::vector<std::vector<uint64_t>> data(evaluator.variables().size(), std::vector<uint64_t>(numWords));
+        std::vector<const uint64_t*> columns;
+        for (auto& column : data) {
+            for (auto& word : column) word = bits();
+            columns.push_back(column.data());
+        }
+
+        std::vector<uint64_t> reference;
+        for (auto b : {BitParallelEvaluator::Backend::Scalar, BitParallelEvaluator::Backend::AVX2,
+                       BitParallelEvaluator::Backend::AVX512}) {
+            if (!BitParallelEvaluator::isSupported(b)) continue;
+            evaluator.setBackend(b);
+            std::vector<uint64_t> out(numWords);
+            double best = 1e100;
+            for (int rep = 0; rep < 3; ++rep) {
+                auto start = std::chrono::steady_clock::now();
+                evaluator.evaluate(columns, numWords, out.data());
+                best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+            if (reference.empty()) reference = out;
+            bool agrees = out == reference;
+            os << std::left << std::setw(14) << ("random_" + std::to_string(leaves)) << std::right
+               << std::setw(8) << evaluator.variables().size() << std::setw(8) << evaluator.instructionCount()
+               << std::setw(10) << BitParallelEvaluator::backendName(b) << std::setw(12) << std::fixed
+               << std::setprecision(2) << best * 1e3 << std::setw(14) << numWords * 64 / best / 1e9
+               << (agrees ? "" : "  MISMATCH") << std::endl;
+            os.unsetf(std::ios::fixed);
+        }
+
+        // 抽样比对：按位取出若干组赋值，逐条解释四元式求值
+        int mismatches = 0;
+        for (int sample = 0; sample < 256; ++sample) {
+            size_t lane = bits() % (numWords * 64);
+            std::unordered_map<std::string, bool> values = {{"true", true}, {"false", false}};
+            for (size_t v = 0; v < data.size(); ++v) {
+                values[evaluator.variables()[v]] = (data[v][lane / 64] >> (lane % 64)) & 1;
+            }
+            for (const auto& q : generator.getQuaternions()) {
+                bool a = values[q.arg1];
+                values[q.result] = (q.op == "!") ? !a : (q.op == "^") ? (a && values[q.arg2])
+                                 : (q.op == "V") ? (a || values[q.arg2]) : a;
+            }
+            if (values[resultVar] != (((reference[lane / 64] >> (lane % 64)) & 1) != 0)) ++mismatches;
+        }
+        if (mismatches) os << "  " << mismatches << " sampled assignments disagree with the quadruple interpreter" << std::endl;
+        delete tree;
+    }
+}
+
+// 字节码程序：由四元式编译得到的寄存器机指令流，每条指令的首字低 8 位是操作码、高 24 位是寄存器号，
+// 之后是源寄存器或跳转目标（字偏移）。寄存器 0/1 固定为 false/true，2..n+1 为输入变量
+class BytecodeProgram {
+public:
+    enum Opcode : uint32_t { HALT, MOV, NOT, AND, OR, JMP, JNZ, JZ };
+
+private:
+    std::vector<uint32_t> code;
+    std::vector<std::string> inputVars;
+    uint32_t numRegisters = 2;
+
+    static const char* opcodeName(uint32_t op) {
+        static const char* const names[] = {"HALT", "MOV", "NOT", "AND", "OR", "JMP", "JNZ", "JZ"};
+        return names[op];
+    }
+
+    // 每条指令占用的字数
+    static size_t width(uint32_t op) {
+        return (op == AND || op == OR) ? 3 : (op == HALT) ? 1 : 2;
+    }
+
+public:
+    // quads 可以是值代码也可以是短路跳转代码（跳转只向前），resultVar 为 HALT 返回的值
+    BytecodeProgram(const std::vector<Quadruple>& quads, const std::string& resultVar) {
+        // 区间 [第一次定义, 最后一次使用] 内占用寄存器；跳转只向前，任何路径都落在该区间内
+        std::unordered_map<std::string, int> lastUse;
+        std::unordered_set<std::string> defined;
+        std::unordered_set<std::string> inputSet;
+        for (int i = 0; i < static_cast<int>(quads.size()); ++i) {
+            const Quadruple& q = quads[i];
+            if (q.op == "label" || q.op == "j") continue;
+            for (const std::string* arg : {&q.arg1, &q.arg2}) {
+                if (!isVariableOperand(*arg)) continue;
+                lastUse[*arg] = i;
+                if (!defined.count(*arg) && inputSet.insert(*arg).second) {
+                    inputVars.push_back(*arg);
+                }
+            }
+            if (q.op != "jnz" && q.op != "jz") defined.insert(q.result);
+        }
+        if (isVariableOperand(resultVar) && !defined.count(resultVar) &&
+            inputSet.insert(resultVar).second) {
+            inputVars.push_back(resultVar);
+        }
+
+        std::unordered_map<std::string, uint32_t> regOf;
+        for (const auto& var : inputVars) regOf[var] = numRegisters++;
+        std::vector<uint32_t> freeRegs;
+        auto operand = [&](const std::string& arg) -> uint32_t {
+            if (arg == "true") return 1;
+            if (arg == "false") return 0;
+            auto it = regOf.find(arg);
+            if (it == regOf.end()) throw std::runtime_error("Use of undefined value '" + arg + "'");
+            return it->second;
+        };
+        auto release = [&](const std::string& var, int i) {
+            auto it = lastUse.find(var);
+            bool expired = it == lastUse.end() || it->second <= i;
+            if (expired && var != resultVar && defined.count(var) && regOf.count(var)) {
+                freeRegs.push_back(regOf[var]);
+                regOf.erase(var);
+            }
+        };
+        auto destination = [&](const std::string& var) -> uint32_t {
+            auto it = regOf.find(var);
+            if (it != regOf.end()) return it->second;
+            uint32_t r;
+            if (!freeRegs.empty()) {
+                r = freeRegs.back();
+                freeRegs.pop_back();
+            } else {
+                r = numRegisters++;
+            }
+            if (r >= (1u << 24)) throw std::runtime_error("Too many registers for bytecode encoding");
+            regOf[var] = r;
+            return r;
+        };
+
+        std::unordered_map<std::string, uint32_t> labelPc;
+        std::vector<std::pair<size_t, std::string>> fixups;  // 待回填的跳转目标
+        for (int i = 0; i < static_cast<int>(quads.size()); ++i) {
+            const Quadruple& q = quads[i];
+            if (q.op == "label") {
+                labelPc[q.result] = code.size();
+            } else if (q.op == "j") {
+                code.push_back(JMP);
+                fixups.push_back({code.size(), q.result});
+                code.push_back(0);
+            } else if (q.op == "jnz" || q.op == "jz") {
+                uint32_t cond = operand(q.arg1);
+                release(q.arg1, i);
+                code.push_back((q.op == "jnz" ? JNZ : JZ) | (cond << 8));
+                fixups.push_back({code.size(), q.result});
+                code.push_back(0);
+            } else if (q.op == "!" || q.op == "=" || q.op == "V" || q.op == "^") {
+                uint32_t a = operand(q.arg1);
+                bool binary = (q.op == "V" || q.op == "^");
+                uint32_t b = binary ? operand(q.arg2) : 0;
+                release(q.arg1, i);
+                if (binary && q.arg2 != q.arg1) release(q.arg2, i);
+                uint32_t op = (q.op == "!") ? NOT : (q.op == "=") ? MOV : (q.op == "^") ? AND : OR;
+                code.push_back(op | (destination(q.result) << 8));
+                code.push_back(a);
+                if (binary) code.push_back(b);
+                release(q.result, i);
+            } else {
+                throw std::runtime_error("Unsupported quadruple op '" + q.op + "'");
+            }
+        }
+        code.push_back(HALT | (operand(resultVar) << 8));
+        for (const auto& fixup : fixups) {
+            auto it = labelPc.find(fixup.second);
+            if (it == labelPc.end()) throw std::runtime_error("Undefined label '" + fixup.second + "'");
+            code[fixup.first] = it->second;
+        }
+    }
+
+    const std::vector<uint32_t>& words() const {
+        return code;
+    }
+
+    const std::vector<std::string>& variables() const {
+        return inputVars;
+    }
+
+    uint32_t registerCount() const {
+        return numRegisters;
+    }
+
+    std::string disassemble() const {
+        std::ostringstream out;
+        for (size_t pc = 0; pc < code.size(); pc += width(code[pc] & 0xff)) {
+            uint32_t op = code[pc] & 0xff, r = code[pc] >> 8;
+            out << std::setw(5) << pc << ": " << opcodeName(op);
+            if (op == JMP) out << " @" << code[pc + 1];
+            else if (op == JNZ || op == JZ) out << " r" << r << ", @" << code[pc + 1];
+            else if (op == HALT) out << " r" << r;
+            else {
+                out << " r" << r << ", r" << code[pc + 1];
+                if (width(op) == 3) out << ", r" << code[pc + 2];
+            }
+            out << "\n";
+        }
+        return out.str();
+    }
+};
+
+// 字节码解释器：GCC/Clang 下用计算 goto 做线程化分发，其他编译器退回 switch 循环
+class BytecodeVM {
+private:
+    const BytecodeProgram& program;
+    std::vector<uint8_t> registers;  // 单线程复用的寄存器文件
+
+public:
+    explicit BytecodeVM(const BytecodeProgram& program)
+        : program(program), registers(program.registerCount()) {}
+
+    // inputs 按 program.variables() 的顺序给出 0/1；registers 至少 registerCount() 个字节
+    static bool run(const BytecodeProgram& program, const uint8_t* inputs, uint8_t* registers) {
+        const uint32_t* base = program.words().data();
+        const uint32_t* pc = base;
+        registers[0] = 0;
+        registers[1] = 1;
+        std::memcpy(registers + 2, inputs, program.variables().size());
+#if defined(__GNUC__)
+        static const void* const dispatch[] = {&&op_halt, &&op_mov, &&op_not, &&op_and,
+                                               &&op_or, &&op_jmp, &&op_jnz, &&op_jz};
+#define VM_NEXT() goto *dispatch[*pc & 0xff]
+        VM_NEXT();
+    op_mov:
+        registers[pc[0] >> 8] = registers[pc[1]];
+        pc += 2;
+        VM_NEXT();
+    op_not:
+        registers[pc[0] >> 8] = registers[pc[1]] ^ 1;
+        pc += 2;
+        VM_NEXT();
+    op_and:
+        registers[pc[0] >> 8] = registers[pc[1]] & registers[pc[2]];
+        pc += 3;
+        VM_NEXT();
+    op_or:
+        registers[pc[0] >> 8] = registers[pc[1]] | registers[pc[2]];
+        pc += 3;
+        VM_NEXT();
+    op_jmp:
+        pc = base + pc[1];
+        VM_NEXT();
+    op_jnz:
+        pc = registers[pc[0] >> 8] ? base + pc[1] : pc + 2;
+        VM_NEXT();
+    op_jz:
+        pc = registers[pc[0] >> 8] ? pc + 2 : base + pc[1];
+        VM_NEXT();
+    op_halt:
+        return registers[pc[0] >> 8] != 0;
+#undef VM_NEXT
+#else
+        for (;;) {
+            uint32_t r = pc[0] >> 8;
+            switch (pc[0] & 0xff) {
+                case BytecodeProgram::MOV: registers[r] = registers[pc[1]]; pc += 2; break;
+                case BytecodeProgram::NOT: registers[r] = registers[pc[1]] ^ 1; pc += 2; break;
+                case BytecodeProgram::AND: registers[r] = registers[pc[1]] & registers[pc[2]]; pc += 3; break;
+                case BytecodeProgram::OR: registers[r] = registers[pc[1]] | registers[pc[2]]; pc += 3; break;
+                case BytecodeProgram::JMP: pc = base + pc[1]; break;
+                case BytecodeProgram::JNZ: pc = registers[r] ? base + pc[1] : pc + 2; break;
+                case BytecodeProgram::JZ: pc = registers[r] ? pc + 2 : base + pc[1]; break;
+                default: return registers[r] != 0;
+            }
+        }
+#endif
+    }
+
+    bool run(const uint8_t* inputs) {
+        return run(program, inputs, registers.data());
+    }
+
+    bool run(const std::unordered_map<std::string, bool>& values) {
+        std::vector<uint8_t> inputs;
+        for (const auto& var : program.variables()) {
+            auto it = values.find(var);
+            if (it == values.end()) throw std::runtime_error("Unbound variable '" + var + "'");
+            inputs.push_back(it->second);
+        }
+        return run(inputs.data());
+    }
+};
+
+// 直接遍历语法树求值，作为字节码解释器的对照；用显式栈做后序遍历，深树不会耗尽调用栈
+class TreeWalkEvaluator {
+public:
+    static bool evaluate(const ASTNode* root, const std::unordered_map<std::string, bool>& values) {
+        std::vector<std::pair<const ASTNode*, bool>> pending = {{root, false}};
+        std::vector<uint8_t> results;
+        while (!pending.empty()) {
+            auto [node, expanded] = pending.back();
+            pending.pop_back();
+            if (node->type == "constant") {
+                results.push_back(node->value == "true");
+            } else if (node->type == "variable") {
+                auto it = values.find(node->value);
+                if (it == values.end()) throw std::runtime_error("Unbound variable '" + node->value + "'");
+                results.push_back(it->second);
+            } else if (!expanded) {
+                pending.push_back({node, true});
+                if (node->right) pending.push_back({node->right, false});
+                pending.push_back({node->left, false});
+            } else if (node->value == "!") {
+                results.back() ^= 1;
+            } else {
+                uint8_t right = results.back();
+                results.pop_back();
+                results.back() = (node->value == "^") ? (results.back() & right) : (results.back() | right);
+            }
+        }
+        return results.back() != 0;
+    }
+};
+
+// 单组赋值求值的延迟：字节码解释器与语法树遍历在 10 到 10^6 个结点的表达式上对比
+void runBytecodeBenchmark(std::ostream& os) {
+    std::mt19937 rng(17);
+    os << std::left << std::setw(10) << "nodes" << std::right << std::setw(8) << "vars" << std::setw(10) << "words"
+       << std::setw(8) << "regs" << std::setw(10) << "evals" << std::setw(14) << "tree ns/eval"
+       << std::setw(14) << "vm ns/eval" << std::setw(10) << "speedup" << std::endl;
+    for (int nodes : {10, 100, 1000, 10000, 100000, 1000000}) {
+        int leaves = std::max(2, nodes / 2);
+        int numVars = std::max(2, leaves / 4);
+        std::string expr = generateRandomExpression(numVars, leaves, rng);
+        ASTBuilder builder;
+        ASTNode* tree = builder.buildFromTokens(tokenizeExpression(expr));
+        QuaternionGenerator generator;
+        std::string resultVar = generator.genExpression(tree);
+        BytecodeProgram program(generator.getQuaternions(), resultVar);
+        BytecodeVM vm(program);
+
+        int evals = std::max(3, 2000000 / nodes);
+        std::vector<std::unordered_map<std::string, bool>> assignments(evals);
+        std::vector<std::vector<uint8_t>> inputs(evals);
+        for (int e = 0; e < evals; ++e) {
+            for (int v = 0; v < numVars; ++v) assignments[e]["x" + std::to_string(v)] = rng() & 1;
+            for (const auto& var : program.variables()) inputs[e].push_back(assignments[e][var]);
+        }
+
+        std::vector<uint8_t> treeResults(evals), vmResults(evals);
+        auto start = std::chrono::steady_clock::now();
+        for (int e = 0; e < evals; ++e) treeResults[e] = TreeWalkEvaluator::evaluate(tree, assignments[e]);
+        double treeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / evals;
+        start = std::chrono::steady_clock::now();
+        for (int e = 0; e < evals; ++e) vmResults[e] = vm.run(inputs[e].data());
+        double vmNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / evals;
+
+        os << std::left << std::setw(10) << nodes << std::right << std::setw(8) << program.variables().size()
+           << std::setw(10) << program.words().size() << std::setw(8) << program.registerCount()
+           << std::setw(10) << evals << std::fixed << std::setprecision(1) << std::setw(14) << treeNs
+           << std::setw(14) << vmNs << std::setw(10) << treeNs / vmNs
+           << (treeResults == vmResults ? "" : "  MISMATCH") << std::endl;
+        os.unsetf(std::ios::fixed);
+        delete tree;
+    }
+}
+
+// x86-64 机器码缓冲区：先以可写方式 mmap，写完后改为只读可执行（W^X）
+class ExecutableBuffer {
+private:
+    void* memory = nullptr;
+    size_t capacity = 0;
+
+public:
+    ExecutableBuffer() = default;
+    ExecutableBuffer(const ExecutableBuffer&) = delete;
+    ExecutableBuffer& operator=(const ExecutableBuffer&) = delete;
+
+    ~ExecutableBuffer() {
+#if defined(__unix__)
+        if (memory) munmap(memory, capacity);
+#endif
+    }
+
+    // 复制机器码并切换为可执行，失败时返回 false
+    bool load(const std::vector<uint8_t>& code) {
+#if defined(__unix__)
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        capacity = (code.size() + page - 1) / page * page;
+        void* p = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return false;
+        memory = p;
+        std::memcpy(memory, code.data(), code.size());
+        return mprotect(memory, capacity, PROT_READ | PROT_EXEC) == 0;
+#else
+        (void)code;
+        return false;
+#endif
+    }
+
+    const void* data() const {
+        return memory;
+    }
+};
+
+// 把寄存器分配后的目标指令翻译为 x86-64 机器码。值统一表示为 0 / 全 1：
+// 标量版本从打包位向量中取出第 i 位并扩展为 0/-1，64 路版本直接读取第 i 个变量的 64 位字。
+// 函数签名为 uint64_t f(const uint64_t* inputs)，rdi 为输入，溢出槽位于栈上
+class X86Emitter {
+public:
+    // 线性扫描分配器的寄存器 R0..R13 对应的 x86 寄存器；最后两个（r14/r15）是分配器的临时寄存器
+    static const int NUM_REGISTERS = 14;
+
+private:
+    enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7 };
+    static constexpr int registerMap[NUM_REGISTERS] = {RAX, RCX, RDX, RSI, 8, 9, 10, 11, RBX, RBP, 12, 13, 14, 15};
+    static constexpr int calleeSaved[6] = {RBX, RBP, 12, 13, 14, 15};
+
+    std::vector<uint8_t> bytes;
+    std::unordered_map<std::string, size_t> labelOffset;
+    std::vector<std::pair<size_t, std::string>> fixups;  // rel32 字段位置与目标标签
+    const std::unordered_map<std::string, int>& variableIndex;
+    bool lanes;
+    int frameBytes = 0;
+    int pendingFlag = -1;  // CMP 的源是立即数时，条件在编译期已知
+
+    void emit(std::initializer_list<uint8_t> b) {
+        bytes.insert(bytes.end(), b);
+    }
+
+    void emit32(uint32_t v) {
+        for (int i = 0; i < 4; ++i) bytes.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    static uint8_t rex(int reg, int rm) {
+        return 0x48 | ((reg >> 3) << 2) | (rm >> 3);
+    }
+
+    // op r/m64, r64
+    void emitRegReg(uint8_t opcode, int rm, int reg) {
+        emit({rex(reg, rm), opcode, static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7))});
+    }
+
+    // 以 /ext 为扩展操作码的单操作数指令
+    void emitUnary(uint8_t opcode, int ext, int rm) {
+        emit({rex(0, rm), opcode, static_cast<uint8_t>(0xC0 | (ext << 3) | (rm & 7))});
+    }
+
+    // op r64, [base + disp32]
+    void emitMemory(uint8_t opcode, int reg, int base, int32_t disp) {
+        emit({rex(reg, base), opcode, static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7))});
+        if ((base & 7) == RSP) bytes.push_back(0x24);
+        emit32(static_cast<uint32_t>(disp));
+    }
+
+    // text[begin, end) 全为十进制数字时返回其值（超过 limit 时返回 limit），否则返回 -1
+    static int parseNumber(const std::string& text, size_t begin, size_t end, int limit) {
+        if (begin >= end) return -1;
+        int value = 0;
+        for (size_t i = begin; i < end; ++i) {
+            if (!std::isdigit(static_cast<unsigned char>(text[i]))) return -1;
+            value = std::min(value * 10 + (text[i] - '0'), limit);
+        }
+        return value;
+    }
+
+    // 寄存器编号；Rx 之类的变量名不是寄存器，返回 -1
+    static int registerNumber(const std::string& operand) {
+        if (operand.size() < 2 || operand[0] != 'R') return -1;
+        return parseNumber(operand, 1, operand.size(), NUM_REGISTERS);
+    }
+
+    static int physical(const std::string& operand) {
+        int r = registerNumber(operand);
+        if (r < 0) throw std::runtime_error("Expected register, got '" + operand + "'");
+        if (r >= NUM_REGISTERS) throw std::runtime_error("Register out of range: " + operand);
+        return registerMap[r];
+    }
+
+    static bool isImmediate(const std::string& operand) {
+        return !operand.empty() && operand[0] == '#';
+    }
+
+    // 溢出槽 [s<k>]，k 必须落在本函数的栈帧内
+    int spillSlot(const std::string& location) const {
+        int slot = -1;
+        if (location.size() > 3 && location.compare(0, 2, "[s") == 0 && location.back() == ']') {
+            slot = parseNumber(location, 2, location.size() - 1, frameBytes / 8);
+        }
+        if (slot < 0) throw std::runtime_error("Expected spill slot, got '" + location + "'");
+        if (slot >= frameBytes / 8) throw std::runtime_error("Spill slot out of range: " + location);
+        return slot;
+    }
+
+    void moveImmediate(int dst, const std::string& imm) {
+        if (imm == "#0") {
+            emitRegReg(0x31, dst, dst);  // xor dst, dst
+        } else {
+            emit({rex(0, dst), 0xC7, static_cast<uint8_t>(0xC0 | (dst & 7))});  // mov dst, -1
+            emit32(0xFFFFFFFFu);
+        }
+    }
+
+    // dst = 寄存器或立即数
+    void moveOperand(int dst, const std::string& src) {
+        if (isImmediate(src)) {
+            moveImmediate(dst, src);
+        } else if (physical(src) != dst) {
+            emitRegReg(0x89, dst, physical(src));
+        }
+    }
+
+    // 从内存位置（程序变量或溢出槽）装入
+    void load(int dst, const std::string& location) {
+        if (location.size() > 2 && location[0] == '[') {
+            emitMemory(0x8B, dst, RSP, 8 * spillSlot(location));
+            return;
+        }
+        auto it = variableIndex.find(location);
+        if (it == variableIndex.end()) throw std::runtime_error("Unknown variable '" + location + "'");
+        int index = it->second;
+        if (lanes) {
+            emitMemory(0x8B, dst, RDI, 8 * index);
+        } else {
+            emitMemory(0x8B, dst, RDI, 8 * (index / 64));
+            if (index % 64) emit({rex(0, dst), 0xC1, static_cast<uint8_t>(0xE8 | (dst & 7)), static_cast<uint8_t>(index % 64)});
+            emit({rex(0, dst), 0x83, static_cast<uint8_t>(0xE0 | (dst & 7)), 0x01});  // and dst, 1
+            emitUnary(0xF7, 3, dst);                                                   // neg dst
+        }
+    }
+
+    void jump(const std::string& opcode, const std::string& label) {
+        if (opcode == "JMP") {
+            bytes.push_back(0xE9);
+        } else {
+            emit({0x0F, static_cast<uint8_t>(opcode == "JNE" ? 0x85 : 0x84)});
+        }
+        fixups.push_back({bytes.size(), label});
+        emit32(0);
+    }
+
+    void lower(const TargetInstruction& in) {
+        const std::string& op = in.opcode;
+        if (op == "LABEL") {
+            labelOffset[in.label] = bytes.size();
+        } else if (op == "LD") {
+            load(physical(in.dst), in.src1);
+        } else if (op == "ST") {
+            emitMemory(0x89, physical(in.src1), RSP, 8 * spillSlot(in.dst));
+        } else if (op == "MOV") {
+            moveOperand(physical(in.dst), in.src1);
+        } else if (op == "NOT") {
+            int dst = physical(in.dst);
+            moveOperand(dst, in.src1);
+            emitUnary(0xF7, 2, dst);
+        } else if (op == "OR" || op == "AND") {
+            int dst = physical(in.dst);
+            std::string a = in.src1, b = in.src2;
+            if (!isImmediate(b) && physical(b) == dst) std::swap(a, b);  // 可交换，避免先覆盖第二个源
+            moveOperand(dst, a);
+            if (isImmediate(b)) {
+                bool ones = (b != "#0");
+                if (op == "OR" && ones) moveImmediate(dst, "#1");
+                if (op == "AND" && !ones) moveImmediate(dst, "#0");
+            } else {
+                emitRegReg(op == "OR" ? 0x09 : 0x21, dst, physical(b));
+            }
+        } else if (op == "CMP") {
+            if (lanes) throw std::runtime_error("64-lane code cannot branch");
+            if (isImmediate(in.src1)) {
+                pendingFlag = (in.src1 != "#0");
+            } else {
+                pendingFlag = -1;
+                emitRegReg(0x85, physical(in.src1), physical(in.src1));  // test r, r
+            }
+        } else if (in.isJump()) {
+            if (lanes) throw std::runtime_error("64-lane code cannot branch");
+            if (op != "JMP" && pendingFlag >= 0) {
+                if ((pendingFlag == 1) == (op == "JNE")) jump("JMP", in.label);
+            } else {
+                jump(op, in.label);
+            }
+        } else {
+            throw std::runtime_error("Cannot lower target instruction '" + in.toString() + "'");
+        }
+    }
+
+public:
+    static bool isRegister(const std::string& operand) {
+        return registerNumber(operand) >= 0;
+    }
+
+    X86Emitter(const std::unordered_map<std::string, int>& variableIndex, bool lanes)
+        : variableIndex(variableIndex), lanes(lanes) {}
+
+    // 翻译整段代码；resultLocation 为结果所在的寄存器、溢出槽、程序变量或立即数
+    std::vector<uint8_t> compile(const std::vector<TargetInstruction>& code, const std::string& resultLocation,
+                                 int spillSlots) {
+        for (int r : calleeSaved) {
+            if (r >= 8) bytes.push_back(0x41);
+            bytes.push_back(static_cast<uint8_t>(0x50 | (r & 7)));
+        }
+        // 返回地址加 6 次压栈后 rsp 模 16 余 8，帧大小取 8 的奇数倍使其重新对齐
+        frameBytes = 8 * spillSlots;
+        if (frameBytes % 16 == 0) frameBytes += 8;
+        emit({0x48, 0x81, 0xEC});
+        emit32(frameBytes);
+
+        for (const auto& in : code) lower(in);
+
+        if (isImmediate(resultLocation)) {
+            moveImmediate(RAX, resultLocation);
+        } else if (isRegister(resultLocation)) {
+            moveOperand(RAX, resultLocation);
+        } else {
+            load(RAX, resultLocation);
+        }
+        if (!lanes) emit({0x83, 0xE0, 0x01});  // and eax, 1
+        emit({0x48, 0x81, 0xC4});
+        emit32(frameBytes);
+        for (int i = 5; i >= 0; --i) {
+            int r = calleeSaved[i];
+            if (r >= 8) bytes.push_back(0x41);
+            bytes.push_back(static_cast<uint8_t>(0x58 | (r & 7)));
+        }
+        bytes.push_back(0xC3);
+
+        for (const auto& fixup : fixups) {
+            auto it = labelOffset.find(fixup.second);
+            if (it == labelOffset.end()) throw std::runtime_error("Undefined label '" + fixup.second + "'");
+            int32_t rel = static_cast<int32_t>(it->second) - static_cast<int32_t>(fixup.first + 4);
+            std::memcpy(&bytes[fixup.first], &rel, 4);
+        }
+        return bytes;
+    }
+};
+
+constexpr int X86Emitter::registerMap[X86Emitter::NUM_REGISTERS];
+constexpr int X86Emitter::calleeSaved[6];
+
+// JIT 编译的表达式：标量版本对一组赋值（打包位向量，变量 i 为第 i 位）求值，
+// 64 路版本对 64 组赋值（每个变量一个 64 位字）同时求值。
+// JIT 被禁用、平台不支持或代码无法翻译时退回字节码解释器
+class JitExpression {
+private:
+    typedef uint64_t (*CompiledFunction)(const uint64_t*);
+
+    BytecodeProgram program;
+    std::unordered_map<std::string, int> variableIndex;
+    ExecutableBuffer scalarBuffer;
+    ExecutableBuffer lanesBuffer;
+    CompiledFunction scalarFunction = nullptr;
+    CompiledFunction lanesFunction = nullptr;
+    size_t machineCodeBytes = 0;
+
+    // 解释器回退路径的输入与寄存器缓冲区按线程各一份：evaluate 是 const 的，
+    // 多个线程共用同一个 JitExpression 时不能写对象内的缓冲区
+    struct Scratch {
+        std::vector<uint8_t> inputs;
+        std::vector<uint8_t> registers;
+    };
+
+    Scratch& scratch() const {
+        static thread_local Scratch buffers;
+        if (buffers.inputs.size() < program.variables().size()) buffers.inputs.resize(program.variables().size());
+        if (buffers.registers.size() < program.registerCount()) buffers.registers.resize(program.registerCount());
+        return buffers;
+    }
+
+    static bool hasJumps(const std::vector<Quadruple>& quads) {
+        for (const auto& q : quads) {
+            if (q.op == "label" || q.op == "j" || q.op == "jnz" || q.op == "jz") return true;
+        }
+        return false;
+    }
+
+    CompiledFunction compile(const std::vector<Quadruple>& quads, const std::string& resultVar, bool lanes,
+                             ExecutableBuffer& buffer) {
+        try {
+            // 结果位置是程序变量时只有名字，叫 R3 的变量会被当成寄存器，这样的表达式交给解释器
+            for (const auto& var : program.variables()) {
+                if (X86Emitter::isRegister(var)) throw std::runtime_error("Variable named like a register: " + var);
+            }
+            LinearScanAllocator allocator(X86Emitter::NUM_REGISTERS);
+            std::vector<TargetInstruction> code = allocator.generate(quads, {resultVar});
+            std::string location = allocator.locationOf(resultVar);
+            PeepholeOptimizer optimizer({location});
+            code = optimizer.optimize(code);
+            X86Emitter emitter(variableIndex, lanes);
+            std::vector<uint8_t> machineCode = emitter.compile(code, location, allocator.getStats().spilledIntervals);
+            if (!buffer.load(machineCode)) return nullptr;
+            machineCodeBytes += machineCode.size();
+            return reinterpret_cast<CompiledFunction>(const_cast<void*>(buffer.data()));
+        } catch (const std::runtime_error&) {
+            return nullptr;
+        }
+    }
+
+public:
+    JitExpression(const std::vector<Quadruple>& quads, const std::string& resultVar, bool enableJit = true)
+        : program(quads, resultVar) {
+        for (size_t i = 0; i < program.variables().size(); ++i) variableIndex[program.variables()[i]] = i;
+#if defined(__x86_64__) && defined(__unix__)
+        if (enableJit) {
+            scalarFunction = compile(quads, resultVar, false, scalarBuffer);
+            if (!hasJumps(quads)) lanesFunction = compile(quads, resultVar, true, lanesBuffer);
+        }
+#else
+        (void)enableJit;
+#endif
+    }
+
+    // 变量顺序：决定打包位向量中的位号与 64 路输入中的字号
+    const std::vector<std::string>& variables() const {
+        return program.variables();
+    }
+
+    bool scalarJitted() const {
+        return scalarFunction != nullptr;
+    }
+
+    bool lanesJitted() const {
+        return lanesFunction != nullptr;
+    }
+
+    size_t codeSize() const {
+        return machineCodeBytes;
+    }
+
+    // packed 至少 (variables().size() + 63) / 64 个字
+    bool evaluate(const uint64_t* packed) const {
+        if (scalarFunction) return scalarFunction(packed) != 0;
+        Scratch& buffers = scratch();
+        size_t numVars = program.variables().size();
+        for (size_t i = 0; i < numVars; ++i) buffers.inputs[i] = (packed[i / 64] >> (i % 64)) & 1;
+        return BytecodeVM::run(program, buffers.inputs.data(), buffers.registers.data());
+    }
+
+    // laneWords[i] 为变量 i 在 64 组赋值中的取值，返回 64 组结果
+    uint64_t evaluateLanes(const uint64_t* laneWords) const {
+        if (lanesFunction) return lanesFunction(laneWords);
+        uint64_t result = 0;
+        Scratch& buffers = scratch();
+        size_t numVars = program.variables().size();
+        for (int lane = 0; lane < 64; ++lane) {
+            for (size_t i = 0; i < numVars; ++i) buffers.inputs[i] = (laneWords[i] >> lane) & 1;
+            if (BytecodeVM::run(program, buffers.inputs.data(), buffers.registers.data())) result |= 1ULL << lane;
+        }
+        return result;
+    }
+};
+
+// JIT 与解释器的差分测试：随机表达式分别以值代码和短路跳转代码编译，
+// 在随机赋值上比较 JIT 标量/64 路结果与字节码解释器，返回不一致的次数
+int runJitDifferentialTest(std::ostream& os, int iterations) {
+    std::mt19937 rng(23);
+    std::mt19937_64 bits(29);
+    int mismatches = 0, jitted = 0, checks = 0;
+    // 最后几个程序的变量名形如寄存器，JIT 要么正确翻译，要么退回解释器
+    const std::vector<std::string> registerLike = {"Rx", "R3", "Rx V R3 ^ -R0", "-(R13 ^ R1x) V R3 V Rx"};
+    const int programs = iterations + static_cast<int>(registerLike.size());
+    for (int it = 0; it < programs; ++it) {
+        int numVars = 2 + it % 70;
+        std::string expr = it < iterations ? generateRandomExpression(numVars, 1 + it % 120, rng)
+                                           : registerLike[it - iterations];
+        ASTBuilder builder;
+        ASTNode* tree = builder.buildFromTokens(tokenizeExpression(expr));
+        for (int mode = 0; mode < 2; ++mode) {
+            QuaternionGenerator generator;
+            std::string resultVar = mode ? generator.genJumpingCode(tree) : generator.genExpression(tree);
+            generator.eliminateDeadCode(resultVar);
+            JitExpression jit(generator.getQuaternions(), resultVar);
+            JitExpression interpreter(generator.getQuaternions(), resultVar, false);
+            jitted += jit.scalarJitted();
+            size_t n = jit.variables().size();
+            for (int k = 0; k < 8; ++k) {
+                std::vector<uint64_t> packed((n + 63) / 64 + 1), lanes(n + 1);
+                for (auto& w : packed) w = bits();
+                for (auto& w : lanes) w = bits();
+                ++checks;
+                if (jit.evaluate(packed.data()) != interpreter.evaluate(packed.data()) ||
+                    jit.evaluateLanes(lanes.data()) != interpreter.evaluateLanes(lanes.data())) {
+                    if (mismatches++ == 0) os << "JIT mismatch on: " << expr << std::endl;
+                }
+            }
+        }
+        delete tree;
+    }
+    os << "差分测试: " << programs * 2 << " 个程序（" << jitted << " 个已 JIT），" << checks << " 组比较，"
+       << mismatches << " 处不一致" << std::endl;
+    return mismatches;
+}
+
+// 单组赋值与 64 路求值的吞吐量：JIT 与字节码解释器对比
+void runJitBenchmark(std::ostream& os) {
+    std::mt19937 rng(31);
+    std::mt19937_64 bits(37);
+    os << std::left << std::setw(10) << "nodes" << std::right << std::setw(10) << "bytes" << std::setw(14)
+       << "vm ns/eval" << std::setw(14) << "jit ns/eval" << std::setw(16) << "jit64 ns/64eval" << std::endl;
+    for (int nodes : {10, 100, 1000, 10000}) {
+        int leaves = std::max(2, nodes / 2);
+        std::string expr = generateRandomExpression(std::max(2, leaves / 4), leaves, rng);
+        ASTBuilder builder;
+        ASTNode* tree = builder.buildFromTokens(tokenizeExpression(expr));
+        QuaternionGenerator generator;
+        std::string resultVar = generator.genExpression(tree);
+        delete tree;
+        generator.eliminateDeadCode(resultVar);
+        JitExpression jit(generator.getQuaternions(), resultVar);
+        JitExpression interpreter(generator.getQuaternions(), resultVar, false);
+
+        size_t n = jit.variables().size();
+        int evals = std::max(10, 2000000 / nodes);
+        std::vector<uint64_t> inputs(static_cast<size_t>(evals) * (n + 1));
+        for (auto& w : inputs) w = bits();
+        volatile uint64_t sink = 0;
+        auto time = [&](auto&& body) {
+            auto start = std::chrono::steady_clock::now();
+            for (int e = 0; e < evals; ++e) sink = sink + body(inputs.data() + static_cast<size_t>(e) * (n + 1));
+            return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / evals;
+        };
+        double vmNs = time([&](const uint64_t* in) { return uint64_t(interpreter.evaluate(in)); });
+        double jitNs = time([&](const uint64_t* in) { return uint64_t(jit.evaluate(in)); });
+        double lanesNs = time([&](const uint64_t* in) { return jit.evaluateLanes(in); });
+        os << std::left << std::setw(10) << nodes << std::right << std::setw(10) << jit.codeSize() << std::fixed
+           << std::setprecision(1) << std::setw(14) << vmNs << std::setw(14) << jitNs << std::setw(16) << lanesNs
+           << (jit.scalarJitted() ? "" : "  (interpreted)") << std::endl;
+        os.unsetf(std::ios::fixed);
+    }
+}
+
+// 预编译 C 后端：把直线型四元式输出为独立的 C 源文件，其中的求值函数对每个 64 位字
+// 做一串无分支的按位运算，循环体没有控制流，系统编译器可以直接向量化
+class CKernelEmitter {
+public:
+    // quads 必须是值代码；生成的函数签名为
+    // void <name>(const uint64_t* const* columns, uint64_t* out, size_t numWords)
+    static std::string emit(const std::vector<Quadruple>& quads, const std::string& resultVar,
+                            const std::vector<std::string>& variables, const std::string& name = "kernel_eval") {
+        std::unordered_map<std::string, std::string> valueOf = {{"true", "~(uint64_t)0"}, {"false", "(uint64_t)0"}};
+        for (size_t i = 0; i < variables.size(); ++i) valueOf[variables[i]] = "v" + std::to_string(i);
+        auto operand = [&](const std::string& arg) -> const std::string& {
+            auto it = valueOf.find(arg);
+            if (it == valueOf.end()) throw std::runtime_error("Use of undefined value '" + arg + "'");
+            return it->second;
+        };
+
+        std::ostringstream body;
+        int temps = 0;
+        for (const auto& q : quads) {
+            std::string expr;
+            if (q.op == "!") expr = "~" + operand(q.arg1);
+            else if (q.op == "=") expr = operand(q.arg1);
+            else if (q.op == "^") expr = operand(q.arg1) + " & " + operand(q.arg2);
+            else if (q.op == "V") expr = operand(q.arg1) + " | " + operand(q.arg2);
+            else throw std::runtime_error("C backend needs straight-line code, found '" + q.op + "'");
+            // 每次定义一个新的 C 局部变量，重复赋值的四元式变量也保持单赋值
+            std::string local = "t" + std::to_string(temps++);
+            body << "        const uint64_t " << local << " = " << expr << ";\n";
+            valueOf[q.result] = local;
+        }
+
+        std::ostringstream out;
+        out << "/* Generated by compile: branch-free evaluation kernel, one assignment per bit. */\n"
+            << "#include <stddef.h>\n#include <stdint.h>\n\n"
+            << "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n"
+            << "const size_t " << name << "_num_variables = " << variables.size() << ";\n"
+            << "const char* const " << name << "_variables[] = {";
+        for (const auto& var : variables) out << "\"" << var << "\", ";
+        out << "0};\n\n"
+            << "/* columns[i] holds variable " << name << "_variables[i]; bit j of word w is assignment 64*w+j. */\n"
+            << "void " << name << "(const uint64_t* const* columns, uint64_t* out, size_t numWords) {\n";
+        for (size_t i = 0; i < variables.size(); ++i) {
+            out << "    const uint64_t* __restrict c" << i << " = columns[" << i << "];\n";
+        }
+        out << "    uint64_t* __restrict result = out;\n"
+            << "    for (size_t w = 0; w < numWords; ++w) {\n";
+        for (size_t i = 0; i < variables.size(); ++i) {
+            out << "        const uint64_t v" << i << " = c" << i << "[w];\n";
+        }
+        out << body.str() << "        result[w] = " << operand(resultVar) << ";\n    }\n}\n\n"
+            << "#ifdef __cplusplus\n}\n#endif\n";
+        return out.str();
+    }
+};
+
+// 删除只含普通文件的目录及其中的文件；不存在时什么也不做
+void removeFlatDirectory(const std::string& path) {
+    if (DIR* dir = opendir(path.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") unlink((path + "/" + name).c_str());
+        }
+        closedir(dir);
+    }
+    rmdir(path.c_str());
+}
+
+// 用本机 C 编译器把生成的源文件编译为共享库并加载；编译器取环境变量 CC，默认 cc
+class NativeKernel {
+private:
+    typedef void (*KernelFunction)(const uint64_t* const*, uint64_t*, size_t);
+
+    // 临时目录与 dlopen 句柄各由一个成员持有：构造函数中途抛出时已构造的成员照样析构，不会泄漏。
+    // 句柄后声明、先析构，先 dlclose 再删除目录
+    struct TemporaryDirectory {
+        std::string path;
+
+        ~TemporaryDirectory() {
+            if (!path.empty()) removeFlatDirectory(path);
+        }
+    };
+
+    struct LibraryHandle {
+        void* handle = nullptr;
+
+        ~LibraryHandle() {
+#if defined(__unix__)
+            if (handle) dlclose(handle);
+#endif
+        }
+    };
+
+    TemporaryDirectory directory;
+    LibraryHandle library;
+    KernelFunction function = nullptr;
+
+public:
+    NativeKernel(const NativeKernel&) = delete;
+    NativeKernel& operator=(const NativeKernel&) = delete;
+
+    explicit NativeKernel(const std::string& source, const std::string& name = "kernel_eval") {
+#if defined(__unix__)
+        char pattern[] = "/tmp/compile-kernel-XXXXXX";
+        if (!mkdtemp(pattern)) throw std::runtime_error("Cannot create temporary directory");
+        directory.path = pattern;
+        std::string sourcePath = directory.path + "/" + name + ".c";
+        std::string libraryPath = directory.path + "/" + name + ".so";
+        std::string logPath = directory.path + "/cc.log";
+        std::ofstream file(sourcePath);
+        file << source;
+        file.close();
+
+        const char* cc = std::getenv("CC");
+        std::string command = std::string(cc ? cc : "cc") + " -O3 -march=native -shared -fPIC -o '" + libraryPath +
+                              "' '" + sourcePath + "' 2> '" + logPath + "'";
+        if (std::system(command.c_str()) != 0) {
+            // 目录随后被删除，把编译器输出带进异常信息
+            std::ifstream log(logPath);
+            std::string message((std::istreambuf_iterator<char>(log)), std::istreambuf_iterator<char>());
+            throw std::runtime_error("C compiler failed: " + message);
+        }
+        library.handle = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!library.handle) throw std::runtime_error(std::string("dlopen failed: ") + dlerror());
+        function = reinterpret_cast<KernelFunction>(dlsym(library.handle, name.c_str()));
+        if (!function) throw std::runtime_error("Kernel symbol '" + name + "' not found");
+#else
+        (void)source;
+        (void)name;
+        throw std::runtime_error("Native kernels need a Unix system with dlopen");
+#endif
+    }
+
+    void evaluate(const std::vector<const uint64_t*>& columns, size_t numWords, uint64_t* out) const {
+        function(columns.data(), out, numWords);
+    }
+};
+
+// 测试驱动：对若干表达式生成 C 内核，用本机编译器编译加载后与位并行求值器逐位比较，并对比吞吐量
+int runCKernelHarness(std::ostream& os) {
+    std::mt19937 rng(41);
+    std::mt19937_64 bits(43);
+    const size_t numWords = size_t(1) << 16;
+    int failures = 0;
+    os << std::left << std::setw(14) << "expr" << std::right << std::setw(8) << "vars" << std::setw(8) << "ops"
+       << std::setw(12) << "cc ms" << std::setw(14) << "native G/s" << std::setw(14) << "bitpar G/s"
+       << std::setw(8) << "check" << std::endl;
+    for (int leaves : {2, 8, 64, 512}) {
+        std::string expr = generateRandomExpression(std::max(2, leaves / 2), leaves, rng);
+        ASTBuilder builder;
+        ASTNode* tree = builder.buildFromTokens(tokenizeExpression(expr));
+        QuaternionGenerator generator;
+        std::string resultVar = generator.genExpression(tree);
+        delete tree;
+        generator.eliminateDeadCode(resultVar);
+        BitParallelEvaluator reference(generator.getQuaternions(), resultVar);
+        const std::vector<std::string>& vars = reference.variables();
+
+        std::vector<std::vector<uint64_t>> data(vars.size(), std::vector<uint64_t>(numWords));
+        std::vector<const uint64_t*> columns;
+        for (auto& column : data) {
+            for (auto& word : column) word = bits();
+            columns.push_back(column.data());
+        }
+        std::vector<uint64_t> expected(numWords), actual(numWords);
+
+        try {
+            auto start = std::chrono::steady_clock::now();
+            NativeKernel kernel(CKernelEmitter::emit(generator.getQuaternions(), resultVar, vars));
+            double compileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            start = std::chrono::steady_clock::now();
+            kernel.evaluate(columns, numWords, actual.data());
+            double nativeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            start = std::chrono::steady_clock::now();
+            reference.evaluate(columns, numWords, expected.data());
+            double referenceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            bool ok = actual == expected;
+            failures += !ok;
+            os << std::left << std::setw(14) << ("random_" + std::to_string(leaves)) << std::right
+               << std::setw(8) << vars.size() << std::setw(8) << reference.instructionCount() << std::fixed
+               << std::setprecision(1) << std::setw(12) << compileMs << std::setprecision(2)
+               << std::setw(14) << numWords * 64 / nativeSeconds / 1e9 << std::setw(14)
+               << numWords * 64 / referenceSeconds / 1e9 << std::setw(8) << (ok ? "ok" : "FAIL") << std::endl;
+            os.unsetf(std::ios::fixed);
+        } catch (const std::runtime_error& e) {
+            ++failures;
+            os << "random_" << leaves << ": " << e.what() << std::endl;
+        }
+    }
+    return failures;
+}
+
+// 列式布尔数据文件（.bcol）：
+//   "BCOL" | 版本 u32 | 行数 u64 | 列数 u32 | 每列：名字长度 u32 + 名字 | 填充到 64 字节边界
+//   随后按列连续存放位图，每列 ceil(行数/64) 个 u64（小端），第 r 行位于字 r/64 的第 r%64 位，末尾多余的位为 0
+struct ColumnarHeader {
+    static const uint32_t VERSION = 1;
+
+    uint64_t numRows = 0;
+    std::vector<std::string> names;
+
+    uint64_t wordsPerColumn() const {
+        return (numRows + 63) / 64;
+    }
+
+    // 数据区起始偏移
+    uint64_t dataOffset() const {
+        uint64_t size = 4 + 4 + 8 + 4;
+        for (const auto& name : names) size += 4 + name.size();
+        return (size + 63) / 64 * 64;
+    }
+
+    uint64_t columnOffset(size_t column) const {
+        return dataOffset() + column * wordsPerColumn() * 8;
+    }
+
+    void write(std::ostream& out) const {
+        auto put32 = [&](uint32_t v) { out.write(reinterpret_cast<const char*>(&v), 4); };
+        out.write("BCOL", 4);
+        put32(VERSION);
+        out.write(reinterpret_cast<const char*>(&numRows), 8);
+        put32(static_cast<uint32_t>(names.size()));
+        for (const auto& name : names) {
+            put32(static_cast<uint32_t>(name.size()));
+            out.write(name.data(), name.size());
+        }
+        uint64_t written = 4 + 4 + 8 + 4;
+        for (const auto& name : names) written += 4 + name.size();
+        std::string padding(dataOffset() - written, '\0');
+        out.write(padding.data(), padding.size());
+    }
+
+    // 从映射的文件头解析，size 为文件大小
+    static ColumnarHeader parse(const uint8_t* data, uint64_t size) {
+        ColumnarHeader header;
+        uint64_t pos = 0;
+        auto need = [&](uint64_t n) {
+            if (pos + n > size) throw std::runtime_error("Truncated columnar file header");
+        };
+        auto get32 = [&]() {
+            need(4);
+            uint32_t v;
+            std::memcpy(&v, data + pos, 4);
+            pos += 4;
+            return v;
+        };
+        need(4);
+        if (std::memcmp(data, "BCOL", 4) != 0) throw std::runtime_error("Not a columnar file (bad magic)");
+        pos = 4;
+        if (get32() != VERSION) throw std::runtime_error("Unsupported columnar file version");
+        need(8);
+        std::memcpy(&header.numRows, data + pos, 8);
+        pos += 8;
+        uint32_t numColumns = get32();
+        for (uint32_t c = 0; c < numColumns; ++c) {
+            uint32_t length = get32();
+            need(length);
+            header.names.emplace_back(reinterpret_cast<const char*>(data + pos), length);
+            pos += length;
+        }
+        // numRows 来自文件，先对照文件大小检查再相乘，构造的行数不能使列偏移溢出
+        uint64_t dataStart = header.dataOffset();
+        if (dataStart > size) throw std::runtime_error("Truncated columnar file data");
+        if (header.numRows > UINT64_MAX - 63) throw std::runtime_error("Bad columnar row count");
+        uint64_t columnBytes = header.wordsPerColumn() * 8;
+        if (numColumns && columnBytes > (size - dataStart) / numColumns) {
+            throw std::runtime_error("Truncated columnar file data");
+        }
+        return header;
+    }
+};
+
+// 只读映射的列式文件；按顺序访问提示内核预读，数据可以大于内存
+class ColumnarFile {
+private:
+    const uint8_t* data = nullptr;
+    uint64_t size = 0;
+    ColumnarHeader header;
+
+public:
+    ColumnarFile(const ColumnarFile&) = delete;
+    ColumnarFile& operator=(const ColumnarFile&) = delete;
+
+    explicit ColumnarFile(const std::string& path) {
+#if defined(__unix__)
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            throw std::runtime_error("Cannot read " + path);
+        }
+        size = static_cast<uint64_t>(st.st_size);
+        void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error("Cannot map " + path);
+        data = static_cast<const uint8_t*>(p);
+        madvise(p, size, MADV_SEQUENTIAL);
+        try {
+            header = ColumnarHeader::parse(data, size);
+        } catch (...) {
+            munmap(p, size);
+            throw;
+        }
+#else
+        throw std::runtime_error("Columnar files need mmap");
+#endif
+    }
+
+    ~ColumnarFile() {
+#if defined(__unix__)
+        if (data) munmap(const_cast<uint8_t*>(data), size);
+#endif
+    }
+
+    const ColumnarHeader& getHeader() const {
+        return header;
+    }
+
+    const uint64_t* column(const std::string& name) const {
+        for (size_t c = 0; c < header.names.size(); ++c) {
+            if (header.names[c] == name) return reinterpret_cast<const uint64_t*>(data + header.columnOffset(c));
+        }
+        throw std::runtime_error("Column '" + name + "' not found in data file");
+    }
+
+    // 已处理完的区间不再需要留在页缓存中
+    void release(const uint64_t* begin, size_t words) const {
+#if defined(__unix__)
+        static const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        uintptr_t first = (reinterpret_cast<uintptr_t>(begin) + page - 1) / page * page;
+        uintptr_t last = (reinterpret_cast<uintptr_t>(begin + words)) / page * page;
+        if (last > first) madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+#else
+        (void)begin;
+        (void)words;
+#endif
+    }
+};
+
+// CSV（首行为列名，之后每行 0/1 或 true/false）转换为列式文件：
+// 第一遍数行数以确定各列位置，第二遍按块转置后定位写入各列
+void convertCsvToColumnar(const std::string& csvPath, const std::string& outPath) {
+    std::ifstream csv(csvPath);
+    if (!csv.is_open()) throw std::runtime_error("Cannot open " + csvPath);
+    auto splitLine = [](const std::string& line) {
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, ',')) {
+            size_t b = field.find_first_not_of(" \t\r"), e = field.find_last_not_of(" \t\r");
+            fields.push_back(b == std::string::npos ? "" : field.substr(b, e - b + 1));
+        }
+        return fields;
+    };
+
+    ColumnarHeader header;
+    std::string line;
+    if (!std::getline(csv, line)) throw std::runtime_error("Empty CSV file");
+    header.names = splitLine(line);
+    while (std::getline(csv, line)) {
+        if (line.find_first_not_of(" \t\r") != std::string::npos) ++header.numRows;
+    }
+
+    std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) throw std::runtime_error("Cannot create " + outPath);
+    header.write(out);
+    // 预先把文件扩展到完整大小，之后按块定位写入
+    if (header.columnOffset(header.names.size()) > header.dataOffset()) {
+        out.seekp(header.columnOffset(header.names.size()) - 1);
+        out.put('\0');
+    }
+
+    csv.clear();
+    csv.seekg(0);
+    std::getline(csv, line);
+    const size_t blockWords = 4096;
+    std::vector<std::vector<uint64_t>> block(header.names.size(), std::vector<uint64_t>(blockWords));
+    uint64_t row = 0, blockStart = 0;
+    auto flush = [&]() {
+        size_t words = (row - blockStart + 63) / 64;
+        for (size_t c = 0; c < block.size(); ++c) {
+            out.seekp(header.columnOffset(c) + blockStart / 64 * 8);
+            out.write(reinterpret_cast<const char*>(block[c].data()), words * 8);
+            std::fill(block[c].begin(), block[c].end(), 0);
+        }
+        blockStart = row;
+    };
+    while (std::getline(csv, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        std::vector<std::string> fields = splitLine(line);
+        if (fields.size() != header.names.size()) {
+            throw std::runtime_error("CSV row " + std::to_string(row + 2) + " has " + std::to_string(fields.size()) +
+                                     " fields, expected " + std::to_string(header.names.size()));
+        }
+        uint64_t bit = row - blockStart;
+        for (size_t c = 0; c < fields.size(); ++c) {
+            if (fields[c] == "1" || fields[c] == "true") {
+                block[c][bit / 64] |= 1ULL << (bit % 64);
+            } else if (fields[c] != "0" && fields[c] != "false") {
+                throw std::runtime_error("CSV value '" + fields[c] + "' is not Boolean");
+            }
+        }
+        if (++row - blockStart == blockWords * 64) flush();
+    }
+    if (row > blockStart) flush();
+    if (!out) throw std::runtime_error("Write to " + outPath + " failed");
+}
+
+struct FilterStats {
+    uint64_t rows = 0;
+    uint64_t matches = 0;
+    uint64_t bytesRead = 0;
+    double seconds = 0;
+};
+
+// 以缓存大小的块流式执行过滤：每块从映射文件中直接取各列的一段交给位并行求值器，
+// 结果位图顺序写入 outPath（单列 "result" 的列式文件），同时统计匹配行数
+FilterStats runColumnarFilter(const BitParallelEvaluator& evaluator, const ColumnarFile& file,
+                              const std::string& outPath, size_t cacheBytes = 1 << 20) {
+    const ColumnarHeader& header = file.getHeader();
+    std::vector<const uint64_t*> columns;
+    for (const auto& var : evaluator.variables()) columns.push_back(file.column(var));
+
+    // 块内所有输入列与结果一起放进 cacheBytes
+    size_t blockWords = cacheBytes / ((columns.size() + 1) * 8);
+    blockWords = std::max(BitParallelEvaluator::CHUNK_WORDS, blockWords / BitParallelEvaluator::CHUNK_WORDS *
+                                                                 BitParallelEvaluator::CHUNK_WORDS);
+
+    ColumnarHeader resultHeader;
+    resultHeader.numRows = header.numRows;
+    resultHeader.names = {"result"};
+    std::ofstream out(outPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) throw std::runtime_error("Cannot create " + outPath);
+    resultHeader.write(out);
+
+    FilterStats stats;
+    stats.rows = header.numRows;
+    uint64_t totalWords = header.wordsPerColumn();
+    std::vector<uint64_t> result(blockWords);
+    std::vector<const uint64_t*> blockColumns(columns.size());
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t w = 0; w < totalWords; w += blockWords) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(blockWords, totalWords - w));
+        for (size_t c = 0; c < columns.size(); ++c) blockColumns[c] = columns[c] + w;
+        evaluator.evaluate(blockColumns, n, result.data());
+        if (w + n == totalWords && header.numRows % 64) result[n - 1] &= (1ULL << (header.numRows % 64)) - 1;
+        for (size_t k = 0; k < n; ++k) stats.matches += __builtin_popcountll(result[k]);
+        out.write(reinterpret_cast<const char*>(result.data()), n * 8);
+        for (size_t c = 0; c < columns.size(); ++c) file.release(blockColumns[c], n);
+    }
+    out.close();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.bytesRead = totalWords * 8 * columns.size();
+    if (!out) throw std::runtime_error("Write to " + outPath + " failed");
+    return stats;
+}
+
+// 生成随机列式数据（每位为 1 的概率 1/2），用于演示与测量带宽
+void writeRandomColumnarFile(const std::string& path, const std::vector<std::string>& names, uint64_t numRows,
+                             uint64_t seed) {
+    ColumnarHeader header;
+    header.numRows = numRows;
+    header.names = names;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) throw std::runtime_error("Cannot create " + path);
+    header.write(out);
+    std::mt19937_64 bits(seed);
+    std::vector<uint64_t> buffer(1 << 16);
+    for (size_t c = 0; c < names.size(); ++c) {
+        for (uint64_t w = 0; w < header.wordsPerColumn(); w += buffer.size()) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(buffer.size(), header.wordsPerColumn() - w));
+            for (size_t k = 0; k < n; ++k) buffer[k] = bits();
+            if (w + n == header.wordsPerColumn() && numRows % 64) buffer[n - 1] &= (1ULL << (numRows % 64)) - 1;
+            out.write(reinterpret_cast<const char*>(buffer.data()), n * 8);
+        }
+    }
+}
+
+// CDCL SAT 求解器：双文字监视、一阶 UIP 冲突子句学习、VSIDS 变量活跃度、相位保存、
+// Luby 序列重启以及按活跃度删减学习子句。对外使用 DIMACS 风格的文字（变量从 1 开始，负数为取反）
+class CDCLSolver {
+public:
+    enum class Result { SAT, UNSAT, UNKNOWN };
+
+    struct Stats {
+        long decisions = 0;
+        long propagations = 0;
+        long conflicts = 0;
+        long restarts = 0;
+        long learned = 0;
+        long deleted = 0;
+    };
+
+private:
+    // 内部文字：2 * 变量 + 符号位（变量从 0 开始）
+    static constexpr int8_t UNDEF = 2;
+
+    struct Clause {
+        std::vector<int> lits;  // lits[0] 与 lits[1] 被监视；作为推理原因时 lits[0] 为被推出的文字
+        bool learnt = false;
+        bool deleted = false;
+        double activity = 0;
+    };
+
+    std::vector<Clause> clauses;
+    std::vector<int> learnts;
+    std::vector<std::vector<int>> watches;  // watches[l]：监视文字 l 的子句，l 变为假时检查
+    std::vector<int8_t> assigns;
+    std::vector<int> level;
+    std::vector<int> reason;
+    std::vector<int> trail;
+    std::vector<int> trailLim;
+    size_t qhead = 0;
+    bool ok = true;
+
+    std::vector<double> activity;
+    double varInc = 1.0;
+    double clauseInc = 1.0;
+    std::vector<int> heap;       // 按活跃度排列的二叉堆，存放候选决策变量
+    std::vector<int> heapIndex;  // 变量在堆中的位置，-1 表示不在堆中
+    std::vector<char> polarity;  // 相位保存：上次赋值是否为假
+    std::vector<char> seen;
+    std::vector<bool> model;
+    double maxLearnts = 0;
+    Stats stats;
+
+    static int var(int lit) { return lit >> 1; }
+    static bool sign(int lit) { return lit & 1; }
+
+    int8_t value(int lit) const {
+        int8_t v = assigns[var(lit)];
+        return v == UNDEF ? UNDEF : static_cast<int8_t>(v ^ sign(lit));
+    }
+
+    int decisionLevel() const {
+        return trailLim.size();
+    }
+
+    static int toInternal(int dimacs) {
+        return dimacs > 0 ? 2 * (dimacs - 1) : 2 * (-dimacs - 1) + 1;
+    }
+
+    bool heapLess(int a, int b) const {
+        return activity[a] > activity[b];
+    }
+
+    void heapUp(int i) {
+        int v = heap[i];
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+            if (!heapLess(v, heap[parent])) break;
+            heap[i] = heap[parent];
+            heapIndex[heap[i]] = i;
+            i = parent;
+        }
+        heap[i] = v;
+        heapIndex[v] = i;
+    }
+
+    void heapDown(int i) {
+        int v = heap[i];
+        int n = heap.size();
+        while (2 * i + 1 < n) {
+            int child = 2 * i + 1;
+            if (child + 1 < n && heapLess(heap[child + 1], heap[child])) ++child;
+            if (!heapLess(heap[child], v)) break;
+            heap[i] = heap[child];
+            heapIndex[heap[i]] = i;
+            i = child;
+        }
+        heap[i] = v;
+        heapIndex[v] = i;
+    }
+
+    void heapInsert(int v) {
+        if (heapIndex[v] >= 0) return;
+        heap.push_back(v);
+        heapUp(heap.size() - 1);
+    }
+
+    int heapPop() {
+        int top = heap[0];
+        heapIndex[top] = -1;
+        int last = heap.back();
+        heap.pop_back();
+        if (!heap.empty()) {
+            heap[0] = last;
+            heapIndex[last] = 0;
+            heapDown(0);
+        }
+        return top;
+    }
+
+    void bumpVariable(int v) {
+        if ((activity[v] += varInc) > 1e100) {
+            for (auto& a : activity) a *= 1e-100;
+            varInc *= 1e-100;
+        }
+        if (heapIndex[v] >= 0) heapUp(heapIndex[v]);
+    }
+
+    void bumpClause(Clause& c) {
+        if ((c.activity += clauseInc) > 1e20) {
+            for (int ci : learnts) clauses[ci].activity *= 1e-20;
+            clauseInc *= 1e-20;
+        }
+    }
+
+    void enqueue(int lit, int from) {
+        assigns[var(lit)] = !sign(lit);
+        level[var(lit)] = decisionLevel();
+        reason[var(lit)] = from;
+        trail.push_back(lit);
+    }
+
+    void attach(int ci) {
+        const Clause& c = clauses[ci];
+        watches[c.lits[0]].push_back(ci);
+        watches[c.lits[1]].push_back(ci);
+    }
+
+    // 单元传播，返回冲突子句下标，没有冲突时返回 -1
+    int propagate() {
+        while (qhead < trail.size()) {
+            int falseLit = trail[qhead++] ^ 1;
+            ++stats.propagations;
+            std::vector<int>& ws = watches[falseLit];
+            size_t i = 0, j = 0;
+            while (i < ws.size()) {
+                int ci = ws[i++];
+                Clause& c = clauses[ci];
+                if (c.lits[0] == falseLit) std::swap(c.lits[0], c.lits[1]);
+                if (value(c.lits[0]) == 1) {
+                    ws[j++] = ci;
+                    continue;
+                }
+                bool moved = false;
+                for (size_t k = 2; k < c.lits.size(); ++k) {
+                    if (value(c.lits[k]) != 0) {
+                        std::swap(c.lits[1], c.lits[k]);
+                        watches[c.lits[1]].push_back(ci);
+                        moved = true;
+                        break;
+                    }
+                }
+                if (moved) continue;
+                ws[j++] = ci;
+                if (value(c.lits[0]) == 0) {
+                    while (i < ws.size()) ws[j++] = ws[i++];
+                    ws.resize(j);
+                    qhead = trail.size();
+                    return ci;
+                }
+                enqueue(c.lits[0], ci);
+            }
+            ws.resize(j);
+        }
+        return -1;
+    }
+
+    // 文字的推理原因全部已在学习子句中时，该文字是多余的
+    bool redundant(int lit) const {
+        int r = reason[var(lit)];
+        if (r < 0) return false;
+        const Clause& c = clauses[r];
+        for (size_t k = 1; k < c.lits.size(); ++k) {
+            int v = var(c.lits[k]);
+            if (!seen[v] && level[v] > 0) return false;
+        }
+        return true;
+    }
+
+    // 一阶 UIP 冲突分析：返回学习子句（第 0 个为断言文字，第 1 个为回退层最高的文字）与回退层
+    std::vector<int> analyze(int conflict, int& backtrackLevel) {
+        std::vector<int> learnt = {-1};
+        int pathCount = 0;
+        int p = -1;
+        int index = trail.size() - 1;
+        do {
+            Clause& c = clauses[conflict];
+            if (c.learnt) bumpClause(c);
+            for (size_t k = (p == -1 ? 0 : 1); k < c.lits.size(); ++k) {
+                int q = c.lits[k];
+                int v = var(q);
+                if (seen[v] || level[v] == 0) continue;
+                seen[v] = 1;
+                bumpVariable(v);
+                if (level[v] >= decisionLevel()) {
+                    ++pathCount;
+                } else {
+                    learnt.push_back(q);
+                }
+            }
+            while (!seen[var(trail[index])]) --index;
+            p = trail[index--];
+            conflict = reason[var(p)];
+            seen[var(p)] = 0;
+            --pathCount;
+        } while (pathCount > 0);
+        learnt[0] = p ^ 1;
+
+        // 局部最小化
+        std::vector<int> kept = {learnt[0]};
+        for (size_t k = 1; k < learnt.size(); ++k) {
+            if (!redundant(learnt[k])) kept.push_back(learnt[k]);
+        }
+        for (int lit : learnt) seen[var(lit)] = 0;
+
+        backtrackLevel = 0;
+        if (kept.size() > 1) {
+            size_t maxIndex = 1;
+            for (size_t k = 2; k < kept.size(); ++k) {
+                if (level[var(kept[k])] > level[var(kept[maxIndex])]) maxIndex = k;
+            }
+            std::swap(kept[1], kept[maxIndex]);
+            backtrackLevel = level[var(kept[1])];
+        }
+        return kept;
+    }
+
+    void backtrack(int targetLevel) {
+        if (decisionLevel() <= targetLevel) return;
+        for (int i = trail.size() - 1; i >= trailLim[targetLevel]; --i) {
+            int v = var(trail[i]);
+            polarity[v] = sign(trail[i]);
+            assigns[v] = UNDEF;
+            reason[v] = -1;
+            heapInsert(v);
+        }
+        trail.resize(trailLim[targetLevel]);
+        trailLim.resize(targetLevel);
+        qhead = trail.size();
+    }
+
+    int pickBranchLiteral() {
+        while (!heap.empty()) {
+            int v = heapPop();
+            if (assigns[v] == UNDEF) return 2 * v + polarity[v];
+        }
+        return -1;
+    }
+
+    bool locked(int ci) const {
+        const Clause& c = clauses[ci];
+        return reason[var(c.lits[0])] == ci && value(c.lits[0]) == 1;
+    }
+
+    // 删去活跃度较低的一半学习子句（二元子句与正作为推理原因的子句保留），
+    // 随后把它们移出监视表并压缩子句表，长时间求解时内存与传播开销不会随删除的子句累积
+    void reduceLearnts() {
+        std::sort(learnts.begin(), learnts.end(), [&](int a, int b) {
+            return clauses[a].activity < clauses[b].activity;
+        });
+        std::vector<int> keep;
+        size_t half = learnts.size() / 2;
+        for (size_t k = 0; k < learnts.size(); ++k) {
+            int ci = learnts[k];
+            Clause& c = clauses[ci];
+            if (k < half && c.lits.size() > 2 && !locked(ci)) {
+                c.deleted = true;
+                ++stats.deleted;
+            } else {
+                keep.push_back(ci);
+            }
+        }
+        if (keep.size() == learnts.size()) return;
+        learnts.swap(keep);
+
+        // 存活的子句前移，监视表、学习子句表与推理原因改用新下标；被删的子句都不是推理原因
+        std::vector<int> newIndex(clauses.size(), -1);
+        size_t n = 0;
+        for (size_t ci = 0; ci < clauses.size(); ++ci) {
+            if (clauses[ci].deleted) continue;
+            newIndex[ci] = n;
+            if (n != ci) clauses[n] = std::move(clauses[ci]);
+            ++n;
+        }
+        clauses.resize(n);
+        for (auto& ws : watches) {
+            size_t j = 0;
+            for (int ci : ws) {
+                if (newIndex[ci] >= 0) ws[j++] = newIndex[ci];
+            }
+            ws.resize(j);
+        }
+        for (int& ci : learnts) ci = newIndex[ci];
+        for (int lit : trail) {
+            int& r = reason[var(lit)];
+            if (r >= 0) r = newIndex[r];
+        }
+    }
+
+    // Luby 序列：1 1 2 1 1 2 4 ...
+    static double luby(double y, int x) {
+        int size = 1, seq = 0;
+        while (size < x + 1) {
+            ++seq;
+            size = 2 * size + 1;
+        }
+        while (size - 1 != x) {
+            size = (size - 1) >> 1;
+            --seq;
+            x = x % size;
+        }
+        return std::pow(y, seq);
+    }
+
+public:
+    int newVariable() {
+        int v = assigns.size();
+        assigns.push_back(UNDEF);
+        level.push_back(0);
+        reason.push_back(-1);
+        activity.push_back(0);
+        polarity.push_back(1);
+        seen.push_back(0);
+        heapIndex.push_back(-1);
+        watches.emplace_back();
+        watches.emplace_back();
+        heapInsert(v);
+        return v + 1;
+    }
+
+    int numVariables() const {
+        return assigns.size();
+    }
+
+    size_t numClauses() const {
+        return clauses.size() - learnts.size();
+    }
+
+    // 只能在求解前（第 0 层）添加；得到空子句时返回 false
+    bool addClause(const std::vector<int>& dimacs) {
+        if (!ok) return false;
+        std::vector<int> lits;
+        for (int d : dimacs) {
+            if (d == 0 || std::abs(d) > numVariables()) throw std::runtime_error("Invalid literal in clause");
+            lits.push_back(toInternal(d));
+        }
+        std::sort(lits.begin(), lits.end());
+        std::vector<int> simplified;
+        for (size_t k = 0; k < lits.size(); ++k) {
+            if (value(lits[k]) == 1 || (k + 1 < lits.size() && lits[k + 1] == (lits[k] ^ 1))) return true;
+            if (value(lits[k]) == 0 || (k > 0 && lits[k] == lits[k - 1])) continue;
+            simplified.push_back(lits[k]);
+        }
+        if (simplified.empty()) return ok = false;
+        if (simplified.size() == 1) {
+            enqueue(simplified[0], -1);
+            return ok = (propagate() < 0);
+        }
+        clauses.push_back({simplified, false, false, 0});
+        attach(clauses.size() - 1);
+        return true;
+    }
+
+    // conflictBudget < 0 表示不限冲突次数
+    Result solve(long conflictBudget = -1) {
+        if (!ok) return Result::UNSAT;
+        maxLearnts = std::max(1000.0, numClauses() / 3.0);
+        int restartCount = 0;
+        long conflictsAtStart = stats.conflicts;
+        while (true) {
+            long restartLimit = static_cast<long>(100 * luby(2, restartCount));
+            long conflictsThisRestart = 0;
+            while (true) {
+                int conflict = propagate();
+                if (conflict >= 0) {
+                    ++stats.conflicts;
+                    ++conflictsThisRestart;
+                    if (decisionLevel() == 0) {
+                        ok = false;
+                        return Result::UNSAT;
+                    }
+                    int backtrackLevel;
+                    std::vector<int> learnt = analyze(conflict, backtrackLevel);
+                    backtrack(backtrackLevel);
+                    if (learnt.size() == 1) {
+                        enqueue(learnt[0], -1);
+                    } else {
+                        clauses.push_back({learnt, true, false, 0});
+                        int ci = clauses.size() - 1;
+                        attach(ci);
+                        learnts.push_back(ci);
+                        bumpClause(clauses[ci]);
+                        enqueue(learnt[0], ci);
+                        ++stats.learned;
+                    }
+                    varInc /= 0.95;
+                    clauseInc /= 0.999;
+                    continue;
+                }
+                if (conflictBudget >= 0 && stats.conflicts - conflictsAtStart >= conflictBudget) {
+                    backtrack(0);
+                    return Result::UNKNOWN;
+                }
+                if (conflictsThisRestart >= restartLimit) {
+                    backtrack(0);
+                    ++stats.restarts;
+                    break;
+                }
+                if (static_cast<double>(learnts.size()) - trail.size() >= maxLearnts) {
+                    reduceLearnts();
+                    maxLearnts *= 1.1;
+                }
+                int lit = pickBranchLiteral();
+                if (lit < 0) {
+                    model.assign(assigns.size(), false);
+                    for (size_t v = 0; v < assigns.size(); ++v) model[v] = assigns[v] == 1;
+                    backtrack(0);
+                    return Result::SAT;
+                }
+                ++stats.decisions;
+                trailLim.push_back(trail.size());
+                enqueue(lit, -1);
+            }
+            ++restartCount;
+        }
+    }
+
+    // 最近一次 SAT 结果中变量（从 1 开始）的取值
+    bool modelValue(int variable) const {
+        return model[variable - 1];
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+// Tseitin 编码：V 按德摩根律改写为 ^，每个与门对应一个新变量并加入与其等价的子句；
+// NOT 与复制不引入变量。与门按（排序后的）输入文字做结构哈希，相同的子电路只编码一次。
+// 同一编码器多次编码时共享程序变量与门，用于构造等价性检查的 miter
+class TseitinEncoder {
+private:
+    CDCLSolver& solver;
+    std::unordered_map<std::string, int> inputVariables;
+    std::unordered_map<uint64_t, int> andGates;
+    int trueLiteral = 0;
+
+    int constant(bool value) {
+        if (!trueLiteral) {
+            trueLiteral = solver.newVariable();
+            solver.addClause({trueLiteral});
+        }
+        return value ? trueLiteral : -trueLiteral;
+    }
+
+    int andGate(int a, int b) {
+        if (a == b) return a;
+        if (a == -b) return constant(false);
+        if (trueLiteral) {
+            if (a == trueLiteral) return b;
+            if (b == trueLiteral) return a;
+            if (a == -trueLiteral || b == -trueLiteral) return -trueLiteral;
+        }
+        if (a > b) std::swap(a, b);
+        uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(a)) << 32) | static_cast<uint32_t>(b);
+        auto it = andGates.find(key);
+        if (it != andGates.end()) return it->second;
+        // t <-> a ^ b
+        int t = solver.newVariable();
+        solver.addClause({-t, a});
+        solver.addClause({-t, b});
+        solver.addClause({t, -a, -b});
+        andGates[key] = t;
+        return t;
+    }
+
+public:
+    explicit TseitinEncoder(CDCLSolver& solver) : solver(solver) {}
+
+    // 返回表示 resultVar 的文字；quads 必须是值代码
+    int encode(const std::vector<Quadruple>& quads, const std::string& resultVar) {
+        std::unordered_map<std::string, int> literalOf;
+        auto operand = [&](const std::string& arg) -> int {
+            if (arg == "true" || arg == "false") return constant(arg == "true");
+            auto it = literalOf.find(arg);
+            if (it != literalOf.end()) return it->second;
+            auto input = inputVariables.find(arg);
+            if (input != inputVariables.end()) return input->second;
+            return inputVariables[arg] = solver.newVariable();
+        };
+        for (const auto& q : quads) {
+            if (q.op == "!") {
+                literalOf[q.result] = -operand(q.arg1);
+            } else if (q.op == "=") {
+                literalOf[q.result] = operand(q.arg1);
+            } else if (q.op == "^") {
+                literalOf[q.result] = andGate(operand(q.arg1), operand(q.arg2));
+            } else if (q.op == "V") {
+                literalOf[q.result] = -andGate(-operand(q.arg1), -operand(q.arg2));
+            } else {
+                throw std::runtime_error("Tseitin encoding needs straight-line code, found '" + q.op + "'");
+            }
+        }
+        return operand(resultVar);
+    }
+
+    const std::unordered_map<std::string, int>& inputs() const {
+        return inputVariables;
+    }
+
+    // 把求解器模型中程序变量的取值写入 model
+    void extractModel(const CDCLSolver& solver, std::unordered_map<std::string, bool>* model) const {
+        if (!model) return;
+        model->clear();
+        for (const auto& input : inputVariables) (*model)[input.first] = solver.modelValue(input.second);
+    }
+};
+
+// 把表达式文本编译为值代码
+std::vector<Quadruple> compileValueCode(const std::string& expr, std::string& resultVar) {
+    ASTBuilder builder;
+    ASTNode* tree = builder.buildFromTokens(tokenizeExpression(expr));
+    QuaternionGenerator generator;
+    resultVar = generator.genExpression(tree);
+    delete tree;
+    return generator.getQuaternions();
+}
+
+// 四元式 quads 计算的 resultVar 是否可能为真；可满足时 model 给出一组使其为真的赋值
+bool isSatisfiable(const std::vector<Quadruple>& quads, const std::string& resultVar,
+                   std::unordered_map<std::string, bool>* model = nullptr) {
+    CDCLSolver solver;
+    TseitinEncoder encoder(solver);
+    solver.addClause({encoder.encode(quads, resultVar)});
+    bool sat = solver.solve() == CDCLSolver::Result::SAT;
+    if (sat) encoder.extractModel(solver, model);
+    return sat;
+}
+
+bool isSatisfiable(const std::string& expr, std::unordered_map<std::string, bool>* model = nullptr) {
+    std::string resultVar;
+    std::vector<Quadruple> quads = compileValueCode(expr, resultVar);
+    return isSatisfiable(quads, resultVar, model);
+}
+
+// 两段代码是否对所有赋值结果相同：对 a XOR b 求可满足性，不等价时 counterexample 给出反例
+bool areEquivalent(const std::vector<Quadruple>& quadsA, const std::string& resultA,
+                   const std::vector<Quadruple>& quadsB, const std::string& resultB,
+                   std::unordered_map<std::string, bool>* counterexample = nullptr) {
+    CDCLSolver solver;
+    TseitinEncoder encoder(solver);
+    int a = encoder.encode(quadsA, resultA);
+    int b = encoder.encode(quadsB, resultB);
+    solver.addClause({a, b});
+    solver.addClause({-a, -b});
+    bool sat = solver.solve() == CDCLSolver::Result::SAT;
+    if (sat) encoder.extractModel(solver, counterexample);
+    return !sat;
+}
+
+bool areEquivalent(const std::string& a, const std::string& b,
+                   std::unordered_map<std::string, bool>* counterexample = nullptr) {
+    std::string resultA, resultB;
+    std::vector<Quadruple> quadsA = compileValueCode(a, resultA);
+    std::vector<Quadruple> quadsB = compileValueCode(b, resultB);
+    return areEquivalent(quadsA, resultA, quadsB, resultB, counterexample);
+}
+
+// 可满足性与等价性基准：数千变量的随机表达式，分别检查可满足、E 与独立编码的副本等价、
+// E 与优化后的 E 等价、E 与改动一个运算符后的 E 不等价；另用随机 3-CNF 考察冲突学习本身
+void runSatBenchmark(std::ostream& os) {
+    std::mt19937 rng(53);
+    os << std::left << std::setw(12) << "check" << std::right << std::setw(8) << "vars" << std::setw(10) << "quads"
+       << std::setw(10) << "result" << std::setw(12) << "ms" << std::setw(12) << "conflicts" << std::endl;
+    auto report = [&](const std::string& name, int numVars, size_t numQuads,
+                      const std::function<std::pair<std::string, long>()>& check) {
+        auto start = std::chrono::steady_clock::now();
+        std::pair<std::string, long> outcome = check();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        os << std::left << std::setw(12) << name << std::right << std::setw(8) << numVars << std::setw(10) << numQuads
+           << std::setw(10) << outcome.first << std::fixed << std::setprecision(1) << std::setw(12) << ms
+           << std::setw(12) << outcome.second << std::endl;
+        os.unsetf(std::ios::fixed);
+    };
+    auto satCheck = [](const std::vector<Quadruple>& quads, const std::string& resultVar) {
+        CDCLSolver solver;
+        TseitinEncoder encoder(solver);
+        solver.addClause({encoder.encode(quads, resultVar)});
+        bool sat = solver.solve() == CDCLSolver::Result::SAT;
+        return std::make_pair(std::string(sat ? "SAT" : "UNSAT"), solver.getStats().conflicts);
+    };
+    auto equivalenceCheck = [](const std::vector<Quadruple>& quadsA, const std::string& resultA,
+                               const std::vector<Quadruple>& quadsB, const std::string& resultB) {
+        CDCLSolver solver;
+        TseitinEncoder encoder(solver);
+        int a = encoder.encode(quadsA, resultA), b = encoder.encode(quadsB, resultB);
+        solver.addClause({a, b});
+        solver.addClause({-a, -b});
+        bool sat = solver.solve() == CDCLSolver::Result::SAT;
+        return std::make_pair(std::string(sat ? "differ" : "equal"), solver.getStats().conflicts);
+    };
+
+    for (int numVars : {1000, 4000, 16000}) {
+        std::string expr = generateRandomExpression(numVars, numVars * 2, rng);
+        std::string resultVar;
+        std::vector<Quadruple> quads = compileValueCode(expr, resultVar);
+
+        // 随机改动一处运算符
+        std::string mutated = expr;
+        std::vector<size_t> operators;
+        for (size_t i = 0; i < mutated.size(); ++i) {
+            if (mutated[i] == 'V' || mutated[i] == '^') operators.push_back(i);
+        }
+        size_t at = operators[rng() % operators.size()];
+        mutated[at] = (mutated[at] == 'V') ? '^' : 'V';
+        std::string mutatedResult;
+        std::vector<Quadruple> mutatedQuads = compileValueCode(mutated, mutatedResult);
+
+        std::vector<Quadruple> optimized = quads;
+        std::vector<std::string> roots = {resultVar};
+        PassManager manager;
+        manager.setPipeline(PassManager::defaultPipeline());
+        manager.run(optimized, roots);
+
+        report("sat", numVars, quads.size(), [&] { return satCheck(quads, resultVar); });
+        report("copy", numVars, quads.size(), [&] { return equivalenceCheck(quads, resultVar, quads, resultVar); });
+        report("optimized", numVars, quads.size(), [&] {
+            return equivalenceCheck(quads, resultVar, optimized, roots[0]);
+        });
+        report("mutated", numVars, quads.size(), [&] {
+            return equivalenceCheck(quads, resultVar, mutatedQuads, mutatedResult);
+        });
+    }
+
+    // 随机 3-CNF：子句数与变量数之比接近 4.26 时最难；比值较低的大实例主要考察传播速度
+    for (auto instance : {std::make_pair(100, 4.26), std::make_pair(200, 4.26), std::make_pair(5000, 3.0)}) {
+        int numVars = instance.first;
+        int numClauses = static_cast<int>(numVars * instance.second);
+        std::uniform_int_distribution<int> varDist(0, numVars - 1);
+        std::string cnf;
+        for (int k = 0; k < numClauses; ++k) {
+            cnf += (k ? " ^ (" : "(");
+            for (int j = 0; j < 3; ++j) {
+                cnf += (j ? " V " : "") + std::string(rng() & 1 ? "-" : "") + "x" + std::to_string(varDist(rng));
+            }
+            cnf += ")";
+        }
+        std::string resultVar;
+        std::vector<Quadruple> quads = compileValueCode(cnf, resultVar);
+        report("3cnf_" + std::to_string(numClauses), numVars, quads.size(), [&] { return satCheck(quads, resultVar); });
+    }
+}
+
+// 多线程编译：所有工作线程共享同一个只读上下文，各自使用独立的四元式生成器，
+// 结果与递归下降分析器的输出逐条比较，并报告不同线程数下的吞吐量
+void runConcurrentCompileBenchmark(const std::shared_ptr<const CompilerContext>& context, std::ostream& os) {
+    std::mt19937 rng(59);
+    const size_t numExpressions = 4000;
+    std::vector<std::string> expressions;
+    for (size_t i = 0; i < numExpressions; ++i) expressions.push_back(generateRandomExpression(32, 256, rng));
+
+    auto compileAll = [&](size_t worker, size_t workers, std::vector<std::vector<Quadruple>>& out) {
+        QuaternionGenerator generator;
+        for (size_t i = worker; i < expressions.size(); i += workers) {
+            generator.clearQuaternions();
+            context->compile(expressions[i], generator);
+            out[i] = generator.getQuaternions();
+        }
+    };
+    auto sameCode = [](const std::vector<Quadruple>& a, const std::vector<Quadruple>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i].op != b[i].op || a[i].arg1 != b[i].arg1 || a[i].arg2 != b[i].arg2 || a[i].result != b[i].result) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // 参考结果来自递归下降的 ASTBuilder，同时校验 LR 分析器构造的语法树
+    std::vector<std::vector<Quadruple>> reference(numExpressions);
+    for (size_t i = 0; i < numExpressions; ++i) {
+        ASTBuilder builder;
+        std::unique_ptr<ASTNode> tree(builder.buildFromTokens(tokenizeExpression(expressions[i])));
+        QuaternionGenerator generator;
+        generator.genExpression(tree.get());
+        reference[i] = generator.getQuaternions();
+    }
+
+    unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> counts = {1, 2, 4};
+    if (hardware > 4) counts.push_back(hardware);
+    os << "硬件线程数: " << hardware << "，表达式数: " << numExpressions << std::endl;
+    os << std::setw(8) << "threads" << std::setw(12) << "ms" << std::setw(14) << "exprs/s" << std::setw(10)
+       << "speedup" << std::setw(8) << "check" << std::endl;
+    double baseline = 0;
+    for (unsigned threads : counts) {
+        std::vector<std::vector<Quadruple>> results(numExpressions);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned w = 0; w < threads; ++w) {
+            workers.emplace_back(compileAll, w, threads, std::ref(results));
+        }
+        for (auto& worker : workers) worker.join();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (threads == 1) baseline = ms;
+        bool ok = true;
+        for (size_t i = 0; i < numExpressions && ok; ++i) ok = sameCode(results[i], reference[i]);
+        os << std::setw(8) << threads << std::fixed << std::setprecision(1) << std::setw(12) << ms << std::setprecision(0)
+           << std::setw(14) << numExpressions / ms * 1000 << std::setprecision(2) << std::setw(10) << baseline / ms
+           << std::setw(8) << (ok ? "ok" : "FAIL") << std::endl;
+        os.unsetf(std::ios::fixed);
+    }
+}
+
+void appendU32(std::string& out, uint32_t value) {
+    char bytes[4];
+    std::memcpy(bytes, &value, 4);
+    out.append(bytes, 4);
+}
+
+uint32_t readU32(const char* data) {
+    uint32_t value;
+    std::memcpy(&value, data, 4);
+    return value;
+}
+
+// 一个表达式的编译产物：数值四元式、结果变量与目标代码文本（每行一条指令）
+struct CompiledArtifact {
+    std::vector<Quadruple> quadruples;
+    std::string resultVar;
+    std::string targetCode;
+
+    size_t byteSize() const {
+        size_t size = sizeof(CompiledArtifact) + resultVar.size() + targetCode.size();
+        for (const auto& q : quadruples) {
+            size += sizeof(Quadruple) + q.op.size() + q.arg1.size() + q.arg2.size() + q.result.size();
+        }
+        return size;
+    }
+};
+
+// 词法分析之后的完整编译：语法分析、生成四元式与目标代码
+CompiledArtifact compileTokens(const CompilerContext& context, const std::vector<Token>& tokens,
+                               ParserEngine engine = ENGINE_LR) {
+    std::unique_ptr<ASTNode> tree(context.buildTree(tokens, engine));
+    QuaternionGenerator generator;
+    CompiledArtifact artifact;
+    {
+        ScopedPhase scope(PHASE_IR);
+        artifact.resultVar = generator.genExpression(tree.get());
+        Profiler::count(COUNTER_QUADS, generator.getQuaternions().size());
+    }
+    for (const auto& instruction : generator.generateTargetInstructions()) {
+        artifact.targetCode += instruction.toString();
+        artifact.targetCode += "\n";
+    }
+    artifact.quadruples = generator.getQuaternions();
+    return artifact;
+}
+
+struct CompileCacheStats {
+    size_t hits = 0;        // 内存命中
+    size_t diskHits = 0;    // 内存未命中、磁盘命中
+    size_t misses = 0;      // 两级都未命中，需要重新编译
+    size_t evictions = 0;   // 因超出内存上限被淘汰的条目
+    size_t diskWrites = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// 按内容寻址的编译缓存：键是规范化 token 序列的 64 位 FNV-1a 哈希。词法分析已把 || 统一为 V、&& 统一为 ^、
+// ! 统一为 -，并丢弃空白，因此写法不同但 token 相同的表达式共享一个条目。
+// 内存中按最近使用顺序淘汰，总大小不超过 capacityBytes；directory 非空时条目同时写入磁盘
+// （每个条目一个以哈希命名的文件），内存未命中时先查磁盘。条目保存规范化 token 串，哈希冲突时按未命中处理。
+// 所有成员函数都可以被多个线程同时调用
+class CompileCache {
+private:
+    struct Entry {
+        uint64_t hash;
+        std::string key;
+        std::shared_ptr<const CompiledArtifact> artifact;
+        size_t bytes;
+    };
+
+    size_t capacityBytes;
+    std::string directory;
+    std::string scope;  // 每个键的前缀：格式版本与文法指纹，换文法或改代码生成后旧条目不会命中
+    mutable std::mutex mutex;
+    std::list<Entry> lru;  // 队首为最近使用
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    CompileCacheStats stats;
+
+    std::string pathOf(uint64_t hash) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.qc", static_cast<unsigned long long>(hash));
+        return directory + name;
+    }
+
+    // 磁盘格式："QCCF" | u32 格式版本 | u64 文法指纹 | 键 | 结果变量 | 目标代码 | u32 四元式条数 | 每条四个字段；
+    // 字符串均为 u32 长度 + 内容
+    std::string serialize(const std::string& key, const CompiledArtifact& artifact) const {
+        std::string data = "QCCF" + scope;
+        auto putString = [&](const std::string& s) {
+            appendU32(data, static_cast<uint32_t>(s.size()));
+            data += s;
+        };
+        putString(key);
+        putString(artifact.resultVar);
+        putString(artifact.targetCode);
+        appendU32(data, static_cast<uint32_t>(artifact.quadruples.size()));
+        for (const auto& q : artifact.quadruples) {
+            putString(q.op);
+            putString(q.arg1);
+            putString(q.arg2);
+            putString(q.result);
+        }
+        return data;
+    }
+
+    bool deserialize(const std::string& data, const std::string& key, CompiledArtifact& artifact) const {
+        size_t pos = 4 + scope.size();
+        bool ok = data.compare(0, 4, "QCCF") == 0 && data.compare(4, scope.size(), scope) == 0;
+        auto getString = [&](std::string& s) {
+            if (!ok || data.size() - pos < 4) return ok = false;
+            uint32_t length = readU32(data.data() + pos);
+            pos += 4;
+            if (data.size() - pos < length) return ok = false;
+            s.assign(data, pos, length);
+            pos += length;
+            return true;
+        };
+        std::string storedKey;
+        if (!getString(storedKey) || storedKey != key) return false;
+        getString(artifact.resultVar);
+        getString(artifact.targetCode);
+        if (!ok || data.size() - pos < 4) return false;
+        uint32_t count = readU32(data.data() + pos);
+        pos += 4;
+        for (uint32_t i = 0; i < count && ok; ++i) {
+            std::string op, arg1, arg2, result;
+            getString(op);
+            getString(arg1);
+            getString(arg2);
+            getString(result);
+            artifact.quadruples.emplace_back(op, arg1, arg2, result);
+        }
+        return ok && pos == data.size();
+    }
+
+    std::shared_ptr<const CompiledArtifact> loadFromDisk(uint64_t hash, const std::string& key) const {
+        std::ifstream file(pathOf(hash), std::ios::binary);
+        if (!file.is_open()) return nullptr;
+        std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        auto artifact = std::make_shared<CompiledArtifact>();
+        if (!deserialize(data, key, *artifact)) return nullptr;
+        return artifact;
+    }
+
+    // 先写 mkstemp 建立的临时文件再改名，多个进程共用目录、并发写同一条目或中途退出都不会留下半个文件
+    bool storeToDisk(uint64_t hash, const std::string& key, const CompiledArtifact& artifact) const {
+        std::string path = pathOf(hash);
+        std::string temporary = path + ".tmpXXXXXX";
+        int fd = mkstemp(&temporary[0]);
+        if (fd < 0) return false;
+        fchmod(fd, 0644);
+        std::string data = serialize(key, artifact);
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            written += n;
+        }
+        bool ok = close(fd) == 0 && written == data.size() && std::rename(temporary.c_str(), path.c_str()) == 0;
+        if (!ok) unlink(temporary.c_str());
+        return ok;
+    }
+
+    // 调用方持有锁
+    void insertLocked(uint64_t hash, const std::string& key, std::shared_ptr<const CompiledArtifact> artifact) {
+        auto it = index.find(hash);
+        if (it != index.end()) {
+            stats.bytes -= it->second->bytes;
+            lru.erase(it->second);
+            index.erase(it);
+        }
+        size_t bytes = artifact->byteSize() + key.size() + sizeof(Entry);
+        lru.push_front({hash, key, std::move(artifact), bytes});
+        index[hash] = lru.begin();
+        stats.bytes += bytes;
+        while (stats.bytes > capacityBytes && lru.size() > 1) {
+            stats.bytes -= lru.back().bytes;
+            index.erase(lru.back().hash);
+            lru.pop_back();
+            ++stats.evictions;
+        }
+        stats.entries = lru.size();
+    }
+
+public:
+    // 磁盘格式或代码生成的输出改变时加一，使旧的磁盘条目失效
+    static const uint32_t FORMAT_VERSION = 2;
+
+    // grammarHash 取自 CompilerContext::grammarHash()，一个缓存只服务于一种文法
+    explicit CompileCache(uint64_t grammarHash, size_t capacityBytes = 64 << 20, const std::string& directory = "")
+        : capacityBytes(capacityBytes), directory(directory) {
+        appendU32(scope, FORMAT_VERSION);
+        appendU32(scope, static_cast<uint32_t>(grammarHash));
+        appendU32(scope, static_cast<uint32_t>(grammarHash >> 32));
+#if defined(__unix__)
+        if (!directory.empty() && mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw std::runtime_error("Cannot create cache directory " + directory);
+        }
+#endif
+    }
+
+    // 规范化 token 串：每个 token 写一个类型字节（|| 与 V、&& 与 ^ 视为同一类型），标识符再写名字
+    static std::string normalizedKey(const std::vector<Token>& tokens) {
+        std::string key;
+        for (const auto& token : tokens) {
+            if (token.type == TOK_END) break;
+            TokenType type = token.type == TOK_OR ? TOK_UNION : token.type == TOK_AND ? TOK_INTERSECTION : token.type;
+            key.push_back(static_cast<char>('A' + type));
+            if (token.type == TOK_IDENTIFIER || token.type == TOK_ILLEGAL) {
+                key += token.value;
+                key.push_back('\0');
+            }
+        }
+        return key;
+    }
+
+    static uint64_t hashKey(const std::string& key) {
+        uint64_t hash = 1469598103934665603ULL;
+        for (unsigned char c : key) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // 查找 tokens 的编译产物，两级都未命中时调用 produce 编译并写入缓存；produce 抛出的异常原样传出，不缓存
+    std::shared_ptr<const CompiledArtifact> getOrCompile(const std::vector<Token>& tokens,
+                                                         const std::function<CompiledArtifact()>& produce) {
+        std::string key = scope + normalizedKey(tokens);
+        uint64_t hash = hashKey(key);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(hash);
+            if (it != index.end() && it->second->key == key) {
+                lru.splice(lru.begin(), lru, it->second);
+                ++stats.hits;
+                return it->second->artifact;
+            }
+        }
+        if (!directory.empty()) {
+            if (std::shared_ptr<const CompiledArtifact> artifact = loadFromDisk(hash, key)) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++stats.diskHits;
+                insertLocked(hash, key, artifact);
+                return artifact;
+            }
+        }
+        auto artifact = std::make_shared<const CompiledArtifact>(produce());
+        bool written = !directory.empty() && storeToDisk(hash, key, *artifact);
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stats.misses;
+        stats.diskWrites += written;
+        insertLocked(hash, key, artifact);
+        return artifact;
+    }
+
+    CompileCacheStats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    void printStats(std::ostream& os) const {
+        CompileCacheStats s = getStats();
+        size_t lookups = s.hits + s.diskHits + s.misses;
+        os << "缓存: 命中 " << s.hits << "，磁盘命中 " << s.diskHits << "，未命中 " << s.misses << "，淘汰 "
+           << s.evictions << "，写盘 " << s.diskWrites << "，条目 " << s.entries << "，" << s.bytes / 1024
+           << " KiB，命中率 " << std::fixed << std::setprecision(1)
+           << (lookups ? 100.0 * (s.hits + s.diskHits) / lookups : 0) << "%" << std::endl;
+        os.unsetf(std::ios::fixed);
+    }
+};
+
+// 缓存效果：从少量不同表达式中重复抽取（随机插入空白、用 ||/&&/! 替换 V/^/-），
+// 比较无缓存、冷缓存、热缓存与只有磁盘存储时的编译时间，并核对缓存返回的结果与直接编译一致
+void runCompileCacheBenchmark(const CompilerContext& context, std::ostream& os) {
+    std::mt19937 rng(67);
+    std::vector<std::string> distinct;
+    for (int i = 0; i < 2000; ++i) distinct.push_back(generateRandomExpression(16, 8 + i % 120, rng));
+    auto respell = [&](const std::string& expr) {
+        std::string out;
+        for (char c : expr) {
+            if (c == 'V' && rng() % 2) out += "||";
+            else if (c == '^' && rng() % 2) out += "&&";
+            else if (c == '-' && rng() % 2) out += "!";
+            else out += c;
+            if (c == ' ' && rng() % 4 == 0) out += "  ";
+        }
+        return out;
+    };
+    std::vector<std::string> workload;
+    // 访问近似 Zipf 分布：少数表达式出现得很频繁
+    for (int i = 0; i < 50000; ++i) {
+        size_t pick = static_cast<size_t>(std::pow(distinct.size(), std::uniform_real_distribution<double>(0, 1)(rng))) - 1;
+        workload.push_back(respell(distinct[pick]));
+    }
+
+    std::string directory = "/tmp/compile-cache-" + std::to_string(getpid());
+    auto timeRun = [&](const char* name, CompileCache* cache) {
+        auto start = std::chrono::steady_clock::now();
+        size_t mismatches = 0, instructions = 0;
+        for (size_t i = 0; i < workload.size(); ++i) {
+            std::vector<Token> tokens = CompilerContext::tokenize(workload[i]);
+            if (cache) {
+                std::shared_ptr<const CompiledArtifact> artifact =
+                    cache->getOrCompile(tokens, [&]() { return compileTokens(context, tokens); });
+                instructions += artifact->targetCode.size();
+                // 抽查：缓存结果与直接编译一致
+                if (i % 97 == 0 && compileTokens(context, tokens).targetCode != artifact->targetCode) ++mismatches;
+            } else {
+                instructions += compileTokens(context, tokens).targetCode.size();
+            }
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        os << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(1) << std::setw(10)
+           << ms << " ms" << std::setprecision(0) << std::setw(12) << workload.size() / ms * 1000 << " 条/s"
+           << (mismatches ? "  结果不一致!" : "") << std::endl;
+        os.unsetf(std::ios::fixed);
+        if (cache) cache->printStats(os);
+    };
+
+    os << workload.size() << " 个请求，" << distinct.size() << " 个不同表达式" << std::endl;
+    timeRun("no cache", nullptr);
+    {
+        CompileCache cache(context.grammarHash(), 64 << 20, directory);
+        timeRun("cold+warm", &cache);
+        timeRun("warm", &cache);
+    }
+    {
+        CompileCache small(context.grammarHash(), 256 << 10);
+        timeRun("256 KiB LRU", &small);
+    }
+    {
+        // 新进程重启的情形：内存为空，条目从磁盘读回
+        CompileCache restarted(context.grammarHash(), 64 << 20, directory);
+        timeRun("disk restart", &restarted);
+    }
+    removeFlatDirectory(directory);
+}
+
+// 工作窃取线程池：每个工作线程有自己的双端队列，从队首取任务，自己的队列空了就从其他队列的队尾窃取。
+// 外部线程提交的任务按轮转分到各队列，工作线程内部提交的任务放进自己的队列
+class WorkStealingPool {
+public:
+    typedef std::function<void(unsigned)> Task;  // 参数为执行该任务的工作线程编号
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued{0};  // 在队列中尚未被取走的任务数
+    std::atomic<size_t> steals{0};
+    std::mutex stateMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable allDone;
+    size_t pending = 0;  // 已提交但尚未执行完的任务数
+    size_t nextQueue = 0;
+    bool stopping = false;
+
+    static thread_local const WorkStealingPool* currentPool;
+    static thread_local unsigned currentWorker;
+
+    bool takeFrom(unsigned index, bool front, Task& task) {
+        Queue& queue = *queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        if (front) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        } else {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        --queued;
+        return true;
+    }
+
+    bool tryPop(unsigned self, Task& task) {
+        if (takeFrom(self, true, task)) return true;
+        for (size_t k = 1; k < queues.size(); ++k) {
+            if (takeFrom((self + k) % queues.size(), false, task)) {
+                ++steals;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(unsigned self) {
+        currentPool = this;
+        currentWorker = self;
+        while (true) {
+            Task task;
+            if (tryPop(self, task)) {
+                task(self);
+                std::lock_guard<std::mutex> lock(stateMutex);
+                if (--pending == 0) allDone.notify_all();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(stateMutex);
+            workAvailable.wait(lock, [&] { return stopping || queued.load() > 0; });
+            if (stopping && queued.load() == 0) return;
+        }
+    }
+
+public:
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    explicit WorkStealingPool(unsigned numThreads) {
+        numThreads = std::max(1u, numThreads);
+        for (unsigned i = 0; i < numThreads; ++i) queues.emplace_back(new Queue);
+        for (unsigned i = 0; i < numThreads; ++i) threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+
+    unsigned size() const {
+        return threads.size();
+    }
+
+    size_t stealCount() const {
+        return steals.load();
+    }
+
+    void submit(Task task) {
+        // 先计入 pending 再放进队列：任务一入队就可能被执行完并递减 pending
+        unsigned index;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            ++pending;
+            index = currentPool == this ? currentWorker : nextQueue++ % queues.size();
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+            ++queued;
+        }
+        // 空等一次 stateMutex：正在检查等待条件的工作线程要么已看到 queued，要么已进入等待，不会错过通知
+        { std::lock_guard<std::mutex> lock(stateMutex); }
+        workAvailable.notify_one();
+    }
+
+    // 等待所有已提交的任务执行完
+    void wait() {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        allDone.wait(lock, [&] { return pending == 0; });
+    }
+};
+
+thread_local const WorkStealingPool* WorkStealingPool::currentPool = nullptr;
+thread_local unsigned WorkStealingPool::currentWorker = 0;
+
+// ================= 跨表达式全局值编号 =================
+
+// 共享程序的一个命名输出：规则名及其结果（临时变量、输入变量或常量）
+struct SharedOutput {
+    std::string name;
+    std::string value;
+};
+
+// 跨表达式的全局值编号：逐条并入各规则的值代码，所有规则共用一个值编号表和临时变量编号空间。
+// 运算数先换成已有的值，(op, arg1, arg2) 相同的运算只保留第一次出现（V/^ 按交换律规范化，--x 化为 x），
+// 所以多条规则中相同的子表达式在共享程序里只出现一次，每次求值只计算一次。
+// 规则名即输出变量，与输入变量、临时变量同在一个名字空间：规则名不能与任何规则的输入变量同名，
+// 共享临时变量编号为 t<tempBase+1>、t<tempBase+2>…，出现 t<k> 形式的规则名或输入变量时整体重编号到其后
+class SharedProgramBuilder {
+private:
+    std::vector<Quadruple> program;
+    std::vector<SharedOutput> outputs;
+    std::unordered_set<std::string> outputNames;
+    std::unordered_set<std::string> inputNames;
+    std::unordered_map<std::string, std::string> available;  // "op,arg1,arg2" 到已有结果
+    std::unordered_map<std::string, std::string> notOf;      // t = !x 中 t 到 x 的映射
+    size_t ruleQuadruples = 0;
+    size_t tempBase = 0;  // 用户名字中 t<k> 的最大 k，共享临时变量从其后编号
+
+    static bool isIdentifierName(const std::string& name) {
+        if (name.empty() || !isalpha(static_cast<unsigned char>(name[0])) || name[0] == 'V') return false;
+        for (char c : name) {
+            if (!isalnum(static_cast<unsigned char>(c)) && c != '_') return false;
+        }
+        return name != "true" && name != "false";
+    }
+
+    // name 为 t<k>（k 无前导零）时返回 k，否则返回 0；位数过多的编号不可能与临时变量相撞
+    static size_t tempNumber(const std::string& name) {
+        if (name.size() < 2 || name.size() > 19 || name[0] != 't' || name[1] == '0') return 0;
+        size_t k = 0;
+        for (size_t i = 1; i < name.size(); ++i) {
+            if (!isdigit(static_cast<unsigned char>(name[i]))) return 0;
+            k = k * 10 + (name[i] - '0');
+        }
+        return k;
+    }
+
+    std::string tempName(size_t index) const {
+        return "t" + std::to_string(tempBase + index + 1);
+    }
+
+    static std::string valueKey(const Quadruple& q) {
+        return q.op + "," + q.arg1 + "," + q.arg2;
+    }
+
+    // 用户名字占用了 t<k> 时把所有共享临时变量重编号到 k 之后。基数至少翻倍，
+    // 逐个出现的 t1、t2、t3… 只引起对数次重编号
+    void reserveName(const std::string& name) {
+        size_t k = tempNumber(name);
+        if (k <= tempBase) return;
+        std::unordered_map<std::string, std::string> rename;
+        size_t oldBase = tempBase;
+        tempBase = std::max(k, 2 * tempBase);
+        for (size_t i = 0; i < program.size(); ++i) {
+            rename["t" + std::to_string(oldBase + i + 1)] = tempName(i);
+        }
+        auto renamed = [&](const std::string& arg) {
+            auto it = rename.find(arg);
+            return it == rename.end() ? arg : it->second;
+        };
+        available.clear();
+        notOf.clear();
+        for (auto& q : program) {
+            q.arg1 = renamed(q.arg1);
+            q.arg2 = renamed(q.arg2);
+            q.result = renamed(q.result);
+            if (q.op == "!") notOf[q.result] = q.arg1;
+            else if (q.arg2 < q.arg1) std::swap(q.arg1, q.arg2);
+            available.emplace(valueKey(q), q.result);
+        }
+        for (auto& output : outputs) output.value = renamed(output.value);
+    }
+
+public:
+    // quads 为一条规则的值代码（genExpression 或 compileStream 的输出），resultVar 为其结果；
+    // 返回该规则的输出在共享程序中的值。规则名非法、重复或与输入变量同名时抛出 runtime_error，
+    // 此时共享程序不变
+    const std::string& addRule(const std::string& name, const std::vector<Quadruple>& quads,
+                               const std::string& resultVar) {
+        if (!isIdentifierName(name)) throw std::runtime_error("Invalid rule name '" + name + "'");
+        if (outputNames.count(name)) throw std::runtime_error("Duplicate rule name '" + name + "'");
+        // 先找出本规则的输入变量并检查名字冲突，再改动共享程序
+        std::unordered_set<std::string> defined, inputs;
+        auto useOperand = [&](const std::string& arg) {
+            if (isVariableOperand(arg) && !defined.count(arg)) inputs.insert(arg);
+        };
+        for (const auto& q : quads) {
+            if (q.op != "!" && q.op != "V" && q.op != "^" && q.op != "=") {
+                throw std::runtime_error("Shared programs need straight-line code, found '" + q.op + "'");
+            }
+            useOperand(q.arg1);
+            if (q.op == "V" || q.op == "^") useOperand(q.arg2);
+            defined.insert(q.result);
+        }
+        useOperand(resultVar);
+        if (inputNames.count(name) || inputs.count(name)) {
+            throw std::runtime_error("Rule name '" + name + "' collides with an input variable");
+        }
+        for (const auto& input : inputs) {
+            if (outputNames.count(input)) {
+                throw std::runtime_error("Input variable '" + input + "' collides with a rule name");
+            }
+        }
+
+        outputNames.insert(name);
+        reserveName(name);
+        for (const auto& input : inputs) {
+            if (inputNames.insert(input).second) reserveName(input);
+        }
+        std::unordered_map<std::string, std::string> local;  // 规则内的结果到共享程序中的值
+        auto value = [&](const std::string& arg) -> const std::string& {
+            auto it = local.find(arg);
+            return it == local.end() ? arg : it->second;
+        };
+        for (const auto& q : quads) {
+            ++ruleQuadruples;
+            std::string a = value(q.arg1);
+            std::string b = (q.op == "V" || q.op == "^") ? value(q.arg2) : "";
+            if (q.op == "=") {
+                local[q.result] = a;
+                continue;
+            }
+            if (q.op == "!") {
+                auto it = notOf.find(a);
+                if (it != notOf.end()) {
+                    local[q.result] = it->second;
+                    continue;
+                }
+            } else if (b < a) {
+                std::swap(a, b);
+            }
+            std::string key = q.op + "," + a + "," + b;
+            auto it = available.find(key);
+            if (it != available.end()) {
+                local[q.result] = it->second;
+                continue;
+            }
+            std::string temp = tempName(program.size());
+            if (q.op == "!") notOf[temp] = a;
+            program.emplace_back(q.op, a, b, temp);
+            available.emplace(std::move(key), temp);
+            local[q.result] = temp;
+        }
+        outputs.push_back({name, value(resultVar)});
+        return outputs.back().value;
+    }
+
+    // 词法分析并流式编译一条规则后并入
+    const std::string& addRule(const CompilerContext& context, const std::string& name, const std::string& text) {
+        class Collector : public QuadrupleSink {
+        public:
+            std::vector<Quadruple> quads;
+
+            void emit(const Quadruple& quad) override {
+                quads.push_back(quad);
+            }
+        };
+        std::vector<Token> tokens = CompilerContext::tokenize(text);
+        Collector collector;
+        std::string result = context.compileStream(tokens.data(), tokens.data() + tokens.size(), collector);
+        return addRule(name, collector.quads, result);
+    }
+
+    const std::vector<Quadruple>& getProgram() const {
+        return program;
+    }
+
+    const std::vector<SharedOutput>& getOutputs() const {
+        return outputs;
+    }
+
+    // 各规则单独编译时的四元式总数
+    size_t ruleQuadrupleCount() const {
+        return ruleQuadruples;
+    }
+
+    // 共享掉的四元式占单独编译总数的比例
+    double sharingRatio() const {
+        return ruleQuadruples ? 1.0 - static_cast<double>(program.size()) / ruleQuadruples : 0.0;
+    }
+
+    std::vector<std::string> outputValues() const {
+        std::vector<std::string> values;
+        for (const auto& output : outputs) values.push_back(output.value);
+        return values;
+    }
+
+    // 共享程序之后为每个输出加一条 (=, 值, , 规则名)，规则名即输出变量
+    std::vector<Quadruple> programWithOutputs() const {
+        std::vector<Quadruple> quads = program;
+        for (const auto& output : outputs) quads.emplace_back("=", output.value, "", output.name);
+        return quads;
+    }
+
+    // 整个批量的目标代码，registerMapOut 非空时返回变量（含各规则名）到寄存器的映射
+    std::vector<TargetInstruction> generateTargetInstructions(
+        std::map<std::string, std::string>* registerMapOut = nullptr) const {
+        QuaternionGenerator generator;
+        generator.setQuaternions(programWithOutputs());
+        return generator.generateTargetInstructions(registerMapOut);
+    }
+
+    // 一次求值算出所有输出的位并行求值器，输出顺序与 getOutputs() 相同
+    BitParallelEvaluator evaluator() const {
+        return BitParallelEvaluator(program, outputValues());
+    }
+
+    void printStats(std::ostream& os) const {
+        os << "共享程序: " << outputs.size() << " 条规则，单独编译 " << ruleQuadruples << " 条四元式，共享后 "
+           << program.size() << " 条，共享率 " << std::fixed << std::setprecision(1) << 100 * sharingRatio() << "%"
+           << std::endl;
+        os.unsetf(std::ios::fixed);
+        os << std::setprecision(6);
+    }
+};
+
+// 共享批量编译：in 中每行一条规则，"名字: 表达式" 或只有表达式（名字为 r<行号>），空行与 # 开头的行跳过。
+// 所有规则并入一个共享程序，out 中依次输出共享四元式、各规则的输出值与整个批量的目标代码；
+// 第一条出错的规则终止编译。统计写入 report
+SharedProgramBuilder runSharedBatchCompilation(const CompilerContext& context, std::istream& in, std::ostream& out,
+                                               std::ostream& report) {
+    auto start = std::chrono::steady_clock::now();
+    SharedProgramBuilder builder;
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+        std::string name = "r" + std::to_string(lineNumber);
+        std::string text = line;
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            std::string label = line.substr(0, colon);
+            size_t b = label.find_first_not_of(" \t"), e = label.find_last_not_of(" \t");
+            if (b == std::string::npos) throw std::runtime_error("Line " + std::to_string(lineNumber) + ": empty rule name");
+            name = label.substr(b, e - b + 1);
+            text = line.substr(colon + 1);
+        }
+        try {
+            builder.addRule(context, name, text);
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error("Line " + std::to_string(lineNumber) + ": " + e.what());
+        }
+    }
+    auto built = std::chrono::steady_clock::now();
+
+    std::map<std::string, std::string> registerMap;
+    std::vector<TargetInstruction> code = builder.generateTargetInstructions(&registerMap);
+    {
+        OutputBuffer buffer(out);
+        buffer.append("# shared program\n");
+        for (size_t i = 0; i < builder.getProgram().size(); ++i) {
+            buffer.appendNumber(i);
+            buffer.append(": ", 2);
+            builder.getProgram()[i].appendTo(buffer);
+            buffer.put('\n');
+        }
+        buffer.append("# outputs\n");
+        for (const auto& output : builder.getOutputs()) {
+            buffer.append(output.name + " = " + output.value + " -> " + registerMap[output.name] + "\n");
+        }
+        buffer.append("# target code\n");
+        writeTargetCode(code, buffer);
+    }
+    out.flush();
+    double buildSeconds = std::chrono::duration<double>(built - start).count();
+    double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    builder.printStats(report);
+    report << "目标指令 " << code.size() << " 条，编译与值编号 " << std::fixed << std::setprecision(3) << buildSeconds
+           << " s，合计 " << totalSeconds << " s" << std::endl;
+    report.unsetf(std::ios::fixed);
+    report << std::setprecision(6);
+    return builder;
+}
+
+// 共享程序基准：规则由一组公共条件随机组合而成（模拟同一批变量上的大量规则），
+// 比较逐条规则单独求值与共享程序一次求出全部输出的耗时，并逐位核对结果
+int runSharedProgramBenchmark(const CompilerContext& context, std::ostream& os) {
+    std::mt19937 rng(97);
+    std::mt19937_64 bits(101);
+    const int numVars = 24;
+    const size_t numWords = BitParallelEvaluator::CHUNK_WORDS;  // 一块 4096 组赋值，重复求值 rounds 次
+    const int rounds = 32;
+    std::vector<std::string> conditions;
+    for (int i = 0; i < 256; ++i) conditions.push_back("(" + generateRandomExpression(numVars, 4, rng) + ")");
+
+    int failures = 0;
+    os << std::setw(8) << "rules" << std::setw(12) << "rule quads" << std::setw(12) << "shared" << std::setw(10)
+       << "ratio" << std::setw(14) << "separate ms" << std::setw(12) << "shared ms" << std::setw(10) << "speedup"
+       << std::setw(8) << "check" << std::endl;
+    for (int numRules : {100, 1000, 5000}) {
+        SharedProgramBuilder builder;
+        std::vector<std::string> texts;
+        for (int r = 0; r < numRules; ++r) {
+            std::string text = conditions[rng() % conditions.size()];
+            for (int k = 1 + rng() % 3; k > 0; --k) {
+                text += (rng() % 3 ? " ^ " : " V ") + conditions[rng() % conditions.size()];
+            }
+            if (rng() % 4 == 0) text = "-(" + text + ")";
+            texts.push_back(text);
+            builder.addRule(context, "r" + std::to_string(r), text);
+        }
+
+        BitParallelEvaluator shared = builder.evaluator();
+        std::vector<std::vector<uint64_t>> data(numVars, std::vector<uint64_t>(numWords));
+        std::unordered_map<std::string, const uint64_t*> columnOf;
+        for (int v = 0; v < numVars; ++v) {
+            for (auto& word : data[v]) word = bits();
+            columnOf["x" + std::to_string(v)] = data[v].data();
+        }
+        auto columnsFor = [&](const BitParallelEvaluator& evaluator) {
+            std::vector<const uint64_t*> columns;
+            for (const auto& var : evaluator.variables()) columns.push_back(columnOf.at(var));
+            return columns;
+        };
+
+        std::vector<std::vector<uint64_t>> expected(numRules, std::vector<uint64_t>(numWords));
+        std::vector<BitParallelEvaluator> separate;
+        for (const auto& text : texts) {
+            std::vector<Token> tokens = CompilerContext::tokenize(text);
+            std::unique_ptr<ASTNode> tree(context.buildTree(tokens));
+            QuaternionGenerator generator;
+            std::string result = generator.genExpression(tree.get());
+            separate.emplace_back(generator.getQuaternions(), result);
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; ++round) {
+            for (int r = 0; r < numRules; ++r) {
+                separate[r].evaluate(columnsFor(separate[r]), numWords, expected[r].data());
+            }
+        }
+        double separateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<std::vector<uint64_t>> actual(numRules, std::vector<uint64_t>(numWords));
+        std::vector<uint64_t*> outs;
+        for (auto& result : actual) outs.push_back(result.data());
+        start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; ++round) shared.evaluate(columnsFor(shared), numWords, outs);
+        double sharedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        bool ok = actual == expected;
+        failures += !ok;
+        os << std::setw(8) << numRules << std::setw(12) << builder.ruleQuadrupleCount() << std::setw(12)
+           << builder.getProgram().size() << std::fixed << std::setprecision(1) << std::setw(9)
+           << 100 * builder.sharingRatio() << "%" << std::setprecision(2) << std::setw(14) << separateMs
+           << std::setw(12) << sharedMs << std::setprecision(1) << std::setw(9) << separateMs / sharedMs << "x"
+           << std::setw(8) << (ok ? "ok" : "FAIL") << std::endl;
+        os.unsetf(std::ios::fixed);
+    }
+    return failures;
+}
+
+// 共享程序的命名差分测试：规则名或输入变量形如临时变量 t<k> 的批量经 runSharedBatchCompilation 编译后，
+// 按名字解释 programWithOutputs() 得到每个输出，与该规则单独编译的结果在全部赋值上比较；
+// 规则名与输入变量同名的批量必须被拒绝。返回失败的用例数
+int runSharedNamingTest(const CompilerContext& context, std::ostream& os) {
+    const std::vector<std::vector<std::string>> accepted = {
+        {"t2: x V y", "r: a ^ b"},
+        {"t1: -(p V q)", "u: p V q", "t4: t9 ^ -p", "v: t9 V t3x"},
+        {"a V t1", "t5: -a ^ t1", "t6: t5x V -t1"},
+    };
+    const std::vector<std::vector<std::string>> rejected = {
+        {"x V r2", "y ^ x"},  // 第 2 行的默认名 r2 与第 1 行的输入同名
+        {"x: x V y"},
+        {"a: b V c", "d: a ^ c"},
+        {"true: a"},
+    };
+    int failures = 0;
+    for (const auto& lines : accepted) {
+        std::string batch;
+        for (const auto& line : lines) batch += line + "\n";
+        std::istringstream in(batch);
+        std::ostringstream out, report;
+        try {
+            SharedProgramBuilder builder = runSharedBatchCompilation(context, in, out, report);
+            std::vector<Quadruple> quads = builder.programWithOutputs();
+            for (size_t r = 0; r < lines.size(); ++r) {
+                const SharedOutput& output = builder.getOutputs()[r];
+                size_t colon = lines[r].find(':');
+                std::string resultVar;
+                std::vector<Quadruple> alone =
+                    compileValueCode(colon == std::string::npos ? lines[r] : lines[r].substr(colon + 1), resultVar);
+                BytecodeProgram expected(alone, resultVar), actual(quads, output.name);
+                std::vector<std::string> vars = expected.variables();
+                for (const auto& var : actual.variables()) {
+                    if (std::find(vars.begin(), vars.end(), var) == vars.end()) vars.push_back(var);
+                }
+                std::vector<uint8_t> registers(std::max(expected.registerCount(), actual.registerCount()));
+                bool ok = true;
+                for (uint64_t assignment = 0; assignment < (1ULL << vars.size()) && ok; ++assignment) {
+                    auto inputsOf = [&](const BytecodeProgram& program) {
+                        std::vector<uint8_t> inputs;
+                        for (const auto& var : program.variables()) {
+                            size_t i = std::find(vars.begin(), vars.end(), var) - vars.begin();
+                            inputs.push_back((assignment >> i) & 1);
+                        }
+                        return inputs;
+                    };
+                    bool want = BytecodeVM::run(expected, inputsOf(expected).data(), registers.data());
+                    bool got = BytecodeVM::run(actual, inputsOf(actual).data(), registers.data());
+                    ok = want == got;
+                }
+                if (!ok) {
+                    ++failures;
+                    os << "  输出 " << output.name << " 与单独编译的结果不一致: " << lines[r] << std::endl;
+                }
+            }
+        } catch (const std::runtime_error& e) {
+            ++failures;
+            os << "  批量被错误地拒绝: " << e.what() << std::endl;
+        }
+    }
+    for (const auto& lines : rejected) {
+        std::string batch;
+        for (const auto& line : lines) batch += line + "\n";
+        std::istringstream in(batch);
+        std::ostringstream out, report;
+        try {
+            runSharedBatchCompilation(context, in, out, report);
+            ++failures;
+            os << "  名字冲突未被拒绝: " << batch;
+        } catch (const std::runtime_error&) {
+        }
+    }
+    os << "共享程序命名测试: " << accepted.size() + rejected.size() << " 个批量，" << failures << " 个失败"
+       << std::endl;
+    return failures;
+}
+
+// 批量编译各阶段的耗时与计数，每个工作线程一份，按缓存行对齐避免伪共享
+struct alignas(64) BatchStageStats {
+    double lexSeconds = 0;
+    double parseSeconds = 0;
+    double irSeconds = 0;
+    double codegenSeconds = 0;
+    double cacheSeconds = 0;  // 缓存查找与插入（不含未命中时的编译）
+    size_t expressions = 0;
+    size_t errors = 0;
+    size_t quadruples = 0;
+    size_t instructions = 0;
+
+    void add(const BatchStageStats& other) {
+        lexSeconds += other.lexSeconds;
+        parseSeconds += other.parseSeconds;
+        irSeconds += other.irSeconds;
+        codegenSeconds += other.codegenSeconds;
+        cacheSeconds += other.cacheSeconds;
+        expressions += other.expressions;
+        errors += other.errors;
+        quadruples += other.quadruples;
+        instructions += other.instructions;
+    }
+};
+
+// 批量编译：in 中每行一个表达式（空行与 # 开头的行跳过），分析表只构造一次。
+// 输入按块读入，块内每 CHUNK_LINES 行为一个任务交给工作窃取线程池执行 词法→语法→四元式→目标代码；
+// 每个任务把结果写入自己的缓冲区，主线程按输入顺序输出，同时读入下一块，使读写与编译重叠。
+// 每个表达式输出 "# 行号" 及其目标代码，出错时输出 "# 行号 error: 原因"；统计信息写入 report
+// cache 非空时先按规范化 token 串查缓存，命中的表达式跳过语法分析与代码生成；engine 选择语法分析引擎
+BatchStageStats runBatchCompilation(const CompilerContext& context, std::istream& in, std::ostream& out,
+                                    std::ostream& report, unsigned numThreads, CompileCache* cache = nullptr,
+                                    ParserEngine engine = ENGINE_LR) {
+    const size_t CHUNK_LINES = 256;
+    const size_t BLOCK_LINES = 1 << 16;
+    WorkStealingPool pool(numThreads);
+    std::vector<BatchStageStats> workerStats(pool.size());
+
+    struct Block {
+        size_t firstLine = 0;
+        std::vector<std::string> lines;
+        std::vector<std::string> outputs;  // 每个任务一段输出
+    };
+    size_t lineNumber = 0, inputBytes = 0;
+    auto readBlock = [&](Block& block) {
+        block.firstLine = lineNumber + 1;
+        block.lines.clear();
+        std::string line;
+        while (block.lines.size() < BLOCK_LINES && std::getline(in, line)) {
+            ++lineNumber;
+            inputBytes += line.size() + 1;
+            block.lines.push_back(std::move(line));
+        }
+        block.outputs.assign((block.lines.size() + CHUNK_LINES - 1) / CHUNK_LINES, std::string());
+        return !block.lines.empty();
+    };
+
+    auto compileChunk = [&](Block& block, size_t chunk, unsigned worker) {
+        typedef std::chrono::steady_clock Clock;
+        BatchStageStats& stats = workerStats[worker];
+        std::string& buffer = block.outputs[chunk];
+        size_t end = std::min(block.lines.size(), (chunk + 1) * CHUNK_LINES);
+        for (size_t i = chunk * CHUNK_LINES; i < end; ++i) {
+            const std::string& line = block.lines[i];
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') continue;
+            ++stats.expressions;
+            buffer += "# " + std::to_string(block.firstLine + i);
+            try {
+                auto t0 = Clock::now();
+                std::vector<Token> tokens = CompilerContext::tokenize(line);
+                auto t1 = Clock::now();
+                double compileSeconds = 0;
+                auto produce = [&]() {
+                    auto p0 = Clock::now();
+                    std::unique_ptr<ASTNode> tree(context.buildTree(tokens, engine));
+                    auto p1 = Clock::now();
+                    QuaternionGenerator generator;
+                    CompiledArtifact artifact;
+                    {
+                        ScopedPhase scope(PHASE_IR);
+                        artifact.resultVar = generator.genExpression(tree.get());
+                        Profiler::count(COUNTER_QUADS, generator.getQuaternions().size());
+                    }
+                    auto p2 = Clock::now();
+                    for (const auto& instruction : generator.generateTargetInstructions()) {
+                        artifact.targetCode += instruction.toString();
+                        artifact.targetCode += "\n";
+                    }
+                    artifact.quadruples = generator.getQuaternions();
+                    auto p3 = Clock::now();
+                    stats.parseSeconds += std::chrono::duration<double>(p1 - p0).count();
+                    stats.irSeconds += std::chrono::duration<double>(p2 - p1).count();
+                    stats.codegenSeconds += std::chrono::duration<double>(p3 - p2).count();
+                    compileSeconds = std::chrono::duration<double>(p3 - p0).count();
+                    return artifact;
+                };
+                std::shared_ptr<const CompiledArtifact> artifact =
+                    cache ? cache->getOrCompile(tokens, produce) : std::make_shared<const CompiledArtifact>(produce());
+                auto t2 = Clock::now();
+                buffer += "\n";
+                buffer += artifact->targetCode;
+                stats.lexSeconds += std::chrono::duration<double>(t1 - t0).count();
+                if (cache) stats.cacheSeconds += std::chrono::duration<double>(t2 - t1).count() - compileSeconds;
+                stats.quadruples += artifact->quadruples.size();
+                stats.instructions += std::count(artifact->targetCode.begin(), artifact->targetCode.end(), '\n');
+            } catch (const std::runtime_error& e) {
+                ++stats.errors;
+                buffer += std::string(" error: ") + e.what() + "\n";
+            }
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    double writeSeconds = 0;
+    auto writeBlock = [&](const Block& block) {
+        auto writeStart = std::chrono::steady_clock::now();
+        for (const auto& output : block.outputs) out << output;
+        writeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - writeStart).count();
+    };
+    // 线程池编译 current 时，主线程输出已完成的 done 并读入 next
+    Block done, current, next;
+    bool haveDone = false;
+    bool haveCurrent = readBlock(current);
+    while (haveCurrent) {
+        for (size_t chunk = 0; chunk < current.outputs.size(); ++chunk) {
+            pool.submit([&compileChunk, &current, chunk](unsigned worker) { compileChunk(current, chunk, worker); });
+        }
+        if (haveDone) writeBlock(done);
+        bool haveNext = readBlock(next);
+        pool.wait();
+        std::swap(done, current);
+        std::swap(current, next);
+        haveDone = true;
+        haveCurrent = haveNext;
+    }
+    if (haveDone) writeBlock(done);
+    out.flush();
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    BatchStageStats total;
+    for (const auto& stats : workerStats) total.add(stats);
+    size_t compiled = total.expressions - total.errors;
+    report << "批量编译: " << total.expressions << " 条表达式（" << total.errors << " 条出错），" << pool.size()
+           << " 个线程，墙钟 " << std::fixed << std::setprecision(3) << wallSeconds << " s，"
+           << std::setprecision(0) << total.expressions / wallSeconds << " 条/s，" << std::setprecision(1)
+           << inputBytes / wallSeconds / 1e6 << " MB/s 输入" << std::endl;
+    report << "四元式 " << total.quadruples << " 条，目标指令 " << total.instructions << " 条，任务窃取 "
+           << pool.stealCount() << " 次" << std::endl;
+    // 各阶段的 CPU 时间为所有线程之和；单线程吞吐量 = 成功编译的表达式数 / 该阶段 CPU 时间
+    report << std::left << std::setw(10) << "stage" << std::right << std::setw(12) << "cpu s" << std::setw(10)
+           << "share" << std::setw(16) << "exprs/s/thread" << std::endl;
+    double cpuTotal = total.lexSeconds + total.parseSeconds + total.irSeconds + total.codegenSeconds + total.cacheSeconds;
+    auto row = [&](const char* name, double seconds, size_t count) {
+        report << std::left << std::setw(10) << name << std::right << std::setprecision(3) << std::setw(12) << seconds
+               << std::setprecision(1) << std::setw(9) << (cpuTotal > 0 ? 100 * seconds / cpuTotal : 0) << "%"
+               << std::setprecision(0) << std::setw(16) << (seconds > 0 ? count / seconds : 0) << std::endl;
+    };
+    // 有缓存时只有未命中的表达式经过语法分析与代码生成
+    size_t generated = cache ? cache->getStats().misses : compiled;
+    row("lex", total.lexSeconds, compiled);
+    if (cache) row("cache", total.cacheSeconds, compiled);
+    row("parse", total.parseSeconds, generated);
+    row("ir", total.irSeconds, generated);
+    row("codegen", total.codegenSeconds, generated);
+    report << std::left << std::setw(10) << "write" << std::right << std::setprecision(3) << std::setw(12)
+           << writeSeconds << "  （主线程，与编译重叠）" << std::endl;
+    report.unsetf(std::ios::fixed);
+    report << std::setprecision(6);
+    if (cache) cache->printStats(report);
+    return total;
+}
+
+// 极深输入的批量测试：20 万项的 V 链与 40 万个连续的 -（语法树深达数十万层）各占一行，
+// 两个工作线程编译时不能爆栈，且末行的语法错误只让该行报错。返回失败的检查数
+int runBatchDeepInputTest(const CompilerContext& context, std::ostream& os) {
+    const size_t TERMS = 200000, NEGATIONS = 400000;
+    std::string chain = "a";
+    for (size_t i = 1; i < TERMS; ++i) chain += " V a";
+    std::istringstream in("a V b\n" + chain + "\n" + std::string(NEGATIONS, '-') + "a\n(a ^ b\n");
+    std::ostringstream out, report;
+    BatchStageStats stats = runBatchCompilation(context, in, out, report, 2);
+    const std::string text = out.str();
+    int failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        if (!ok) {
+            ++failures;
+            os << "  " << what << std::endl;
+        }
+    };
+    check(stats.expressions == 4 && stats.errors == 1,
+          "应为 4 条表达式 1 条出错，实际 " + std::to_string(stats.expressions) + " 条 " +
+              std::to_string(stats.errors) + " 条出错");
+    check(stats.quadruples == 1 + (TERMS - 1) + NEGATIONS,
+          "四元式数应为 " + std::to_string(1 + (TERMS - 1) + NEGATIONS) + "，实际 " +
+              std::to_string(stats.quadruples));
+    check(text.find("# 4 error: ") != std::string::npos, "第 4 行没有报错");
+    check(text.find("error") == text.find("# 4 error: ") + 4, "前 3 行不应报错");
+    os << "极深输入批量测试: " << failures << " 个失败" << std::endl;
+    return failures;
+}
+
+// 批处理模式的命令行：compile --batch <表达式文件> [-o 输出文件] [-j 线程数] [-g 文法文件]
+//                      [--cache-mb 内存缓存大小] [--cache-dir 磁盘缓存目录] [--engine lr|pratt] [--shared]
+//                      [--profile JSON 文件]
+// --shared 时所有表达式做跨表达式值编号，编译为一个带命名输出的共享程序；
+// --profile 时打开剖析器（含文法与分析表的构造），结束后把各阶段统计写入该文件
+int runBatchMode(int argc, char* argv[]) {
+    std::string inputPath, outputPath, grammarPath = "input.txt", cacheDirectory, profilePath;
+    unsigned numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t cacheMegabytes = 0;
+    ParserEngine engine = ENGINE_LR;
+    bool shared = false;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--shared") {
+            shared = true;
+        } else if ((arg == "-o" || arg == "-j" || arg == "-g" || arg == "--cache-mb" || arg == "--cache-dir" ||
+                    arg == "--engine" || arg == "--profile") && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (arg == "--engine" && value != "lr" && value != "pratt") {
+                inputPath.clear();
+                break;
+            }
+            if (arg == "-o") outputPath = value;
+            else if (arg == "--engine") engine = value == "pratt" ? ENGINE_PRATT : ENGINE_LR;
+            else if (arg == "-g") grammarPath = value;
+            else if (arg == "--cache-mb") cacheMegabytes = std::max(1L, std::atol(value.c_str()));
+            else if (arg == "--cache-dir") cacheDirectory = value;
+            else if (arg == "--profile") profilePath = value;
+            else numThreads = std::max(1, std::atoi(value.c_str()));
+        } else if (arg.size() > 2 && arg.compare(0, 2, "-j") == 0) {
+            numThreads = std::max(1, std::atoi(arg.c_str() + 2));
+        } else if (inputPath.empty() && arg[0] != '-') {
+            inputPath = arg;
+        } else {
+            inputPath.clear();
+            break;
+        }
+    }
+    if (inputPath.empty()) {
+        std::cerr << "用法: " << argv[0] << " --batch <表达式文件> [-o 输出文件] [-j 线程数] [-g 文法文件]"
+                  << " [--cache-mb 内存缓存大小] [--cache-dir 磁盘缓存目录] [--engine lr|pratt] [--shared]"
+                  << " [--profile JSON 文件]" << std::endl;
+        return 2;
+    }
+    try {
+        Profiler::setEnabled(!profilePath.empty());
+        auto writeProfile = [&]() {
+            if (profilePath.empty()) return;
+            std::ofstream profile(profilePath, std::ios::trunc);
+            if (!profile.is_open()) throw std::runtime_error("Cannot create " + profilePath);
+            Profiler::writeJson(profile);
+        };
+        std::shared_ptr<const CompilerContext> context = CompilerContext::fromFile(grammarPath);
+        std::ifstream in(inputPath);
+        if (!in.is_open()) throw std::runtime_error("Cannot open " + inputPath);
+        std::ofstream file;
+        if (!outputPath.empty()) {
+            file.open(outputPath, std::ios::trunc);
+            if (!file.is_open()) throw std::runtime_error("Cannot create " + outputPath);
+        }
+        if (shared) {
+            runSharedBatchCompilation(*context, in, outputPath.empty() ? std::cout : file, std::cerr);
+            writeProfile();
+            return 0;
+        }
+        // 只给出磁盘目录时内存缓存默认 64 MiB
+        std::unique_ptr<CompileCache> cache;
+        if (cacheMegabytes || !cacheDirectory.empty()) {
+            cache.reset(new CompileCache(context->grammarHash(), (cacheMegabytes ? cacheMegabytes : 64) << 20,
+                                         cacheDirectory));
+        }
+        BatchStageStats stats = runBatchCompilation(*context, in, outputPath.empty() ? std::cout : file, std::cerr,
+                                                    numThreads, cache.get(), engine);
+        writeProfile();
+        return stats.errors ? 1 : 0;
+    } catch (const std::runtime_error& e) {
+        std::cerr << "批量编译失败: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+// ================= 并行语法分析 =================
+
+struct ParallelParseStats {
+    bool parallel = false;  // 是否在顶层运算符处切开；否则整段顺序分析
+    int level = 0;          // 剥掉的外层括号层数
+    size_t pieces = 0;      // 切出的子表达式数
+    std::string splitOperator;
+    double lexSeconds = 0;
+    double scanSeconds = 0;
+    double parseSeconds = 0;
+    double stitchSeconds = 0;
+};
+
+// 并行编译一个很长的表达式，四元式写入 quads，返回结果变量：
+// 1. 文本在空白处切块并行词法分析（空白总是 token 边界）；
+// 2. 括号深度用并行前缀和求出：各块先求括号增量之和，块间做前缀和，再由各块填入每个 token 之前的深度；
+// 3. 剥掉包住整个表达式的外层括号，在最外层的最低优先级运算符（V，没有时为 ^）处切开，
+//    子表达式按 token 数分组交给线程池，各自对 token 区间做流式编译（不建语法树）；
+// 4. 左结合的链顺序编译时依次是 子式1、子式2、合并、子式3、合并……，按这个顺序拼接，
+//    并把每个子式局部的临时变量 t<k> 换成全局编号，结果与顺序编译逐条相同。
+// 找不到切分点、括号不配对或某个子式为空时整段顺序分析，由它报告语法错误
+std::string parallelCompile(const CompilerContext& context, const std::string& text, WorkStealingPool& pool,
+                            std::vector<Quadruple>& quads, ParallelParseStats* stats = nullptr) {
+    typedef std::chrono::steady_clock Clock;
+    class Appender : public QuadrupleSink {
+    public:
+        std::vector<Quadruple>& quads;
+
+        explicit Appender(std::vector<Quadruple>& quads) : quads(quads) {}
+
+        void emit(const Quadruple& quad) override {
+            quads.push_back(quad);
+        }
+    };
+    ParallelParseStats local;
+    auto seconds = [](Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double>(b - a).count(); };
+    auto parallelFor = [&](size_t count, const std::function<void(size_t)>& body) {
+        for (size_t c = 0; c < count; ++c) pool.submit([&body, c](unsigned) { body(c); });
+        pool.wait();
+    };
+    const size_t numChunks = pool.size() * 4;
+
+    // 1. 并行词法分析
+    auto t0 = Clock::now();
+    std::vector<size_t> cut(numChunks + 1, text.size());
+    cut[0] = 0;
+    for (size_t c = 1; c < numChunks; ++c) {
+        size_t pos = std::max(cut[c - 1], text.size() / numChunks * c);
+        while (pos < text.size() && !std::isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+        cut[c] = pos;
+    }
+    std::vector<std::vector<Token>> lexed(numChunks);
+    parallelFor(numChunks, [&](size_t c) { lexed[c] = CompilerContext::tokenize(text.substr(cut[c], cut[c + 1] - cut[c])); });
+    std::vector<size_t> tokenStart(numChunks + 1, 0);
+    for (size_t c = 0; c < numChunks; ++c) tokenStart[c + 1] = tokenStart[c] + lexed[c].size();
+    std::vector<Token> tokens(tokenStart.back());
+    parallelFor(numChunks, [&](size_t c) {
+        std::move(lexed[c].begin(), lexed[c].end(), tokens.begin() + tokenStart[c]);
+        std::vector<Token>().swap(lexed[c]);
+    });
+    const size_t n = tokens.size();
+    auto t1 = Clock::now();
+    local.lexSeconds = seconds(t0, t1);
+
+    auto sequential = [&]() {
+        quads.clear();
+        Appender appender(quads);
+        std::string result = context.compileStream(tokens.data(), tokens.data() + n, appender);
+        local.parseSeconds = seconds(t1, Clock::now());
+        if (stats) *stats = local;
+        return result;
+    };
+    if (n < 3) return sequential();
+
+    // 2. 括号深度的并行前缀和；同时求开头的左括号串与结尾的右括号串之间 token 的最小深度，
+    // 以及每个 token 之后的最小深度（为负说明括号不配对）
+    size_t leading = 0, trailing = 0;
+    while (leading < n && tokens[leading].type == TOK_LPAREN) ++leading;
+    while (trailing < n && tokens[n - 1 - trailing].type == TOK_RPAREN) ++trailing;
+    if (leading + trailing >= n) return sequential();
+    std::vector<size_t> bound(numChunks + 1);
+    for (size_t c = 0; c <= numChunks; ++c) bound[c] = n / numChunks * c + std::min(c, n % numChunks);
+    auto delta = [&](size_t i) {
+        return tokens[i].type == TOK_LPAREN ? 1 : tokens[i].type == TOK_RPAREN ? -1 : 0;
+    };
+    std::vector<long> chunkSum(numChunks, 0), chunkStart(numChunks, 0);
+    std::vector<long> innerMin(numChunks, LONG_MAX), afterMin(numChunks, LONG_MAX);
+    parallelFor(numChunks, [&](size_t c) {
+        long sum = 0;
+        for (size_t i = bound[c]; i < bound[c + 1]; ++i) sum += delta(i);
+        chunkSum[c] = sum;
+    });
+    for (size_t c = 1; c < numChunks; ++c) chunkStart[c] = chunkStart[c - 1] + chunkSum[c - 1];
+    std::vector<int> depth(n);
+    parallelFor(numChunks, [&](size_t c) {
+        long d = chunkStart[c];
+        for (size_t i = bound[c]; i < bound[c + 1]; ++i) {
+            depth[i] = static_cast<int>(d);
+            if (i >= leading && i < n - trailing) innerMin[c] = std::min(innerMin[c], d);
+            d += delta(i);
+            afterMin[c] = std::min(afterMin[c], d);
+        }
+    });
+    if (chunkStart.back() + chunkSum.back() != 0 || *std::min_element(afterMin.begin(), afterMin.end()) < 0) {
+        return sequential();
+    }
+    // 中间部分的最小深度就是能整层剥掉的外层括号数
+    const long level = std::min<long>(*std::min_element(innerMin.begin(), innerMin.end()), std::min(leading, trailing));
+    local.level = static_cast<int>(level);
+
+    // 最外层的 V 处切开，没有 V 时在最外层的 ^ 处切开
+    std::vector<size_t> splits;
+    for (int precedence = 0; precedence < 2 && splits.empty(); ++precedence) {
+        std::vector<std::vector<size_t>> found(numChunks);
+        parallelFor(numChunks, [&](size_t c) {
+            for (size_t i = std::max<size_t>(bound[c], level); i < std::min<size_t>(bound[c + 1], n - level); ++i) {
+                TokenType type = tokens[i].type;
+                bool match = precedence == 0 ? (type == TOK_UNION || type == TOK_OR)
+                                             : (type == TOK_INTERSECTION || type == TOK_AND);
+                if (match && depth[i] == level) found[c].push_back(i);
+            }
+        });
+        for (const auto& positions : found) splits.insert(splits.end(), positions.begin(), positions.end());
+    }
+    auto t2 = Clock::now();
+    local.scanSeconds = seconds(t1, t2);
+    if (splits.empty()) return sequential();
+
+    // 子表达式 j 为 token [pieceBegin[j], pieceEnd[j])
+    const size_t numPieces = splits.size() + 1;
+    std::vector<size_t> pieceBegin(numPieces), pieceEnd(numPieces);
+    pieceBegin[0] = level;
+    for (size_t j = 0; j < splits.size(); ++j) {
+        pieceEnd[j] = splits[j];
+        pieceBegin[j + 1] = splits[j] + 1;
+    }
+    pieceEnd[numPieces - 1] = n - level;
+    for (size_t j = 0; j < numPieces; ++j) {
+        if (pieceBegin[j] >= pieceEnd[j]) return sequential();
+    }
+    local.parallel = true;
+    local.pieces = numPieces;
+    local.splitOperator = tokens[splits[0]].value;
+
+    // 3. 按 token 数把子表达式分组，各组独立流式编译
+    const size_t numGroups = std::min(numPieces, static_cast<size_t>(pool.size()) * 8);
+    std::vector<size_t> groupFirst(numGroups + 1, numPieces);
+    groupFirst[0] = 0;
+    for (size_t g = 1, j = 0; g < numGroups; ++g) {
+        size_t target = level + (n - 2 * level) / numGroups * g;
+        while (j < numPieces && pieceBegin[j] < target) ++j;
+        groupFirst[g] = std::max(j, groupFirst[g - 1]);
+    }
+    struct Group {
+        std::vector<Quadruple> quads;
+        std::vector<size_t> quadBegin;  // 各子式在组内的第一条四元式；子式的第 k 条四元式定义局部临时变量 t<k+1>
+        std::vector<std::string> results;
+        std::string error;
+    };
+    std::vector<Group> groups(numGroups);
+    parallelFor(numGroups, [&](size_t g) {
+        Group& group = groups[g];
+        Appender appender(group.quads);
+        try {
+            for (size_t j = groupFirst[g]; j < groupFirst[g + 1]; ++j) {
+                group.quadBegin.push_back(group.quads.size());
+                group.results.push_back(
+                    context.compileStream(tokens.data() + pieceBegin[j], tokens.data() + pieceEnd[j], appender));
+            }
+        } catch (const std::runtime_error& e) {
+            group.error = e.what();
+        }
+        group.quadBegin.push_back(group.quads.size());
+    });
+    for (const auto& group : groups) {
+        if (!group.error.empty()) throw std::runtime_error(group.error);
+    }
+    auto t3 = Clock::now();
+    local.parseSeconds = seconds(t2, t3);
+
+    // 4. 拼接：输出依次为 子式0、子式1、合并1、子式2、合并2……。每条四元式恰好定义一个临时变量，
+    // 所以位置 p 上的四元式定义全局 t<p+1>；子式 j 的局部 t<k> 换成 t<outputBegin[j] + k>
+    std::vector<size_t> outputBegin(numPieces);
+    size_t next = 0;
+    for (size_t g = 0; g < numGroups; ++g) {
+        for (size_t k = 0; k + groupFirst[g] < groupFirst[g + 1]; ++k) {
+            size_t j = groupFirst[g] + k;
+            outputBegin[j] = next;
+            next += groups[g].quadBegin[k + 1] - groups[g].quadBegin[k] + (j > 0 ? 1 : 0);
+        }
+    }
+    auto renamer = [&](size_t g, size_t k) {
+        size_t j = groupFirst[g] + k;
+        size_t count = groups[g].quadBegin[k + 1] - groups[g].quadBegin[k];
+        size_t base = outputBegin[j];
+        return [count, base](std::string& name) {
+            if (name.size() < 2 || name[0] != 't') return std::move(name);
+            size_t value = 0;
+            for (size_t i = 1; i < name.size(); ++i) {
+                if (name[i] < '0' || name[i] > '9') return std::move(name);
+                value = value * 10 + (name[i] - '0');
+            }
+            return value >= 1 && value <= count ? "t" + std::to_string(base + value) : std::move(name);
+        };
+    };
+    quads.assign(next, Quadruple("", "", "", ""));
+    std::vector<std::string> pieceResult(numPieces);
+    parallelFor(numGroups, [&](size_t g) {
+        for (size_t k = 0; k + groupFirst[g] < groupFirst[g + 1]; ++k) {
+            auto rename = renamer(g, k);
+            size_t j = groupFirst[g] + k;
+            size_t out = outputBegin[j];
+            for (size_t q = groups[g].quadBegin[k]; q < groups[g].quadBegin[k + 1]; ++q) {
+                Quadruple& quad = groups[g].quads[q];
+                quads[out++] = Quadruple(std::move(quad.op), rename(quad.arg1), rename(quad.arg2), rename(quad.result));
+            }
+            pieceResult[j] = rename(groups[g].results[k]);
+        }
+        std::vector<Quadruple>().swap(groups[g].quads);
+    });
+    // 合并四元式紧跟在子式 j（j >= 1）之后
+    std::string result = pieceResult[0];
+    for (size_t j = 1; j < numPieces; ++j) {
+        size_t count = (j + 1 < numPieces ? outputBegin[j + 1] : next) - outputBegin[j] - 1;
+        size_t position = outputBegin[j] + count;
+        std::string temp = "t" + std::to_string(position + 1);
+        quads[position] = Quadruple(local.splitOperator, result, pieceResult[j], temp);
+        result = temp;
+    }
+    local.stitchSeconds = seconds(t3, Clock::now());
+    if (stats) *stats = local;
+    return result;
+}
+
+// 并行分析基准：一个由数十万个子式组成、外面再包一层括号的超长表达式（以及只有顶层 ^ 的链），
+// 以流式顺序编译为基准，比较 1/2/4 个工作线程下各阶段的耗时，并核对四元式与顺序编译逐条相同
+void runParallelParseBenchmark(const CompilerContext& context, std::ostream& os) {
+    class Collector : public QuadrupleSink {
+    public:
+        std::vector<Quadruple> quads;
+
+        void emit(const Quadruple& quad) override {
+            quads.push_back(quad);
+        }
+    };
+
+    std::mt19937 rng(89);
+    auto leaf = [&]() {
+        return std::string(rng() % 5 == 0 ? "-" : "") + "x" + std::to_string(rng() % 256);
+    };
+    auto piece = [&]() {
+        switch (rng() % 4) {
+            case 0: return leaf();
+            case 1: return leaf() + " ^ " + leaf();
+            case 2: return "(" + leaf() + " V " + leaf() + ")";
+            default: return "-(" + leaf() + " ^ " + leaf() + " V " + leaf() + ")";
+        }
+    };
+    os << "硬件线程数 " << std::thread::hardware_concurrency() << std::endl;
+    for (int shape = 0; shape < 2; ++shape) {
+        std::string text = shape == 0 ? "((" + piece() : "(" + leaf() + " V " + leaf() + ")";
+        for (int i = 1; i < (shape == 0 ? 1 << 19 : 1 << 17); ++i) {
+            text += shape == 0 ? (rng() % 2 ? " V " : " || ") + piece() : " ^ (" + leaf() + " V " + leaf() + ")";
+        }
+        if (shape == 0) text += "))";
+
+        Collector expected;
+        auto start = std::chrono::steady_clock::now();
+        std::istringstream source(text);
+        std::string expectedResult = context.compileStream(source, expected);
+        double sequentialMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        os << (shape == 0 ? "顶层 V 链" : "顶层 ^ 链") << "，" << text.size() / 1024 << " KiB，"
+           << expected.quads.size() << " 条四元式，顺序流式编译 " << std::fixed << std::setprecision(1)
+           << sequentialMs << " ms" << std::endl;
+        os << std::setw(8) << "threads" << std::setw(10) << "total ms" << std::setw(10) << "lex" << std::setw(10)
+           << "scan" << std::setw(10) << "parse" << std::setw(10) << "stitch" << std::setw(10) << "pieces"
+           << std::setw(10) << "speedup" << std::setw(8) << "check" << std::endl;
+        for (unsigned threads : {1u, 2u, 4u}) {
+            WorkStealingPool pool(threads);
+            std::vector<Quadruple> quads;
+            ParallelParseStats stats;
+            start = std::chrono::steady_clock::now();
+            std::string result = parallelCompile(context, text, pool, quads, &stats);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            bool same = result == expectedResult && quads.size() == expected.quads.size();
+            for (size_t i = 0; same && i < quads.size(); ++i) {
+                const Quadruple& x = quads[i];
+                const Quadruple& y = expected.quads[i];
+                same = x.op == y.op && x.arg1 == y.arg1 && x.arg2 == y.arg2 && x.result == y.result;
+            }
+            os << std::setw(8) << threads << std::setw(10) << ms << std::setw(10) << stats.lexSeconds * 1000
+               << std::setw(10) << stats.scanSeconds * 1000 << std::setw(10) << stats.parseSeconds * 1000
+               << std::setw(10) << stats.stitchSeconds * 1000 << std::setw(10) << stats.pieces << std::setw(9)
+               << sequentialMs / ms << "x" << std::setw(8) << (same ? "ok" : "FAIL") << std::endl;
+        }
+        os.unsetf(std::ios::fixed);
+    }
+}
+
+// ================= 剖析报告 =================
+
+// 打开剖析器，从文法文件重新构造分析表，再完整编译源表达式（含寄存器分配）和一个较大的随机表达式，
+// 以 JSON 输出各阶段统计；最后比较剖析器关闭与打开时反复编译的耗时，说明插桩开销
+void runProfileReport(const std::string& grammarPath, const std::string& sourceText, std::ostream& os) {
+    bool wasEnabled = Profiler::isEnabled();
+    Profiler::reset();
+    Profiler::setEnabled(true);
+    std::shared_ptr<const CompilerContext> context = CompilerContext::fromFile(grammarPath);
+    QuaternionGenerator generator;
+    std::string resultVar = context->compile(sourceText, generator);
+    LinearScanAllocator allocator(4);
+    allocator.generate(generator.getQuaternions(), {resultVar});
+    generator.generateTargetInstructions();
+
+    std::mt19937 rng(103);
+    std::vector<Token> tokens = CompilerContext::tokenize(generateRandomExpression(64, 1 << 15, rng));
+    compileTokens(*context, tokens);
+    Profiler::writeJson(os);
+
+    // 关闭与打开交替测量，各取最小值以减少噪声
+    double disabledMs = 1e300, enabledMs = 1e300;
+    for (int round = 0; round < 10; ++round) {
+        bool enabled = round % 2;
+        Profiler::setEnabled(enabled);
+        auto start = std::chrono::steady_clock::now();
+        compileTokens(*context, tokens);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        (enabled ? enabledMs : disabledMs) = std::min(enabled ? enabledMs : disabledMs, ms);
+    }
+    Profiler::setEnabled(wasEnabled);
+    os << tokens.size() << " 个 token 的表达式编译一次: 剖析关闭 " << std::fixed << std::setprecision(2) << disabledMs
+       << " ms，打开 " << enabledMs << " ms（" << std::showpos << std::setprecision(1)
+       << 100 * (enabledMs / disabledMs - 1) << "%）" << std::noshowpos << std::endl;
+    os.unsetf(std::ios::fixed);
+    os << std::setprecision(6);
+}
+
+// 编译服务的二进制帧（整数均为小端）：
+//   请求  u32 长度 | u32 请求号 | u8 类型 | 负载
+//   响应  u32 长度 | u32 请求号 | u8 状态 | 负载
+// 长度不含长度字段本身。类型 1 生成四元式、2 生成目标代码：负载为表达式文本，响应为每行一条的文本；
+// 类型 3 求值：负载为 u32 表达式长度 | 表达式 | u32 赋值个数 | 每个赋值 u8 名字长度 + 名字 + u8 取值，
+// 响应为 1 字节结果。状态 0 成功，1 失败（负载为错误信息）。
+// 同一连接上可以连续发送多个请求而不等待响应；响应按完成顺序返回，用请求号与请求对应
+enum ServerRequestType : uint8_t {
+    REQUEST_QUADRUPLES = 1,
+    REQUEST_TARGET_CODE = 2,
+    REQUEST_EVALUATE = 3,
+};
+
+struct ServerFrame {
+    static const uint32_t MAX_LENGTH = 1 << 24;
+
+    uint32_t id = 0;
+    uint8_t kind = 0;  // 请求中为类型，响应中为状态
+    std::string payload;
+
+    void appendTo(std::string& out) const {
+        appendU32(out, static_cast<uint32_t>(5 + payload.size()));
+        appendU32(out, id);
+        out.push_back(static_cast<char>(kind));
+        out += payload;
+    }
+
+    // 从 buffer 的 offset 处解析一个完整帧并前移 offset；数据不完整时返回 false
+    static bool parse(const std::string& buffer, size_t& offset, ServerFrame& frame) {
+        if (buffer.size() - offset < 4) return false;
+        uint32_t length = readU32(buffer.data() + offset);
+        if (length < 5 || length > MAX_LENGTH) throw std::runtime_error("Bad frame length " + std::to_string(length));
+        if (buffer.size() - offset - 4 < length) return false;
+        frame.id = readU32(buffer.data() + offset + 4);
+        frame.kind = static_cast<uint8_t>(buffer[offset + 8]);
+        frame.payload.assign(buffer, offset + 9, length - 5);
+        offset += 4 + length;
+        return true;
+    }
+
+    static std::string evaluationPayload(const std::string& expr, const std::unordered_map<std::string, bool>& values) {
+        std::string payload;
+        appendU32(payload, static_cast<uint32_t>(expr.size()));
+        payload += expr;
+        appendU32(payload, static_cast<uint32_t>(values.size()));
+        for (const auto& entry : values) {
+            if (entry.first.size() > 255) throw std::runtime_error("Variable name too long: " + entry.first);
+            payload.push_back(static_cast<char>(entry.first.size()));
+            payload += entry.first;
+            payload.push_back(entry.second ? 1 : 0);
+        }
+        return payload;
+    }
+};
+
+// 处理一个请求；只读访问 context，可以在任意工作线程上并发调用。cache 非空时编译请求先查缓存
+ServerFrame handleServerRequest(const CompilerContext& context, const ServerFrame& request,
+                                CompileCache* cache = nullptr) {
+    ServerFrame response;
+    response.id = request.id;
+    try {
+        std::string expr = request.payload;
+        std::unordered_map<std::string, bool> values;
+        if (request.kind == REQUEST_EVALUATE) {
+            const std::string& p = request.payload;
+            size_t pos = 0;
+            auto need = [&](size_t n) {
+                if (p.size() - pos < n) throw std::runtime_error("Truncated evaluate request");
+            };
+            need(4);
+            uint32_t length = readU32(p.data());
+            pos = 4;
+            need(length);
+            expr = p.substr(pos, length);
+            pos += length;
+            need(4);
+            uint32_t count = readU32(p.data() + pos);
+            pos += 4;
+            for (uint32_t i = 0; i < count; ++i) {
+                need(1);
+                size_t nameLength = static_cast<uint8_t>(p[pos++]);
+                need(nameLength + 1);
+                values[p.substr(pos, nameLength)] = p[pos + nameLength] != 0;
+                pos += nameLength + 1;
+            }
+        } else if (request.kind != REQUEST_QUADRUPLES && request.kind != REQUEST_TARGET_CODE) {
+            throw std::runtime_error("Unknown request type " + std::to_string(request.kind));
+        }
+
+        std::vector<Token> tokens = CompilerContext::tokenize(expr);
+        if (request.kind == REQUEST_EVALUATE) {
+            std::unique_ptr<ASTNode> tree(context.buildTree(tokens));
+            response.payload.push_back(TreeWalkEvaluator::evaluate(tree.get(), values) ? 1 : 0);
+        } else {
+            std::shared_ptr<const CompiledArtifact> artifact =
+                cache ? cache->getOrCompile(tokens, [&]() { return compileTokens(context, tokens); })
+                      : std::make_shared<const CompiledArtifact>(compileTokens(context, tokens));
+            if (request.kind == REQUEST_QUADRUPLES) {
+                for (const auto& q : artifact->quadruples) response.payload += q.toString() + "\n";
+                response.payload += "result " + artifact->resultVar + "\n";
+            } else {
+                response.payload = artifact->targetCode;
+            }
+        }
+        response.kind = 0;
+    } catch (const std::runtime_error& e) {
+        response.kind = 1;
+        response.payload = e.what();
+    }
+    return response;
+}
+
+#if defined(__linux__)
+void writeAll(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+        written += n;
+    }
+}
+
+int connectUnixSocket(const std::string& path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::runtime_error("Cannot create socket");
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        throw std::runtime_error("Cannot connect to " + path + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+#endif
+
+// 常驻编译服务：文法与分析表只加载一次。主线程用 epoll 事件循环接受连接、收发数据并切分请求帧，
+// 请求交给工作窃取线程池处理；工作线程把编码好的响应放进完成队列并通过 eventfd 唤醒事件循环写回。
+// 每个连接同时在处理的请求数有上限，超过时暂停读取该连接，形成背压
+class CompileServer {
+private:
+    static const size_t MAX_IN_FLIGHT = 1024;
+    static const size_t MAX_PENDING_OUTPUT = 1 << 20;  // 待发响应超过此字节数时停止读取新请求
+    static const uint64_t LISTEN_KEY = 0;
+    static const uint64_t WAKE_KEY = 1;
+
+    struct Connection {
+        int fd = -1;
+        std::string in;
+        std::string out;
+        size_t inFlight = 0;
+        bool peerClosed = false;
+        uint32_t events = 0;  // 当前在 epoll 中登记的事件
+    };
+
+    std::shared_ptr<const CompilerContext> context;
+    CompileCache* cache;
+    std::string path;
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::unordered_map<uint64_t, Connection> connections;
+    uint64_t nextKey = 2;
+    std::mutex completedMutex;
+    std::vector<std::pair<uint64_t, std::string>> completed;  // （连接，编码后的响应）
+    std::atomic<bool> stopRequested{false};
+    std::atomic<size_t> served{0};
+    std::unique_ptr<WorkStealingPool> pool;
+
+#if defined(__linux__)
+    void closeConnection(uint64_t key) {
+        auto it = connections.find(key);
+        if (it == connections.end()) return;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        close(it->second.fd);
+        connections.erase(it);
+    }
+
+    // 背压：在途请求数与尚未写出的响应字节数都未达上限时才接受新请求。
+    // 只读请求不读响应的客户端会让 out 增长，超过上限后停止读取，由内核套接字缓冲区挡住它
+    static bool acceptsRequests(const Connection& connection) {
+        return connection.inFlight < MAX_IN_FLIGHT && connection.out.size() < MAX_PENDING_OUTPUT;
+    }
+
+    // 按连接状态登记关心的事件：未达背压上限时读，有待发数据时写
+    void updateInterest(uint64_t key, Connection& connection) {
+        uint32_t events = 0;
+        if (!connection.peerClosed && acceptsRequests(connection)) events |= EPOLLIN;
+        if (!connection.out.empty()) events |= EPOLLOUT;
+        if (events == connection.events) return;
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = key;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.events = events;
+    }
+
+    // 切分已收到的完整帧并提交给线程池；返回 false 表示帧格式错误
+    bool dispatch(uint64_t key, Connection& connection) {
+        size_t offset = 0;
+        ServerFrame frame;
+        try {
+            while (acceptsRequests(connection) && ServerFrame::parse(connection.in, offset, frame)) {
+                ++connection.inFlight;
+                pool->submit([this, key, frame](unsigned) {
+                    std::string bytes;
+                    handleServerRequest(*context, frame, cache).appendTo(bytes);
+                    bool wasEmpty;
+                    {
+                        std::lock_guard<std::mutex> lock(completedMutex);
+                        wasEmpty = completed.empty();
+                        completed.emplace_back(key, std::move(bytes));
+                    }
+                    // 队列非空时事件循环已被唤醒、尚未取走，不必重复唤醒
+                    if (wasEmpty) {
+                        uint64_t one = 1;
+                        ssize_t ignored = ::write(wakeFd, &one, sizeof(one));
+                        (void)ignored;
+                    }
+                });
+            }
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+        connection.in.erase(0, offset);
+        return true;
+    }
+
+    // 尽量写出待发数据；连接已无事可做时关闭，返回 false
+    bool flush(uint64_t key, Connection& connection) {
+        while (!connection.out.empty()) {
+            ssize_t n = ::write(connection.fd, connection.out.data(), connection.out.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n <= 0) {
+                closeConnection(key);
+                return false;
+            }
+            connection.out.erase(0, n);
+        }
+        // 写出后背压可能解除，继续处理缓冲区中剩余的帧（它们不会再触发 EPOLLIN）
+        if (!connection.in.empty() && !dispatch(key, connection)) {
+            closeConnection(key);
+            return false;
+        }
+        if (connection.peerClosed && connection.inFlight == 0 && connection.out.empty()) {
+            closeConnection(key);
+            return false;
+        }
+        updateInterest(key, connection);
+        return true;
+    }
+
+    void acceptConnections() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            uint64_t key = nextKey++;
+            Connection& connection = connections[key];
+            connection.fd = fd;
+            connection.events = EPOLLIN;
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = key;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        }
+    }
+
+    void readConnection(uint64_t key, Connection& connection) {
+        char buffer[65536];
+        while (true) {
+            ssize_t n = ::read(connection.fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                connection.in.append(buffer, n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n == 0) connection.peerClosed = true;
+            else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                closeConnection(key);
+                return;
+            }
+            break;
+        }
+        if (!dispatch(key, connection)) {
+            closeConnection(key);
+            return;
+        }
+        flush(key, connection);
+    }
+
+    void deliverCompleted() {
+        uint64_t count;
+        ssize_t ignored = ::read(wakeFd, &count, sizeof(count));
+        (void)ignored;
+        std::vector<std::pair<uint64_t, std::string>> batch;
+        {
+            std::lock_guard<std::mutex> lock(completedMutex);
+            batch.swap(completed);
+        }
+        std::unordered_set<uint64_t> touched;
+        for (auto& response : batch) {
+            auto it = connections.find(response.first);
+            if (it == connections.end()) continue;  // 连接已断开
+            it->second.out += response.second;
+            --it->second.inFlight;
+            ++served;
+            touched.insert(response.first);
+        }
+        for (uint64_t key : touched) {
+            auto it = connections.find(key);
+            // 背压解除后继续处理缓冲区中剩余的帧
+            if (dispatch(key, it->second)) flush(key, it->second);
+            else closeConnection(key);
+        }
+    }
+#endif
+
+public:
+    CompileServer(const CompileServer&) = delete;
+    CompileServer& operator=(const CompileServer&) = delete;
+
+    // 构造时即开始监听，之后 run() 进入事件循环；cache 可以为空，非空时须比服务器活得久
+    CompileServer(std::shared_ptr<const CompilerContext> context, const std::string& path, unsigned numThreads,
+                  CompileCache* cache = nullptr)
+        : context(std::move(context)), cache(cache), path(path) {
+#if defined(__linux__)
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, path.c_str());
+        unlink(path.c_str());
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listenFd, SOMAXCONN) != 0) {
+            std::string reason = std::strerror(errno);
+            if (listenFd >= 0) close(listenFd);
+            throw std::runtime_error("Cannot listen on " + path + ": " + reason);
+        }
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = LISTEN_KEY;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+        event.data.u64 = WAKE_KEY;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+        pool.reset(new WorkStealingPool(numThreads));
+#else
+        (void)numThreads;
+        throw std::runtime_error("The compile server needs Linux (epoll)");
+#endif
+    }
+
+    ~CompileServer() {
+#if defined(__linux__)
+        pool.reset();  // 先等工作线程做完，它们会访问完成队列与 eventfd
+        for (auto& entry : connections) close(entry.second.fd);
+        close(wakeFd);
+        close(epollFd);
+        close(listenFd);
+        unlink(path.c_str());
+#endif
+    }
+
+    // 事件循环，直到 stop() 被调用
+    void run() {
+#if defined(__linux__)
+        epoll_event events[64];
+        while (!stopRequested.load()) {
+            int n = epoll_wait(epollFd, events, 64, -1);
+            if (n < 0 && errno == EINTR) continue;
+            for (int i = 0; i < n; ++i) {
+                uint64_t key = events[i].data.u64;
+                if (key == LISTEN_KEY) {
+                    acceptConnections();
+                } else if (key == WAKE_KEY) {
+                    deliverCompleted();
+                } else {
+                    auto it = connections.find(key);
+                    if (it == connections.end()) continue;
+                    if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+                        closeConnection(key);
+                    } else if (events[i].events & EPOLLIN) {
+                        readConnection(key, it->second);
+                    } else if (events[i].events & EPOLLOUT) {
+                        flush(key, it->second);
+                    }
+                }
+            }
+        }
+#endif
+    }
+
+    // 可以在任意线程或信号处理函数中调用
+    void stop() {
+        stopRequested.store(true);
+#if defined(__linux__)
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+#endif
+    }
+
+    size_t requestsServed() const {
+        return served.load();
+    }
+};
+
+struct LoadTestStats {
+    size_t requests = 0;
+    size_t errors = 0;      // 服务端返回失败状态
+    size_t mismatches = 0;  // 与本地编译结果不一致
+    double seconds = 0;
+    double p50Us = 0;
+    double p99Us = 0;
+    double maxUs = 0;
+};
+
+// 负载生成器：connections 个连接各用一个线程，每个连接保持 pipeline 个请求在途，共发送 requests 个请求，
+// 三种请求类型轮流出现。reference 非空时用它在本地处理同样的请求并逐个比较响应
+LoadTestStats runLoadGenerator(const std::string& path, unsigned connections, unsigned pipeline, size_t requests,
+                               const CompilerContext* reference) {
+    typedef std::chrono::steady_clock Clock;
+    connections = std::max(1u, connections);
+    pipeline = std::max(1u, pipeline);
+    std::vector<std::vector<double>> latencies(connections);
+    std::vector<size_t> errors(connections, 0), mismatches(connections, 0);
+    std::vector<std::string> failures(connections);
+
+    auto worker = [&](unsigned c) {
+#if defined(__linux__)
+        try {
+            // 每个连接准备一组请求循环使用，并预先算好期望的响应
+            std::mt19937 rng(61 + c);
+            std::vector<ServerFrame> templates;
+            std::vector<std::string> expected;
+            for (int i = 0; i < 64; ++i) {
+                std::string expr = generateRandomExpression(8, 4 + i, rng);
+                ServerFrame frame;
+                frame.kind = static_cast<uint8_t>(REQUEST_QUADRUPLES + i % 3);
+                if (frame.kind == REQUEST_EVALUATE) {
+                    std::unordered_map<std::string, bool> values;
+                    for (int v = 0; v < 8; ++v) values["x" + std::to_string(v)] = rng() & 1;
+                    frame.payload = ServerFrame::evaluationPayload(expr, values);
+                } else {
+                    frame.payload = expr;
+                }
+                templates.push_back(frame);
+                if (reference) {
+                    ServerFrame response = handleServerRequest(*reference, frame);
+                    expected.push_back(std::string(1, static_cast<char>(response.kind)) + response.payload);
+                }
+            }
+
+            size_t count = requests / connections + (c < requests % connections ? 1 : 0);
+            std::vector<Clock::time_point> sent(count);
+            latencies[c].reserve(count);
+            int fd = connectUnixSocket(path);
+            size_t nextToSend = 0, received = 0;
+            auto sendUpTo = [&](size_t limit) {
+                std::string batch;
+                for (; nextToSend < std::min(limit, count); ++nextToSend) {
+                    ServerFrame frame = templates[nextToSend % templates.size()];
+                    frame.id = static_cast<uint32_t>(nextToSend);
+                    frame.appendTo(batch);
+                    sent[nextToSend] = Clock::now();
+                }
+                if (!batch.empty()) writeAll(fd, batch);
+            };
+            sendUpTo(pipeline);
+            std::string buffer;
+            char chunk[65536];
+            while (received < count) {
+                ssize_t n = ::read(fd, chunk, sizeof(chunk));
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) throw std::runtime_error("Server closed the connection");
+                auto now = Clock::now();
+                buffer.append(chunk, n);
+                size_t offset = 0;
+                ServerFrame response;
+                while (ServerFrame::parse(buffer, offset, response)) {
+                    if (response.id >= count) throw std::runtime_error("Unexpected response id");
+                    latencies[c].push_back(std::chrono::duration<double, std::micro>(now - sent[response.id]).count());
+                    errors[c] += response.kind != 0;
+                    if (reference && std::string(1, static_cast<char>(response.kind)) + response.payload !=
+                                         expected[response.id % templates.size()]) {
+                        ++mismatches[c];
+                    }
+                    ++received;
+                }
+                buffer.erase(0, offset);
+                sendUpTo(received + pipeline);
+            }
+            close(fd);
+        } catch (const std::runtime_error& e) {
+            failures[c] = e.what();
+        }
+#else
+        (void)c;
+        failures[c] = "The load generator needs Linux";
+#endif
+    };
+
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned c = 0; c < connections; ++c) threads.emplace_back(worker, c);
+    for (auto& thread : threads) thread.join();
+    LoadTestStats stats;
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (unsigned c = 0; c < connections; ++c) {
+        if (!failures[c].empty()) throw std::runtime_error("Connection " + std::to_string(c) + ": " + failures[c]);
+    }
+
+    std::vector<double> all;
+    for (unsigned c = 0; c < connections; ++c) {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        stats.errors += errors[c];
+        stats.mismatches += mismatches[c];
+    }
+    stats.requests = all.size();
+    if (!all.empty()) {
+        std::sort(all.begin(), all.end());
+        stats.p50Us = all[all.size() / 2];
+        stats.p99Us = all[std::min(all.size() - 1, all.size() * 99 / 100)];
+        stats.maxUs = all.back();
+    }
+    return stats;
+}
+
+void printLoadTestStats(const LoadTestStats& stats, std::ostream& os) {
+    os << "请求 " << stats.requests << " 个，失败 " << stats.errors << " 个，结果不一致 " << stats.mismatches
+       << " 个，用时 " << std::fixed << std::setprecision(3) << stats.seconds << " s" << std::endl;
+    os << "吞吐 " << std::setprecision(0) << stats.requests / stats.seconds << " 请求/s，延迟 p50 "
+       << std::setprecision(1) << stats.p50Us << " us，p99 " << stats.p99Us << " us，最大 " << stats.maxUs << " us"
+       << std::endl;
+    os.unsetf(std::ios::fixed);
+    os << std::setprecision(6);
+}
+
+#if defined(__linux__)
+CompileServer* activeServer = nullptr;
+
+void stopActiveServer(int) {
+    if (activeServer) activeServer->stop();
+}
+#endif
+
+// 服务模式：compile --serve <套接字路径> [-j 线程数] [-g 文法文件] [--cache-mb 大小] [--cache-dir 目录]，
+//           收到 SIGINT/SIGTERM 时退出
+// 压测模式：compile --client <套接字路径> [-n 请求数] [-c 连接数] [-p 在途请求数] [--verify] [-g 文法文件]
+int runServerMode(int argc, char* argv[]) {
+    std::string mode = argv[1];
+    std::string socketPath, grammarPath = "input.txt", cacheDirectory;
+    unsigned numThreads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned connections = 4, pipeline = 16;
+    size_t cacheMegabytes = 0;
+    size_t requests = 100000;
+    bool verify = false;
+    bool valid = argc > 2;
+    for (int i = 2; i < argc && valid; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--verify") {
+            verify = true;
+        } else if ((arg == "--cache-mb" || arg == "--cache-dir") && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (arg == "--cache-mb") cacheMegabytes = std::max(1L, std::atol(value.c_str()));
+            else cacheDirectory = value;
+        } else if (arg.size() == 2 && arg[0] == '-' && std::strchr("jgncp", arg[1]) && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (arg == "-g") grammarPath = value;
+            else if (arg == "-j") numThreads = std::max(1, std::atoi(value.c_str()));
+            else if (arg == "-n") requests = std::max(1L, std::atol(value.c_str()));
+            else if (arg == "-c") connections = std::max(1, std::atoi(value.c_str()));
+            else pipeline = std::max(1, std::atoi(value.c_str()));
+        } else if (socketPath.empty() && arg[0] != '-') {
+            socketPath = arg;
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid || socketPath.empty()) {
+        std::cerr << "用法: " << argv[0]
+                  << " --serve <套接字路径> [-j 线程数] [-g 文法文件] [--cache-mb 大小] [--cache-dir 目录]" << std::endl
+                  << "      " << argv[0]
+                  << " --client <套接字路径> [-n 请求数] [-c 连接数] [-p 在途请求数] [--verify] [-g 文法文件]"
+                  << std::endl;
+        return 2;
+    }
+    try {
+        if (mode == "--serve") {
+#if defined(__linux__)
+            std::shared_ptr<const CompilerContext> context = CompilerContext::fromFile(grammarPath);
+            std::unique_ptr<CompileCache> cache;
+            if (cacheMegabytes || !cacheDirectory.empty()) {
+                cache.reset(new CompileCache(context->grammarHash(), (cacheMegabytes ? cacheMegabytes : 64) << 20,
+                                             cacheDirectory));
+            }
+            CompileServer server(context, socketPath, numThreads, cache.get());
+            activeServer = &server;
+            struct sigaction action {};
+            action.sa_handler = stopActiveServer;
+            sigaction(SIGINT, &action, nullptr);
+            sigaction(SIGTERM, &action, nullptr);
+            signal(SIGPIPE, SIG_IGN);
+            std::cerr << "编译服务监听 " << socketPath << "，" << numThreads << " 个工作线程" << std::endl;
+            server.run();
+            activeServer = nullptr;
+            std::cerr << "已处理 " << server.requestsServed() << " 个请求" << std::endl;
+            if (cache) cache->printStats(std::cerr);
+#else
+            throw std::runtime_error("The compile server needs Linux (epoll)");
+#endif
+        } else {
+            std::shared_ptr<const CompilerContext> reference;
+            if (verify) reference = CompilerContext::fromFile(grammarPath);
+            LoadTestStats stats = runLoadGenerator(socketPath, connections, pipeline, requests, reference.get());
+            printLoadTestStats(stats, std::cout);
+            return stats.errors || stats.mismatches ? 1 : 0;
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << "错误: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// ================= 增量重分析 =================
+
+// 可编辑的表达式文档：保存上一次 LR 分析得到的具体语法树（含每个 token 及其前导空白），
+// 编辑时只对受影响的 token 窗口重新词法分析，再以旧树为输入重新分析。旧子树若完全在窗口之外、
+// 其后的 token 未变且分析器处于当初移进它时的状态，就按 GOTO 整棵压栈，不再展开；
+// 只有覆盖编辑点的结点被重新规约并生成四元式。树深为 O(log n) 时一次编辑的代价与表达式长度无关
+class IncrementalDocument {
+public:
+    struct EditStats {
+        size_t relexedTokens = 0;   // 重新词法分析的 token 数
+        size_t reusedSubtrees = 0;  // 整棵复用的旧子树数
+        size_t newNodes = 0;        // 新建的非终结符结点数
+        size_t newQuadruples = 0;   // 重新生成的四元式数
+        double seconds = 0;
+    };
+
+private:
+    // 结点集中存放在数组中，相互用下标引用；旧树被替换后不可达的结点在数组过大时统一回收
+    struct Node {
+        int symbol = -1;          // 非终结符下标，叶子为 -1
+        int rule = -1;            // 规约所用产生式，叶子为 -1
+        int startState = 0;       // 移进本结点第一个 token 之前的栈顶状态
+        int children[3] = {-1, -1, -1};
+        int childCount = 0;
+        int operand = -1;         // 提供本子树结果的结点：叶子或生成四元式的结点
+        TokenType type = TOK_END; // 叶子的 token 类型
+        uint32_t padding = 0;     // 叶子前导空白的长度
+        size_t tokens = 0;        // 覆盖的 token 数
+        size_t bytes = 0;         // 覆盖的源文本字节数，含各叶子的前导空白
+        std::string text;         // 叶子：前导空白 + token 原文；生成四元式的结点：结果临时变量名
+    };
+
+    // 产生式的语义动作，与 CompilerContext::reduceNode 一致
+    enum SemanticKind { PASS, NEGATE, BINARY };
+    struct RuleInfo {
+        int left = -1;
+        int length = 0;
+        SemanticKind kind = PASS;
+        int operandChild = 0;  // PASS/NEGATE 取哪个孩子的结果
+        std::string op;        // BINARY 的运算符
+    };
+
+    std::shared_ptr<const CompilerContext> context;
+    std::vector<RuleInfo> rules;
+    std::vector<Node> nodes;
+    int root = -1;             // 最近一次分析成功的语法树，-1 表示还没有
+    std::string trailing;      // 最后一个 token 之后的空白
+    size_t liveNodes = 0;      // 上次回收后语法树的结点数
+    long long tempCounter = 0;
+
+    // 分析失败的编辑先挂起：旧树的 token [pendingA, pendingB)（到末尾时连同 trailing）
+    // 当前的文本为 pendingText，之后的编辑与它合并后重试，语法树保持上一次成功的版本
+    bool pending = false;
+    size_t pendingA = 0, pendingB = 0;
+    std::string pendingText;
+    std::string error;
+    EditStats stats;
+
+    static bool isWordChar(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    static bool isSpace(char c) {
+        return std::isspace(static_cast<unsigned char>(c));
+    }
+
+    // 两段文本直接相接时，词法分析是否可能把边界两侧的字符并成一个 token
+    static bool canJoin(char left, char right) {
+        return (isWordChar(left) && isWordChar(right)) || (left == right && (left == '|' || left == '&'));
+    }
+
+    size_t treeBytes() const {
+        return root < 0 ? 0 : nodes[root].bytes;
+    }
+
+    // 第 k 个叶子（k 小于 token 数）及其起始字节（含前导空白）
+    std::pair<int, size_t> locateLeaf(size_t k) const {
+        int x = root;
+        size_t offset = 0;
+        while (nodes[x].childCount > 0) {
+            const Node& n = nodes[x];
+            for (int c = 0; c < n.childCount; ++c) {
+                const Node& child = nodes[n.children[c]];
+                if (k < child.tokens) {
+                    x = n.children[c];
+                    break;
+                }
+                k -= child.tokens;
+                offset += child.bytes;
+            }
+        }
+        return {x, offset};
+    }
+
+    // 字节 offset 所在的叶子下标；落在末尾空白中时返回 token 数
+    size_t leafIndexAt(size_t offset) const {
+        if (offset >= treeBytes()) return tokenCount();
+        int x = root;
+        size_t index = 0;
+        while (nodes[x].childCount > 0) {
+            const Node& n = nodes[x];
+            for (int c = 0; c < n.childCount; ++c) {
+                const Node& child = nodes[n.children[c]];
+                if (offset < child.bytes) {
+                    x = n.children[c];
+                    break;
+                }
+                offset -= child.bytes;
+                index += child.tokens;
+            }
+        }
+        return index;
+    }
+
+    size_t leafStart(size_t k) const {
+        return k >= tokenCount() ? treeBytes() : locateLeaf(k).second;
+    }
+
+    // 旧树 token 区间 [a, b) 对应的文本区间终点：b 为末尾时包括 trailing
+    size_t regionEnd(size_t b) const {
+        return b >= tokenCount() ? treeBytes() + trailing.size() : leafStart(b);
+    }
+
+    // 叶子 [p, q) 的原文（含前导空白），只访问与区间相交的子树
+    void appendLeaves(size_t p, size_t q, std::string& out) const {
+        if (root < 0 || p >= q) return;
+        std::vector<std::pair<int, size_t>> stack = {{root, 0}};  // 结点及其第一个 token 的下标
+        while (!stack.empty()) {
+            std::pair<int, size_t> top = stack.back();
+            stack.pop_back();
+            const Node& n = nodes[top.first];
+            if (top.second >= q || top.second + n.tokens <= p) continue;
+            if (n.childCount == 0) {
+                out += n.text;
+                continue;
+            }
+            size_t first = top.second + n.tokens;
+            for (int c = n.childCount - 1; c >= 0; --c) {
+                first -= nodes[n.children[c]].tokens;
+                stack.push_back({n.children[c], first});
+            }
+        }
+    }
+
+    std::string regionText(size_t a, size_t b) const {
+        std::string out;
+        appendLeaves(a, b, out);
+        if (b >= tokenCount()) out += trailing;
+        return out;
+    }
+
+    // 按 token 下标单调前进的旧树游标：seek(j) 返回从第 j 个 token 开始的最外层结点
+    class TreeCursor {
+    private:
+        struct Frame {
+            int node;
+            size_t start;  // 该结点第一个 token 的下标
+            int index;     // 在父结点中的位置
+        };
+        const std::vector<Node>& nodes;
+        std::vector<Frame> path;
+
+    public:
+        TreeCursor(const std::vector<Node>& nodes, int root) : nodes(nodes) {
+            if (root >= 0) path.push_back({root, 0, 0});
+        }
+
+        int seek(size_t j) {
+            while (true) {
+                Frame& f = path.back();
+                const Node& n = nodes[f.node];
+                if (f.start == j && n.tokens > 0) return f.node;
+                if (f.start + n.tokens <= j) {
+                    // 跳过整棵子树，换到下一个兄弟；父结点也走完时继续向上
+                    while (true) {
+                        Frame done = path.back();
+                        if (path.size() == 1) return -1;
+                        path.pop_back();
+                        const Node& parent = nodes[path.back().node];
+                        if (done.index + 1 < parent.childCount) {
+                            path.push_back({parent.children[done.index + 1], done.start + nodes[done.node].tokens,
+                                            done.index + 1});
+                            break;
+                        }
+                    }
+                    continue;
+                }
+                path.push_back({n.children[0], f.start, 0});
+            }
+        }
+    };
+
+    // 词法分析窗口文本，叶子追加到结点数组；返回最后一个 token 之后的空白
+    std::string lexWindow(const std::string& text, std::vector<int>& fresh) {
+        std::istringstream stream(text);
+        size_t position = 0;
+        while (true) {
+            Token token = get_next_token(stream);
+            std::streamoff end = stream.tellg();
+            stream.clear();  // 标识符读到文本末尾时流处于失败状态
+            if (token.type == TOK_END) return text.substr(position);
+            size_t stop = end < 0 ? text.size() : static_cast<size_t>(end);
+            Node leaf;
+            leaf.type = token.type;
+            leaf.text = text.substr(position, stop - position);
+            while (leaf.padding < leaf.text.size() && isSpace(leaf.text[leaf.padding])) ++leaf.padding;
+            leaf.tokens = 1;
+            leaf.bytes = leaf.text.size();
+            leaf.operand = nodes.size();
+            fresh.push_back(nodes.size());
+            nodes.push_back(std::move(leaf));
+            position = stop;
+        }
+    }
+
+    // 旧树的 token [a, b) 换成 fresh 后重新分析，成功返回新树的根，失败抛出 runtime_error
+    int reparse(size_t a, size_t b, const std::vector<int>& fresh) {
+        const size_t m = fresh.size();
+        const size_t total = tokenCount() - (b - a) + m;
+        const int endTerminal = context->terminalOf(TOK_END);
+        TreeCursor cursor(nodes, root);
+        std::vector<std::pair<int, int>> stack = {{0, -1}};  // (状态, 结点)
+        size_t i = 0;
+        while (true) {
+            int state = stack.back().first;
+            int leaf = -1;
+            if (i < total && (i < a || i >= a + m)) {
+                size_t j = i < a ? i : i - a - m + b;  // 对应旧树中的 token 下标
+                int x = cursor.seek(j);
+                bool reused = false;
+                for (; nodes[x].childCount > 0; x = nodes[x].children[0]) {
+                    const Node& n = nodes[x];
+                    // 前缀中的子树连同其后一个 token 都必须在编辑窗口之前
+                    if (n.startState != state || (j < a && j + n.tokens >= a)) continue;
+                    int target = context->gotoAt(state, n.symbol);
+                    if (target < 0) continue;
+                    stack.push_back({target, x});
+                    i += n.tokens;
+                    ++stats.reusedSubtrees;
+                    reused = true;
+                    break;
+                }
+                if (reused) continue;
+                leaf = x;
+            } else if (i < total) {
+                leaf = fresh[i - a];
+            }
+
+            int terminal = leaf < 0 ? endTerminal : context->terminalOf(nodes[leaf].type);
+            ActionItem item = context->actionAt(state, terminal);
+            if (item.actionType == SHIFT) {
+                nodes[leaf].startState = state;
+                stack.push_back({item.stateOrRule, leaf});
+                ++i;
+            } else if (item.actionType == REDUCE) {
+                const RuleInfo& rule = rules[item.stateOrRule];
+                Node node;
+                node.symbol = rule.left;
+                node.rule = item.stateOrRule;
+                node.childCount = rule.length;
+                for (int c = 0; c < rule.length; ++c) {
+                    int child = stack[stack.size() - rule.length + c].second;
+                    node.children[c] = child;
+                    node.tokens += nodes[child].tokens;
+                    node.bytes += nodes[child].bytes;
+                }
+                stack.resize(stack.size() - rule.length);
+                node.startState = stack.back().first;
+                if (rule.kind == PASS) {
+                    node.operand = nodes[node.children[rule.operandChild]].operand;
+                } else {
+                    node.operand = nodes.size();
+                    node.text = "t" + std::to_string(++tempCounter);
+                    ++stats.newQuadruples;
+                }
+                ++stats.newNodes;
+                stack.push_back({context->gotoAt(stack.back().first, rule.left), static_cast<int>(nodes.size())});
+                nodes.push_back(std::move(node));
+            } else if (item.actionType == ACCEPT) {
+                return stack.back().second;
+            } else {
+                throw std::runtime_error("No action found for state " + std::to_string(state) + " and input " +
+                                         (leaf < 0 ? std::string("$") : nodes[leaf].text.substr(nodes[leaf].padding)));
+            }
+        }
+    }
+
+    // 把仍可达的结点按后序复制到新数组，丢弃被替换的旧结点
+    void compact() {
+        std::vector<Node> live;
+        live.reserve(liveNodes + liveNodes / 2);
+        std::vector<int> remap(nodes.size(), -1);
+        std::vector<std::pair<int, int>> stack = {{root, 0}};  // (结点, 下一个要访问的孩子)
+        while (!stack.empty()) {
+            int x = stack.back().first;
+            if (stack.back().second < nodes[x].childCount) {
+                int child = nodes[x].children[stack.back().second++];
+                stack.push_back({child, 0});
+                continue;
+            }
+            stack.pop_back();
+            Node node = std::move(nodes[x]);
+            for (int c = 0; c < node.childCount; ++c) node.children[c] = remap[node.children[c]];
+            remap[x] = live.size();
+            node.operand = remap[node.operand];
+            live.push_back(std::move(node));
+        }
+        root = live.size() - 1;
+        nodes.swap(live);
+        liveNodes = nodes.size();
+    }
+
+    // 以旧树的 token [a, b) 和它们现在的文本重新分析
+    bool reanalyze(size_t a, size_t b, const std::string& text) {
+        auto start = std::chrono::steady_clock::now();
+        stats = EditStats();
+        std::vector<int> fresh;
+        std::string rest = lexWindow(text, fresh);
+        stats.relexedTokens = fresh.size();
+        try {
+            bool atEnd = b >= tokenCount();
+            root = reparse(a, b, fresh);
+            if (atEnd) trailing = rest;
+            pending = false;
+            pendingText.clear();
+            error.clear();
+            if (nodes.size() > 2 * liveNodes + 65536) compact();
+        } catch (const std::runtime_error& e) {
+            pending = true;
+            pendingA = a;
+            pendingB = b;
+            pendingText = text;
+            error = e.what();
+        }
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return !pending;
+    }
+
+public:
+    IncrementalDocument(std::shared_ptr<const CompilerContext> compilerContext, const std::string& text)
+        : context(std::move(compilerContext)) {
+        const Grammar& grammar = context->getGrammar();
+        for (const auto& p : grammar.prods) {
+            RuleInfo info;
+            info.left = context->nonTerminalOf(p.left);
+            info.length = p.rights.size();
+            const std::vector<std::string>& r = p.rights;
+            if (r.empty() || r.size() > 3) {
+                throw std::runtime_error("Incremental parsing needs productions with 1 to 3 symbols");
+            }
+            if (r.size() == 2 && r[0] == "-") {
+                info.kind = NEGATE;
+                info.operandChild = 1;
+            } else if (r.size() == 3 && r[0] == "(" && r[2] == ")") {
+                info.operandChild = 1;
+            } else if (r.size() == 3) {
+                info.kind = BINARY;
+                info.op = r[1];
+            } else if (r.size() != 1) {
+                throw std::runtime_error("No semantic action for production " + p.left);
+            }
+            rules.push_back(info);
+        }
+        reanalyze(0, 0, text);
+        liveNodes = nodes.size();
+    }
+
+    // 把当前文本中 [offset, offset + removed) 替换为 inserted。返回新文本能否通过分析；
+    // 不能时文本照常更新，语法树和四元式保持上一次成功的版本，后续编辑修好后一并重新分析
+    bool edit(size_t offset, size_t removed, const std::string& inserted) {
+        const size_t length = size();
+        if (offset > length || removed > length - offset) throw std::runtime_error("Edit range out of bounds");
+        const size_t n = tokenCount();
+
+        // 挂起窗口在当前文本与旧树文本中的位置
+        size_t windowStart = 0, windowOldEnd = 0;
+        if (pending) {
+            windowStart = leafStart(pendingA);
+            windowOldEnd = regionEnd(pendingB);
+        }
+        const size_t windowNewEnd = windowStart + pendingText.size();
+        // 当前文本中的位置映射为旧树中的叶子下标，落在挂起窗口内的位置取窗口的边界
+        auto leafBefore = [&](size_t pos) -> size_t {
+            if (pending && pos >= windowStart) {
+                if (pos <= windowNewEnd) return pendingA;
+                pos = pos - windowNewEnd + windowOldEnd;
+            }
+            return leafIndexAt(pos);
+        };
+        auto leafAfter = [&](size_t pos) -> size_t {
+            if (pending && pos >= windowStart) {
+                if (pos <= windowNewEnd) return pendingB;
+                pos = pos - windowNewEnd + windowOldEnd;
+            }
+            return std::min(n, leafIndexAt(pos) + 1);
+        };
+        size_t a = leafBefore(offset), b = leafAfter(offset + removed);
+        if (pending) {
+            a = std::min(a, pendingA);
+            b = std::max(b, pendingB);
+        }
+
+        // 窗口当前的文本
+        std::string text;
+        if (pending) {
+            appendLeaves(a, pendingA, text);
+            text += pendingText;
+            if (pendingB < n) text += regionText(pendingB, b);
+        } else {
+            text = regionText(a, b);
+        }
+        text.replace(offset - leafStart(a), removed, inserted);
+
+        // 窗口边界两侧可能连成一个 token，或者末尾的空白会并入下一个 token 的前导空白时，把窗口扩大
+        while (true) {
+            if (b < n) {
+                const Node& next = nodes[locateLeaf(b).first];
+                if (text.empty() || isSpace(text.back()) || canJoin(text.back(), next.text[0])) {
+                    text += next.text;
+                    // 窗口到达末尾时与 regionText 一样连同 trailing，否则重新分析会丢掉末尾的空白
+                    if (++b == n) text += trailing;
+                    continue;
+                }
+            }
+            if (a > 0) {
+                const Node& previous = nodes[locateLeaf(a - 1).first];
+                if (text.empty() || canJoin(previous.text.back(), text[0])) {
+                    text.insert(0, previous.text);
+                    --a;
+                    continue;
+                }
+            }
+            break;
+        }
+        return reanalyze(a, b, text);
+    }
+
+    bool isValid() const {
+        return !pending;
+    }
+
+    const std::string& errorMessage() const {
+        return error;
+    }
+
+    const EditStats& lastEdit() const {
+        return stats;
+    }
+
+    // 语法树中的 token 数
+    size_t tokenCount() const {
+        return root < 0 ? 0 : nodes[root].tokens;
+    }
+
+    // 当前文本的字节数
+    size_t size() const {
+        size_t length = treeBytes() + trailing.size();
+        if (pending) length = length - (regionEnd(pendingB) - leafStart(pendingA)) + pendingText.size();
+        return length;
+    }
+
+    std::string text() const {
+        if (!pending) return regionText(0, tokenCount());
+        std::string out;
+        appendLeaves(0, pendingA, out);
+        out += pendingText;
+        if (pendingB < tokenCount()) out += regionText(pendingB, tokenCount());
+        return out;
+    }
+
+    // 按语法树后序输出最近一次成功分析的四元式，临时变量按定义顺序重新编号为 t1, t2, ...，
+    // 与对整段文本调用 QuaternionGenerator::genExpression 的结果相同；result 为结果变量
+    std::vector<Quadruple> quadruples(std::string* result = nullptr) const {
+        std::vector<Quadruple> quads;
+        if (root < 0) return quads;
+        std::unordered_map<int, std::string> names;
+        auto valueOf = [&](int node) {
+            const Node& n = nodes[nodes[node].operand];
+            return n.childCount == 0 ? n.text.substr(n.padding) : names.at(nodes[node].operand);
+        };
+        std::vector<std::pair<int, int>> stack = {{root, 0}};
+        while (!stack.empty()) {
+            int x = stack.back().first;
+            if (stack.back().second < nodes[x].childCount) {
+                int child = nodes[x].children[stack.back().second++];
+                stack.push_back({child, 0});
+                continue;
+            }
+            stack.pop_back();
+            const Node& n = nodes[x];
+            if (n.rule < 0 || rules[n.rule].kind == PASS) continue;
+            std::string temp = "t" + std::to_string(names.size() + 1);
+            names[x] = temp;
+            if (rules[n.rule].kind == NEGATE) {
+                quads.emplace_back("!", valueOf(n.children[1]), "", temp);
+            } else {
+                quads.emplace_back(rules[n.rule].op, valueOf(n.children[0]), valueOf(n.children[2]), temp);
+            }
+        }
+        if (result) *result = valueOf(root);
+        return quads;
+    }
+};
+
+// 增量编辑基准：对不同规模的随机表达式做随机小编辑（改名、切换运算符、插入取反、
+// 先打出不完整的文本再补全），比较单次编辑的延迟与整段重新编译的时间，并抽查结果与整段编译一致
+// 增量编辑的回归测试：每组编辑逐条应用到文档与一份镜像文本上，每步比较文本，
+// 最后比较四元式与整段重新编译的结果。重点是挂起窗口、窗口扩大到末尾与末尾空白的组合。返回失败的组数
+int runIncrementalEditTest(std::shared_ptr<const CompilerContext> context, std::ostream& os) {
+    struct Edit {
+        size_t offset, removed;
+        std::string inserted;
+    };
+    const std::vector<std::pair<std::string, std::vector<Edit>>> cases = {
+        {"-a ", {{0, 0, "("}, {0, 2, ""}}},  // "(-a " 挂起，删掉 "(-" 后窗口扩大到末尾
+        {"a V b  ", {{6, 1, ""}}},
+        {"a V b ", {{4, 1, ""}, {4, 0, "c"}}},
+        {"x ^ y\n", {{0, 1, "xy"}, {7, 0, " V z"}}},
+        {"-(a) ", {{1, 1, ""}, {3, 1, ""}, {1, 0, "-"}}},
+    };
+    int failures = 0;
+    for (const auto& [initial, edits] : cases) {
+        std::string mirror = initial;
+        IncrementalDocument document(context, mirror);
+        bool same = document.text() == mirror;
+        for (const Edit& e : edits) {
+            document.edit(e.offset, e.removed, e.inserted);
+            mirror.replace(e.offset, e.removed, e.inserted);
+            same = same && document.text() == mirror && document.size() == mirror.size();
+        }
+        if (same && document.isValid()) {
+            std::string actualResult;
+            QuaternionGenerator reference;
+            std::string expectedResult = context->compile(mirror, reference);
+            std::vector<Quadruple> quads = document.quadruples(&actualResult);
+            same = actualResult == expectedResult && quads.size() == reference.getQuaternions().size();
+            for (size_t q = 0; same && q < quads.size(); ++q) {
+                const Quadruple& x = quads[q];
+                const Quadruple& y = reference.getQuaternions()[q];
+                same = x.op == y.op && x.arg1 == y.arg1 && x.arg2 == y.arg2 && x.result == y.result;
+            }
+        }
+        if (!same) {
+            ++failures;
+            os << "  \"" << initial << "\" 编辑后为 \"" << document.text() << "\"，应为 \"" << mirror << "\""
+               << std::endl;
+        }
+    }
+    os << "增量编辑测试: " << cases.size() << " 组，" << failures << " 组失败" << std::endl;
+    return failures;
+}
+
+void runIncrementalBenchmark(std::shared_ptr<const CompilerContext> context, std::ostream& os) {
+    std::mt19937 rng(71);
+    const int EDITS = 400;
+    os << std::right << std::setw(10) << "tokens" << std::setw(14) << "full ms" << std::setw(14) << "edit p50 us"
+       << std::setw(14) << "edit p99 us" << std::setw(10) << "relexed" << std::setw(10) << "reused"
+       << std::setw(10) << "new" << std::setw(8) << "check" << std::endl;
+    for (int leaves : {1 << 10, 1 << 13, 1 << 16}) {
+        std::string mirror = generateRandomExpression(64, leaves, rng);
+
+        auto start = std::chrono::steady_clock::now();
+        QuaternionGenerator full;
+        context->compile(mirror, full);
+        double fullMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        IncrementalDocument document(context, mirror);
+        std::vector<double> latencies;
+        size_t relexed = 0, reused = 0, created = 0, mismatches = 0;
+        auto apply = [&](size_t offset, size_t removed, const std::string& inserted) {
+            bool ok = document.edit(offset, removed, inserted);
+            mirror.replace(offset, removed, inserted);
+            const IncrementalDocument::EditStats& s = document.lastEdit();
+            latencies.push_back(s.seconds * 1e6);
+            relexed += s.relexedTokens;
+            reused += s.reusedSubtrees;
+            created += s.newNodes;
+            return ok;
+        };
+        // 从随机位置向后找一个标识符
+        auto findIdentifier = [&]() {
+            size_t pos = mirror.find('x', rng() % mirror.size());
+            if (pos == std::string::npos) pos = mirror.find('x');
+            return pos;
+        };
+
+        for (int e = 0; e < EDITS; ++e) {
+            size_t pos = findIdentifier();
+            if (pos == std::string::npos) break;
+            size_t end = pos + 1;
+            while (end < mirror.size() && std::isdigit(static_cast<unsigned char>(mirror[end]))) ++end;
+            std::string name = "x" + std::to_string(rng() % 64);
+            bool ok = true;
+            switch (e % 4) {
+                case 0:
+                    ok = apply(pos, end - pos, name);
+                    break;
+                case 1: {
+                    size_t op = mirror.find_first_of("V^", pos);
+                    if (op != std::string::npos) ok = apply(op, 1, mirror[op] == 'V' ? "^" : "V");
+                    break;
+                }
+                case 2:
+                    ok = apply(pos, 0, "-");
+                    break;
+                default:
+                    // 中间状态 "x1 V" 不合法，补全后恢复
+                    if (apply(end, 0, " V")) ++mismatches;
+                    ok = apply(end + 2, 0, " " + name);
+                    break;
+            }
+            if (!ok) ++mismatches;
+            if (e % 50 == 49 || e == EDITS - 1) {
+                std::string expectedResult, actualResult;
+                QuaternionGenerator reference;
+                expectedResult = context->compile(mirror, reference);
+                std::vector<Quadruple> quads = document.quadruples(&actualResult);
+                bool same = document.text() == mirror && actualResult == expectedResult &&
+                            quads.size() == reference.getQuaternions().size();
+                for (size_t q = 0; same && q < quads.size(); ++q) {
+                    const Quadruple& x = quads[q];
+                    const Quadruple& y = reference.getQuaternions()[q];
+                    same = x.op == y.op && x.arg1 == y.arg1 && x.arg2 == y.arg2 && x.result == y.result;
+                }
+                if (!same) ++mismatches;
+            }
+        }
+
+        std::vector<double> sorted = latencies;
+        std::sort(sorted.begin(), sorted.end());
+        size_t count = sorted.size();
+        os << std::setw(10) << document.tokenCount() << std::fixed << std::setprecision(2) << std::setw(14) << fullMs
+           << std::setprecision(1) << std::setw(14) << sorted[count / 2] << std::setw(14) << sorted[count * 99 / 100]
+           << std::setw(10) << double(relexed) / count << std::setw(10) << double(reused) / count << std::setw(10)
+           << double(created) / count << std::setw(8) << (mismatches ? "FAIL" : "ok") << std::endl;
+        os.unsetf(std::ios::fixed);
+    }
+}
+
+// ================= 流式编译 =================
+
+// 流式编译基准：把不同形状的大表达式写入临时文件，从文件流直接编译到计数用的 sink，
+// 记录吞吐量和分析栈最大深度；平衡形状另外与先整段词法分析、建树再生成代码的做法比较并核对结果
+void runStreamingBenchmark(const CompilerContext& context, std::ostream& os) {
+    // 计数；需要核对时收集全部四元式
+    class CollectingSink : public QuadrupleSink {
+    public:
+        std::vector<Quadruple> quads;
+        bool keep = false;
+        size_t count = 0;
+
+        void emit(const Quadruple& quad) override {
+            ++count;
+            if (keep) quads.push_back(quad);
+        }
+    };
+
+    std::mt19937 rng(73);
+    const std::string path = "/tmp/compile-stream-" + std::to_string(getpid()) + ".txt";
+    auto randomLeaf = [&]() {
+        return std::string(rng() % 5 == 0 ? "-" : "") + "x" + std::to_string(rng() % 64);
+    };
+    os << std::left << std::setw(10) << "shape" << std::right << std::setw(12) << "tokens" << std::setw(12) << "MB"
+       << std::setw(12) << "stream ms" << std::setw(12) << "Mtok/s" << std::setw(12) << "max stack"
+       << std::setw(14) << "in-memory ms" << std::setw(8) << "check" << std::endl;
+    for (const char* shape : {"flat", "nested", "balanced"}) {
+        std::string name = shape;
+        {
+            std::ofstream file(path, std::ios::trunc);
+            if (name == "flat") {
+                // 左递归链 a V b ^ c ...：规约随读随做，栈深为常数
+                file << randomLeaf();
+                for (int i = 1; i < (1 << 21); ++i) file << (rng() % 2 ? " V " : " ^ ") << randomLeaf();
+            } else if (name == "nested") {
+                // 右侧层层嵌套的括号：栈深与嵌套层数成正比
+                const int depth = 1 << 16;
+                for (int i = 0; i < depth; ++i) file << "(" << randomLeaf() << (rng() % 2 ? " V " : " ^ ");
+                file << randomLeaf() << std::string(depth, ')');
+            } else {
+                file << generateRandomExpression(64, 1 << 19, rng);
+            }
+            if (!file) throw std::runtime_error("Cannot write " + path);
+        }
+
+        CollectingSink sink;
+        sink.keep = name == "balanced";
+        StreamCompileStats stats;
+        std::ifstream in(path);
+        auto start = std::chrono::steady_clock::now();
+        std::string result = context.compileStream(in, sink, &stats);
+        double streamMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        in.close();
+
+        std::string inMemory = "-", check = "-";
+        if (name == "balanced") {
+            // 对照：整段读入、词法分析、建树、生成四元式
+            start = std::chrono::steady_clock::now();
+            std::ifstream whole(path);
+            std::stringstream buffer;
+            buffer << whole.rdbuf();
+            QuaternionGenerator generator;
+            std::string expected = context.compile(buffer.str(), generator);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::ostringstream text;
+            text << std::fixed << std::setprecision(1) << ms;
+            inMemory = text.str();
+            bool same = expected == result && generator.getQuaternions().size() == sink.quads.size();
+            for (size_t i = 0; same && i < sink.quads.size(); ++i) {
+                same = generator.getQuaternions()[i].toString() == sink.quads[i].toString();
+            }
+            check = same ? "ok" : "FAIL";
+        }
+        std::ifstream sizeProbe(path, std::ios::binary | std::ios::ate);
+        double megabytes = static_cast<double>(sizeProbe.tellg()) / (1 << 20);
+        os << std::left << std::setw(10) << name << std::right << std::setw(12) << stats.tokens << std::fixed
+           << std::setprecision(1) << std::setw(12) << megabytes << std::setw(12) << streamMs << std::setw(12)
+           << stats.tokens / streamMs / 1000 << std::setw(12) << stats.maxStackDepth << std::setw(14) << inMemory
+           << std::setw(8) << check << std::endl;
+        os.unsetf(std::ios::fixed);
+    }
+    std::remove(path.c_str());
+}
+
+// 输出基准：约一百万条四元式及其目标代码，分别用逐行 std::endl、缓冲文本和二进制格式写入文件，
+// 与直接整块写出同样字节数的速度（磁盘速度）比较，并核对缓冲输出与原格式逐字节相同、二进制可以读回
+void runEmitterBenchmark(const CompilerContext& context, std::ostream& os) {
+    class Collector : public QuadrupleSink {
+    public:
+        std::vector<Quadruple> quads;
+        std::string result;
+
+        void emit(const Quadruple& quad) override {
+            quads.push_back(quad);
+        }
+
+        void finish(const std::string& value) override {
+            result = value;
+        }
+    };
+
+    std::mt19937 rng(79);
+    Collector program;
+    {
+        std::istringstream source(generateRandomExpression(256, 1 << 20, rng));
+        context.compileStream(source, program);
+    }
+    QuaternionGenerator generator;
+    for (const auto& quad : program.quads) generator.addQuaternion(quad.op, quad.arg1, quad.arg2, quad.result);
+    std::vector<TargetInstruction> target = generator.generateTargetInstructions();
+
+    const std::string path = "/tmp/compile-emit-" + std::to_string(getpid());
+    auto fileSize = [&](const std::string& file) {
+        std::ifstream in(file, std::ios::binary | std::ios::ate);
+        return static_cast<double>(in.tellg());
+    };
+    auto slurp = [&](const std::string& file) {
+        std::ifstream in(file, std::ios::binary);
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        return buffer.str();
+    };
+    auto timeWrite = [&](const std::string& file, const std::function<void(std::ostream&)>& write) {
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::ofstream out(file, std::ios::binary | std::ios::trunc);
+            write(out);
+            if (!out) throw std::runtime_error("Write to " + file + " failed");
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    auto report = [&](const char* name, double ms, double bytes, const char* check) {
+        os << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(1)
+           << std::setw(10) << ms << " ms" << std::setw(10) << bytes / (1 << 20) << " MB" << std::setw(10)
+           << bytes / (1 << 20) / ms * 1000 << " MB/s" << std::setw(8) << check << std::endl;
+        os.unsetf(std::ios::fixed);
+    };
+
+    os << program.quads.size() << " 条四元式，" << target.size() << " 条目标指令" << std::endl;
+    double ms = timeWrite(path + ".endl", [&](std::ostream& out) {
+        std::vector<std::string> lines;
+        for (const auto& quad : program.quads) lines.push_back(quad.toString());
+        for (size_t i = 0; i < lines.size(); ++i) out << i << ": " << lines[i] << std::endl;
+    });
+    report("quads vector+endl", ms, fileSize(path + ".endl"), "");
+    ms = timeWrite(path + ".txt", [&](std::ostream& out) {
+        QuadrupleTextWriter writer(out);
+        for (const auto& quad : program.quads) writer.emit(quad);
+        writer.finish(program.result);
+    });
+    std::string text = slurp(path + ".txt");
+    report("quads buffered", ms, text.size(), text == slurp(path + ".endl") ? "same" : "DIFF");
+    ms = timeWrite(path + ".bin", [&](std::ostream& out) {
+        BinaryQuadrupleWriter writer(out);
+        for (const auto& quad : program.quads) writer.emit(quad);
+        writer.finish(program.result);
+    });
+    bool roundTrip;
+    {
+        std::ifstream in(path + ".bin", std::ios::binary);
+        std::string result;
+        std::vector<Quadruple> decoded = BinaryQuadrupleWriter::read(in, &result);
+        roundTrip = result == program.result && decoded.size() == program.quads.size();
+        for (size_t i = 0; roundTrip && i < decoded.size(); ++i) {
+            const Quadruple& x = decoded[i];
+            const Quadruple& y = program.quads[i];
+            roundTrip = x.op == y.op && x.arg1 == y.arg1 && x.arg2 == y.arg2 && x.result == y.result;
+        }
+    }
+    report("quads binary", ms, fileSize(path + ".bin"), roundTrip ? "ok" : "FAIL");
+    ms = timeWrite(path + ".raw", [&](std::ostream& out) {
+        for (size_t offset = 0; offset < text.size(); offset += 1 << 20) {
+            out.write(text.data() + offset, std::min<size_t>(1 << 20, text.size() - offset));
+        }
+    });
+    report("raw write (disk)", ms, text.size(), "");
+
+    ms = timeWrite(path + ".endl", [&](std::ostream& out) {
+        std::vector<std::string> lines;
+        for (const auto& instruction : target) lines.push_back(instruction.toString());
+        for (size_t i = 0; i < lines.size(); ++i) out << i << ": " << lines[i] << std::endl;
+    });
+    report("target vector+endl", ms, fileSize(path + ".endl"), "");
+    ms = timeWrite(path + ".txt", [&](std::ostream& out) {
+        OutputBuffer buffer(out);
+        writeTargetCode(target, buffer);
+    });
+    report("target buffered", ms, fileSize(path + ".txt"), slurp(path + ".txt") == slurp(path + ".endl") ? "same" : "DIFF");
+    for (const char* suffix : {".endl", ".txt", ".bin", ".raw"}) std::remove((path + suffix).c_str());
+}
+
+// 两棵语法树结构与结点值是否相同（显式栈，不递归）
+bool sameTree(const ASTNode* a, const ASTNode* b) {
+    std::vector<std::pair<const ASTNode*, const ASTNode*>> stack = {{a, b}};
+    while (!stack.empty()) {
+        std::pair<const ASTNode*, const ASTNode*> top = stack.back();
+        stack.pop_back();
+        if (!top.first || !top.second) {
+            if (top.first != top.second) return false;
+            continue;
+        }
+        if (top.first->type != top.second->type || top.first->value != top.second->value) return false;
+        stack.push_back({top.first->left, top.second->left});
+        stack.push_back({top.first->right, top.second->right});
+    }
+    return true;
+}
+
+// Pratt 引擎的差分测试与基准：随机的带括号表达式、无括号的混合优先级链和随机 token 串，
+// 两种引擎对是否接受的判断必须一致，接受时语法树必须相同；再比较两者在大表达式上的建树速度。返回不一致的个数
+int runPrattBenchmark(const CompilerContext& context, std::ostream& os) {
+    std::mt19937 rng(83);
+    auto leaf = [&]() {
+        std::string prefix = rng() % 5 == 0 ? (rng() % 2 ? "-" : "!") : "";
+        int pick = rng() % 20;
+        return prefix + (pick == 0 ? "true" : pick == 1 ? "false" : "x" + std::to_string(rng() % 8));
+    };
+    auto chain = [&](int leaves) {
+        static const char* const ops[] = {" V ", " ^ ", " || ", " && "};
+        std::string text = leaf();
+        for (int i = 1; i < leaves; ++i) text += ops[rng() % 4] + leaf();
+        return text;
+    };
+    auto soup = [&]() {
+        static const char* const pieces[] = {"(", ")", "V", "^", "-", "!", "x1", "y", "true", "||", "&&", "|", "#"};
+        std::string text;
+        for (int i = 1 + rng() % 12; i > 0; --i) text += std::string(pieces[rng() % 13]) + " ";
+        return text;
+    };
+
+    int mismatches = 0, accepted = 0;
+    const int CASES = 30000;
+    for (int i = 0; i < CASES; ++i) {
+        std::string text = i % 3 == 0 ? generateRandomExpression(8, 1 + rng() % 40, rng)
+                         : i % 3 == 1 ? chain(1 + rng() % 12) : soup();
+        std::vector<Token> tokens = CompilerContext::tokenize(text);
+        bool lr = context.parse(tokens);
+        if (lr != PrattParser::parse(tokens)) {
+            if (mismatches++ < 5) os << "accept mismatch: " << text << std::endl;
+            continue;
+        }
+        if (!lr) continue;
+        ++accepted;
+        std::unique_ptr<ASTNode> expected(context.buildTree(tokens));
+        std::unique_ptr<ASTNode> actual(PrattParser::buildTree(tokens));
+        if (!sameTree(expected.get(), actual.get()) && mismatches++ < 5) os << "tree mismatch: " << text << std::endl;
+    }
+    os << "差分测试: " << CASES << " 个输入（" << accepted << " 个合法），不一致 " << mismatches << std::endl;
+
+    os << std::left << std::setw(12) << "shape" << std::right << std::setw(10) << "tokens" << std::setw(14)
+       << "LR Mtok/s" << std::setw(14) << "Pratt Mtok/s" << std::setw(10) << "speedup" << std::endl;
+    for (int shape = 0; shape < 2; ++shape) {
+        std::string text = shape == 0 ? generateRandomExpression(64, 1 << 16, rng) : chain(1 << 14);
+        std::vector<Token> tokens = CompilerContext::tokenize(text);
+        auto measure = [&](ParserEngine engine) {
+            int rounds = 0;
+            auto start = std::chrono::steady_clock::now();
+            double seconds = 0;
+            while (seconds < 0.2) {
+                delete context.buildTree(tokens, engine);
+                ++rounds;
+                seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            return tokens.size() * rounds / seconds / 1e6;
+        };
+        double lr = measure(ENGINE_LR), pratt = measure(ENGINE_PRATT);
+        os << std::left << std::setw(12) << (shape == 0 ? "balanced" : "flat chain") << std::right << std::setw(10)
+           << tokens.size() << std::fixed << std::setprecision(2) << std::setw(14) << lr << std::setw(14) << pratt
+           << std::setw(9) << pratt / lr << "x" << std::endl;
+        os.unsetf(std::ios::fixed);
+    }
+    return mismatches;
+}
+
+// 命令行流式编译：compile --stream <文件|-> [-o 输出文件] [--binary] [-g 文法文件]，
+// 四元式边分析边写出，--binary 时写 BinaryQuadrupleWriter 的二进制格式
+int runStreamMode(int argc, char* argv[]) {
+    std::string inputPath, outputPath, grammarPath = "input.txt";
+    bool binary = false;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if ((arg == "-g" || arg == "-o") && i + 1 < argc) {
+            (arg == "-g" ? grammarPath : outputPath) = argv[++i];
+        } else if (arg == "--binary") {
+            binary = true;
+        } else if (inputPath.empty()) {
+            inputPath = arg;
+        } else {
+            inputPath.clear();
+            break;
+        }
+    }
+    if (inputPath.empty() || (binary && outputPath.empty())) {
+        std::cerr << "用法: " << argv[0] << " --stream <表达式文件|-> [-o 输出文件] [--binary] [-g 文法文件]"
+                  << "（--binary 需要 -o）" << std::endl;
+        return 2;
+    }
+    try {
+        std::shared_ptr<const CompilerContext> context = CompilerContext::fromFile(grammarPath);
+        std::ifstream file;
+        if (inputPath != "-") {
+            file.open(inputPath);
+            if (!file.is_open()) throw std::runtime_error("Cannot open " + inputPath);
+        }
+        std::ofstream output;
+        if (!outputPath.empty()) {
+            output.open(outputPath, std::ios::binary | std::ios::trunc);
+            if (!output.is_open()) throw std::runtime_error("Cannot create " + outputPath);
+        }
+        std::ostream& out = outputPath.empty() ? std::cout : output;
+        std::unique_ptr<QuadrupleSink> sink;
+        if (binary) sink.reset(new BinaryQuadrupleWriter(out));
+        else sink.reset(new QuadrupleTextWriter(out));
+        StreamCompileStats stats;
+        std::string result = context->compileStream(inputPath == "-" ? std::cin : file, *sink, &stats);
+        if (!binary) out << "result: " << result << std::endl;
+        if (!out) throw std::runtime_error("Write failed");
+        std::cerr << stats.tokens << " 个 token，" << stats.quadruples << " 条四元式，分析栈最大深度 "
+                  << stats.maxStackDepth << std::endl;
+        return 0;
+    } catch (const std::runtime_error& e) {
+        std::cout.flush();
+        std::cerr << "流式编译失败: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+// ================= 基准测试 =================
+
+enum ExpressionShape {
+    SHAPE_BALANCED,   // 完全平衡的二叉树，每个内部结点带一对括号，深度约 log n
+    SHAPE_LEFT_DEEP,  // 不带括号的长链，按优先级与左结合规约得到左深树
+    SHAPE_NESTED      // x op (x op (x op ...))，括号嵌套深度约 n/4
+};
+
+// 确定性的表达式生成器：给定形状、目标 token 数、变量数与种子，输出总是相同（mt19937_64 的输出序列由标准规定）。
+// 作为 streambuf 按块产生文本，10^8 个 token 的表达式也可以直接交给 compileStream 而不必放进内存。
+// 变量为 x0..x{numVars-1}，约 1/8 的叶子取反，运算符 V 与 ^ 各半
+class ExpressionGenerator : public std::streambuf {
+private:
+    static constexpr uint64_t CLOSE = 0;                 // 平衡形状的待办栈：0 为右括号，
+    static constexpr uint64_t OPERATOR = ~uint64_t(0);  // 全 1 为运算符，其余为子树的叶子数
+
+    ExpressionShape shape;
+    uint64_t leaves;
+    int numVars;
+    std::mt19937_64 rng;
+    uint64_t emitted = 0;  // 已输出的叶子数
+    uint64_t closed = 0;   // 嵌套形状已输出的右括号数
+    uint64_t tokens = 0;
+    std::vector<uint64_t> pending;
+    std::string buffer;
+
+    void appendLeaf() {
+        uint64_t r = rng();
+        if (r % 8 == 0) {
+            buffer += '-';
+            ++tokens;
+        }
+        buffer += 'x';
+        buffer += std::to_string((r >> 8) % static_cast<uint64_t>(numVars));
+        buffer += ' ';
+        ++tokens;
+    }
+
+    void appendOperator() {
+        buffer += (rng() & 1) ? "V " : "^ ";
+        ++tokens;
+    }
+
+    // 追加下一段文本，全部输出后返回 false
+    bool step() {
+        switch (shape) {
+            case SHAPE_LEFT_DEEP:
+                if (emitted == leaves) return false;
+                if (emitted) appendOperator();
+                appendLeaf();
+                ++emitted;
+                return true;
+            case SHAPE_NESTED:
+                if (emitted + 1 < leaves) {
+                    appendLeaf();
+                    appendOperator();
+                    buffer += "( ";
+                    ++tokens;
+                } else if (emitted + 1 == leaves) {
+                    appendLeaf();
+                } else if (closed + 1 < leaves) {
+                    buffer += ") ";
+                    ++tokens;
+                    ++closed;
+                    return true;
+                } else {
+                    return false;
+                }
+                ++emitted;
+                return true;
+            default: {
+                if (pending.empty()) return false;
+                uint64_t item = pending.back();
+                pending.pop_back();
+                if (item == CLOSE) {
+                    buffer += ") ";
+                    ++tokens;
+                } else if (item == OPERATOR) {
+                    appendOperator();
+                } else if (item == 1) {
+                    appendLeaf();
+                } else {
+                    buffer += "( ";
+                    ++tokens;
+                    pending.push_back(CLOSE);
+                    pending.push_back(item - item / 2);
+                    pending.push_back(OPERATOR);
+                    pending.push_back(item / 2);
+                }
+                return true;
+            }
+        }
+    }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        buffer.clear();
+        while (buffer.size() < (1 << 16) && step()) {}
+        if (buffer.empty()) return traits_type::eof();
+        setg(&buffer[0], &buffer[0], &buffer[0] + buffer.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+public:
+    ExpressionGenerator(ExpressionShape shape, uint64_t targetTokens, int numVars, uint64_t seed)
+        : shape(shape), numVars(std::max(1, numVars)), rng(seed) {
+        // 每个叶子约 1.1 个 token；平衡形状每个内部结点另有运算符和一对括号，链每个叶子另有一个运算符，
+        // 嵌套形状每层另有运算符和一对括号
+        double perLeaf = shape == SHAPE_LEFT_DEEP ? 2.125 : 4.125;
+        leaves = std::max<uint64_t>(1, static_cast<uint64_t>(targetTokens / perLeaf));
+        if (shape == SHAPE_BALANCED) pending.push_back(leaves);
+    }
+
+    static const char* shapeName(ExpressionShape shape) {
+        return shape == SHAPE_BALANCED ? "balanced" : shape == SHAPE_LEFT_DEEP ? "left_deep" : "nested";
+    }
+
+    // 到目前为止输出的 token 数
+    uint64_t tokenCount() const {
+        return tokens;
+    }
+
+    static std::string generate(ExpressionShape shape, uint64_t targetTokens, int numVars, uint64_t seed) {
+        ExpressionGenerator generator(shape, targetTokens, numVars, seed);
+        std::istream in(&generator);
+        std::ostringstream text;
+        text << in.rdbuf();
+        return text.str();
+    }
+};
+
+// 分层优先级文法：levels 层二元运算 E_i -> E_i op_i E_{i+1} | E_{i+1}，最底层之下为
+// F -> -F | true | false | (E0)。第 0、1 层的运算符是 V 和 ^，其余层用输入中不会出现的终结符 o<i>，
+// 因此同一个表达式可以用任意层数的文法分析，每个叶子要经过 levels 次单产生式规约。
+// 生成的文本含 S'->E0 共 2*levels+5 条产生式；读入时文法为 F->true 补一条 F->id，分析器中共 2*levels+6 条
+std::string generateLayeredGrammar(int levels) {
+    levels = std::max(2, levels);
+    auto level = [&](int i) { return i < levels ? "E" + std::to_string(i) : std::string("F"); };
+    auto op = [](int i) { return i == 0 ? std::string("V") : i == 1 ? std::string("^") : "o" + std::to_string(i); };
+    std::ostringstream text;
+    for (int i = 0; i < levels; ++i) text << level(i) << ",";
+    text << "F,S'\ntrue,false,(,),^,V,-";
+    for (int i = 2; i < levels; ++i) text << "," << op(i);
+    text << "\nS'->E0\n";
+    for (int i = 0; i < levels; ++i) {
+        text << level(i) << "->" << level(i) << op(i) << level(i + 1) << "\n";
+        text << level(i) << "->" << level(i + 1) << "\n";
+    }
+    text << "F->-F\nF->true\nF->false\nF->(E0)\n";
+    return text.str();
+}
+
+struct BenchmarkOptions {
+    uint64_t maxTokens = 1000000;
+    uint64_t treeLimit = 1000000;     // 平衡形状构造语法树的阶段最多到这个规模
+    uint64_t deepTreeLimit = 10000;   // 深形状的语法树阶段（genExpression 与析构是递归的）最多到这个规模
+    int numVars = 64;
+    int maxLevels = 512;              // 文法组扫描到的层数；levels 层的文法读入后有 2*levels+6 条产生式
+                                      // （generateLayeredGrammar 的 2*levels+5 条加上补的 F->id），即 JSON 的 size
+    uint64_t seed = 1;
+};
+
+// 基准测试：输出为 JSON Lines，第一行描述格式与参数，之后每个 (suite, case, size, stage) 一行，
+// 字段顺序固定，便于跨提交比较：
+//   {"suite": "expr", "case": "balanced", "size": token 数, "stage": ..., "seconds": ..., "ns_per_unit": ...,
+//    "allocations": ..., "bytes": ...}
+// expr 组对三种形状、10 到 maxTokens 的每个数量级分别测 generate（只生成文本）、stream（边生成边流式编译，
+// 内存不随规模增长）以及 lex、parse、ir、codegen、regalloc 各阶段；grammar 组对 levels 为 2、4、8…maxLevels 的
+// 分层文法测 grammar、first_follow、collection、table 与用该文法流式编译一个 10^4 token 的平衡表达式。
+// size 为实际 token 数或读入后的产生式数；ns_per_unit 按 token 计，文法构造各阶段按产生式计。
+// seconds 为多次运行中的最小值（文法构造各阶段只运行一次），allocations/bytes 为第一次运行的分配次数与字节数
+void runBenchmarkSuite(const BenchmarkOptions& options, std::ostream& out) {
+    typedef std::chrono::steady_clock Clock;
+    class CountingSink : public QuadrupleSink {
+    public:
+        uint64_t count = 0;
+
+        void emit(const Quadruple&) override {
+            ++count;
+        }
+    };
+    out << "{\"format\": \"compile-bench\", \"version\": 1, \"seed\": " << options.seed << ", \"vars\": "
+        << options.numVars << ", \"max_tokens\": " << options.maxTokens << ", \"max_levels\": " << options.maxLevels
+        << "}" << std::endl;
+    auto record = [&](const char* suite, const std::string& name, uint64_t size, const char* stage, double seconds,
+                      uint64_t units, uint64_t allocations, uint64_t bytes) {
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << "{\"suite\": \"" << suite << "\", \"case\": \"" << name << "\", \"size\": " << size
+            << ", \"stage\": \"" << stage << "\", \"seconds\": " << std::fixed << std::setprecision(9) << seconds
+            << ", \"ns_per_unit\": " << std::setprecision(3) << (units ? seconds * 1e9 / units : 0.0)
+            << ", \"allocations\": " << allocations << ", \"bytes\": " << bytes << "}" << std::endl;
+        out.flags(flags);
+        out.precision(precision);
+    };
+    // 运行 body 若干次（小规模多跑几次），记录最短时间与第一次运行的分配
+    auto measure = [&](uint64_t size, const std::function<void()>& body, uint64_t& allocations, uint64_t& bytes) {
+        int repeats = size <= 10000 ? 20 : size <= 1000000 ? 3 : 1;
+        double best = 1e300;
+        for (int r = 0; r < repeats; ++r) {
+            size_t allocsBefore = tl_allocationCount, bytesBefore = tl_allocatedBytes;
+            auto start = Clock::now();
+            body();
+            best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+            if (r > 0) continue;
+            allocations = tl_allocationCount - allocsBefore;
+            bytes = tl_allocatedBytes - bytesBefore;
+        }
+        return best;
+    };
+
+    std::shared_ptr<const CompilerContext> context;
+    {
+        std::istringstream grammar(generateLayeredGrammar(2));
+        context = std::make_shared<const CompilerContext>(grammar);
+    }
+    for (ExpressionShape shape : {SHAPE_BALANCED, SHAPE_LEFT_DEEP, SHAPE_NESTED}) {
+        const char* name = ExpressionGenerator::shapeName(shape);
+        for (uint64_t target = 10; target <= options.maxTokens; target *= 10) {
+            uint64_t allocations = 0, bytes = 0, tokens = 0;
+            double seconds = measure(target, [&]() {
+                ExpressionGenerator generator(shape, target, options.numVars, options.seed);
+                std::istream in(&generator);
+                char chunk[1 << 16];
+                while (in.read(chunk, sizeof(chunk)) || in.gcount()) {}
+                tokens = generator.tokenCount();
+            }, allocations, bytes);
+            record("expr", name, tokens, "generate", seconds, tokens, allocations, bytes);
+
+            seconds = measure(target, [&]() {
+                ExpressionGenerator generator(shape, target, options.numVars, options.seed);
+                std::istream in(&generator);
+                CountingSink sink;
+                context->compileStream(in, sink);
+            }, allocations, bytes);
+            record("expr", name, tokens, "stream", seconds, tokens, allocations, bytes);
+
+            if (target > (shape == SHAPE_BALANCED ? options.treeLimit : options.deepTreeLimit)) continue;
+            std::string text = ExpressionGenerator::generate(shape, target, options.numVars, options.seed);
+            std::vector<Token> tokenList;
+            seconds = measure(target, [&]() { tokenList = CompilerContext::tokenize(text); }, allocations, bytes);
+            record("expr", name, tokens, "lex", seconds, tokens, allocations, bytes);
+
+            std::unique_ptr<ASTNode> tree;
+            seconds = measure(target, [&]() {
+                tree.reset();
+                tree.reset(context->buildTree(tokenList));
+            }, allocations, bytes);
+            record("expr", name, tokens, "parse", seconds, tokens, allocations, bytes);
+
+            QuaternionGenerator generator;
+            std::string resultVar;
+            seconds = measure(target, [&]() {
+                generator = QuaternionGenerator();
+                resultVar = generator.genExpression(tree.get());
+            }, allocations, bytes);
+            record("expr", name, tokens, "ir", seconds, tokens, allocations, bytes);
+
+            seconds = measure(target, [&]() { generator.generateTargetInstructions(); }, allocations, bytes);
+            record("expr", name, tokens, "codegen", seconds, tokens, allocations, bytes);
+
+            seconds = measure(target, [&]() {
+                LinearScanAllocator allocator(16);
+                allocator.generate(generator.getQuaternions(), {resultVar});
+            }, allocations, bytes);
+            record("expr", name, tokens, "regalloc", seconds, tokens, allocations, bytes);
+        }
+    }
+
+    // 文法各阶段取自剖析器
+    bool wasEnabled = Profiler::isEnabled();
+    std::string probe = ExpressionGenerator::generate(SHAPE_BALANCED, 10000, options.numVars, options.seed);
+    uint64_t probeTokens = CompilerContext::tokenize(probe).size();
+    for (int levels = 2; levels <= options.maxLevels; levels *= 2) {
+        std::string text = generateLayeredGrammar(levels);
+        Profiler::reset();
+        Profiler::setEnabled(true);
+        std::istringstream grammar(text);
+        CompilerContext layered(grammar);
+        Profiler::setEnabled(wasEnabled);
+        uint64_t productions = layered.getGrammar().prods.size();
+        std::string name = "layered_" + std::to_string(levels);
+        for (ProfilePhase phase : {PHASE_GRAMMAR, PHASE_FIRST_FOLLOW, PHASE_COLLECTION, PHASE_TABLE}) {
+            record("grammar", name, productions, Profiler::phaseName(phase), Profiler::phaseNanoseconds(phase) / 1e9,
+                   productions, Profiler::phaseAllocations(phase), Profiler::phaseAllocatedBytes(phase));
+        }
+        uint64_t allocations = 0, bytes = 0;
+        double seconds = measure(10000, [&]() {
+            std::istringstream in(probe);
+            CountingSink sink;
+            layered.compileStream(in, sink);
+        }, allocations, bytes);
+        record("grammar", name, productions, "stream_10k", seconds, probeTokens, allocations, bytes);
+    }
+    Profiler::reset();
+}
+
+// 基准测试的命令行：compile --bench [-o 输出文件] [--max-tokens N] [--max-levels N] [--vars N] [--seed N]
+//                                 [--tree-limit N]
+// 默认文法扫描到 512 层（1030 条产生式），数千条产生式的规模用 --max-levels 1024 或更大显式打开：
+// 项目集规范族的构造大约随产生式数的三次方增长，1024 层单独需要约 100 s
+// 生成器也可以单独使用：compile --bench --emit-expression balanced|left_deep|nested <token 数>
+//                       compile --bench --emit-grammar <层数>
+// 生成的文本写到标准输出或 -o 指定的文件
+int runBenchmarkMode(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    std::string outputPath, emitShape;
+    uint64_t emitTokens = 0;
+    int emitLevels = -1;
+    // 数值参数必须是完整的十进制数："abc"、"10k"、负数或超出 limit 都是用法错误
+    auto parseNumber = [](const std::string& text, uint64_t limit, uint64_t& number) {
+        if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) return false;
+        errno = 0;
+        number = std::strtoull(text.c_str(), nullptr, 10);
+        return errno != ERANGE && number <= limit;
+    };
+    bool valid = true;
+    for (int i = 2; i < argc && valid; ++i) {
+        std::string arg = argv[i];
+        uint64_t number = 0;
+        if (arg == "--emit-expression" && i + 2 < argc) {
+            emitShape = argv[++i];
+            valid = (emitShape == "balanced" || emitShape == "left_deep" || emitShape == "nested") &&
+                    parseNumber(argv[++i], UINT64_MAX, emitTokens);
+        } else if (arg == "-o" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if ((arg == "--max-tokens" || arg == "--max-levels" || arg == "--vars" || arg == "--seed" ||
+                    arg == "--tree-limit" || arg == "--emit-grammar") && i + 1 < argc) {
+            bool isCount = arg == "--max-levels" || arg == "--vars" || arg == "--emit-grammar";
+            valid = parseNumber(argv[++i], isCount ? INT_MAX : UINT64_MAX, number);
+            if (arg == "--max-tokens") options.maxTokens = number;
+            else if (arg == "--max-levels") options.maxLevels = static_cast<int>(number);
+            else if (arg == "--vars") options.numVars = std::max<int>(1, static_cast<int>(number));
+            else if (arg == "--seed") options.seed = number;
+            else if (arg == "--tree-limit") options.treeLimit = number;
+            else emitLevels = static_cast<int>(number);
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid) {
+        std::cerr << "用法: " << argv[0] << " --bench [-o 输出文件] [--max-tokens N] [--max-levels N] [--vars N]"
+                  << " [--seed N] [--tree-limit N]" << std::endl
+                  << "      " << argv[0] << " --bench --emit-expression balanced|left_deep|nested <token 数>"
+                  << " [--vars N] [--seed N] [-o 输出文件]" << std::endl
+                  << "      " << argv[0] << " --bench --emit-grammar <层数> [-o 输出文件]" << std::endl;
+        return 2;
+    }
+    try {
+        std::ofstream file;
+        if (!outputPath.empty()) {
+            file.open(outputPath, std::ios::trunc);
+            if (!file.is_open()) throw std::runtime_error("Cannot create " + outputPath);
+        }
+        std::ostream& out = outputPath.empty() ? std::cout : file;
+        if (!emitShape.empty()) {
+            ExpressionShape shape = emitShape == "balanced" ? SHAPE_BALANCED
+                                    : emitShape == "left_deep" ? SHAPE_LEFT_DEEP : SHAPE_NESTED;
+            ExpressionGenerator generator(shape, emitTokens, options.numVars, options.seed);
+            out << &generator << "\n";
+        } else if (emitLevels >= 0) {
+            out << generateLayeredGrammar(emitLevels);
+        } else {
+            runBenchmarkSuite(options, out);
+        }
+        out.flush();
+        if (!out) throw std::runtime_error("Write failed");
+        return 0;
+    } catch (const std::runtime_error& e) {
+        std::cerr << "基准测试失败: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+// 显示菜单
+void display_menu() {
+    std::cout << "选择功能：" << std::endl;
+    std::cout << "1. 词法分析" << std::endl;
+    std::cout << "2. 语法分析" << std::endl;
+    std::cout << "3. 语义分析" << std::endl;
+    std::cout << "4. 中间代码生成" << std::endl;
+    std::cout << "5. 中间代码优化" << std::endl;
+    std::cout << "6. 目标代码生成" << std::endl;
+    std::cout << "7. 活跃变量分析与死代码消除" << std::endl;
+    std::cout << "8. 短路跳转代码生成" << std::endl;
+    std::cout << "9. 优化遍管理器" << std::endl;
+    std::cout << "10. BDD 规范化与最小化" << std::endl;
+    std::cout << "11. BDD 基准测试" << std::endl;
+    std::cout << "12. 两级逻辑最小化" << std::endl;
+    std::cout << "13. 线性扫描寄存器分配" << std::endl;
+    std::cout << "14. 窥孔优化" << std::endl;
+    std::cout << "15. 位并行真值表求值" << std::endl;
+    std::cout << "16. 字节码虚拟机" << std::endl;
+    std::cout << "17. x86-64 JIT 编译" << std::endl;
+    std::cout << "18. C 内核生成" << std::endl;
+    std::cout << "19. 列式数据流式过滤" << std::endl;
+    std::cout << "20. SAT 可满足性与等价性检查" << std::endl;
+    std::cout << "21. 多线程并行编译" << std::endl;
+    std::cout << "22. 编译服务与压测" << std::endl;
+    std::cout << "23. 编译缓存" << std::endl;
+    std::cout << "24. 增量重分析" << std::endl;
+    std::cout << "25. 流式编译" << std::endl;
+    std::cout << "26. 缓冲输出与二进制格式" << std::endl;
+    std::cout << "27. Pratt 算符优先分析" << std::endl;
+    std::cout << "28. 并行语法分析" << std::endl;
+    std::cout << "29. 跨表达式值编号" << std::endl;
+    std::cout << "30. 阶段计时与分配统计" << std::endl;
+    std::cout << "31. 基准测试（小规模）" << std::endl;
+    std::cout << "0. 退出" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    // 非交互的批处理模式
+    if (argc > 1 && std::string(argv[1]) == "--batch") {
+        return runBatchMode(argc, argv);
+    }
+    if (argc > 1 && (std::string(argv[1]) == "--serve" || std::string(argv[1]) == "--client")) {
+        return runServerMode(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--stream") {
+        return runStreamMode(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        return runBenchmarkMode(argc, argv);
+    }
+
+    // 打开源文件用于词法分析
+    std::ifstream source("source.txt");
+    if (!source.is_open()) {
+        std::cerr << "无法打开源文件！" << std::endl;
+        return 1;
+    }
+
+    std::ifstream input("input.txt"); // 打开语法文件
+    if (!input.is_open()) {
+        std::cerr << "无法打开语法文件！" << std::endl;
+        return 1;
+    }
+
+    // 文法与 SLR(1) 分析表只构造一次，之后只读
+    std::shared_ptr<const CompilerContext> context;
+    try {
+        context = std::make_shared<const CompilerContext>(input);
+    } catch (const std::runtime_error& e) {
+        std::cerr << "文法错误: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<Token> inputTokens;
+    Token token;
+    while ((token = get_next_token(source)).type != TOK_END) {
+        inputTokens.push_back(token);
+    }
+    QuaternionGenerator generator;
+    std::vector<std::string> inputs;
+
+    for (int i=0 ; i<inputTokens.size();++i) {
+        inputs.push_back(inputTokens[i].value);
+    }
+    int choice;
+    while (true) {
+        display_menu();
         std::cin >> choice;
 
         switch (choice) {
@@ -1267,18 +10264,8 @@ int main() {
                 }
                 break;
             }
-            case 2: { // 语法分析    
-                read_grammar_from_file(input);
-                // getFirstSet();
-                // getFollowSet();
-                // 生成LR1表和分析
-                CanonicalCollection cc = buildCanonicalCollection();
-                // std::cout << cc << std::endl;
-                generateLR0Table(cc);
-                
-                inputTokens.push_back(Token{TOK_END, "$"}); // 添加结束符
-
-                bool result = parse(inputTokens); // 调用语法分析函数
+            case 2: { // 语法分析：分析表在启动时由 context 构造一次，可以重复执行
+                bool result = context->parse(inputTokens, &std::cout); // 调用语法分析函数
                 if (result) {
                     std::cout << "语法分析成功！" << std::endl;
                 } else {
@@ -1289,15 +10276,14 @@ int main() {
             }
             case 3: {
                 ASTBuilder builder;
-        
-               
+                try {
                     ASTNode* tree = builder.buildFromTokens(inputs);
                     // ASTPrinter::printTree(tree);
                     ASTPrinter::printTreeStructure(tree);
                     delete tree;
-                
-                
-             
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "语义分析失败: " << e.what() << std::endl;
+                }
                 break;
             }
             case 4: {
@@ -1319,11 +10305,582 @@ int main() {
             case 6: {
                 generator.clearQuaternions();
                 int index = 0;
-                parseAndGenerateQuadruples(inputs,generator,index);
+                std::string resultVar = parseAndGenerateQuadruples(inputs,generator,index);
+                generator.eliminateDeadCode(resultVar);  // 不为死临时变量生成代码和分配寄存器
                 generator.printTargetCode();
                 // 目标代码生成的功能
                 break;
             }
+            case 7: {
+                generator.clearQuaternions();
+                int index = 0;
+                std::string resultVar = parseAndGenerateQuadruples(inputs,generator,index);
+                generator.printQuaternions();
+                LivenessAnalyzer analyzer = generator.analyzeLiveness(resultVar);
+                analyzer.printLiveRanges();
+                int removed = generator.eliminateDeadCode(resultVar);
+                std::cout << "删除死代码 " << removed << " 条，结果变量: " << resultVar << std::endl;
+                generator.printQuaternions();
+                break;
+            }
+            case 8: {
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    std::string resultVar = generator.genJumpingCode(tree.get());
+                    generator.eliminateDeadCode(resultVar);
+                    generator.printQuaternions();
+                    generator.printTargetCode();
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "跳转代码生成失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 9: {
+                std::cout << "输入优化遍顺序（默认 " << PassManager::defaultPipeline() << "，输入 - 使用默认）：" << std::endl;
+                std::string spec;
+                std::cin >> spec;
+                PassManager manager;
+                if (!manager.setPipeline(spec == "-" ? PassManager::defaultPipeline() : spec)) {
+                    break;
+                }
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    std::vector<std::string> roots = {generator.genExpression(tree.get())};
+                    generator.printQuaternions();
+
+                    std::vector<Quadruple> quads = generator.getQuaternions();
+                    manager.run(quads, roots);
+                    generator.setQuaternions(quads);
+                    std::cout << "优化后（结果: " << roots[0] << "）：" << std::endl;
+                    generator.printQuaternions();
+
+                    std::ofstream statsFile("pass_stats.json");
+                    manager.writeStatsJson(statsFile);
+                    manager.writeStatsJson(std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "优化失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 10: {
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    BDDManager manager;
+                    std::vector<int> roots = {manager.buildFromAST(tree.get())};
+                    size_t before = manager.countNodes(roots);
+                    size_t after = manager.sift(roots);
+                    std::cout << "BDD 结点数: " << before << " -> " << after << "（sifting 后）" << std::endl;
+                    std::cout << "变量次序:";
+                    for (const auto& v : manager.variableOrder()) {
+                        std::cout << " " << v;
+                    }
+                    std::cout << std::endl;
+                    std::string resultVar = manager.emitQuadruples(roots[0], generator);
+                    std::cout << "结果: " << resultVar << std::endl;
+                    generator.printQuaternions();
+                    generator.printTargetCode();
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "BDD 构造失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 11: {
+                runBDDBenchmark(std::cout);
+                break;
+            }
+            case 12: {
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    TwoLevelMinimizer minimizer;
+                    std::vector<Cube> cover = minimizer.minimize(tree.get());
+                    std::cout << (minimizer.usedExactMethod() ? "Quine-McCluskey" : "Espresso") << " 最小积之和: "
+                              << minimizer.coverToString(cover) << std::endl;
+                    std::string resultVar = minimizer.emitQuadruples(cover, generator);
+                    std::cout << "结果: " << resultVar << std::endl;
+                    generator.printQuaternions();
+                    generator.printTargetCode();
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "逻辑最小化失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 13: {
+                std::cout << "输入物理寄存器数（至少 3）：" << std::endl;
+                int numRegisters;
+                std::cin >> numRegisters;
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    std::string resultVar = generator.genExpression(tree.get());
+                    generator.eliminateDeadCode(resultVar);
+                    generator.printQuaternions();
+
+                    LinearScanAllocator allocator(numRegisters);
+                    std::vector<TargetInstruction> code = allocator.generate(generator.getQuaternions(), {resultVar});
+                    std::cout << "Target Code:" << std::endl;
+                    for (size_t i = 0; i < code.size(); ++i) {
+                        std::cout << i << ": " << code[i].toString() << std::endl;
+                    }
+                    const RegisterAllocationStats& stats = allocator.getStats();
+                    std::cout << "结果位于 " << allocator.locationOf(resultVar) << "，活跃区间 " << stats.intervals
+                              << "，溢出区间 " << stats.spilledIntervals << "，溢出写回 " << stats.spillStores
+                              << "，重新装入 " << stats.spillLoads << std::endl;
+                    runRegisterAllocationReport(std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "寄存器分配失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 14: {
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    std::string resultVar = generator.genExpression(tree.get());
+                    generator.eliminateDeadCode(resultVar);
+
+                    std::map<std::string, std::string> registerMap;
+                    std::vector<TargetInstruction> code = generator.generateTargetInstructions(&registerMap);
+                    std::string location = registerMap.count(resultVar) ? registerMap[resultVar] : resultVar;
+                    PeepholeOptimizer optimizer({location});
+                    std::vector<TargetInstruction> optimized = optimizer.optimize(code);
+                    std::cout << "Target Code:" << std::endl;
+                    for (size_t i = 0; i < code.size(); ++i) {
+                        std::cout << i << ": " << code[i].toString() << std::endl;
+                    }
+                    std::cout << "Optimized Target Code:" << std::endl;
+                    for (size_t i = 0; i < optimized.size(); ++i) {
+                        std::cout << i << ": " << optimized[i].toString() << std::endl;
+                    }
+                    const PeepholeStats& stats = optimizer.getStats();
+                    std::cout << "指令数 " << stats.instructionsBefore << " -> " << stats.instructionsAfter
+                              << "，结果位于 " << location << "，规则命中：";
+                    for (const auto& hit : stats.ruleHits) std::cout << " " << hit.first << "=" << hit.second;
+                    std::cout << std::endl;
+                    runPeepholeBenchmark(std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "窥孔优化失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 15: {
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    std::string resultVar = generator.genExpression(tree.get());
+                    generator.eliminateDeadCode(resultVar);
+                    BitParallelEvaluator evaluator(generator.getQuaternions(), resultVar);
+                    const std::vector<std::string>& vars = evaluator.variables();
+                    if (vars.size() > 24) {
+                        std::cerr << "变量过多，无法穷举真值表" << std::endl;
+                        break;
+                    }
+
+                    // 穷举全部赋值：每个字同时求出 64 组赋值
+                    std::vector<std::vector<uint64_t>> data = BitParallelEvaluator::truthTableColumns(vars.size());
+                    std::vector<const uint64_t*> columns;
+                    for (const auto& column : data) columns.push_back(column.data());
+                    size_t numAssignments = size_t(1) << vars.size();
+                    std::vector<uint64_t> result((numAssignments + 63) / 64);
+                    evaluator.evaluate(columns, result.size(), result.data());
+                    if (numAssignments % 64) result.back() &= (1ULL << numAssignments) - 1;
+
+                    size_t satisfying = 0;
+                    for (uint64_t word : result) satisfying += __builtin_popcountll(word);
+                    std::cout << "后端 " << BitParallelEvaluator::backendName(evaluator.getBackend()) << "，变量 "
+                              << vars.size() << "，满足赋值 " << satisfying << " / " << numAssignments << std::endl;
+                    if (vars.size() <= 6) {
+                        for (const auto& var : vars) std::cout << var << " ";
+                        std::cout << "| " << resultVar << std::endl;
+                        for (size_t j = 0; j < numAssignments; ++j) {
+                            for (size_t v = 0; v < vars.size(); ++v) {
+                                std::cout << std::string(vars[v].size() - 1, ' ') << ((j >> v) & 1) << " ";
+                            }
+                            std::cout << "| " << ((result[0] >> j) & 1) << std::endl;
+                        }
+                    }
+                    runBitParallelBenchmark(std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "位并行求值失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 16: {
+                std::cout << "输入变量赋值（如 a=1,b=0，未列出的变量为 0，输入 - 表示全为 0）：" << std::endl;
+                std::string spec;
+                std::cin >> spec;
+                std::unordered_map<std::string, bool> values;
+                if (spec != "-") {
+                    std::stringstream ss(spec);
+                    std::string item;
+                    while (std::getline(ss, item, ',')) {
+                        size_t eq = item.find('=');
+                        if (eq != std::string::npos) values[item.substr(0, eq)] = item.substr(eq + 1) == "1";
+                    }
+                }
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    std::string resultVar = generator.genJumpingCode(tree.get());
+                    generator.printQuaternions();
+                    BytecodeProgram program(generator.getQuaternions(), resultVar);
+                    std::cout << "Bytecode:" << std::endl << program.disassemble();
+                    for (const auto& var : program.variables()) values.emplace(var, false);
+                    BytecodeVM vm(program);
+                    std::cout << "字节码结果: " << (vm.run(values) ? "true" : "false")
+                              << "，语法树遍历结果: " << (TreeWalkEvaluator::evaluate(tree.get(), values) ? "true" : "false")
+                              << std::endl;
+                    runBytecodeBenchmark(std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "字节码执行失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 17: {
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    std::string resultVar = generator.genExpression(tree.get());
+                    generator.eliminateDeadCode(resultVar);
+                    JitExpression jit(generator.getQuaternions(), resultVar);
+                    JitExpression interpreter(generator.getQuaternions(), resultVar, false);
+                    const std::vector<std::string>& vars = jit.variables();
+                    std::cout << "标量: " << (jit.scalarJitted() ? "JIT" : "解释执行") << "，64 路: "
+                              << (jit.lanesJitted() ? "JIT" : "解释执行") << "，机器码 " << jit.codeSize() << " 字节"
+                              << std::endl;
+                    if (vars.size() <= 6) {
+                        // 64 路版本一次求出全部赋值：变量 i 的输入字即真值表的第 i 列
+                        std::vector<std::vector<uint64_t>> columns = BitParallelEvaluator::truthTableColumns(vars.size());
+                        std::vector<uint64_t> laneWords;
+                        for (const auto& column : columns) laneWords.push_back(column[0]);
+                        laneWords.push_back(0);
+                        uint64_t table = jit.evaluateLanes(laneWords.data());
+                        for (const auto& var : vars) std::cout << var << " ";
+                        std::cout << "| " << resultVar << std::endl;
+                        for (uint64_t j = 0; j < (1ULL << vars.size()); ++j) {
+                            for (size_t v = 0; v < vars.size(); ++v) {
+                                std::cout << std::string(vars[v].size() - 1, ' ') << ((j >> v) & 1) << " ";
+                            }
+                            bool expected = interpreter.evaluate(&j);
+                            std::cout << "| " << ((table >> j) & 1) << (jit.evaluate(&j) == expected ? "" : "  MISMATCH")
+                                      << std::endl;
+                        }
+                    }
+                    runJitDifferentialTest(std::cout, 300);
+                    runJitBenchmark(std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "JIT 编译失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 18: {
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    std::string resultVar = generator.genExpression(tree.get());
+                    generator.eliminateDeadCode(resultVar);
+                    BitParallelEvaluator evaluator(generator.getQuaternions(), resultVar);
+                    std::string source = CKernelEmitter::emit(generator.getQuaternions(), resultVar, evaluator.variables());
+                    std::ofstream kernelFile("kernel.c");
+                    kernelFile << source;
+                    std::cout << source << "已写入 kernel.c" << std::endl;
+                    runCKernelHarness(std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "C 内核生成失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 19: {
+                std::cout << "输入数据文件（.csv 先转换为 .bcol，.bcol 直接过滤，输入 - 生成 2^26 行随机数据）：" << std::endl;
+                std::string path;
+                std::cin >> path;
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    std::string resultVar = generator.genExpression(tree.get());
+                    generator.eliminateDeadCode(resultVar);
+                    BitParallelEvaluator evaluator(generator.getQuaternions(), resultVar);
+
+                    std::string dataPath = path;
+                    if (path == "-") {
+                        dataPath = "/tmp/compile-filter-demo.bcol";
+                        writeRandomColumnarFile(dataPath, evaluator.variables(), uint64_t(1) << 26, 47);
+                    } else if (path.size() > 4 && path.substr(path.size() - 4) == ".csv") {
+                        dataPath = path.substr(0, path.size() - 4) + ".bcol";
+                        convertCsvToColumnar(path, dataPath);
+                        std::cout << "已转换为 " << dataPath << std::endl;
+                    }
+                    ColumnarFile file(dataPath);
+                    FilterStats stats = runColumnarFilter(evaluator, file, "filter_result.bcol");
+                    std::cout << "行数 " << stats.rows << "，匹配 " << stats.matches << "，用时 " << std::fixed
+                              << std::setprecision(3) << stats.seconds * 1e3 << " ms，读取 "
+                              << stats.bytesRead / stats.seconds / 1e9 << " GB/s，"
+                              << stats.rows / stats.seconds / 1e9 << " G 行/s，结果写入 filter_result.bcol" << std::endl;
+                    std::cout.unsetf(std::ios::fixed);
+                    std::cout << std::setprecision(6);
+                    if (path == "-") std::remove(dataPath.c_str());
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "列式过滤失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 20: {
+                generator.clearQuaternions();
+                ASTBuilder builder;
+                try {
+                    std::unique_ptr<ASTNode> tree(builder.buildFromTokens(inputs));
+                    std::string resultVar = generator.genExpression(tree.get());
+                    std::vector<Quadruple> original = generator.getQuaternions();
+
+                    std::unordered_map<std::string, bool> model;
+                    if (isSatisfiable(original, resultVar, &model)) {
+                        std::cout << "可满足，例如:";
+                        for (const auto& entry : model) std::cout << " " << entry.first << "=" << entry.second;
+                        std::cout << std::endl;
+                    } else {
+                        std::cout << "不可满足：表达式恒为假" << std::endl;
+                    }
+                    // 否定的结果取一个原四元式中没有出现过的临时变量名，不会与用户的标识符相撞
+                    std::unordered_set<std::string> used;
+                    for (const auto& q : original) used.insert({q.arg1, q.arg2, q.result});
+                    size_t k = original.size() + 1;
+                    while (used.count("t" + std::to_string(k))) ++k;
+                    std::string negatedVar = "t" + std::to_string(k);
+                    std::vector<Quadruple> negated = original;
+                    negated.push_back({"!", resultVar, "", negatedVar});
+                    std::cout << (isSatisfiable(negated, negatedVar) ? "不是永真式" : "永真式：表达式恒为真") << std::endl;
+
+                    // 与两级最小化的结果做等价性检查
+                    TwoLevelMinimizer minimizer;
+                    std::vector<Cube> cover = minimizer.minimize(tree.get());
+                    QuaternionGenerator minimized;
+                    std::string minimizedVar = minimizer.emitQuadruples(cover, minimized);
+                    std::unordered_map<std::string, bool> counterexample;
+                    bool equal = areEquivalent(original, resultVar, minimized.getQuaternions(), minimizedVar, &counterexample);
+                    std::cout << "与最小积之和 " << minimizer.coverToString(cover) << (equal ? " 等价" : " 不等价")
+                              << std::endl;
+                    runSatBenchmark(std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "SAT 检查失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 21: {
+                try {
+                    // 用共享上下文的 LR 分析器建树并生成四元式，再测量多线程吞吐量
+                    std::unique_ptr<ASTNode> tree(context->buildTree(inputTokens));
+                    QuaternionGenerator local;
+                    std::string resultVar = local.genExpression(tree.get());
+                    local.printQuaternions();
+                    std::cout << "结果: " << resultVar << std::endl;
+                    runConcurrentCompileBenchmark(context, std::cout);
+                    runBatchDeepInputTest(*context, std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "并行编译失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 22: {
+#if defined(__linux__)
+                // 在后台线程启动编译服务，用负载生成器分别测量逐个请求与流水线请求
+                try {
+                    std::string socketPath = "/tmp/compile-server-" + std::to_string(getpid()) + ".sock";
+                    unsigned numThreads = std::max(2u, std::thread::hardware_concurrency());
+                    CompileServer server(context, socketPath, numThreads);
+                    std::thread serverThread([&server]() { server.run(); });
+                    signal(SIGPIPE, SIG_IGN);
+                    try {
+                        std::cout << "服务 " << socketPath << "，" << numThreads << " 个工作线程" << std::endl;
+                        std::cout << "1 个连接，每次 1 个请求:" << std::endl;
+                        printLoadTestStats(runLoadGenerator(socketPath, 1, 1, 20000, context.get()), std::cout);
+                        std::cout << "4 个连接，每个 16 个请求在途:" << std::endl;
+                        printLoadTestStats(runLoadGenerator(socketPath, 4, 16, 100000, context.get()), std::cout);
+                    } catch (const std::runtime_error& e) {
+                        std::cerr << "压测失败: " << e.what() << std::endl;
+                    }
+                    server.stop();
+                    serverThread.join();
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "编译服务失败: " << e.what() << std::endl;
+                }
+#else
+                std::cerr << "编译服务需要 Linux" << std::endl;
+#endif
+                break;
+            }
+            case 23: {
+                try {
+                    // 源表达式查两次缓存：第二次命中，直接得到目标代码
+                    CompileCache cache(context->grammarHash());
+                    for (int round = 0; round < 2; ++round) {
+                        std::shared_ptr<const CompiledArtifact> artifact =
+                            cache.getOrCompile(inputTokens, [&]() { return compileTokens(*context, inputTokens); });
+                        if (round == 0) std::cout << artifact->targetCode;
+                    }
+                    cache.printStats(std::cout);
+                    runCompileCacheBenchmark(*context, std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "编译缓存失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 24: {
+                try {
+                    // 在源表达式末尾追加一项：先是不完整的 " ^"，补全后只重新分析末尾的窗口
+                    std::string text;
+                    for (const auto& value : inputs) text += value + " ";
+                    IncrementalDocument document(context, text);
+                    for (const std::string& piece : {std::string("^"), std::string(" extra")}) {
+                        bool ok = document.edit(document.size(), 0, piece);
+                        const IncrementalDocument::EditStats& s = document.lastEdit();
+                        std::cout << "编辑后文本: " << document.text() << std::endl;
+                        std::cout << (ok ? "分析成功" : "分析失败: " + document.errorMessage()) << "（重新词法分析 "
+                                  << s.relexedTokens << " 个 token，复用 " << s.reusedSubtrees << " 棵子树，新建 "
+                                  << s.newNodes << " 个结点）" << std::endl;
+                    }
+                    std::string result;
+                    for (const auto& q : document.quadruples(&result)) std::cout << q.toString() << std::endl;
+                    std::cout << "结果: " << result << std::endl;
+                    runIncrementalEditTest(context, std::cout);
+                    runIncrementalBenchmark(context, std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "增量重分析失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 25: {
+                try {
+                    // 重新打开源文件，边读边分析边输出，不经过 inputTokens
+                    std::ifstream stream("source.txt");
+                    QuadrupleTextWriter writer(std::cout);
+                    StreamCompileStats stats;
+                    std::string result = context->compileStream(stream, writer, &stats);
+                    std::cout << "结果: " << result << "（" << stats.tokens << " 个 token，分析栈最大深度 "
+                              << stats.maxStackDepth << "）" << std::endl;
+                    runStreamingBenchmark(*context, std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cout.flush();
+                    std::cerr << "流式编译失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 26: {
+                try {
+                    // 源表达式的四元式写成二进制格式再读回，按文本格式输出
+                    std::unique_ptr<ASTNode> tree(context->buildTree(inputTokens));
+                    QuaternionGenerator program;
+                    std::string result = program.genExpression(tree.get());
+                    std::stringstream encoded;
+                    uint64_t binaryBytes;
+                    {
+                        BinaryQuadrupleWriter writer(encoded);
+                        for (const auto& quad : program.getQuaternions()) writer.emit(quad);
+                        writer.finish(result);
+                        binaryBytes = writer.bytesWritten();
+                    }
+                    std::string decodedResult;
+                    std::vector<Quadruple> decoded = BinaryQuadrupleWriter::read(encoded, &decodedResult);
+                    {
+                        QuadrupleTextWriter writer(std::cout);
+                        for (const auto& quad : decoded) writer.emit(quad);
+                        writer.finish(decodedResult);
+                    }
+                    std::cout << "结果: " << decodedResult << "，二进制 " << binaryBytes << " 字节" << std::endl;
+                    program.printTargetCode();
+                    runEmitterBenchmark(*context, std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cout.flush();
+                    std::cerr << "输出失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 27: {
+                try {
+                    // 用 Pratt 引擎分析源表达式，输出语法树与四元式
+                    std::unique_ptr<ASTNode> tree(context->buildTree(inputTokens, ENGINE_PRATT));
+                    ASTPrinter::printTree(tree.get());
+                    QuaternionGenerator program;
+                    std::cout << "结果: " << program.genExpression(tree.get()) << std::endl;
+                    program.printQuaternions();
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "Pratt 分析失败: " << e.what() << std::endl;
+                }
+                runPrattBenchmark(*context, std::cout);
+                break;
+            }
+            case 28: {
+                try {
+                    // 源表达式按顶层运算符切开并行分析，拼接后的四元式与顺序编译相同
+                    std::string text;
+                    for (const auto& value : inputs) text += value + " ";
+                    WorkStealingPool pool(std::max(1u, std::thread::hardware_concurrency()));
+                    std::vector<Quadruple> quads;
+                    ParallelParseStats stats;
+                    std::string result = parallelCompile(*context, text, pool, quads, &stats);
+                    for (size_t i = 0; i < quads.size(); ++i) std::cout << i << ": " << quads[i].toString() << std::endl;
+                    std::cout << "结果: " << result << "（"
+                              << (stats.parallel ? "在 " + std::to_string(stats.pieces) + " 个顶层 " +
+                                                       stats.splitOperator + " 子式处并行"
+                                                 : std::string("没有顶层切分点，顺序分析"))
+                              << "）" << std::endl;
+                    runParallelParseBenchmark(*context, std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "并行语法分析失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 29: {
+                try {
+                    // 源表达式与其否定作为两条规则并入一个共享程序，否定只多一条 ! 四元式
+                    std::string text;
+                    for (const auto& value : inputs) text += value + " ";
+                    SharedProgramBuilder builder;
+                    builder.addRule(*context, "source", text);
+                    builder.addRule(*context, "negated", "-(" + text + ")");
+                    QuaternionGenerator program;
+                    program.setQuaternions(builder.programWithOutputs());
+                    program.printQuaternions();
+                    program.printTargetCode();
+                    builder.printStats(std::cout);
+                    runSharedNamingTest(*context, std::cout);
+                    runSharedProgramBenchmark(*context, std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "跨表达式值编号失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 30: {
+                try {
+                    std::string text;
+                    for (const auto& value : inputs) text += value + " ";
+                    runProfileReport("input.txt", text, std::cout);
+                } catch (const std::runtime_error& e) {
+                    std::cerr << "剖析失败: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 31: {
+                // 完整规模用 --bench 运行，这里只到 10^4 个 token 与 32 层文法
+                BenchmarkOptions options;
+                options.maxTokens = 10000;
+                options.maxLevels = 32;
+                runBenchmarkSuite(options, std::cout);
+                break;
+            }
             case 0: { // 退出程序
                 source.close(); // 关闭源文件流
                 return 0;